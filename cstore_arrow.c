@@ -0,0 +1,1647 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_arrow.c
+ *
+ * This file contains functions that write and read the Arrow IPC streaming
+ * format, which "COPY cstore_table TO/FROM ... (FORMAT arrow)" use. We write
+ * one record batch per column block, and build its buffers directly from the
+ * block's decoded values. Arrow metadata are flatbuffers, which we build and
+ * parse with a few small helpers instead of depending on a flatbuffers library.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+
+#include "postgres.h"
+#include "cstore_fdw.h"
+#include "cstore_version_compat.h"
+
+#include "catalog/pg_type.h"
+#include "datatype/timestamp.h"
+#include "mb/pg_wchar.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+
+/* Arrow message header types */
+#define ARROW_MESSAGE_SCHEMA 1
+#define ARROW_MESSAGE_DICTIONARY_BATCH 2
+#define ARROW_MESSAGE_RECORD_BATCH 3
+
+/* Arrow metadata version V5 */
+#define ARROW_METADATA_VERSION 4
+
+/* Arrow type union members that cstore columns map to */
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_TYPE_DATE 8
+#define ARROW_TYPE_TIMESTAMP 10
+
+#define ARROW_PRECISION_SINGLE 1
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_DATE_UNIT_DAY 0
+#define ARROW_TIME_UNIT_SECOND 0
+#define ARROW_TIME_UNIT_MILLISECOND 1
+#define ARROW_TIME_UNIT_MICROSECOND 2
+#define ARROW_TIME_UNIT_NANOSECOND 3
+
+/* continuation marker before each message in the streaming format */
+#define ARROW_CONTINUATION_MARKER 0xFFFFFFFF
+
+/* Arrow file format magic, which precedes the stream in Arrow files */
+#define ARROW_FILE_MAGIC "ARROW1"
+#define ARROW_FILE_MAGIC_LENGTH 6
+
+/* difference between Unix and PostgreSQL epochs */
+#define ARROW_EPOCH_DAY_OFFSET (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE)
+#define ARROW_EPOCH_USEC_OFFSET (ARROW_EPOCH_DAY_OFFSET * USECS_PER_DAY)
+
+
+/*
+ * ArrowColumnType describes the Arrow type of a column. Fixed-width types have
+ * a value width in bytes; bool values are bits and have a zero width.
+ */
+typedef struct ArrowColumnType
+{
+	uint8 typeId;
+	int32 bitWidth;
+	int16 precision;
+	int16 unit;
+	bool isSigned;
+	bool hasTimezone;
+	uint32 valueWidth;
+
+} ArrowColumnType;
+
+
+static ArrowColumnType ArrowTypeForColumn(Oid typeId);
+static bool ArrowTypesMatch(ArrowColumnType *expectedType, ArrowColumnType *fieldType);
+static StringInfo ArrowStartMessage(uint8 headerType, int64 bodyLength,
+									uint32 *headerFieldPosition);
+static void ArrowAppendMessage(StringInfo outputBuffer, StringInfo metadata,
+							   StringInfo body);
+static uint32 ArrowWriteField(StringInfo metadata, Form_pg_attribute attributeForm);
+static uint32 ArrowWriteType(StringInfo metadata, ArrowColumnType *columnType);
+static void ArrowAppendColumnBuffers(StringInfo body, StringInfo bufferList,
+									 ArrowColumnType *columnType, Oid typeId,
+									 ColumnBlockData *blockData, uint32 rowCount);
+static void ArrowEndBuffer(StringInfo body, StringInfo bufferList,
+						   uint32 startPosition);
+static StringInfo ArrowReadMessage(FILE *inputFile, const char *inputFilename,
+								   bool firstMessage);
+static StringInfo ArrowReadBody(FILE *inputFile, const char *inputFilename,
+								int64 bodyLength);
+static void ArrowReadSchema(StringInfo metadata, uint32 schemaPosition,
+							TupleDesc tupleDescriptor, List *attributeNumberList,
+							ArrowColumnType *fieldTypeArray);
+static ArrowColumnType ArrowReadType(StringInfo metadata, uint32 fieldPosition);
+static uint64 ArrowLoadRecordBatch(StringInfo metadata, uint32 recordBatchPosition,
+								   StringInfo body, TupleDesc tupleDescriptor,
+								   List *attributeNumberList,
+								   ArrowColumnType *fieldTypeArray,
+								   FmgrInfo *inputFunctionArray,
+								   Oid *typeIOParamArray,
+								   TableWriteState *writeState);
+static Datum ArrowReadValue(ArrowColumnType *fieldType, Form_pg_attribute attributeForm,
+							FmgrInfo *inputFunction, Oid typeIOParam, StringInfo body,
+							uint64 *bufferArray, uint64 rowIndex);
+
+/* flatbuffer helpers */
+static void FlatAlign(StringInfo buffer, uint32 alignment);
+static void FlatAppendZeros(StringInfo buffer, uint32 length);
+static uint32 FlatStartTable(StringInfo buffer, const uint16 *fieldOffsetArray,
+							 uint16 fieldCount, uint16 tableSize);
+static uint32 FlatStartVector(StringInfo buffer, uint32 elementCount,
+							  uint32 elementSize, uint32 alignment);
+static uint32 FlatString(StringInfo buffer, const char *string, uint32 length);
+static void FlatSet(StringInfo buffer, uint32 position, const void *value,
+					uint32 size);
+static void FlatSetOffset(StringInfo buffer, uint32 position, uint32 targetPosition);
+static void FlatCheckBounds(StringInfo buffer, uint64 position, uint64 size);
+static uint32 FlatReadUInt32(StringInfo buffer, uint32 position);
+static uint32 FlatTableField(StringInfo buffer, uint32 tablePosition,
+							 uint16 fieldIndex);
+static uint32 FlatReadOffset(StringInfo buffer, uint32 fieldPosition);
+
+
+/*
+ * ArrowCheckColumnTypes errors out if a column in the given attribute number
+ * list has a type that we can't write in Arrow format.
+ */
+void
+ArrowCheckColumnTypes(TupleDesc tupleDescriptor, List *attributeNumberList)
+{
+	ListCell *attributeNumberCell = NULL;
+
+#ifdef WORDS_BIGENDIAN
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("arrow format is only supported on little-endian "
+						   "platforms")));
+#endif
+
+	foreach(attributeNumberCell, attributeNumberList)
+	{
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+
+		ArrowTypeForColumn(attributeForm->atttypid);
+	}
+}
+
+
+/*
+ * ArrowWriteSchema appends the schema message of an Arrow stream with the given
+ * columns to the output buffer.
+ */
+void
+ArrowWriteSchema(StringInfo outputBuffer, TupleDesc tupleDescriptor,
+				 List *attributeNumberList)
+{
+	static const uint16 schemaFieldOffsets[] = { 0, 4 };
+	uint32 headerFieldPosition = 0;
+	uint32 schemaPosition = 0;
+	uint32 fieldVectorPosition = 0;
+	uint32 fieldIndex = 0;
+	ListCell *attributeNumberCell = NULL;
+
+	StringInfo metadata = ArrowStartMessage(ARROW_MESSAGE_SCHEMA, 0,
+											&headerFieldPosition);
+
+	/* Schema table: endianness (default little), fields */
+	schemaPosition = FlatStartTable(metadata, schemaFieldOffsets, 2, 8);
+	FlatSetOffset(metadata, headerFieldPosition, schemaPosition);
+
+	fieldVectorPosition = FlatStartVector(metadata, list_length(attributeNumberList),
+										  sizeof(uint32), sizeof(uint32));
+	FlatSetOffset(metadata, schemaPosition + 4, fieldVectorPosition);
+
+	foreach(attributeNumberCell, attributeNumberList)
+	{
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+
+		uint32 fieldPosition = ArrowWriteField(metadata, attributeForm);
+		FlatSetOffset(metadata, fieldVectorPosition + 4 + fieldIndex * 4,
+					  fieldPosition);
+		fieldIndex++;
+	}
+
+	ArrowAppendMessage(outputBuffer, metadata, NULL);
+}
+
+
+/*
+ * ArrowWriteRecordBatch appends a record batch message with the given column
+ * block's rows to the output buffer. Each column's Arrow buffers are built from
+ * the block's value and exists arrays.
+ */
+void
+ArrowWriteRecordBatch(StringInfo outputBuffer, TupleDesc tupleDescriptor,
+					  List *attributeNumberList, ColumnBlockData **blockDataArray,
+					  uint32 rowCount)
+{
+	static const uint16 recordBatchFieldOffsets[] = { 8, 4, 16 };
+	StringInfo body = makeStringInfo();
+	StringInfo nodeList = makeStringInfo();
+	StringInfo bufferList = makeStringInfo();
+	StringInfo metadata = NULL;
+	uint32 headerFieldPosition = 0;
+	uint32 recordBatchPosition = 0;
+	uint32 nodeVectorPosition = 0;
+	uint32 bufferVectorPosition = 0;
+	int64 batchLength = rowCount;
+	ListCell *attributeNumberCell = NULL;
+
+	foreach(attributeNumberCell, attributeNumberList)
+	{
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+		ColumnBlockData *blockData = blockDataArray[attributeNumber - 1];
+		ArrowColumnType columnType = ArrowTypeForColumn(attributeForm->atttypid);
+		int64 nullCount = 0;
+		uint32 rowIndex = 0;
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			if (!blockData->existsArray[rowIndex])
+			{
+				nullCount++;
+			}
+		}
+
+		/* FieldNode struct: length, null count */
+		appendBinaryStringInfo(nodeList, (char *) &batchLength, sizeof(int64));
+		appendBinaryStringInfo(nodeList, (char *) &nullCount, sizeof(int64));
+
+		ArrowAppendColumnBuffers(body, bufferList, &columnType,
+								 getBaseType(attributeForm->atttypid),
+								 blockData, rowCount);
+	}
+
+	metadata = ArrowStartMessage(ARROW_MESSAGE_RECORD_BATCH, body->len,
+								 &headerFieldPosition);
+
+	/* RecordBatch table: length, nodes, buffers */
+	recordBatchPosition = FlatStartTable(metadata, recordBatchFieldOffsets, 3, 24);
+	FlatSetOffset(metadata, headerFieldPosition, recordBatchPosition);
+	FlatSet(metadata, recordBatchPosition + 8, &batchLength, sizeof(int64));
+
+	nodeVectorPosition = FlatStartVector(metadata, list_length(attributeNumberList),
+										 2 * sizeof(int64), sizeof(int64));
+	FlatSet(metadata, nodeVectorPosition + 4, nodeList->data, nodeList->len);
+	FlatSetOffset(metadata, recordBatchPosition + 4, nodeVectorPosition);
+
+	bufferVectorPosition = FlatStartVector(metadata,
+										   bufferList->len / (2 * sizeof(int64)),
+										   2 * sizeof(int64), sizeof(int64));
+	FlatSet(metadata, bufferVectorPosition + 4, bufferList->data, bufferList->len);
+	FlatSetOffset(metadata, recordBatchPosition + 16, bufferVectorPosition);
+
+	ArrowAppendMessage(outputBuffer, metadata, body);
+
+	pfree(body->data);
+	pfree(body);
+	pfree(nodeList->data);
+	pfree(nodeList);
+	pfree(bufferList->data);
+	pfree(bufferList);
+}
+
+
+/* ArrowWriteEndOfStream appends the end of stream marker to the output buffer. */
+void
+ArrowWriteEndOfStream(StringInfo outputBuffer)
+{
+	uint32 continuationMarker = ARROW_CONTINUATION_MARKER;
+	uint32 metadataLength = 0;
+
+	appendBinaryStringInfo(outputBuffer, (char *) &continuationMarker, sizeof(uint32));
+	appendBinaryStringInfo(outputBuffer, (char *) &metadataLength, sizeof(uint32));
+}
+
+
+/*
+ * ArrowLoadFile reads the Arrow stream or file with the given name, and writes
+ * its rows to the given cstore write state. The stream's fields are loaded into
+ * the columns in the given attribute number list in order, and other columns
+ * are set to null. The function returns the number of loaded rows.
+ */
+uint64
+ArrowLoadFile(const char *inputFilename, TupleDesc tupleDescriptor,
+			  List *attributeNumberList, TableWriteState *writeState)
+{
+	uint32 fieldCount = list_length(attributeNumberList);
+	ArrowColumnType *fieldTypeArray = palloc0(fieldCount * sizeof(ArrowColumnType));
+	FmgrInfo *inputFunctionArray = palloc0(fieldCount * sizeof(FmgrInfo));
+	Oid *typeIOParamArray = palloc0(fieldCount * sizeof(Oid));
+	MemoryContext batchContext = NULL;
+	StringInfo metadata = NULL;
+	uint64 loadedRowCount = 0;
+	bool schemaRead = false;
+	uint32 fieldIndex = 0;
+	ListCell *attributeNumberCell = NULL;
+	FILE *inputFile = NULL;
+
+#ifdef WORDS_BIGENDIAN
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("arrow format is only supported on little-endian "
+						   "platforms")));
+#endif
+
+	/* string columns are loaded through their input functions to apply typmods */
+	foreach(attributeNumberCell, attributeNumberList)
+	{
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+		Oid inputFunctionId = InvalidOid;
+
+		getTypeInputInfo(attributeForm->atttypid, &inputFunctionId,
+						 &typeIOParamArray[fieldIndex]);
+		fmgr_info(inputFunctionId, &inputFunctionArray[fieldIndex]);
+		fieldIndex++;
+	}
+
+	inputFile = AllocateFile(inputFilename, PG_BINARY_R);
+	if (inputFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for reading: %m",
+							   inputFilename)));
+	}
+
+	batchContext = AllocSetContextCreate(CurrentMemoryContext,
+										 "Arrow Record Batch Memory Context",
+										 ALLOCSET_DEFAULT_SIZES);
+
+	while ((metadata = ArrowReadMessage(inputFile, inputFilename, !schemaRead)) != NULL)
+	{
+		uint32 messagePosition = FlatReadUInt32(metadata, 0);
+		uint32 headerTypePosition = FlatTableField(metadata, messagePosition, 1);
+		uint32 headerPosition = FlatTableField(metadata, messagePosition, 2);
+		uint32 bodyLengthPosition = FlatTableField(metadata, messagePosition, 3);
+		uint8 headerType = 0;
+		int64 bodyLength = 0;
+
+		if (headerTypePosition == 0 || headerPosition == 0)
+		{
+			ereport(ERROR, (errmsg("invalid arrow message in file \"%s\"",
+								   inputFilename)));
+		}
+
+		FlatCheckBounds(metadata, headerTypePosition, sizeof(uint8));
+		headerType = (uint8) metadata->data[headerTypePosition];
+		headerPosition = FlatReadOffset(metadata, headerPosition);
+
+		if (bodyLengthPosition != 0)
+		{
+			FlatCheckBounds(metadata, bodyLengthPosition, sizeof(int64));
+			memcpy(&bodyLength, metadata->data + bodyLengthPosition, sizeof(int64));
+		}
+
+		if (!schemaRead)
+		{
+			if (headerType != ARROW_MESSAGE_SCHEMA)
+			{
+				ereport(ERROR, (errmsg("arrow stream in file \"%s\" doesn't start "
+									   "with a schema", inputFilename)));
+			}
+
+			ArrowReadSchema(metadata, headerPosition, tupleDescriptor,
+							attributeNumberList, fieldTypeArray);
+			schemaRead = true;
+		}
+		else if (headerType == ARROW_MESSAGE_RECORD_BATCH)
+		{
+			MemoryContext oldContext = MemoryContextSwitchTo(batchContext);
+			StringInfo body = ArrowReadBody(inputFile, inputFilename, bodyLength);
+
+			loadedRowCount += ArrowLoadRecordBatch(metadata, headerPosition, body,
+												   tupleDescriptor,
+												   attributeNumberList,
+												   fieldTypeArray, inputFunctionArray,
+												   typeIOParamArray, writeState);
+
+			MemoryContextSwitchTo(oldContext);
+			MemoryContextReset(batchContext);
+		}
+		else if (headerType == ARROW_MESSAGE_DICTIONARY_BATCH)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("dictionary encoded arrow columns are not "
+								   "supported")));
+		}
+		else
+		{
+			ereport(ERROR, (errmsg("unexpected arrow message in file \"%s\"",
+								   inputFilename)));
+		}
+
+		pfree(metadata->data);
+		pfree(metadata);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (!schemaRead)
+	{
+		ereport(ERROR, (errmsg("arrow stream in file \"%s\" doesn't have a schema",
+							   inputFilename)));
+	}
+
+	MemoryContextDelete(batchContext);
+	FreeFile(inputFile);
+
+	return loadedRowCount;
+}
+
+
+/*
+ * ArrowTypeForColumn returns the Arrow type that we use for columns of the given
+ * type, and errors out for types that we don't support.
+ */
+static ArrowColumnType
+ArrowTypeForColumn(Oid typeId)
+{
+	ArrowColumnType columnType;
+	memset(&columnType, 0, sizeof(ArrowColumnType));
+
+	switch (getBaseType(typeId))
+	{
+		case BOOLOID:
+		{
+			columnType.typeId = ARROW_TYPE_BOOL;
+			break;
+		}
+
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		{
+			columnType.typeId = ARROW_TYPE_INT;
+			columnType.valueWidth = get_typlen(getBaseType(typeId));
+			columnType.bitWidth = columnType.valueWidth * 8;
+			columnType.isSigned = true;
+			break;
+		}
+
+		case FLOAT4OID:
+		{
+			columnType.typeId = ARROW_TYPE_FLOATING_POINT;
+			columnType.precision = ARROW_PRECISION_SINGLE;
+			columnType.valueWidth = sizeof(float4);
+			break;
+		}
+
+		case FLOAT8OID:
+		{
+			columnType.typeId = ARROW_TYPE_FLOATING_POINT;
+			columnType.precision = ARROW_PRECISION_DOUBLE;
+			columnType.valueWidth = sizeof(float8);
+			break;
+		}
+
+		case DATEOID:
+		{
+			columnType.typeId = ARROW_TYPE_DATE;
+			columnType.unit = ARROW_DATE_UNIT_DAY;
+			columnType.valueWidth = sizeof(int32);
+			break;
+		}
+
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+		{
+			columnType.typeId = ARROW_TYPE_TIMESTAMP;
+			columnType.unit = ARROW_TIME_UNIT_MICROSECOND;
+			columnType.hasTimezone = (getBaseType(typeId) == TIMESTAMPTZOID);
+			columnType.valueWidth = sizeof(int64);
+			break;
+		}
+
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+		{
+			columnType.typeId = ARROW_TYPE_UTF8;
+			break;
+		}
+
+		case BYTEAOID:
+		{
+			columnType.typeId = ARROW_TYPE_BINARY;
+			break;
+		}
+
+		default:
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("type %s is not supported in arrow format",
+								   format_type_be(typeId))));
+		}
+	}
+
+	return columnType;
+}
+
+
+/*
+ * ArrowTypesMatch returns whether values of the given Arrow field type can be
+ * loaded into a column with the given expected type. Timestamps can have any
+ * unit and time zone, since we convert them to microseconds on load.
+ */
+static bool
+ArrowTypesMatch(ArrowColumnType *expectedType, ArrowColumnType *fieldType)
+{
+	if (expectedType->typeId != fieldType->typeId)
+	{
+		return false;
+	}
+
+	switch (expectedType->typeId)
+	{
+		case ARROW_TYPE_INT:
+		{
+			return expectedType->bitWidth == fieldType->bitWidth &&
+				   fieldType->isSigned;
+		}
+
+		case ARROW_TYPE_FLOATING_POINT:
+		{
+			return expectedType->precision == fieldType->precision;
+		}
+
+		case ARROW_TYPE_DATE:
+		{
+			return fieldType->unit == ARROW_DATE_UNIT_DAY;
+		}
+
+		default:
+		{
+			return true;
+		}
+	}
+}
+
+
+/*
+ * ArrowStartMessage starts the flatbuffer of an Arrow message with the given
+ * header type and body length. The function sets the given position to the
+ * message's header field, which the caller points to the header table.
+ */
+static StringInfo
+ArrowStartMessage(uint8 headerType, int64 bodyLength, uint32 *headerFieldPosition)
+{
+	static const uint16 messageFieldOffsets[] = { 4, 6, 8, 16 };
+	StringInfo metadata = makeStringInfo();
+	uint32 messagePosition = 0;
+	int16 metadataVersion = ARROW_METADATA_VERSION;
+
+	/* root offset of the flatbuffer */
+	FlatAppendZeros(metadata, sizeof(uint32));
+
+	/* Message table: version, header type, header, body length */
+	messagePosition = FlatStartTable(metadata, messageFieldOffsets, 4, 24);
+	FlatSetOffset(metadata, 0, messagePosition);
+	FlatSet(metadata, messagePosition + 4, &metadataVersion, sizeof(int16));
+	FlatSet(metadata, messagePosition + 6, &headerType, sizeof(uint8));
+	FlatSet(metadata, messagePosition + 16, &bodyLength, sizeof(int64));
+
+	(*headerFieldPosition) = messagePosition + 8;
+
+	return metadata;
+}
+
+
+/*
+ * ArrowAppendMessage appends an encapsulated Arrow message with the given
+ * metadata and body to the output buffer. Metadata are padded so that the body
+ * starts at an 8-byte boundary.
+ */
+static void
+ArrowAppendMessage(StringInfo outputBuffer, StringInfo metadata, StringInfo body)
+{
+	uint32 continuationMarker = ARROW_CONTINUATION_MARKER;
+	uint32 metadataLength = 0;
+
+	FlatAlign(metadata, 8);
+	metadataLength = metadata->len;
+
+	appendBinaryStringInfo(outputBuffer, (char *) &continuationMarker, sizeof(uint32));
+	appendBinaryStringInfo(outputBuffer, (char *) &metadataLength, sizeof(uint32));
+	appendBinaryStringInfo(outputBuffer, metadata->data, metadata->len);
+
+	if (body != NULL)
+	{
+		appendBinaryStringInfo(outputBuffer, body->data, body->len);
+	}
+
+	pfree(metadata->data);
+	pfree(metadata);
+}
+
+
+/* ArrowWriteField writes a Field table for the given column, and returns its position. */
+static uint32
+ArrowWriteField(StringInfo metadata, Form_pg_attribute attributeForm)
+{
+	/* name, nullable, type type, type, dictionary (absent), children */
+	static const uint16 fieldFieldOffsets[] = { 4, 16, 17, 8, 0, 12 };
+	ArrowColumnType columnType = ArrowTypeForColumn(attributeForm->atttypid);
+	char *columnName = NameStr(attributeForm->attname);
+	char *convertedName = pg_server_to_any(columnName, strlen(columnName), PG_UTF8);
+	uint8 nullable = attributeForm->attnotnull ? 0 : 1;
+	uint32 fieldPosition = 0;
+	uint32 namePosition = 0;
+	uint32 typePosition = 0;
+	uint32 childrenPosition = 0;
+
+	fieldPosition = FlatStartTable(metadata, fieldFieldOffsets, 6, 20);
+	FlatSet(metadata, fieldPosition + 16, &nullable, sizeof(uint8));
+	FlatSet(metadata, fieldPosition + 17, &columnType.typeId, sizeof(uint8));
+
+	namePosition = FlatString(metadata, convertedName, strlen(convertedName));
+	FlatSetOffset(metadata, fieldPosition + 4, namePosition);
+
+	typePosition = ArrowWriteType(metadata, &columnType);
+	FlatSetOffset(metadata, fieldPosition + 8, typePosition);
+
+	childrenPosition = FlatStartVector(metadata, 0, sizeof(uint32), sizeof(uint32));
+	FlatSetOffset(metadata, fieldPosition + 12, childrenPosition);
+
+	return fieldPosition;
+}
+
+
+/* ArrowWriteType writes the type table of a field, and returns its position. */
+static uint32
+ArrowWriteType(StringInfo metadata, ArrowColumnType *columnType)
+{
+	static const uint16 intFieldOffsets[] = { 4, 8 };
+	static const uint16 unitFieldOffsets[] = { 4 };
+	static const uint16 timestampFieldOffsets[] = { 4, 8 };
+	uint32 typePosition = 0;
+
+	switch (columnType->typeId)
+	{
+		case ARROW_TYPE_INT:
+		{
+			uint8 isSigned = columnType->isSigned ? 1 : 0;
+
+			typePosition = FlatStartTable(metadata, intFieldOffsets, 2, 12);
+			FlatSet(metadata, typePosition + 4, &columnType->bitWidth, sizeof(int32));
+			FlatSet(metadata, typePosition + 8, &isSigned, sizeof(uint8));
+			break;
+		}
+
+		case ARROW_TYPE_FLOATING_POINT:
+		{
+			typePosition = FlatStartTable(metadata, unitFieldOffsets, 1, 8);
+			FlatSet(metadata, typePosition + 4, &columnType->precision, sizeof(int16));
+			break;
+		}
+
+		case ARROW_TYPE_DATE:
+		{
+			typePosition = FlatStartTable(metadata, unitFieldOffsets, 1, 8);
+			FlatSet(metadata, typePosition + 4, &columnType->unit, sizeof(int16));
+			break;
+		}
+
+		case ARROW_TYPE_TIMESTAMP:
+		{
+			uint16 fieldCount = columnType->hasTimezone ? 2 : 1;
+
+			typePosition = FlatStartTable(metadata, timestampFieldOffsets, fieldCount, 12);
+			FlatSet(metadata, typePosition + 4, &columnType->unit, sizeof(int16));
+
+			/* cstore stores timestamptz values in UTC */
+			if (columnType->hasTimezone)
+			{
+				uint32 timezonePosition = FlatString(metadata, "UTC", 3);
+				FlatSetOffset(metadata, typePosition + 8, timezonePosition);
+			}
+			break;
+		}
+
+		default:
+		{
+			/* Utf8, Binary and Bool tables have no fields */
+			typePosition = FlatStartTable(metadata, NULL, 0, 4);
+			break;
+		}
+	}
+
+	return typePosition;
+}
+
+
+/*
+ * ArrowAppendColumnBuffers appends a column's validity, offsets and values
+ * buffers to the record batch body, and their positions to the buffer list. We
+ * leave the validity buffer empty when there are no nulls. Integers and floats
+ * are written with their in-memory representation; 8-byte values are copied
+ * from the block's value array at once when datums hold them by value.
+ */
+static void
+ArrowAppendColumnBuffers(StringInfo body, StringInfo bufferList,
+						 ArrowColumnType *columnType, Oid typeId,
+						 ColumnBlockData *blockData, uint32 rowCount)
+{
+	bool *existsArray = blockData->existsArray;
+	Datum *valueArray = blockData->valueArray;
+	uint32 startPosition = body->len;
+	bool hasNulls = false;
+	uint32 rowIndex = 0;
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		if (!existsArray[rowIndex])
+		{
+			hasNulls = true;
+			break;
+		}
+	}
+
+	/* validity bitmap */
+	if (hasNulls)
+	{
+		uint32 byteCount = (rowCount + 7) / 8;
+		uint8 *validityBytes = NULL;
+
+		FlatAppendZeros(body, byteCount);
+		validityBytes = (uint8 *) (body->data + startPosition);
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			if (existsArray[rowIndex])
+			{
+				validityBytes[rowIndex / 8] |= (1 << (rowIndex % 8));
+			}
+		}
+	}
+
+	ArrowEndBuffer(body, bufferList, startPosition);
+
+	startPosition = body->len;
+
+	if (columnType->typeId == ARROW_TYPE_BOOL)
+	{
+		uint8 *valueBytes = NULL;
+
+		FlatAppendZeros(body, (rowCount + 7) / 8);
+		valueBytes = (uint8 *) (body->data + startPosition);
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			if (existsArray[rowIndex] && DatumGetBool(valueArray[rowIndex]))
+			{
+				valueBytes[rowIndex / 8] |= (1 << (rowIndex % 8));
+			}
+		}
+	}
+	else if (columnType->typeId == ARROW_TYPE_UTF8 ||
+			 columnType->typeId == ARROW_TYPE_BINARY)
+	{
+		bool needTranscoding = (columnType->typeId == ARROW_TYPE_UTF8 &&
+								GetDatabaseEncoding() != PG_UTF8);
+		StringInfo valueBuffer = makeStringInfo();
+		int32 valueOffset = 0;
+
+		/* offsets buffer, and then the values buffer */
+		appendBinaryStringInfo(body, (char *) &valueOffset, sizeof(int32));
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			if (existsArray[rowIndex])
+			{
+				struct varlena *value = (struct varlena *) DatumGetPointer(valueArray[rowIndex]);
+				char *valueData = VARDATA_ANY(value);
+				int valueLength = VARSIZE_ANY_EXHDR(value);
+
+				if (needTranscoding)
+				{
+					valueData = pg_server_to_any(valueData, valueLength, PG_UTF8);
+					valueLength = strlen(valueData);
+				}
+
+				if ((uint64) valueBuffer->len + valueLength > PG_INT32_MAX)
+				{
+					ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+									errmsg("column block is too large for an arrow "
+										   "record batch")));
+				}
+
+				appendBinaryStringInfo(valueBuffer, valueData, valueLength);
+			}
+
+			valueOffset = valueBuffer->len;
+			appendBinaryStringInfo(body, (char *) &valueOffset, sizeof(int32));
+		}
+
+		ArrowEndBuffer(body, bufferList, startPosition);
+
+		startPosition = body->len;
+		appendBinaryStringInfo(body, valueBuffer->data, valueBuffer->len);
+
+		pfree(valueBuffer->data);
+		pfree(valueBuffer);
+	}
+	else if (columnType->valueWidth == sizeof(int64))
+	{
+#ifdef USE_FLOAT8_BYVAL
+		appendBinaryStringInfo(body, (char *) valueArray, rowCount * sizeof(int64));
+#else
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			int64 value = 0;
+
+			if (existsArray[rowIndex] && typeId == FLOAT8OID)
+			{
+				float8 floatValue = DatumGetFloat8(valueArray[rowIndex]);
+				memcpy(&value, &floatValue, sizeof(int64));
+			}
+			else if (existsArray[rowIndex])
+			{
+				value = DatumGetInt64(valueArray[rowIndex]);
+			}
+
+			appendBinaryStringInfo(body, (char *) &value, sizeof(int64));
+		}
+#endif
+
+		/* Arrow timestamps count from the Unix epoch */
+		if (columnType->typeId == ARROW_TYPE_TIMESTAMP)
+		{
+			int64 *timestampArray = (int64 *) (body->data + startPosition);
+			for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+			{
+				if (existsArray[rowIndex] && !TIMESTAMP_NOT_FINITE(timestampArray[rowIndex]))
+				{
+					timestampArray[rowIndex] += ARROW_EPOCH_USEC_OFFSET;
+				}
+			}
+		}
+	}
+	else if (columnType->valueWidth == sizeof(int32))
+	{
+		int32 *valueBuffer = NULL;
+
+		FlatAppendZeros(body, rowCount * sizeof(int32));
+		valueBuffer = (int32 *) (body->data + startPosition);
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			if (!existsArray[rowIndex])
+			{
+				continue;
+			}
+
+			if (typeId == FLOAT4OID)
+			{
+				float4 floatValue = DatumGetFloat4(valueArray[rowIndex]);
+				memcpy(&valueBuffer[rowIndex], &floatValue, sizeof(int32));
+			}
+			else if (typeId == DATEOID)
+			{
+				DateADT dateValue = DatumGetDateADT(valueArray[rowIndex]);
+				if (!DATE_NOT_FINITE(dateValue))
+				{
+					dateValue += ARROW_EPOCH_DAY_OFFSET;
+				}
+
+				valueBuffer[rowIndex] = dateValue;
+			}
+			else
+			{
+				valueBuffer[rowIndex] = DatumGetInt32(valueArray[rowIndex]);
+			}
+		}
+	}
+	else
+	{
+		int16 *valueBuffer = NULL;
+
+		Assert(columnType->valueWidth == sizeof(int16));
+
+		FlatAppendZeros(body, rowCount * sizeof(int16));
+		valueBuffer = (int16 *) (body->data + startPosition);
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			if (existsArray[rowIndex])
+			{
+				valueBuffer[rowIndex] = DatumGetInt16(valueArray[rowIndex]);
+			}
+		}
+	}
+
+	ArrowEndBuffer(body, bufferList, startPosition);
+}
+
+
+/*
+ * ArrowEndBuffer adds the body buffer that starts at the given position and ends
+ * at the end of the body to the buffer list, and pads the body to 8 bytes.
+ */
+static void
+ArrowEndBuffer(StringInfo body, StringInfo bufferList, uint32 startPosition)
+{
+	int64 bufferOffset = startPosition;
+	int64 bufferLength = body->len - startPosition;
+
+	appendBinaryStringInfo(bufferList, (char *) &bufferOffset, sizeof(int64));
+	appendBinaryStringInfo(bufferList, (char *) &bufferLength, sizeof(int64));
+
+	FlatAlign(body, 8);
+}
+
+
+/*
+ * ArrowReadMessage reads the metadata of the next message in the Arrow stream,
+ * and returns them. The function returns NULL at the end of the stream. The
+ * first message may be preceded by the magic of the Arrow file format.
+ */
+static StringInfo
+ArrowReadMessage(FILE *inputFile, const char *inputFilename, bool firstMessage)
+{
+	StringInfo metadata = NULL;
+	uint32 metadataLength = 0;
+	size_t readSize = 0;
+
+	readSize = fread(&metadataLength, 1, sizeof(uint32), inputFile);
+	if (readSize == 0 && feof(inputFile))
+	{
+		return NULL;
+	}
+
+	if (firstMessage && readSize == sizeof(uint32) &&
+		memcmp(&metadataLength, ARROW_FILE_MAGIC, sizeof(uint32)) == 0)
+	{
+		/* skip the rest of the magic and its padding */
+		char magicRest[4];
+		if (fread(magicRest, 1, sizeof(magicRest), inputFile) != sizeof(magicRest) ||
+			memcmp(magicRest, ARROW_FILE_MAGIC + 4, ARROW_FILE_MAGIC_LENGTH - 4) != 0)
+		{
+			ereport(ERROR, (errmsg("invalid arrow file \"%s\"", inputFilename)));
+		}
+
+		readSize = fread(&metadataLength, 1, sizeof(uint32), inputFile);
+	}
+
+	/* streams written before Arrow 0.15 don't have the continuation marker */
+	if (readSize == sizeof(uint32) && metadataLength == ARROW_CONTINUATION_MARKER)
+	{
+		readSize = fread(&metadataLength, 1, sizeof(uint32), inputFile);
+	}
+
+	if (readSize != sizeof(uint32))
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read arrow message from file \"%s\": %m",
+							   inputFilename)));
+	}
+
+	if (metadataLength == 0)
+	{
+		return NULL;
+	}
+
+	if (metadataLength >= MaxAllocSize)
+	{
+		ereport(ERROR, (errmsg("invalid arrow message in file \"%s\"", inputFilename)));
+	}
+
+	metadata = makeStringInfo();
+	enlargeStringInfo(metadata, metadataLength);
+
+	if (fread(metadata->data, 1, metadataLength, inputFile) != metadataLength)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read arrow message from file \"%s\": %m",
+							   inputFilename)));
+	}
+
+	metadata->len = metadataLength;
+	metadata->data[metadataLength] = '\0';
+
+	return metadata;
+}
+
+
+/* ArrowReadBody reads a message body of the given length from the Arrow stream. */
+static StringInfo
+ArrowReadBody(FILE *inputFile, const char *inputFilename, int64 bodyLength)
+{
+	StringInfo body = makeStringInfo();
+
+	if (bodyLength < 0 || bodyLength >= MaxAllocSize)
+	{
+		ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						errmsg("arrow record batch in file \"%s\" is too large",
+							   inputFilename)));
+	}
+
+	enlargeStringInfo(body, bodyLength);
+
+	if (fread(body->data, 1, bodyLength, inputFile) != (size_t) bodyLength)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read arrow record batch from file "
+							   "\"%s\": %m", inputFilename)));
+	}
+
+	body->len = bodyLength;
+
+	return body;
+}
+
+
+/*
+ * ArrowReadSchema checks that the fields of the given schema can be loaded into
+ * the columns in the given attribute number list, and sets the field types.
+ */
+static void
+ArrowReadSchema(StringInfo metadata, uint32 schemaPosition, TupleDesc tupleDescriptor,
+				List *attributeNumberList, ArrowColumnType *fieldTypeArray)
+{
+	uint32 fieldVectorPosition = FlatTableField(metadata, schemaPosition, 1);
+	uint32 fieldCount = 0;
+	uint32 fieldIndex = 0;
+	ListCell *attributeNumberCell = NULL;
+
+	if (fieldVectorPosition != 0)
+	{
+		fieldVectorPosition = FlatReadOffset(metadata, fieldVectorPosition);
+		fieldCount = FlatReadUInt32(metadata, fieldVectorPosition);
+	}
+
+	if (fieldCount != list_length(attributeNumberList))
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("arrow stream has %u fields, but %d columns are "
+							   "loaded", fieldCount, list_length(attributeNumberList))));
+	}
+
+	foreach(attributeNumberCell, attributeNumberList)
+	{
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+		ArrowColumnType expectedType = ArrowTypeForColumn(attributeForm->atttypid);
+		uint32 fieldPosition = FlatReadOffset(metadata, fieldVectorPosition + 4 +
+											  fieldIndex * 4);
+
+		fieldTypeArray[fieldIndex] = ArrowReadType(metadata, fieldPosition);
+		if (!ArrowTypesMatch(&expectedType, &fieldTypeArray[fieldIndex]))
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+							errmsg("arrow field %u doesn't match the type of column "
+								   "\"%s\"", fieldIndex + 1,
+								   NameStr(attributeForm->attname))));
+		}
+
+		fieldTypeArray[fieldIndex].valueWidth = expectedType.valueWidth;
+		fieldIndex++;
+	}
+}
+
+
+/* ArrowReadType reads the type of the Field table at the given position. */
+static ArrowColumnType
+ArrowReadType(StringInfo metadata, uint32 fieldPosition)
+{
+	ArrowColumnType fieldType;
+	uint32 typeTypePosition = FlatTableField(metadata, fieldPosition, 2);
+	uint32 typePosition = FlatTableField(metadata, fieldPosition, 3);
+
+	memset(&fieldType, 0, sizeof(ArrowColumnType));
+
+	if (typeTypePosition == 0 || typePosition == 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("arrow field doesn't have a type")));
+	}
+
+	FlatCheckBounds(metadata, typeTypePosition, sizeof(uint8));
+	fieldType.typeId = (uint8) metadata->data[typeTypePosition];
+	typePosition = FlatReadOffset(metadata, typePosition);
+
+	if (fieldType.typeId == ARROW_TYPE_INT)
+	{
+		uint32 bitWidthPosition = FlatTableField(metadata, typePosition, 0);
+		uint32 isSignedPosition = FlatTableField(metadata, typePosition, 1);
+
+		if (bitWidthPosition != 0)
+		{
+			fieldType.bitWidth = (int32) FlatReadUInt32(metadata, bitWidthPosition);
+		}
+
+		if (isSignedPosition != 0)
+		{
+			FlatCheckBounds(metadata, isSignedPosition, sizeof(uint8));
+			fieldType.isSigned = (metadata->data[isSignedPosition] != 0);
+		}
+	}
+	else if (fieldType.typeId == ARROW_TYPE_FLOATING_POINT ||
+			 fieldType.typeId == ARROW_TYPE_DATE ||
+			 fieldType.typeId == ARROW_TYPE_TIMESTAMP)
+	{
+		uint32 unitPosition = FlatTableField(metadata, typePosition, 0);
+		int16 unit = 0;
+
+		/* the Date unit defaults to milliseconds, and other units to zero */
+		if (fieldType.typeId == ARROW_TYPE_DATE)
+		{
+			unit = 1;
+		}
+
+		if (unitPosition != 0)
+		{
+			FlatCheckBounds(metadata, unitPosition, sizeof(int16));
+			memcpy(&unit, metadata->data + unitPosition, sizeof(int16));
+		}
+
+		fieldType.precision = unit;
+		fieldType.unit = unit;
+	}
+
+	return fieldType;
+}
+
+
+/*
+ * ArrowLoadRecordBatch writes the rows of the record batch with the given
+ * metadata and body to the cstore write state, and returns the number of rows.
+ */
+static uint64
+ArrowLoadRecordBatch(StringInfo metadata, uint32 recordBatchPosition, StringInfo body,
+					 TupleDesc tupleDescriptor, List *attributeNumberList,
+					 ArrowColumnType *fieldTypeArray, FmgrInfo *inputFunctionArray,
+					 Oid *typeIOParamArray, TableWriteState *writeState)
+{
+	uint32 lengthPosition = FlatTableField(metadata, recordBatchPosition, 0);
+	uint32 bufferVectorPosition = FlatTableField(metadata, recordBatchPosition, 2);
+	uint32 columnCount = tupleDescriptor->natts;
+	uint32 fieldCount = list_length(attributeNumberList);
+	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	uint64 **fieldBufferArray = palloc0(fieldCount * sizeof(uint64 *));
+	MemoryContext rowContext = NULL;
+	uint32 bufferCount = 0;
+	uint32 bufferIndex = 0;
+	uint32 fieldIndex = 0;
+	int64 rowCount = 0;
+	int64 rowIndex = 0;
+
+	if (FlatTableField(metadata, recordBatchPosition, 3) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("compressed arrow record batches are not supported")));
+	}
+
+	if (lengthPosition != 0)
+	{
+		FlatCheckBounds(metadata, lengthPosition, sizeof(int64));
+		memcpy(&rowCount, metadata->data + lengthPosition, sizeof(int64));
+	}
+
+	if (rowCount < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("invalid arrow record batch length")));
+	}
+
+	if (bufferVectorPosition != 0)
+	{
+		bufferVectorPosition = FlatReadOffset(metadata, bufferVectorPosition);
+		bufferCount = FlatReadUInt32(metadata, bufferVectorPosition);
+		FlatCheckBounds(metadata, bufferVectorPosition + 4,
+						(uint64) bufferCount * 2 * sizeof(int64));
+	}
+
+	/* find each field's buffers, and check that they are within the body */
+	for (fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+	{
+		ArrowColumnType *fieldType = &fieldTypeArray[fieldIndex];
+		uint32 fieldBufferCount = 2;
+		uint32 fieldBufferIndex = 0;
+
+		if (fieldType->typeId == ARROW_TYPE_UTF8 || fieldType->typeId == ARROW_TYPE_BINARY)
+		{
+			fieldBufferCount = 3;
+		}
+
+		if (bufferIndex + fieldBufferCount > bufferCount)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("arrow record batch doesn't have enough buffers")));
+		}
+
+		fieldBufferArray[fieldIndex] = palloc0(fieldBufferCount * 2 * sizeof(uint64));
+		memcpy(fieldBufferArray[fieldIndex],
+			   metadata->data + bufferVectorPosition + 4 + bufferIndex * 2 * sizeof(int64),
+			   fieldBufferCount * 2 * sizeof(uint64));
+
+		for (fieldBufferIndex = 0; fieldBufferIndex < fieldBufferCount; fieldBufferIndex++)
+		{
+			uint64 bufferOffset = fieldBufferArray[fieldIndex][fieldBufferIndex * 2];
+			uint64 bufferLength = fieldBufferArray[fieldIndex][fieldBufferIndex * 2 + 1];
+
+			FlatCheckBounds(body, bufferOffset, bufferLength);
+		}
+
+		/* check that values and offsets buffers have rowCount entries */
+		if (fieldType->valueWidth > 0 &&
+			fieldBufferArray[fieldIndex][3] < (uint64) rowCount * fieldType->valueWidth)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("arrow values buffer is too short")));
+		}
+		else if (fieldType->typeId == ARROW_TYPE_BOOL &&
+				 fieldBufferArray[fieldIndex][3] < (uint64) (rowCount + 7) / 8)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("arrow values buffer is too short")));
+		}
+		else if (fieldBufferCount == 3 && rowCount > 0 &&
+				 fieldBufferArray[fieldIndex][3] < (uint64) (rowCount + 1) * sizeof(int32))
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("arrow offsets buffer is too short")));
+		}
+
+		if (fieldBufferArray[fieldIndex][1] != 0 &&
+			fieldBufferArray[fieldIndex][1] < (uint64) (rowCount + 7) / 8)
+		{
+			ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+							errmsg("arrow validity buffer is too short")));
+		}
+
+		bufferIndex += fieldBufferCount;
+	}
+
+	/* columns that aren't loaded are null */
+	memset(columnNulls, true, columnCount * sizeof(bool));
+
+	rowContext = AllocSetContextCreate(CurrentMemoryContext,
+									   "Arrow Row Memory Context",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(rowContext);
+		ListCell *attributeNumberCell = NULL;
+
+		fieldIndex = 0;
+		foreach(attributeNumberCell, attributeNumberList)
+		{
+			AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+															attributeNumber - 1);
+			uint64 *bufferArray = fieldBufferArray[fieldIndex];
+			uint64 validityLength = bufferArray[1];
+			bool valueExists = true;
+
+			if (validityLength != 0)
+			{
+				uint8 validityByte = (uint8) body->data[bufferArray[0] + rowIndex / 8];
+				valueExists = ((validityByte >> (rowIndex % 8)) & 1) != 0;
+			}
+
+			columnNulls[attributeNumber - 1] = !valueExists;
+			if (valueExists)
+			{
+				columnValues[attributeNumber - 1] =
+					ArrowReadValue(&fieldTypeArray[fieldIndex], attributeForm,
+								   &inputFunctionArray[fieldIndex],
+								   typeIOParamArray[fieldIndex], body,
+								   bufferArray, rowIndex);
+			}
+
+			fieldIndex++;
+		}
+
+		CStoreWriteRow(writeState, columnValues, columnNulls);
+
+		MemoryContextSwitchTo(oldContext);
+		MemoryContextReset(rowContext);
+	}
+
+	MemoryContextDelete(rowContext);
+
+	return rowCount;
+}
+
+
+/*
+ * ArrowReadValue converts the value at the given row of an Arrow field into a
+ * datum of the column's type.
+ */
+static Datum
+ArrowReadValue(ArrowColumnType *fieldType, Form_pg_attribute attributeForm,
+			   FmgrInfo *inputFunction, Oid typeIOParam, StringInfo body,
+			   uint64 *bufferArray, uint64 rowIndex)
+{
+	char *valueData = body->data + bufferArray[2];
+	Oid typeId = getBaseType(attributeForm->atttypid);
+	Datum value = 0;
+
+	switch (fieldType->typeId)
+	{
+		case ARROW_TYPE_BOOL:
+		{
+			uint8 valueByte = (uint8) valueData[rowIndex / 8];
+			value = BoolGetDatum(((valueByte >> (rowIndex % 8)) & 1) != 0);
+			break;
+		}
+
+		case ARROW_TYPE_INT:
+		{
+			if (fieldType->valueWidth == sizeof(int16))
+			{
+				int16 intValue = 0;
+				memcpy(&intValue, valueData + rowIndex * sizeof(int16), sizeof(int16));
+				value = Int16GetDatum(intValue);
+			}
+			else if (fieldType->valueWidth == sizeof(int32))
+			{
+				int32 intValue = 0;
+				memcpy(&intValue, valueData + rowIndex * sizeof(int32), sizeof(int32));
+				value = Int32GetDatum(intValue);
+			}
+			else
+			{
+				int64 intValue = 0;
+				memcpy(&intValue, valueData + rowIndex * sizeof(int64), sizeof(int64));
+				value = Int64GetDatum(intValue);
+			}
+			break;
+		}
+
+		case ARROW_TYPE_FLOATING_POINT:
+		{
+			if (typeId == FLOAT4OID)
+			{
+				float4 floatValue = 0;
+				memcpy(&floatValue, valueData + rowIndex * sizeof(float4), sizeof(float4));
+				value = Float4GetDatum(floatValue);
+			}
+			else
+			{
+				float8 floatValue = 0;
+				memcpy(&floatValue, valueData + rowIndex * sizeof(float8), sizeof(float8));
+				value = Float8GetDatum(floatValue);
+			}
+			break;
+		}
+
+		case ARROW_TYPE_DATE:
+		{
+			int32 dateValue = 0;
+			memcpy(&dateValue, valueData + rowIndex * sizeof(int32), sizeof(int32));
+
+			if (!DATE_NOT_FINITE(dateValue))
+			{
+				dateValue -= ARROW_EPOCH_DAY_OFFSET;
+			}
+
+			value = DateADTGetDatum(dateValue);
+			break;
+		}
+
+		case ARROW_TYPE_TIMESTAMP:
+		{
+			int64 timestampValue = 0;
+			memcpy(&timestampValue, valueData + rowIndex * sizeof(int64), sizeof(int64));
+
+			if (!TIMESTAMP_NOT_FINITE(timestampValue))
+			{
+				if (fieldType->unit == ARROW_TIME_UNIT_SECOND)
+				{
+					timestampValue *= USECS_PER_SEC;
+				}
+				else if (fieldType->unit == ARROW_TIME_UNIT_MILLISECOND)
+				{
+					timestampValue *= 1000;
+				}
+				else if (fieldType->unit == ARROW_TIME_UNIT_NANOSECOND)
+				{
+					timestampValue /= 1000;
+				}
+
+				timestampValue -= ARROW_EPOCH_USEC_OFFSET;
+			}
+
+			value = TimestampGetDatum(timestampValue);
+			break;
+		}
+
+		default:
+		{
+			/* Utf8 and Binary values are between consecutive offsets */
+			char *offsetData = body->data + bufferArray[2];
+			char *stringData = body->data + bufferArray[4];
+			int32 startOffset = 0;
+			int32 endOffset = 0;
+			int32 valueLength = 0;
+
+			memcpy(&startOffset, offsetData + rowIndex * sizeof(int32), sizeof(int32));
+			memcpy(&endOffset, offsetData + (rowIndex + 1) * sizeof(int32),
+				   sizeof(int32));
+			valueLength = endOffset - startOffset;
+
+			if (startOffset < 0 || valueLength < 0 ||
+				(uint64) endOffset > bufferArray[5])
+			{
+				ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+								errmsg("invalid arrow value offsets")));
+			}
+
+			if (fieldType->typeId == ARROW_TYPE_BINARY)
+			{
+				bytea *byteaValue = palloc(valueLength + VARHDRSZ);
+				SET_VARSIZE(byteaValue, valueLength + VARHDRSZ);
+				memcpy(VARDATA(byteaValue), stringData + startOffset, valueLength);
+				value = PointerGetDatum(byteaValue);
+			}
+			else
+			{
+				char *valueString = pnstrdup(stringData + startOffset, valueLength);
+				char *convertedString = pg_any_to_server(valueString, valueLength,
+														 PG_UTF8);
+
+				value = InputFunctionCall(inputFunction, convertedString,
+										  typeIOParam, attributeForm->atttypmod);
+			}
+			break;
+		}
+	}
+
+	return value;
+}
+
+
+/* FlatAlign pads the buffer with zeros to the given alignment. */
+static void
+FlatAlign(StringInfo buffer, uint32 alignment)
+{
+	while (buffer->len % alignment != 0)
+	{
+		appendStringInfoCharMacro(buffer, '\0');
+	}
+}
+
+
+/* FlatAppendZeros appends the given number of zero bytes to the buffer. */
+static void
+FlatAppendZeros(StringInfo buffer, uint32 length)
+{
+	enlargeStringInfo(buffer, length);
+	memset(buffer->data + buffer->len, 0, length);
+	buffer->len += length;
+	buffer->data[buffer->len] = '\0';
+}
+
+
+/*
+ * FlatStartTable appends a vtable with the given field offsets and a zeroed
+ * table of the given size to the flatbuffer, and returns the table's position.
+ * We write tables before the objects they point to, so offsets point forward.
+ */
+static uint32
+FlatStartTable(StringInfo buffer, const uint16 *fieldOffsetArray, uint16 fieldCount,
+			   uint16 tableSize)
+{
+	uint16 vtableSize = sizeof(uint16) * (2 + fieldCount);
+	uint32 vtablePosition = 0;
+	uint32 tablePosition = 0;
+	int32 vtableOffset = 0;
+
+	FlatAlign(buffer, sizeof(uint16));
+	vtablePosition = buffer->len;
+	appendBinaryStringInfo(buffer, (char *) &vtableSize, sizeof(uint16));
+	appendBinaryStringInfo(buffer, (char *) &tableSize, sizeof(uint16));
+	if (fieldCount > 0)
+	{
+		appendBinaryStringInfo(buffer, (char *) fieldOffsetArray,
+							   fieldCount * sizeof(uint16));
+	}
+
+	FlatAlign(buffer, 8);
+	tablePosition = buffer->len;
+	FlatAppendZeros(buffer, tableSize);
+
+	/* the table starts with the offset back to its vtable */
+	vtableOffset = tablePosition - vtablePosition;
+	FlatSet(buffer, tablePosition, &vtableOffset, sizeof(int32));
+
+	return tablePosition;
+}
+
+
+/*
+ * FlatStartVector appends a vector with the given number of zeroed elements to
+ * the flatbuffer, and returns the position of its length field. Elements start
+ * at the given alignment.
+ */
+static uint32
+FlatStartVector(StringInfo buffer, uint32 elementCount, uint32 elementSize,
+				uint32 alignment)
+{
+	uint32 vectorPosition = 0;
+
+	FlatAlign(buffer, sizeof(uint32));
+	while ((buffer->len + sizeof(uint32)) % alignment != 0)
+	{
+		FlatAppendZeros(buffer, sizeof(uint32));
+	}
+
+	vectorPosition = buffer->len;
+	appendBinaryStringInfo(buffer, (char *) &elementCount, sizeof(uint32));
+	FlatAppendZeros(buffer, elementCount * elementSize);
+
+	return vectorPosition;
+}
+
+
+/* FlatString appends a string to the flatbuffer, and returns its position. */
+static uint32
+FlatString(StringInfo buffer, const char *string, uint32 length)
+{
+	uint32 stringPosition = 0;
+
+	FlatAlign(buffer, sizeof(uint32));
+	stringPosition = buffer->len;
+	appendBinaryStringInfo(buffer, (char *) &length, sizeof(uint32));
+	appendBinaryStringInfo(buffer, string, length);
+	appendStringInfoCharMacro(buffer, '\0');
+
+	return stringPosition;
+}
+
+
+/* FlatSet copies the given value into the flatbuffer at the given position. */
+static void
+FlatSet(StringInfo buffer, uint32 position, const void *value, uint32 size)
+{
+	Assert(position + size <= (uint32) buffer->len);
+	memcpy(buffer->data + position, value, size);
+}
+
+
+/* FlatSetOffset points the offset field at the given position to the target. */
+static void
+FlatSetOffset(StringInfo buffer, uint32 position, uint32 targetPosition)
+{
+	uint32 offset = targetPosition - position;
+
+	Assert(targetPosition > position);
+	FlatSet(buffer, position, &offset, sizeof(uint32));
+}
+
+
+/* FlatCheckBounds errors out if the given range isn't within the buffer. */
+static void
+FlatCheckBounds(StringInfo buffer, uint64 position, uint64 size)
+{
+	if (position > (uint64) buffer->len || size > (uint64) buffer->len - position)
+	{
+		ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						errmsg("invalid arrow message"),
+						errdetail("offset " UINT64_FORMAT " is out of bounds",
+								  position)));
+	}
+}
+
+
+/* FlatReadUInt32 reads the 32-bit integer at the given flatbuffer position. */
+static uint32
+FlatReadUInt32(StringInfo buffer, uint32 position)
+{
+	uint32 value = 0;
+
+	FlatCheckBounds(buffer, position, sizeof(uint32));
+	memcpy(&value, buffer->data + position, sizeof(uint32));
+
+	return value;
+}
+
+
+/*
+ * FlatTableField returns the position of the given field of the table at the
+ * given position, or 0 if the field isn't set.
+ */
+static uint32
+FlatTableField(StringInfo buffer, uint32 tablePosition, uint16 fieldIndex)
+{
+	int32 vtableOffset = (int32) FlatReadUInt32(buffer, tablePosition);
+	int64 vtablePosition = (int64) tablePosition - vtableOffset;
+	uint16 vtableSize = 0;
+	uint16 fieldOffset = 0;
+
+	FlatCheckBounds(buffer, vtablePosition, sizeof(uint16));
+	memcpy(&vtableSize, buffer->data + vtablePosition, sizeof(uint16));
+
+	if (sizeof(uint16) * (2 + fieldIndex) >= vtableSize)
+	{
+		return 0;
+	}
+
+	FlatCheckBounds(buffer, vtablePosition + sizeof(uint16) * (2 + fieldIndex),
+					sizeof(uint16));
+	memcpy(&fieldOffset, buffer->data + vtablePosition + sizeof(uint16) * (2 + fieldIndex),
+		   sizeof(uint16));
+
+	if (fieldOffset == 0)
+	{
+		return 0;
+	}
+
+	return tablePosition + fieldOffset;
+}
+
+
+/* FlatReadOffset returns the position that the offset field at the given position points to. */
+static uint32
+FlatReadOffset(StringInfo buffer, uint32 fieldPosition)
+{
+	uint64 targetPosition = (uint64) fieldPosition + FlatReadUInt32(buffer, fieldPosition);
+
+	FlatCheckBounds(buffer, targetPosition, 0);
+
+	return (uint32) targetPosition;
+}
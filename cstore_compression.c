@@ -2,8 +2,8 @@
  *
  * cstore_compression.c
  *
- * This file contains compression/decompression functions definitions
- * used in cstore_fdw.
+ * This file contains compression/decompression and checksum functions
+ * definitions used in cstore_fdw.
  *
  * Copyright (c) 2016, Citus Data, Inc.
  *
@@ -16,6 +16,7 @@
 
 #if PG_VERSION_NUM >= 90500
 #include "common/pg_lzcompress.h"
+#include "port/pg_crc32c.h"
 #else
 #include "utils/pg_lzcompress.h"
 #endif
@@ -52,6 +53,9 @@ typedef struct CStoreCompressHeader
 
 #endif
 
+/* length of the compression header in both header formats */
+#define CSTORE_COMPRESS_HEADER_LENGTH ((int32) (2 * sizeof(int32)))
+
 
 
 /*
@@ -169,3 +173,48 @@ DecompressBuffer(StringInfo buffer, CompressionType compressionType)
 
 	return decompressedBuffer;
 }
+
+
+/*
+ * DecompressedSize returns the size of the given buffer after decompression with
+ * the given compression type. A compressed buffer only needs to contain its
+ * compression header, so callers can find the size without reading the data.
+ */
+uint64
+DecompressedSize(StringInfo buffer, CompressionType compressionType)
+{
+	Assert(compressionType == COMPRESSION_NONE || compressionType == COMPRESSION_PG_LZ);
+
+	if (compressionType == COMPRESSION_NONE)
+	{
+		return buffer->len;
+	}
+
+	/* the header has a varlena length word and the raw size */
+	if (buffer->len < CSTORE_COMPRESS_HEADER_LENGTH)
+	{
+		ereport(ERROR, (errmsg("cannot read the compressed buffer's header")));
+	}
+
+	return CSTORE_COMPRESS_RAWSIZE(buffer->data);
+}
+
+
+#if PG_VERSION_NUM >= 90500
+/*
+ * BufferChecksum returns the CRC-32C checksum of the given buffer. PostgreSQL
+ * computes it with the SSE 4.2 or ARMv8 CRC instructions when the CPU has them,
+ * and falls back to a table based implementation otherwise.
+ */
+uint32
+BufferChecksum(StringInfo buffer)
+{
+	pg_crc32c checksum;
+
+	INIT_CRC32C(checksum);
+	COMP_CRC32C(checksum, buffer->data, buffer->len);
+	FIN_CRC32C(checksum);
+
+	return (uint32) checksum;
+}
+#endif
@@ -0,0 +1,400 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_delta.c
+ *
+ * This file contains functions that manage a table's delta store. Inserts that
+ * don't select from a query usually add a few rows at a time, and writing a
+ * stripe for each of them would leave the table with many small stripes. These
+ * inserts instead append their rows as heap tuples to the table's delta file,
+ * and reads return these rows after the table's stripes. Once the delta store
+ * reaches a stripe's row count, we merge its rows into a stripe.
+ *
+ * The delta file starts with a fixed size header, which has the delta store's
+ * generation, and the number and total length of the rows that follow. Appends
+ * write rows after the rows that the header covers, and then update the header,
+ * so readers and crashes never see partially written rows. A merge records the
+ * generation it merged in the footer of the segment it wrote, and then starts
+ * the next generation with an empty delta file. Readers ignore delta files of
+ * merged generations, so a crash between the two steps doesn't duplicate rows.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+
+#include "postgres.h"
+#include "cstore_fdw.h"
+#include "cstore_version_compat.h"
+
+#include <sys/stat.h>
+#include "access/htup_details.h"
+#include "storage/fd.h"
+
+
+/* DeltaFileHeader is the header at the start of a table's delta file. */
+typedef struct DeltaFileHeader
+{
+	uint64 generation;
+	uint64 rowCount;
+	uint64 dataLength;
+
+} DeltaFileHeader;
+
+
+static StringInfo DeltaFilename(const char *filename);
+static void ReadDeltaHeader(FILE *deltaFile, const char *deltaFilename,
+							DeltaFileHeader *deltaHeader);
+static void WriteDeltaData(FILE *deltaFile, const char *deltaFilename, uint64 offset,
+						   void *data, uint32 dataLength);
+static void SyncDeltaFile(FILE *deltaFile, const char *deltaFilename);
+
+
+/*
+ * CStoreAppendDeltaRow appends the given heap tuple to the given buffer in the
+ * delta file's row format: the tuple's length, followed by the tuple's header
+ * and data.
+ */
+void
+CStoreAppendDeltaRow(StringInfo rowBuffer, HeapTuple heapTuple)
+{
+	uint32 tupleLength = heapTuple->t_len;
+
+	appendBinaryStringInfo(rowBuffer, (char *) &tupleLength, sizeof(uint32));
+	appendBinaryStringInfo(rowBuffer, (char *) heapTuple->t_data, tupleLength);
+}
+
+
+/*
+ * CStoreAppendDelta appends the given rows to the delta store of the table with
+ * the given filename, and returns the number of rows in the delta store. The
+ * caller must hold the table's delta lock. If the delta store doesn't exist yet,
+ * or a merge moved its rows into stripes but didn't start the next generation,
+ * we start the next generation first.
+ */
+uint64
+CStoreAppendDelta(const char *filename, StringInfo rowBuffer, uint32 rowCount)
+{
+	StringInfo deltaFilename = DeltaFilename(filename);
+	uint64 mergedDeltaGeneration = CStoreMergedDeltaGeneration(filename);
+	DeltaFileHeader deltaHeader;
+	FILE *deltaFile = NULL;
+
+	memset(&deltaHeader, 0, sizeof(deltaHeader));
+
+	deltaFile = AllocateFile(deltaFilename->data, "r+");
+	if (deltaFile == NULL && errno != ENOENT)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for writing: %m",
+							   deltaFilename->data)));
+	}
+
+	if (deltaFile != NULL)
+	{
+		ReadDeltaHeader(deltaFile, deltaFilename->data, &deltaHeader);
+	}
+
+	if (deltaFile == NULL || deltaHeader.generation <= mergedDeltaGeneration)
+	{
+		if (deltaFile != NULL)
+		{
+			FreeFile(deltaFile);
+		}
+
+		CStoreResetDelta(filename, mergedDeltaGeneration + 1);
+
+		deltaFile = AllocateFile(deltaFilename->data, "r+");
+		if (deltaFile == NULL)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not open file \"%s\" for writing: %m",
+								   deltaFilename->data)));
+		}
+
+		ReadDeltaHeader(deltaFile, deltaFilename->data, &deltaHeader);
+	}
+
+	/* this overwrites rows of appends that crashed before updating the header */
+	WriteDeltaData(deltaFile, deltaFilename->data,
+				   sizeof(DeltaFileHeader) + deltaHeader.dataLength,
+				   rowBuffer->data, rowBuffer->len);
+	SyncDeltaFile(deltaFile, deltaFilename->data);
+
+	deltaHeader.rowCount += rowCount;
+	deltaHeader.dataLength += rowBuffer->len;
+
+	WriteDeltaData(deltaFile, deltaFilename->data, 0, &deltaHeader,
+				   sizeof(DeltaFileHeader));
+	SyncDeltaFile(deltaFile, deltaFilename->data);
+
+	if (FreeFile(deltaFile) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not close file \"%s\": %m",
+							   deltaFilename->data)));
+	}
+
+	pfree(deltaFilename->data);
+	pfree(deltaFilename);
+
+	return deltaHeader.rowCount;
+}
+
+
+/*
+ * CStoreReadDelta reads the delta store of the table with the given filename.
+ * If readRows is false, the function only reads the delta store's generation and
+ * row count. Tables without a delta file have an empty delta store. Callers
+ * check if the delta store's generation was already merged into stripes.
+ */
+TableDelta *
+CStoreReadDelta(const char *filename, bool readRows)
+{
+	StringInfo deltaFilename = DeltaFilename(filename);
+	TableDelta *tableDelta = palloc0(sizeof(TableDelta));
+	DeltaFileHeader deltaHeader;
+	FILE *deltaFile = NULL;
+
+	deltaFile = AllocateFile(deltaFilename->data, PG_BINARY_R);
+	if (deltaFile == NULL)
+	{
+		if (errno != ENOENT)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not open file \"%s\" for reading: %m",
+								   deltaFilename->data)));
+		}
+
+		return tableDelta;
+	}
+
+	ReadDeltaHeader(deltaFile, deltaFilename->data, &deltaHeader);
+
+	tableDelta->generation = deltaHeader.generation;
+	tableDelta->rowCount = deltaHeader.rowCount;
+
+	if (readRows && deltaHeader.rowCount > 0)
+	{
+		char *rowData = palloc(deltaHeader.dataLength);
+		uint64 rowDataOffset = 0;
+		uint64 rowIndex = 0;
+
+		if (fread(rowData, deltaHeader.dataLength, 1, deltaFile) != 1)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not read file \"%s\": %m",
+								   deltaFilename->data)));
+		}
+
+		tableDelta->rowArray = palloc(deltaHeader.rowCount * sizeof(HeapTuple));
+		for (rowIndex = 0; rowIndex < deltaHeader.rowCount; rowIndex++)
+		{
+			HeapTuple heapTuple = NULL;
+			uint32 tupleLength = 0;
+
+			if (rowDataOffset + sizeof(uint32) > deltaHeader.dataLength)
+			{
+				ereport(ERROR, (errmsg("could not read delta store"),
+								errdetail("row data in file \"%s\" is truncated",
+										  deltaFilename->data)));
+			}
+
+			memcpy(&tupleLength, rowData + rowDataOffset, sizeof(uint32));
+			rowDataOffset += sizeof(uint32);
+
+			if (rowDataOffset + tupleLength > deltaHeader.dataLength)
+			{
+				ereport(ERROR, (errmsg("could not read delta store"),
+								errdetail("row data in file \"%s\" is truncated",
+										  deltaFilename->data)));
+			}
+
+			/* tuple data must be aligned, so we copy each tuple */
+			heapTuple = palloc(HEAPTUPLESIZE + tupleLength);
+			heapTuple->t_len = tupleLength;
+			ItemPointerSetInvalid(&heapTuple->t_self);
+			heapTuple->t_tableOid = InvalidOid;
+			heapTuple->t_data = (HeapTupleHeader) ((char *) heapTuple + HEAPTUPLESIZE);
+			memcpy(heapTuple->t_data, rowData + rowDataOffset, tupleLength);
+			rowDataOffset += tupleLength;
+
+			tableDelta->rowArray[rowIndex] = heapTuple;
+		}
+
+		pfree(rowData);
+	}
+
+	FreeFile(deltaFile);
+	pfree(deltaFilename->data);
+	pfree(deltaFilename);
+
+	return tableDelta;
+}
+
+
+/*
+ * CStoreResetDelta replaces the delta file of the table with the given filename
+ * with an empty delta file of the given generation. Like footers, we first write
+ * the new file to a temporary file, and then rename it. Reads that already
+ * opened the old file keep reading it.
+ */
+void
+CStoreResetDelta(const char *filename, uint64 generation)
+{
+	StringInfo deltaFilename = DeltaFilename(filename);
+	StringInfo tempDeltaFilename = makeStringInfo();
+	DeltaFileHeader deltaHeader;
+	FILE *deltaFile = NULL;
+
+	memset(&deltaHeader, 0, sizeof(deltaHeader));
+	deltaHeader.generation = generation;
+
+	appendStringInfo(tempDeltaFilename, "%s%s", deltaFilename->data,
+					 CSTORE_TEMP_FILE_SUFFIX);
+
+	deltaFile = AllocateFile(tempDeltaFilename->data, PG_BINARY_W);
+	if (deltaFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for writing: %m",
+							   tempDeltaFilename->data)));
+	}
+
+	WriteDeltaData(deltaFile, tempDeltaFilename->data, 0, &deltaHeader,
+				   sizeof(DeltaFileHeader));
+	SyncDeltaFile(deltaFile, tempDeltaFilename->data);
+
+	if (FreeFile(deltaFile) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not close file \"%s\": %m",
+							   tempDeltaFilename->data)));
+	}
+
+	if (rename(tempDeltaFilename->data, deltaFilename->data) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   tempDeltaFilename->data, deltaFilename->data)));
+	}
+
+	pfree(deltaFilename->data);
+	pfree(deltaFilename);
+	pfree(tempDeltaFilename->data);
+	pfree(tempDeltaFilename);
+}
+
+
+/*
+ * CStoreMergedDeltaGeneration returns the last delta store generation that was
+ * merged into the stripes of the table with the given filename, or zero if no
+ * delta store was merged yet.
+ */
+uint64
+CStoreMergedDeltaGeneration(const char *filename)
+{
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+	uint32 segmentIndex = 0;
+	uint64 mergedDeltaGeneration = 0;
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		char *segmentFilename = CStoreSegmentFilename(filename, segmentIndex);
+		StringInfo tableFooterFilename = makeStringInfo();
+		TableFooter *tableFooter = NULL;
+		struct stat statBuffer;
+
+		appendStringInfo(tableFooterFilename, "%s%s", segmentFilename,
+						 CSTORE_FOOTER_FILE_SUFFIX);
+
+		/* segments get their footer when their first load finishes */
+		if (segmentIndex > 0 && stat(tableFooterFilename->data, &statBuffer) < 0)
+		{
+			continue;
+		}
+
+		tableFooter = CStoreReadFooter(tableFooterFilename);
+		mergedDeltaGeneration = Max(mergedDeltaGeneration,
+									tableFooter->mergedDeltaGeneration);
+
+		pfree(tableFooterFilename->data);
+		pfree(tableFooterFilename);
+		pfree(segmentFilename);
+	}
+
+	return mergedDeltaGeneration;
+}
+
+
+/* DeltaFilename returns the name of the delta file of the given table file. */
+static StringInfo
+DeltaFilename(const char *filename)
+{
+	StringInfo deltaFilename = makeStringInfo();
+	appendStringInfo(deltaFilename, "%s%s", filename, CSTORE_DELTA_FILE_SUFFIX);
+
+	return deltaFilename;
+}
+
+
+/* ReadDeltaHeader reads the header at the start of the given delta file. */
+static void
+ReadDeltaHeader(FILE *deltaFile, const char *deltaFilename,
+				DeltaFileHeader *deltaHeader)
+{
+	errno = 0;
+	if (fseeko(deltaFile, 0, SEEK_SET) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not seek in file \"%s\": %m", deltaFilename)));
+	}
+
+	if (fread(deltaHeader, sizeof(DeltaFileHeader), 1, deltaFile) != 1)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read delta store header from file \"%s\"",
+							   deltaFilename)));
+	}
+}
+
+
+/* WriteDeltaData writes the given data at the given offset of the delta file. */
+static void
+WriteDeltaData(FILE *deltaFile, const char *deltaFilename, uint64 offset,
+			   void *data, uint32 dataLength)
+{
+	errno = 0;
+	if (fseeko(deltaFile, offset, SEEK_SET) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not seek in file \"%s\": %m", deltaFilename)));
+	}
+
+	if (dataLength > 0 && fwrite(data, dataLength, 1, deltaFile) != 1)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not write file \"%s\": %m", deltaFilename)));
+	}
+}
+
+
+/* SyncDeltaFile flushes and syncs the given delta file. */
+static void
+SyncDeltaFile(FILE *deltaFile, const char *deltaFilename)
+{
+	errno = 0;
+	if (fflush(deltaFile) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not flush file \"%s\": %m", deltaFilename)));
+	}
+
+	if (pg_fsync(fileno(deltaFile)) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not sync file \"%s\": %m", deltaFilename)));
+	}
+}
@@ -0,0 +1,42 @@
+/* cstore_fdw/cstore_fdw--1.7--1.8.sql */
+
+CREATE FUNCTION cstore_attach_file(relation regclass, filename text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_drop_stripes(relation regclass, predicate text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_compact(relation regclass)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_block_info(relation regclass, verify boolean DEFAULT false,
+								  OUT segment integer, OUT stripe integer,
+								  OUT column_name name, OUT block integer,
+								  OUT row_count bigint, OUT compression text,
+								  OUT exists_size bigint, OUT value_size bigint,
+								  OUT decompressed_size bigint,
+								  OUT min_value text, OUT max_value text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+-- the table access method needs PostgreSQL 12 or later
+DO $cstam$
+BEGIN
+	IF current_setting('server_version_num')::int >= 120000 THEN
+		EXECUTE 'CREATE FUNCTION cstore_tableam_handler(internal)
+				 RETURNS table_am_handler
+				 AS ''MODULE_PATHNAME''
+				 LANGUAGE C STRICT';
+
+		EXECUTE 'CREATE ACCESS METHOD cstore_tableam TYPE TABLE
+				 HANDLER cstore_tableam_handler';
+	END IF;
+END;
+$cstam$;
@@ -1,4 +1,4 @@
-/* cstore_fdw/cstore_fdw--1.7.sql */
+/* cstore_fdw/cstore_fdw--1.8.sql */
 
 -- complain if script is sourced in psql, rather than via CREATE EXTENSION
 \echo Use "CREATE EXTENSION cstore_fdw" to load this file. \quit
@@ -31,6 +31,32 @@ RETURNS bigint
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT;
 
+CREATE FUNCTION cstore_attach_file(relation regclass, filename text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_drop_stripes(relation regclass, predicate text)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_compact(relation regclass)
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION cstore_block_info(relation regclass, verify boolean DEFAULT false,
+								  OUT segment integer, OUT stripe integer,
+								  OUT column_name name, OUT block integer,
+								  OUT row_count bigint, OUT compression text,
+								  OUT exists_size bigint, OUT value_size bigint,
+								  OUT decompressed_size bigint,
+								  OUT min_value text, OUT max_value text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
 CREATE OR REPLACE FUNCTION cstore_clean_table_resources(oid)
 RETURNS void
 AS 'MODULE_PATHNAME'
@@ -58,3 +84,18 @@ CREATE EVENT TRIGGER cstore_drop_event
     ON SQL_DROP
     EXECUTE PROCEDURE cstore_drop_trigger();
 
+
+-- the table access method needs PostgreSQL 12 or later
+DO $cstam$
+BEGIN
+	IF current_setting('server_version_num')::int >= 120000 THEN
+		EXECUTE 'CREATE FUNCTION cstore_tableam_handler(internal)
+				 RETURNS table_am_handler
+				 AS ''MODULE_PATHNAME''
+				 LANGUAGE C STRICT';
+
+		EXECUTE 'CREATE ACCESS METHOD cstore_tableam TYPE TABLE
+				 HANDLER cstore_tableam_handler';
+	END IF;
+END;
+$cstam$;
@@ -21,28 +21,49 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <limits.h>
+#include <math.h>
+#include "access/hash.h"
 #include "access/htup_details.h"
+#if PG_VERSION_NUM >= 100000
+#include "access/parallel.h"
+#endif
+#include "access/nbtree.h"
 #include "access/reloptions.h"
 #include "access/sysattr.h"
 #include "access/tuptoaster.h"
+#include "access/xact.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_am.h"
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_namespace.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/dbcommands.h"
 #include "commands/defrem.h"
 #include "commands/event_trigger.h"
 #include "commands/explain.h"
 #include "commands/extension.h"
+#include "commands/tablecmds.h"
 #include "commands/vacuum.h"
+#include "executor/executor.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
+#include "funcapi.h"
+#include "libpq/libpq.h"
+#include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
 #if PG_VERSION_NUM >= 120000
 #include "access/heapam.h"
 #include "access/tableam.h"
@@ -51,17 +72,30 @@
 #else
 #include "optimizer/var.h"
 #endif
+#include "parser/analyze.h"
 #include "parser/parser.h"
 #include "parser/parsetree.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_type.h"
+#if PG_VERSION_NUM >= 100000
+#include "postmaster/bgworker.h"
+#endif
 #include "storage/fd.h"
+#include "storage/lmgr.h"
+#include "tcop/tcopprot.h"
 #include "tcop/utility.h"
+#include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
 #include "utils/fmgroids.h"
+#include "utils/guc.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
+#include "utils/rls.h"
+#include "utils/selfuncs.h"
+#include "utils/syscache.h"
+#include "utils/tuplestore.h"
 #if PG_VERSION_NUM >= 120000
 #include "utils/snapmgr.h"
 #else
@@ -88,19 +122,56 @@ static void CStoreProcessCopyCommand(CopyStmt *copyStatement, const char *queryS
 									 char *completionTag);
 static uint64 CopyIntoCStoreTable(const CopyStmt *copyStatement,
 								  const char *queryString);
+static bool ArrowCopyFormat(const CopyStmt *copyStatement);
+static uint64 ArrowCopyIntoCStoreTable(const CopyStmt *copyStatement,
+									   Relation relation);
+#if PG_VERSION_NUM >= 100000
+static bool ParallelCopyAllowed(const CopyStmt *copyStatement, Relation relation);
+static uint64 ParallelCopyIntoCStoreTable(const CopyStmt *copyStatement,
+										  Relation relation);
+static void FindCopyChunkBounds(const char *inputFilename, List *copyOptionList,
+								ParallelCopyChunk *chunkArray, uint32 chunkCount);
+static uint64 CopyChunkIntoSegment(Relation relation, ParallelCopyShared *shared,
+								   uint32 chunkIndex, const char *inputFilename,
+								   List *attributeList, List *copyOptionList);
+static int ReadCopyChunkData(void *outputBuffer, int minReadSize, int maxReadSize);
+#endif
 static uint64 CopyOutCStoreTable(CopyStmt* copyStatement, const char* queryString);
+static List * CopyAttributeNumberList(Relation relation, List *attributeNameList);
+static CStoreCopyOutState * BeginNativeCopyOut(const CopyStmt *copyStatement,
+											   Relation relation);
+static uint64 NativeCopyOutCStoreTable(CStoreCopyOutState *copyOutState,
+									   Relation relation);
+static void CopyOutHeader(CStoreCopyOutState *copyOutState, TupleDesc tupleDescriptor);
+static void CopyOutRow(CStoreCopyOutState *copyOutState, ColumnBlockData **blockDataArray,
+					   uint32 rowIndex);
+static void CopyOutBinaryValue(CStoreCopyOutState *copyOutState,
+							   FmgrInfo *sendFunction, Datum value);
+static void CopyOutAttributeText(CStoreCopyOutState *copyOutState,
+								 const char *valueString);
+static void CopyOutAttributeCSV(CStoreCopyOutState *copyOutState,
+								const char *valueString, bool forceQuote,
+								bool singleColumn);
+static void CopyOutEndRow(CStoreCopyOutState *copyOutState);
+static void CopyOutFlush(CStoreCopyOutState *copyOutState);
 static void CStoreProcessAlterTableCommand(AlterTableStmt *alterStatement);
+static Oid IndexColumnDropRelationId(AlterTableStmt *alterStatement);
+static Oid IndexColumnRenameRelationId(RenameStmt *renameStatement);
+static void SetIndexColumnOption(Oid relationId, char *indexColumnName);
 static List * DroppedCStoreFilenameList(DropStmt *dropStatement);
 static List * FindCStoreTables(List *tableList);
 static List * OpenRelationsForTruncate(List *cstoreTableList);
 static void TruncateCStoreTables(List *cstoreRelationList);
-static void DeleteCStoreTableFiles(char *filename);
+static uint32 LockWritableSegment(Relation relation, const char *filename);
+static void LockAllSegments(Relation relation, const char *filename);
+static void RemoveSegmentFooter(const char *filename, uint32 segmentIndex);
+static int64 SegmentFilesSize(const char *filename, const char *suffix);
+static List * ParseStripePredicate(Relation relation, const char *predicateString);
 static void InitializeCStoreTableFile(Oid relationId, Relation relation);
 static bool CStoreTable(Oid relationId);
 static bool CStoreServer(ForeignServer *server);
 static bool DistributedTable(Oid relationId);
 static bool DistributedWorkerCopy(CopyStmt *copyStatement);
-static void CreateCStoreDatabaseDirectory(Oid databaseOid);
 static bool DirectoryExists(StringInfo directoryName);
 static void CreateDirectory(StringInfo directoryName);
 static void RemoveCStoreDatabaseDirectory(Oid databaseOid);
@@ -111,6 +182,10 @@ static char * CStoreGetOptionValue(Oid foreignTableId, const char *optionName);
 static void ValidateForeignTableOptions(char *filename, char *compressionTypeString,
 										char *stripeRowCountString,
 										char *blockRowCountString);
+static int32 IndexColumnIndex(Oid foreignTableId, char *indexColumnName);
+static void CheckIndexColumnOption(Oid foreignTableId);
+static uint32 * MaxSkipValueLengthArray(Oid foreignTableId);
+static uint32 ParseMaxSkipValueLength(char *maxSkipValueLengthString);
 static char * CStoreDefaultFilePath(Oid foreignTableId);
 static CompressionType ParseCompressionType(const char *compressionTypeString);
 static void CStoreGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel,
@@ -127,13 +202,100 @@ static ForeignScan * CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel
 										  Oid foreignTableId, ForeignPath *bestPath,
 										  List *targetList, List *scanClauses);
 #endif
+static void CStoreGetParameterizedPaths(PlannerInfo *root, RelOptInfo *baserel,
+										Oid foreignTableId, List *queryColumnList,
+										double tupleCountEstimate,
+										double totalDiskAccessCost,
+										uint32 blockRowCount);
+static List * ParameterizedPathInfoList(PlannerInfo *root, RelOptInfo *baserel,
+										List *queryColumnList);
+static List * AppendParamPathInfo(PlannerInfo *root, RelOptInfo *baserel,
+								  RestrictInfo *restrictInfo, List *paramInfoList);
+static bool ColumnEquivalenceMemberMatches(PlannerInfo *root, RelOptInfo *baserel,
+										   EquivalenceClass *equivalenceClass,
+										   EquivalenceMember *equivalenceMember,
+										   void *context);
+static Var * JoinClauseFilterColumn(Expr *clause, RelOptInfo *baserel);
+static double ParameterizedBlockFraction(PlannerInfo *root, RelOptInfo *baserel,
+										 ParamPathInfo *paramInfo, Oid foreignTableId,
+										 double tupleCountEstimate,
+										 uint32 blockRowCount);
+static double ColumnCorrelation(Oid relationId, AttrNumber attributeNumber);
+static void CStoreGetTopNPaths(PlannerInfo *root, RelOptInfo *baserel,
+							   Relation relation, List *queryColumnList,
+							   double tupleCountEstimate, double totalDiskAccessCost,
+							   uint32 blockRowCount);
+static Var * TopNSortColumn(PlannerInfo *root, RelOptInfo *baserel,
+							List *queryColumnList, bool *sortDescending,
+							bool *sortNullsFirst);
+#if PG_VERSION_NUM >= 110000
+static void CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+									   RelOptInfo *inputRel, RelOptInfo *outputRel,
+									   void *extra);
+#elif PG_VERSION_NUM >= 100000
+static void CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+									   RelOptInfo *inputRel, RelOptInfo *outputRel);
+#endif
+#if PG_VERSION_NUM >= 100000
+static List * AggregateScanTargetList(PathTarget *groupingTarget, Var *groupColumn);
+static List * ScanAggregateFunction(Aggref *aggregate, RelOptInfo *baserel);
+#endif
+static bool IntegerColumnType(Oid typeId);
 static double TupleCountEstimate(RelOptInfo *baserel, const char *filename);
 static BlockNumber PageCount(const char *filename);
 static List * ColumnList(RelOptInfo *baserel, Oid foreignTableId);
 static void CStoreExplainForeignScan(ForeignScanState *scanState,
 									 ExplainState *explainState);
 static void CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags);
+static List * EvaluateRuntimeConstants(List *whereClauseList, ExprContext *exprContext,
+									   bool evaluateExecParams);
+static Node * EvaluateRuntimeConstantsMutator(Node *node,
+											  RuntimeConstantContext *context);
+static bool RuntimeConstantExpression(Node *node, bool evaluateExecParams);
+static bool ContainsNonEvaluableNodeWalker(Node *node, bool *evaluateExecParams);
+static Const * EvaluateExpressionToConst(Expr *expression, ExprContext *exprContext);
 static TupleTableSlot * CStoreIterateForeignScan(ForeignScanState *scanState);
+static void StoreRowWithRowId(TableReadState *readState, TupleTableSlot *tupleSlot);
+static void EncodeRowId(uint32 stripeIndex, uint32 rowOffset, ItemPointer rowId);
+static void DecodeRowId(ItemPointer rowId, uint32 *stripeIndex, uint32 *rowOffset);
+static TupleTableSlot * IterateTopNForeignScan(ForeignScanState *scanState);
+static void ComputeTopNRows(ForeignScanState *scanState);
+static void AddTopNRow(CStoreScanState *cstoreScanState, TupleDesc tupleDescriptor,
+					   Datum *columnValues, bool *columnNulls);
+static int CompareTopNValues(CStoreScanState *cstoreScanState, Datum leftValue,
+							 bool leftNull, Datum rightValue, bool rightNull);
+static int CompareTopNRows(const void *leftElement, const void *rightElement,
+						   void *context);
+static void BeginAggregateForeignScan(ForeignScanState *scanState);
+static Oid AggregateScanRelationId(ForeignScan *foreignScan, List *rangeTable);
+static TupleTableSlot * IterateAggregateForeignScan(ForeignScanState *scanState);
+static void ComputeAggregateGroups(ForeignScanState *scanState);
+static void AssignRowGroups(ForeignScanState *scanState, ColumnBlockData **blockDataArray,
+							uint32 blockRowCount);
+static bool BlockRowMatchesQual(ForeignScanState *scanState,
+								ColumnBlockData **blockDataArray, uint32 rowIndex);
+static AggregateGroup * LookupAggregateGroup(CStoreScanState *cstoreScanState,
+											 Datum groupValue, bool groupValueNull);
+static void AddAggregateGroup(CStoreScanState *cstoreScanState, AggregateGroup *group);
+static void AggregateBlockSummary(CStoreScanState *cstoreScanState,
+								  ColumnBlockSkipNode **blockSkipNodeArray,
+								  uint32 blockRowCount);
+static void AggregateBlockValues(CStoreScanState *cstoreScanState,
+								 ColumnBlockData **blockDataArray,
+								 uint32 blockRowCount);
+static void AggregateIntegerValues(ScanAggregate *aggregate, uint32 aggregateIndex,
+								   ColumnBlockData *blockData,
+								   AggregateGroup **rowGroupArray,
+								   uint32 blockRowCount);
+static void AggregateFloatValues(ScanAggregate *aggregate, uint32 aggregateIndex,
+								 ColumnBlockData *blockData,
+								 AggregateGroup **rowGroupArray, uint32 blockRowCount);
+static void SetAggregateGroupValues(CStoreScanState *cstoreScanState,
+									AggregateGroup *group, Datum *columnValues,
+									bool *columnNulls);
+static int64 IntegerDatumValue(Datum datum, Oid typeId);
+static Datum IntegerValueDatum(int64 value, Oid typeId);
+static int CompareFloatValues(double leftValue, double rightValue);
 static void CStoreEndForeignScan(ForeignScanState *scanState);
 static void CStoreReScanForeignScan(ForeignScanState *scanState);
 static bool CStoreAnalyzeForeignTable(Relation relation,
@@ -142,6 +304,10 @@ static bool CStoreAnalyzeForeignTable(Relation relation,
 static int CStoreAcquireSampleRows(Relation relation, int logLevel,
 								   HeapTuple *sampleRows, int targetRowCount,
 								   double *totalRowCount, double *totalDeadRowCount);
+static void SetSampleRowPosition(HeapTuple sampleRow, double rowNumber);
+static int CompareSampleRows(const void *leftElement, const void *rightElement);
+static void CStoreAddForeignUpdateTargets(Query *parseTree, RangeTblEntry *tableEntry,
+										  Relation targetRelation);
 static List * CStorePlanForeignModify(PlannerInfo *plannerInfo, ModifyTable *plan,
 									 Index resultRelation, int subplanIndex);
 static void CStoreBeginForeignModify(ModifyTableState *modifyTableState,
@@ -149,12 +315,33 @@ static void CStoreBeginForeignModify(ModifyTableState *modifyTableState,
 									 int subplanIndex, int executorflags);
 static void CStoreBeginForeignInsert(ModifyTableState *modifyTableState,
 									 ResultRelInfo *relationInfo);
+static void CStoreBeginForeignDelete(ModifyTableState *modifyTableState,
+									 ResultRelInfo *relationInfo, int subplanIndex);
+static void CStoreBeginDeltaInsert(ResultRelInfo *relationInfo);
+static TableWriteState * BeginModifyWrite(ResultRelInfo *relationInfo);
 static TupleTableSlot * CStoreExecForeignInsert(EState *executorState,
 												ResultRelInfo *relationInfo,
 												TupleTableSlot *tupleSlot,
 												TupleTableSlot *planSlot);
+static TupleTableSlot * CStoreExecForeignDelete(EState *executorState,
+												ResultRelInfo *relationInfo,
+												TupleTableSlot *tupleSlot,
+												TupleTableSlot *planSlot);
+static TupleTableSlot * CStoreExecForeignUpdate(EState *executorState,
+												ResultRelInfo *relationInfo,
+												TupleTableSlot *tupleSlot,
+												TupleTableSlot *planSlot);
+static bool MarkRowIdDeleted(CStoreModifyState *modifyState, TupleTableSlot *planSlot);
+static bool MarkDeletedRow(CStoreModifyState *modifyState, uint32 stripeIndex,
+						   uint32 rowOffset);
 static void CStoreEndForeignModify(EState *executorState, ResultRelInfo *relationInfo);
 static void CStoreEndForeignInsert(EState *executorState, ResultRelInfo *relationInfo);
+static void CStoreEndDeltaInsert(CStoreModifyState *modifyState);
+static void MergeDelta(Relation relation, CStoreFdwOptions *cstoreFdwOptions);
+static void CStoreEndForeignDelete(CStoreModifyState *modifyState);
+static void MergeModifiedSegments(CStoreModifyState *modifyState);
+static void MergeDeletedRows(StripeMetadata *stripeMetadata, uint8 *deletedRowBitmap,
+							 uint32 deletedRowBitmapLength);
 #if PG_VERSION_NUM >= 90600
 static bool CStoreIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
 											RangeTblEntry *rte);
@@ -165,6 +352,10 @@ PG_MODULE_MAGIC;
 
 PG_FUNCTION_INFO_V1(cstore_ddl_event_end_trigger);
 PG_FUNCTION_INFO_V1(cstore_table_size);
+PG_FUNCTION_INFO_V1(cstore_attach_file);
+PG_FUNCTION_INFO_V1(cstore_drop_stripes);
+PG_FUNCTION_INFO_V1(cstore_compact);
+PG_FUNCTION_INFO_V1(cstore_block_info);
 PG_FUNCTION_INFO_V1(cstore_fdw_handler);
 PG_FUNCTION_INFO_V1(cstore_fdw_validator);
 PG_FUNCTION_INFO_V1(cstore_clean_table_resources);
@@ -173,6 +364,19 @@ PG_FUNCTION_INFO_V1(cstore_clean_table_resources);
 /* saved hook value in case of unload */
 static ProcessUtility_hook_type PreviousProcessUtilityHook = NULL;
 
+/* number of workers that load a COPY FROM file along with the leader */
+static int ParallelCopyWorkerCount = 0;
+
+/* whether reads check the checksums of column blocks and skip lists */
+bool CStoreVerifyChecksums = true;
+
+/* signature at the start of binary COPY files */
+static const char BinarySignature[11] = "PGCOPY\n\377\r\n\0";
+
+/* input file and bytes left in the chunk that this process loads */
+static FILE *CopyChunkFile = NULL;
+static uint64 CopyChunkBytesLeft = 0;
+
 
 /*
  * _PG_init is called when the module is loaded. In this function we save the
@@ -183,6 +387,28 @@ void _PG_init(void)
 {
 	PreviousProcessUtilityHook = ProcessUtility_hook;
 	ProcessUtility_hook = CStoreProcessUtility;
+
+	DefineCustomBoolVariable("cstore_fdw.verify_checksums",
+							 "Checks the checksums of cstore data when reading it.",
+							 "Reads error out when a column block or a skip list "
+							 "doesn't match the checksum that was stored with it. "
+							 "Files written by older versions don't have checksums.",
+							 &CStoreVerifyChecksums, true, PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+
+#if PG_VERSION_NUM >= 100000
+	DefineCustomIntVariable("cstore_fdw.parallel_copy_workers",
+							"Sets the number of parallel workers that load a "
+							"COPY FROM file into a cstore table.",
+							"Each worker parses and writes a part of the file "
+							"into its own segment file of the table.",
+							&ParallelCopyWorkerCount, 0, 0, MAX_PARALLEL_WORKER_LIMIT,
+							PGC_USERSET, 0, NULL, NULL, NULL);
+#endif
+
+#if PG_VERSION_NUM >= 120000
+	CStoreTableAMInit();
+#endif
 }
 
 
@@ -193,6 +419,10 @@ void _PG_init(void)
 void _PG_fini(void)
 {
 	ProcessUtility_hook = PreviousProcessUtilityHook;
+
+#if PG_VERSION_NUM >= 120000
+	CStoreTableAMFini();
+#endif
 }
 
 
@@ -200,7 +430,8 @@ void _PG_fini(void)
  * cstore_ddl_event_end_trigger is the event trigger function which is called on
  * ddl_command_end event. This function creates required directories after the
  * CREATE SERVER statement and valid data and footer files after the CREATE FOREIGN
- * TABLE statement.
+ * TABLE statement. It also checks the index column option of created tables and
+ * of tables whose options change.
  */
 Datum
 cstore_ddl_event_end_trigger(PG_FUNCTION_ARGS)
@@ -249,10 +480,30 @@ cstore_ddl_event_end_trigger(PG_FUNCTION_ARGS)
 			 */
 			CreateCStoreDatabaseDirectory(MyDatabaseId);
 
+			CheckIndexColumnOption(relationId);
 			InitializeCStoreTableFile(relationId, relation);
 			heap_close(relation, AccessExclusiveLock);
 		}
 	}
+	else if (nodeTag(parseTree) == T_AlterTableStmt)
+	{
+		AlterTableStmt *alterStatement = (AlterTableStmt *) parseTree;
+		Oid relationId = RangeVarGetRelid(alterStatement->relation, NoLock, true);
+		ListCell *commandCell = NULL;
+
+		if (CStoreTable(relationId))
+		{
+			foreach(commandCell, alterStatement->cmds)
+			{
+				AlterTableCmd *alterCommand = (AlterTableCmd *) lfirst(commandCell);
+
+				if (alterCommand->subtype == AT_GenericOptions)
+				{
+					CheckIndexColumnOption(relationId);
+				}
+			}
+		}
+	}
 
 	PG_RETURN_NULL();
 }
@@ -383,9 +634,30 @@ CStoreProcessUtility(Node * parseTree, const char *queryString,
 	else if (nodeTag(parseTree) == T_AlterTableStmt)
 	{
 		AlterTableStmt *alterTable = (AlterTableStmt *) parseTree;
+		Oid indexColumnDropRelationId = IndexColumnDropRelationId(alterTable);
+
 		CStoreProcessAlterTableCommand(alterTable);
 		CALL_PREVIOUS_UTILITY(parseTree, queryString, context, paramListInfo,
 							  destReceiver, completionTag);
+
+		/* like indexes, the sparse index goes away with its column */
+		if (indexColumnDropRelationId != InvalidOid)
+		{
+			SetIndexColumnOption(indexColumnDropRelationId, NULL);
+		}
+	}
+	else if (nodeTag(parseTree) == T_RenameStmt)
+	{
+		RenameStmt *renameStatement = (RenameStmt *) parseTree;
+		Oid indexColumnRenameRelationId = IndexColumnRenameRelationId(renameStatement);
+
+		CALL_PREVIOUS_UTILITY(parseTree, queryString, context, paramListInfo,
+							  destReceiver, completionTag);
+
+		if (indexColumnRenameRelationId != InvalidOid)
+		{
+			SetIndexColumnOption(indexColumnRenameRelationId, renameStatement->newname);
+		}
 	}
 	else if (nodeTag(parseTree) == T_DropdbStmt)
 	{
@@ -527,6 +799,7 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 	TableWriteState *writeState = NULL;
 	CStoreFdwOptions *cstoreFdwOptions = NULL;
 	MemoryContext tupleContext = NULL;
+	uint32 segmentIndex = 0;
 
 	/* Only superuser can copy from or to local file */
 	CheckSuperuserPrivilegesForCopy(copyStatement);
@@ -534,10 +807,11 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 	Assert(copyStatement->relation != NULL);
 
 	/*
-	 * Open and lock the relation. We acquire ShareUpdateExclusiveLock to allow
-	 * concurrent reads, but block concurrent writes.
+	 * Open and lock the relation. We acquire RowExclusiveLock to allow both
+	 * concurrent reads and concurrent loads; concurrent loads write into
+	 * different segment files of the table.
 	 */
-	relation = heap_openrv(copyStatement->relation, ShareUpdateExclusiveLock);
+	relation = heap_openrv(copyStatement->relation, RowExclusiveLock);
 	relationId = RelationGetRelid(relation);
 
 	/* allocate column values and nulls arrays */
@@ -548,6 +822,24 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 
 	cstoreFdwOptions = CStoreGetOptions(relationId);
 
+	if (ArrowCopyFormat(copyStatement))
+	{
+		processedRowCount = ArrowCopyIntoCStoreTable(copyStatement, relation);
+		heap_close(relation, RowExclusiveLock);
+
+		return processedRowCount;
+	}
+
+#if PG_VERSION_NUM >= 100000
+	if (ParallelCopyAllowed(copyStatement, relation))
+	{
+		processedRowCount = ParallelCopyIntoCStoreTable(copyStatement, relation);
+		heap_close(relation, RowExclusiveLock);
+
+		return processedRowCount;
+	}
+#endif
+
 	/*
 	 * We create a new memory context called tuple context, and read and write
 	 * each row's values within this memory context. After each read and write,
@@ -579,11 +871,15 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 							  copyStatement->options);
 #endif
 
-	/* init state to write to the cstore file */
-	writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
+	/* init state to write to a segment file that no other load is writing */
+	segmentIndex = LockWritableSegment(relation, cstoreFdwOptions->filename);
+	writeState = CStoreBeginWrite(CStoreSegmentFilename(cstoreFdwOptions->filename,
+														segmentIndex),
 								  cstoreFdwOptions->compressionType,
 								  cstoreFdwOptions->stripeRowCount,
 								  cstoreFdwOptions->blockRowCount,
+								  cstoreFdwOptions->indexColumnIndex,
+								  cstoreFdwOptions->maxSkipValueLengthArray,
 								  tupleDescriptor);
 
 	while (nextRowFound)
@@ -612,1400 +908,6518 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 	/* end read/write sessions and close the relation */
 	EndCopyFrom(copyState);
 	CStoreEndWrite(writeState);
-	heap_close(relation, ShareUpdateExclusiveLock);
+	UnlockPage(relation, segmentIndex, ExclusiveLock);
+	heap_close(relation, RowExclusiveLock);
 
 	return processedRowCount;
 }
 
 
+/* ArrowCopyFormat returns whether the COPY statement uses the arrow format. */
+static bool
+ArrowCopyFormat(const CopyStmt *copyStatement)
+{
+	ListCell *optionCell = NULL;
+
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strcmp(option->defname, "format") == 0 &&
+			strcmp(defGetString(option), "arrow") == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 /*
- * CopyFromCStoreTable handles a "COPY cstore_table TO ..." statement. Statement
- * is converted to "COPY (SELECT * FROM cstore_table) TO ..." and forwarded to
- * postgres native COPY handler. Function returns number of files copied to external
- * stream. Copying selected columns from cstore table is not currently supported.
+ * ArrowCopyIntoCStoreTable loads the Arrow stream or file of a "COPY cstore_table
+ * FROM" statement into a segment of the cstore table, and returns the number of
+ * loaded rows. PostgreSQL's COPY doesn't know the arrow format, so we check the
+ * statement's options and privileges here.
  */
 static uint64
-CopyOutCStoreTable(CopyStmt* copyStatement, const char* queryString)
+ArrowCopyIntoCStoreTable(const CopyStmt *copyStatement, Relation relation)
 {
-	uint64 processedCount = 0;
-	RangeVar *relation = NULL;
-	char *qualifiedName = NULL;
-	List *queryList = NIL;
-	Node *rawQuery = NULL;
+	Oid relationId = RelationGetRelid(relation);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	TupleConstr *constraints = tupleDescriptor->constr;
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(relationId);
+	TableWriteState *writeState = NULL;
+	List *attributeNumberList = NIL;
+	ListCell *optionCell = NULL;
+	ListCell *attributeNumberCell = NULL;
+	AclResult aclResult = ACLCHECK_OK;
+	uint32 segmentIndex = 0;
+	uint64 processedRowCount = 0;
 
-	StringInfo newQuerySubstring = makeStringInfo();
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strcmp(option->defname, "format") != 0)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("COPY options other than FORMAT are not supported "
+								   "in arrow format")));
+		}
+	}
 
-	if (copyStatement->attlist != NIL)
+	if (copyStatement->filename == NULL || copyStatement->is_program)
 	{
 		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-						errmsg("copy column list is not supported"),
-						errhint("use 'copy (select <columns> from <table>) to "
-								"...' instead")));
+						errmsg("arrow format is only supported when copying from "
+							   "a file")));
 	}
 
-	relation = copyStatement->relation;
-	qualifiedName = quote_qualified_identifier(relation->schemaname,
-											   relation->relname);
-	appendStringInfo(newQuerySubstring, "select * from %s", qualifiedName);
-	queryList = raw_parser(newQuerySubstring->data);
+	if (!is_absolute_path(copyStatement->filename))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_NAME),
+						errmsg("relative path not allowed for COPY from file")));
+	}
 
-	/* take the first parse tree */
-	rawQuery = linitial(queryList);
+	if (check_enable_rls(relationId, InvalidOid, false) == RLS_ENABLED)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("COPY FROM not supported with row-level security")));
+	}
 
-	/*
-	 * Set the relation field to NULL so that COPY command works on
-	 * query field instead.
-	 */
-	copyStatement->relation = NULL;
+	attributeNumberList = CopyAttributeNumberList(relation, copyStatement->attlist);
 
-#if (PG_VERSION_NUM >= 100000)
-	/*
-	 * raw_parser returns list of RawStmt* in PG 10+ we need to
-	 * extract actual query from it.
-	 */
+	/* the user needs insert privilege on the table, or on each loaded column */
+	aclResult = pg_class_aclcheck(relationId, GetUserId(), ACL_INSERT);
+	if (aclResult != ACLCHECK_OK)
 	{
-		ParseState *pstate = make_parsestate(NULL);
-		RawStmt *rawStatement = (RawStmt *) rawQuery;
-
-		pstate->p_sourcetext = newQuerySubstring->data;
-		copyStatement->query = rawStatement->stmt;
+		foreach(attributeNumberCell, attributeNumberList)
+		{
+			AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+			if (pg_attribute_aclcheck(relationId, attributeNumber, GetUserId(),
+									  ACL_INSERT) != ACLCHECK_OK)
+			{
+				aclcheck_error(aclResult, ACLCHECK_OBJECT_TABLE,
+							   RelationGetRelationName(relation));
+			}
+		}
+	}
 
-		DoCopy(pstate, copyStatement, -1, -1, &processedCount);
-		free_parsestate(pstate);
+	/* we don't evaluate default expressions for columns that aren't loaded */
+	if (constraints != NULL)
+	{
+		int defaultIndex = 0;
+		for (defaultIndex = 0; defaultIndex < constraints->num_defval; defaultIndex++)
+		{
+			AttrNumber attributeNumber = constraints->defval[defaultIndex].adnum;
+			if (!list_member_int(attributeNumberList, attributeNumber))
+			{
+				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+								errmsg("column defaults are not supported in arrow "
+									   "format"),
+								errhint("Include column \"%s\" in the column list.",
+										NameStr(TupleDescAttr(tupleDescriptor,
+															  attributeNumber - 1)->attname))));
+			}
+		}
 	}
-#else
-	copyStatement->query = rawQuery;
 
-	DoCopy(copyStatement, queryString, &processedCount);
-#endif
+	segmentIndex = LockWritableSegment(relation, cstoreFdwOptions->filename);
+	writeState = CStoreBeginWrite(CStoreSegmentFilename(cstoreFdwOptions->filename,
+														segmentIndex),
+								  cstoreFdwOptions->compressionType,
+								  cstoreFdwOptions->stripeRowCount,
+								  cstoreFdwOptions->blockRowCount,
+								  cstoreFdwOptions->indexColumnIndex,
+								  cstoreFdwOptions->maxSkipValueLengthArray,
+								  tupleDescriptor);
 
-	return processedCount;
+	processedRowCount = ArrowLoadFile(copyStatement->filename, tupleDescriptor,
+									  attributeNumberList, writeState);
+
+	CStoreEndWrite(writeState);
+	UnlockPage(relation, segmentIndex, ExclusiveLock);
+
+	return processedRowCount;
 }
 
 
+#if PG_VERSION_NUM >= 100000
+
 /*
- * CStoreProcessAlterTableCommand checks if given alter table statement is
- * compatible with underlying data structure. Currently it only checks alter
- * column type. The function errors out if current column type can not be safely
- * converted to requested column type. This check is more restrictive than
- * PostgreSQL's because we can not change existing data.
+ * ParallelCopyAllowed returns whether a COPY into the given cstore table can be
+ * loaded by parallel workers. This needs a text or csv input file that workers
+ * can open and seek in, and an encoding where a newline, quote or backslash
+ * byte is never part of a multibyte character.
  */
-static void
-CStoreProcessAlterTableCommand(AlterTableStmt *alterStatement)
+static bool
+ParallelCopyAllowed(const CopyStmt *copyStatement, Relation relation)
 {
-	ObjectType objectType = alterStatement->relkind;
-	RangeVar *relationRangeVar = alterStatement->relation;
-	Oid relationId = InvalidOid;
-	List *commandList = alterStatement->cmds;
-	ListCell *commandCell = NULL;
+	TupleConstr *constraints = RelationGetDescr(relation)->constr;
+	int fileEncoding = pg_get_client_encoding();
+	ListCell *optionCell = NULL;
 
-	/* we are only interested in foreign table changes */
-	if (objectType != OBJECT_TABLE && objectType != OBJECT_FOREIGN_TABLE)
+	if (ParallelCopyWorkerCount == 0)
 	{
-		return;
+		return false;
 	}
 
-	relationId = RangeVarGetRelid(relationRangeVar, AccessShareLock, true);
-	if (!CStoreTable(relationId))
+	if (copyStatement->filename == NULL || copyStatement->is_program)
 	{
-		return;
+		return false;
 	}
 
-	foreach(commandCell, commandList)
+	/* default expressions such as nextval() can't run in parallel workers */
+	if (constraints != NULL && constraints->num_defval > 0)
 	{
-		AlterTableCmd *alterCommand = (AlterTableCmd *) lfirst(commandCell);
-		if(alterCommand->subtype == AT_AlterColumnType)
-		{
-			char *columnName = alterCommand->name;
-			ColumnDef *columnDef = (ColumnDef *) alterCommand->def;
-			Oid targetTypeId = typenameTypeId(NULL, columnDef->typeName);
-			char *typeName = TypeNameToString(columnDef->typeName);
-			AttrNumber attributeNumber = get_attnum(relationId, columnName);
-			Oid currentTypeId = InvalidOid;
-
-			if (attributeNumber <= 0)
-			{
-				/* let standard utility handle this */
-				continue;
-			}
+		return false;
+	}
 
-			currentTypeId = get_atttype(relationId, attributeNumber);
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
 
-			/*
-			 * We are only interested in implicit coersion type compatibility.
-			 * Erroring out here to prevent further processing.
-			 */
-			if (!can_coerce_type(1, &currentTypeId, &targetTypeId, COERCION_IMPLICIT))
-			{
-				ereport(ERROR, (errmsg("Column %s cannot be cast automatically to "
-									   "type %s", columnName, typeName)));
-			}
+		if (strcmp(option->defname, "format") == 0 &&
+			strcmp(defGetString(option), "binary") == 0)
+		{
+			return false;
 		}
+		else if (strcmp(option->defname, "encoding") == 0)
+		{
+			fileEncoding = pg_char_to_encoding(defGetString(option));
+		}
+	}
+
+	if (fileEncoding < 0 || PG_ENCODING_IS_CLIENT_ONLY(fileEncoding))
+	{
+		return false;
 	}
+
+	return true;
 }
 
 
 /*
- * DropppedCStoreFilenameList extracts and returns the list of cstore file names
- * from DROP table statement
+ * ParallelCopyIntoCStoreTable loads the input file of a "COPY cstore_table FROM"
+ * statement using parallel workers. We split the file into one chunk per worker
+ * plus one for the leader, and each process loads its chunk into a new segment
+ * of the table. We add all new segments to the segment manifest at once when
+ * every chunk is loaded, so readers see either none or all of the loaded rows.
+ * We hold the relation extension lock until then so that concurrent loads don't
+ * add the same segments; they can still load into existing segments.
  */
-static List *
-DroppedCStoreFilenameList(DropStmt *dropStatement)
+static uint64
+ParallelCopyIntoCStoreTable(const CopyStmt *copyStatement, Relation relation)
 {
-	List *droppedCStoreFileList = NIL;
+	Oid relationId = RelationGetRelid(relation);
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(relationId);
+	uint32 chunkCount = ParallelCopyWorkerCount + 1;
+	uint32 chunkIndex = 0;
+	uint64 processedRowCount = 0;
+	ParallelCopyChunk *chunkArray = NULL;
+	ParallelCopyShared *shared = NULL;
+	Size sharedSize = 0;
+	ParallelContext *parallelContext = NULL;
+	List *serializedOptionList = NIL;
+	List *statementList = NIL;
+	char *serializedStatement = NULL;
+	char *sharedStatement = NULL;
+	ListCell *optionCell = NULL;
 
-	if (dropStatement->removeType == OBJECT_FOREIGN_TABLE)
+	chunkArray = palloc0(chunkCount * sizeof(ParallelCopyChunk));
+	FindCopyChunkBounds(copyStatement->filename, copyStatement->options,
+						chunkArray, chunkCount);
+
+	/* DefElem nodes can't be read back from strings, so we send names and args */
+	foreach(optionCell, copyStatement->options)
 	{
-		ListCell *dropObjectCell = NULL;
-		foreach(dropObjectCell, dropStatement->objects)
-		{
-			List *tableNameList = (List *) lfirst(dropObjectCell);
-			RangeVar *rangeVar = makeRangeVarFromNameList(tableNameList);
+		DefElem *option = (DefElem *) lfirst(optionCell);
+		List *serializedOption = list_make2(makeString(option->defname), option->arg);
 
-			Oid relationId = RangeVarGetRelid(rangeVar, AccessShareLock, true);
-			if (CStoreTable(relationId))
-			{
-				CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(relationId);
-				char *defaultfilename = CStoreDefaultFilePath(relationId);
+		serializedOptionList = lappend(serializedOptionList, serializedOption);
+	}
 
-				/*
-				 * Skip files that are placed in default location, they are handled
-				 * by sql drop trigger. Both paths are generated by code, use
-				 * of strcmp is safe here.
-				 */
-				if (strcmp(defaultfilename, cstoreFdwOptions->filename) == 0)
-				{
-					continue;
-				}
+	statementList = list_make3(makeString(copyStatement->filename),
+							   copyStatement->attlist, serializedOptionList);
+	serializedStatement = nodeToString(statementList);
 
-				droppedCStoreFileList = lappend(droppedCStoreFileList,
-												cstoreFdwOptions->filename);
-			}
-		}
+	LockRelationForExtension(relation, ExclusiveLock);
+
+	EnterParallelMode();
+
+	parallelContext = CreateParallelContextCompat(CSTORE_FDW_NAME,
+												  "ParallelCopyWorkerMain",
+												  chunkCount - 1);
+
+	sharedSize = add_size(offsetof(ParallelCopyShared, chunkArray),
+						  mul_size(chunkCount, sizeof(ParallelCopyChunk)));
+	shm_toc_estimate_chunk(&parallelContext->estimator, sharedSize);
+	shm_toc_estimate_chunk(&parallelContext->estimator, strlen(serializedStatement) + 1);
+	shm_toc_estimate_keys(&parallelContext->estimator, 2);
+
+	InitializeParallelDSM(parallelContext);
+
+	shared = shm_toc_allocate(parallelContext->toc, sharedSize);
+	shared->relationId = relationId;
+	shared->firstSegmentIndex = CStoreReadSegmentCount(cstoreFdwOptions->filename);
+	shared->chunkCount = chunkCount;
+	memcpy(shared->chunkArray, chunkArray, chunkCount * sizeof(ParallelCopyChunk));
+	shm_toc_insert(parallelContext->toc, PARALLEL_COPY_KEY_SHARED, shared);
+
+	sharedStatement = shm_toc_allocate(parallelContext->toc,
+									   strlen(serializedStatement) + 1);
+	strcpy(sharedStatement, serializedStatement);
+	shm_toc_insert(parallelContext->toc, PARALLEL_COPY_KEY_STATEMENT, sharedStatement);
+
+	/* remove footers that an earlier failed load may have left in new segments */
+	for (chunkIndex = 0; chunkIndex < chunkCount; chunkIndex++)
+	{
+		RemoveSegmentFooter(cstoreFdwOptions->filename,
+							shared->firstSegmentIndex + chunkIndex);
 	}
 
-	return droppedCStoreFileList;
-}
+	LaunchParallelWorkers(parallelContext);
 
+	/* the leader loads the last chunk while workers load theirs */
+	CopyChunkIntoSegment(relation, shared, chunkCount - 1, copyStatement->filename,
+						 copyStatement->attlist, copyStatement->options);
 
-/* FindCStoreTables returns list of CStore tables from given table list */
-static List *
-FindCStoreTables(List *tableList)
-{
-	List *cstoreTableList = NIL;
-	ListCell *relationCell = NULL;
-	foreach(relationCell, tableList)
+	WaitForParallelWorkersToFinish(parallelContext);
+
+	/* load the chunks of workers that couldn't be launched */
+	for (chunkIndex = parallelContext->nworkers_launched; chunkIndex < chunkCount - 1;
+		 chunkIndex++)
 	{
-		RangeVar *rangeVar = (RangeVar *) lfirst(relationCell);
-		Oid relationId = RangeVarGetRelid(rangeVar, AccessShareLock, true);
-		if (CStoreTable(relationId) && !DistributedTable(relationId))
-		{
-			cstoreTableList = lappend(cstoreTableList, rangeVar);
-		}
+		CopyChunkIntoSegment(relation, shared, chunkIndex, copyStatement->filename,
+							 copyStatement->attlist, copyStatement->options);
 	}
 
-	return cstoreTableList;
+	for (chunkIndex = 0; chunkIndex < chunkCount; chunkIndex++)
+	{
+		processedRowCount += shared->chunkArray[chunkIndex].processedRowCount;
+	}
+
+	CStoreWriteSegmentCount(cstoreFdwOptions->filename,
+							shared->firstSegmentIndex + chunkCount);
+
+	DestroyParallelContext(parallelContext);
+	ExitParallelMode();
+
+	UnlockRelationForExtension(relation, ExclusiveLock);
+
+	return processedRowCount;
 }
 
 
 /*
- * OpenRelationsForTruncate opens and locks relations for tables to be truncated.
- *
- * It also performs a permission checks to see if the user has truncate privilege
- * on tables.
+ * ParallelCopyWorkerMain is the entry point of parallel COPY workers. Each worker
+ * loads the chunk of the input file that matches its worker number.
  */
-static List *
-OpenRelationsForTruncate(List *cstoreTableList)
+void
+ParallelCopyWorkerMain(dsm_segment *segment, shm_toc *toc)
 {
-	ListCell *relationCell = NULL;
-	List *relationIdList = NIL;
-	List *relationList = NIL;
-	foreach(relationCell, cstoreTableList)
+	ParallelCopyShared *shared = NULL;
+	char *serializedStatement = NULL;
+	List *statementList = NIL;
+	List *serializedOptionList = NIL;
+	List *copyOptionList = NIL;
+	ListCell *optionCell = NULL;
+	char *inputFilename = NULL;
+	List *attributeList = NIL;
+	Relation relation = NULL;
+
+	shared = shm_toc_lookup(toc, PARALLEL_COPY_KEY_SHARED, false);
+	serializedStatement = shm_toc_lookup(toc, PARALLEL_COPY_KEY_STATEMENT, false);
+
+	statementList = (List *) stringToNode(serializedStatement);
+	inputFilename = strVal(linitial(statementList));
+	attributeList = (List *) lsecond(statementList);
+	serializedOptionList = (List *) lthird(statementList);
+
+	foreach(optionCell, serializedOptionList)
 	{
-		RangeVar *rangeVar = (RangeVar *) lfirst(relationCell);
-		Relation relation = heap_openrv(rangeVar, AccessExclusiveLock);
-		Oid relationId = relation->rd_id;
-		AclResult aclresult = pg_class_aclcheck(relationId, GetUserId(),
-											   ACL_TRUNCATE);
-		if (aclresult != ACLCHECK_OK)
+		List *serializedOption = (List *) lfirst(optionCell);
+		char *optionName = strVal(linitial(serializedOption));
+		Node *optionArg = (Node *) lsecond(serializedOption);
+
+		copyOptionList = lappend(copyOptionList, makeDefElem(optionName, optionArg, -1));
+	}
+
+	relation = heap_open(shared->relationId, RowExclusiveLock);
+
+	CopyChunkIntoSegment(relation, shared, ParallelWorkerNumber, inputFilename,
+						 attributeList, copyOptionList);
+
+	heap_close(relation, RowExclusiveLock);
+}
+
+
+/*
+ * FindCopyChunkBounds splits the given COPY input file into chunks of about the
+ * same size, and writes their byte ranges into the given chunk array. Chunks must
+ * start at row boundaries, so we find them in one sequential pass over the file.
+ * A newline in a quoted csv value or after a backslash in text format doesn't end
+ * a row, so we track quotes and escapes on the way. We also stop at the end of
+ * data marker, since COPY ignores everything after it.
+ */
+static void
+FindCopyChunkBounds(const char *inputFilename, List *copyOptionList,
+					ParallelCopyChunk *chunkArray, uint32 chunkCount)
+{
+	FILE *inputFile = NULL;
+	struct stat statBuffer;
+	char *readBuffer = palloc(PARALLEL_COPY_READ_BUFFER_SIZE);
+	size_t readSize = 0;
+	uint64 fileOffset = 0;
+	uint64 lineStartOffset = 0;
+	uint64 dataEndOffset = 0;
+	uint32 chunkIndex = 1;
+	char lineHead[3] = { '\0', '\0', '\0' };
+	bool csvFormat = false;
+	char quoteChar = '"';
+	char escapeChar = '\0';
+	bool inQuote = false;
+	bool escaped = false;
+	bool dataEndFound = false;
+	ListCell *optionCell = NULL;
+
+	foreach(optionCell, copyOptionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
+
+		if (strcmp(option->defname, "format") == 0)
 		{
-			aclcheck_error(aclresult, ACLCHECK_OBJECT_TABLE, get_rel_name(relationId));
+			csvFormat = (strcmp(defGetString(option), "csv") == 0);
 		}
-
-		/* check if this relation is repeated */
-		if (list_member_oid(relationIdList, relationId))
+		else if (strcmp(option->defname, "quote") == 0)
 		{
-			heap_close(relation, AccessExclusiveLock);
+			quoteChar = defGetString(option)[0];
 		}
-		else
+		else if (strcmp(option->defname, "escape") == 0)
 		{
-			relationIdList = lappend_oid(relationIdList, relationId);
-			relationList = lappend(relationList, relation);
+			escapeChar = defGetString(option)[0];
 		}
 	}
 
-	return relationList;
-}
+	if (escapeChar == '\0')
+	{
+		escapeChar = quoteChar;
+	}
 
+	inputFile = AllocateFile(inputFilename, PG_BINARY_R);
+	if (inputFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for reading: %m",
+							   inputFilename)));
+	}
 
-/* TruncateCStoreTable truncates given cstore tables */
-static void
-TruncateCStoreTables(List *cstoreRelationList)
-{
-	ListCell *relationCell = NULL;
-	foreach(relationCell, cstoreRelationList)
+	if (fstat(fileno(inputFile), &statBuffer) != 0)
 	{
-		Relation relation = (Relation) lfirst(relationCell);
-		Oid relationId = relation->rd_id;
-		CStoreFdwOptions *cstoreFdwOptions = NULL;
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not stat file \"%s\": %m", inputFilename)));
+	}
 
-		Assert(CStoreTable(relationId));
+	while (!dataEndFound &&
+		   (readSize = fread(readBuffer, 1, PARALLEL_COPY_READ_BUFFER_SIZE,
+							 inputFile)) > 0)
+	{
+		size_t bufferIndex = 0;
 
-		cstoreFdwOptions = CStoreGetOptions(relationId);
-		DeleteCStoreTableFiles(cstoreFdwOptions->filename);
-		InitializeCStoreTableFile(relationId, relation);
-	}
-}
+		for (bufferIndex = 0; bufferIndex < readSize; bufferIndex++)
+		{
+			char byte = readBuffer[bufferIndex];
+			uint64 byteOffset = fileOffset + bufferIndex;
+			uint64 lineLength = byteOffset - lineStartOffset;
+			uint64 rowEndOffset = 0;
 
+			if (lineLength < 3)
+			{
+				lineHead[lineLength] = byte;
+			}
 
-/*
- * DeleteCStoreTableFiles deletes the data and footer files for a cstore table
- * whose data filename is given.
- */
-static void
-DeleteCStoreTableFiles(char *filename)
-{
-	int dataFileRemoved = 0;
-	int footerFileRemoved = 0;
+			if (escaped)
+			{
+				escaped = false;
+				continue;
+			}
 
-	StringInfo tableFooterFilename = makeStringInfo();
-	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+			if (csvFormat && inQuote)
+			{
+				if (byte == escapeChar && escapeChar != quoteChar)
+				{
+					escaped = true;
+				}
+				else if (byte == quoteChar)
+				{
+					inQuote = false;
+				}
+
+				continue;
+			}
+			else if (csvFormat && byte == quoteChar)
+			{
+				inQuote = true;
+				continue;
+			}
+			else if (!csvFormat && byte == '\\')
+			{
+				escaped = true;
+				continue;
+			}
+
+			if (byte != '\n')
+			{
+				continue;
+			}
+
+			/* the end of data marker is a line with only "\." on it */
+			if (lineHead[0] == '\\' && lineHead[1] == '.' &&
+				(lineLength == 2 || (lineLength == 3 && lineHead[2] == '\r')))
+			{
+				dataEndOffset = lineStartOffset;
+				dataEndFound = true;
+				break;
+			}
+
+			rowEndOffset = byteOffset + 1;
+			lineStartOffset = rowEndOffset;
 
-	/* delete the footer file */
-	footerFileRemoved = unlink(tableFooterFilename->data);
-	if (footerFileRemoved != 0)
+			while (chunkIndex < chunkCount &&
+				   rowEndOffset >= (uint64) statBuffer.st_size * chunkIndex / chunkCount)
+			{
+				chunkArray[chunkIndex].startOffset = rowEndOffset;
+				chunkIndex++;
+			}
+		}
+
+		fileOffset += readSize;
+	}
+
+	if (ferror(inputFile))
 	{
-		ereport(WARNING, (errcode_for_file_access(),
-						  errmsg("could not delete file \"%s\": %m",
-								 tableFooterFilename->data)));
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read file \"%s\": %m", inputFilename)));
 	}
 
-	/* delete the data file */
-	dataFileRemoved = unlink(filename);
-	if (dataFileRemoved != 0)
+	if (!dataEndFound)
 	{
-		ereport(WARNING, (errcode_for_file_access(),
-						  errmsg("could not delete file \"%s\": %m",
-								 filename)));
+		dataEndOffset = fileOffset;
+	}
+
+	/* chunks that start after the last row boundary are empty */
+	for (; chunkIndex < chunkCount; chunkIndex++)
+	{
+		chunkArray[chunkIndex].startOffset = dataEndOffset;
+	}
+
+	chunkArray[0].startOffset = 0;
+	for (chunkIndex = 0; chunkIndex < chunkCount - 1; chunkIndex++)
+	{
+		chunkArray[chunkIndex].endOffset = chunkArray[chunkIndex + 1].startOffset;
 	}
+
+	chunkArray[chunkCount - 1].endOffset = dataEndOffset;
+
+	FreeFile(inputFile);
+	pfree(readBuffer);
 }
 
 
 /*
- * InitializeCStoreTableFile creates data and footer file for a cstore table.
- * The function assumes data and footer files do not exist, therefore
- * it should be called on empty or non-existing table. Notice that the caller
- * is expected to acquire AccessExclusiveLock on the relation.
+ * CopyChunkIntoSegment parses the rows in the given chunk of the COPY input file,
+ * and writes them to the chunk's segment file of the cstore table. Only the first
+ * chunk has the csv header line, so we drop the header option for other chunks.
+ * The function records and returns the number of copied rows.
  */
-static void InitializeCStoreTableFile(Oid relationId, Relation relation)
+static uint64
+CopyChunkIntoSegment(Relation relation, ParallelCopyShared *shared, uint32 chunkIndex,
+					 const char *inputFilename, List *attributeList,
+					 List *copyOptionList)
 {
-	TableWriteState *writeState = NULL;
+	ParallelCopyChunk *chunk = &shared->chunkArray[chunkIndex];
+	uint32 segmentIndex = shared->firstSegmentIndex + chunkIndex;
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(RelationGetRelid(relation));
 	TupleDesc tupleDescriptor = RelationGetDescr(relation);
-	CStoreFdwOptions* cstoreFdwOptions = CStoreGetOptions(relationId);
+	uint32 columnCount = tupleDescriptor->natts;
+	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	List *chunkOptionList = NIL;
+	ListCell *optionCell = NULL;
+	ParseState *pstate = NULL;
+	CopyState copyState = NULL;
+	TableWriteState *writeState = NULL;
+	MemoryContext tupleContext = NULL;
+	bool nextRowFound = true;
+	uint64 processedRowCount = 0;
+	int seekResult = 0;
 
-	/*
-	 * Initialize state to write to the cstore file. This creates an
-	 * empty data file and a valid footer file for the table.
-	 */
-	writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
-			cstoreFdwOptions->compressionType, cstoreFdwOptions->stripeRowCount,
-			cstoreFdwOptions->blockRowCount, tupleDescriptor);
-	CStoreEndWrite(writeState);
-}
+	foreach(optionCell, copyOptionList)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
 
+		if (chunkIndex > 0 && strcmp(option->defname, "header") == 0)
+		{
+			continue;
+		}
 
+		chunkOptionList = lappend(chunkOptionList, option);
+	}
 
-/*
- * CStoreTable checks if the given table name belongs to a foreign columnar store
- * table. If it does, the function returns true. Otherwise, it returns false.
- */
-static bool
-CStoreTable(Oid relationId)
-{
-	bool cstoreTable = false;
-	char relationKind = 0;
+	CopyChunkFile = AllocateFile(inputFilename, PG_BINARY_R);
+	if (CopyChunkFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for reading: %m",
+							   inputFilename)));
+	}
 
-	if (relationId == InvalidOid)
+	errno = 0;
+	seekResult = fseeko(CopyChunkFile, (off_t) chunk->startOffset, SEEK_SET);
+	if (seekResult != 0)
 	{
-		return false;
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not seek in file \"%s\": %m", inputFilename)));
 	}
 
-	relationKind = get_rel_relkind(relationId);
-	if (relationKind == RELKIND_FOREIGN_TABLE)
+	CopyChunkBytesLeft = chunk->endOffset - chunk->startOffset;
+
+	tupleContext = AllocSetContextCreate(CurrentMemoryContext,
+										 "CStore COPY Row Memory Context",
+										 ALLOCSET_DEFAULT_SIZES);
+
+	pstate = make_parsestate(NULL);
+	copyState = BeginCopyFrom(pstate, relation, NULL, false, ReadCopyChunkData,
+							  attributeList, chunkOptionList);
+	free_parsestate(pstate);
+
+	writeState = CStoreBeginWrite(CStoreSegmentFilename(cstoreFdwOptions->filename,
+														segmentIndex),
+								  cstoreFdwOptions->compressionType,
+								  cstoreFdwOptions->stripeRowCount,
+								  cstoreFdwOptions->blockRowCount,
+								  cstoreFdwOptions->indexColumnIndex,
+								  cstoreFdwOptions->maxSkipValueLengthArray,
+								  tupleDescriptor);
+
+	while (nextRowFound)
 	{
-		ForeignTable *foreignTable = GetForeignTable(relationId);
-		ForeignServer *server = GetForeignServer(foreignTable->serverid);
-		if (CStoreServer(server))
+		MemoryContext oldContext = MemoryContextSwitchTo(tupleContext);
+#if PG_VERSION_NUM >= 120000
+		nextRowFound = NextCopyFrom(copyState, NULL, columnValues, columnNulls);
+#else
+		nextRowFound = NextCopyFrom(copyState, NULL, columnValues, columnNulls, NULL);
+#endif
+		MemoryContextSwitchTo(oldContext);
+
+		if (nextRowFound)
 		{
-			cstoreTable = true;
+			CStoreWriteRow(writeState, columnValues, columnNulls);
+			processedRowCount++;
 		}
+
+		MemoryContextReset(tupleContext);
+
+		CHECK_FOR_INTERRUPTS();
 	}
 
-	return cstoreTable;
+	EndCopyFrom(copyState);
+	CStoreEndWrite(writeState);
+
+	FreeFile(CopyChunkFile);
+	CopyChunkFile = NULL;
+	MemoryContextDelete(tupleContext);
+
+	chunk->processedRowCount = processedRowCount;
+
+	return processedRowCount;
 }
 
 
 /*
- * CStoreServer checks if the given foreign server belongs to cstore_fdw. If it
- * does, the function returns true. Otherwise, it returns false.
+ * ReadCopyChunkData is the COPY data source callback for parallel COPY. It reads
+ * at most the given number of bytes from the current chunk of the input file,
+ * and returns the number of bytes read, or 0 at the end of the chunk.
  */
-static bool
-CStoreServer(ForeignServer *server)
+static int
+ReadCopyChunkData(void *outputBuffer, int minReadSize, int maxReadSize)
 {
-	ForeignDataWrapper *foreignDataWrapper = GetForeignDataWrapper(server->fdwid);
-	bool cstoreServer = false;
+	size_t readSize = Min((uint64) maxReadSize, CopyChunkBytesLeft);
+	size_t bytesRead = 0;
 
-	char *foreignWrapperName = foreignDataWrapper->fdwname;
-	if (strncmp(foreignWrapperName, CSTORE_FDW_NAME, NAMEDATALEN) == 0)
+	if (readSize == 0)
 	{
-		cstoreServer = true;
+		return 0;
 	}
 
-	return cstoreServer;
+	bytesRead = fread(outputBuffer, 1, readSize, CopyChunkFile);
+	if (ferror(CopyChunkFile))
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read COPY input file: %m")));
+	}
+
+	CopyChunkBytesLeft -= bytesRead;
+
+	return (int) bytesRead;
 }
 
+#endif
+
 
 /*
- * DistributedTable checks if the given relationId is the OID of a distributed table,
- * which may also be a cstore_fdw table, but in that case COPY should be handled by
- * Citus.
+ * CopyOutCStoreTable handles a "COPY cstore_table TO ..." statement. When we
+ * support the statement's destination and options, we format rows straight from
+ * decoded column blocks. Otherwise, the statement is converted to "COPY (SELECT
+ * <columns> FROM cstore_table) TO ..." and forwarded to postgres native COPY
+ * handler. Function returns number of rows copied to external stream.
  */
-static bool
-DistributedTable(Oid relationId)
+static uint64
+CopyOutCStoreTable(CopyStmt* copyStatement, const char* queryString)
 {
-	bool distributedTable = false;
-	Oid partitionOid = InvalidOid;
-	Relation heapRelation = NULL;
-	TableScanDesc scanDesc = NULL;
-	const int scanKeyCount = 1;
-	ScanKeyData scanKey[1];
-	HeapTuple heapTuple = NULL;
-
-	bool missingOK = true;
-	Oid extensionOid = get_extension_oid(CITUS_EXTENSION_NAME, missingOK);
-	if (extensionOid == InvalidOid)
-	{
-		/* if the citus extension isn't created, no tables are distributed */
-		return false;
-	}
-
-	partitionOid = get_relname_relid(CITUS_PARTITION_TABLE_NAME, PG_CATALOG_NAMESPACE);
-	if (partitionOid == InvalidOid)
-	{
-		/* the pg_dist_partition table does not exist */
-		return false;
-	}
+	uint64 processedCount = 0;
+	RangeVar *relation = NULL;
+	Relation cstoreRelation = NULL;
+	CStoreCopyOutState *copyOutState = NULL;
+	char *qualifiedName = NULL;
+	List *queryList = NIL;
+	Node *rawQuery = NULL;
+	ListCell *columnNameCell = NULL;
 
-	heapRelation = heap_open(partitionOid, AccessShareLock);
+	StringInfo newQuerySubstring = makeStringInfo();
 
-	ScanKeyInit(&scanKey[0], ATTR_NUM_PARTITION_RELATION_ID, InvalidStrategy,
-				F_OIDEQ, ObjectIdGetDatum(relationId));
+	/* Only superuser can copy from or to local file */
+	CheckSuperuserPrivilegesForCopy(copyStatement);
 
-	scanDesc = table_beginscan(heapRelation, SnapshotSelf, scanKeyCount, scanKey);
+	cstoreRelation = heap_openrv(copyStatement->relation, AccessShareLock);
+	copyOutState = BeginNativeCopyOut(copyStatement, cstoreRelation);
+	if (copyOutState != NULL)
+	{
+		processedCount = NativeCopyOutCStoreTable(copyOutState, cstoreRelation);
+		heap_close(cstoreRelation, AccessShareLock);
 
-	heapTuple = heap_getnext(scanDesc, ForwardScanDirection);
+		return processedCount;
+	}
 
-	distributedTable = HeapTupleIsValid(heapTuple);
+	heap_close(cstoreRelation, AccessShareLock);
 
-	table_endscan(scanDesc);
-	relation_close(heapRelation, AccessShareLock);
+	relation = copyStatement->relation;
+	qualifiedName = quote_qualified_identifier(relation->schemaname,
+											   relation->relname);
 
-	return distributedTable;
-}
+	appendStringInfoString(newQuerySubstring, "select ");
+	if (copyStatement->attlist == NIL)
+	{
+		appendStringInfoString(newQuerySubstring, "*");
+	}
 
+	foreach(columnNameCell, copyStatement->attlist)
+	{
+		char *columnName = strVal(lfirst(columnNameCell));
 
-/*
- * DistributedWorkerCopy returns whether the Citus-specific master_host option is
- * present in the COPY options.
- */
-static bool
-DistributedWorkerCopy(CopyStmt *copyStatement)
-{
-    ListCell *optionCell = NULL;
-    foreach(optionCell, copyStatement->options)
-    {
-        DefElem *defel = (DefElem *) lfirst(optionCell);
-        if (strncmp(defel->defname, "master_host", NAMEDATALEN) == 0)
-        {
-            return true;
-        }
-    }
+		if (columnNameCell != list_head(copyStatement->attlist))
+		{
+			appendStringInfoString(newQuerySubstring, ", ");
+		}
 
-    return false;
-}
+		appendStringInfoString(newQuerySubstring, quote_identifier(columnName));
+	}
 
+	appendStringInfo(newQuerySubstring, " from %s", qualifiedName);
+	queryList = raw_parser(newQuerySubstring->data);
 
-/*
- * CreateCStoreDatabaseDirectory creates the directory (and parent directories,
- * if needed) used to store automatically managed cstore_fdw files. The path to
- * the directory is $PGDATA/cstore_fdw/{databaseOid}.
- */
-static void
-CreateCStoreDatabaseDirectory(Oid databaseOid)
-{
-	bool cstoreDirectoryExists = false;
-	bool databaseDirectoryExists = false;
-	StringInfo cstoreDatabaseDirectoryPath = NULL;
+	/* take the first parse tree */
+	rawQuery = linitial(queryList);
 
-	StringInfo cstoreDirectoryPath = makeStringInfo();
-	appendStringInfo(cstoreDirectoryPath, "%s/%s", DataDir, CSTORE_FDW_NAME);
+	/*
+	 * Set the relation and column list fields to NULL so that COPY command
+	 * works on query field instead.
+	 */
+	copyStatement->relation = NULL;
+	copyStatement->attlist = NIL;
 
-	cstoreDirectoryExists = DirectoryExists(cstoreDirectoryPath);
-	if (!cstoreDirectoryExists)
+#if (PG_VERSION_NUM >= 100000)
+	/*
+	 * raw_parser returns list of RawStmt* in PG 10+ we need to
+	 * extract actual query from it.
+	 */
 	{
-		CreateDirectory(cstoreDirectoryPath);
-	}
+		ParseState *pstate = make_parsestate(NULL);
+		RawStmt *rawStatement = (RawStmt *) rawQuery;
 
-	cstoreDatabaseDirectoryPath = makeStringInfo();
-	appendStringInfo(cstoreDatabaseDirectoryPath, "%s/%s/%u", DataDir,
-					 CSTORE_FDW_NAME, databaseOid);
+		pstate->p_sourcetext = newQuerySubstring->data;
+		copyStatement->query = rawStatement->stmt;
 
-	databaseDirectoryExists = DirectoryExists(cstoreDatabaseDirectoryPath);
-	if (!databaseDirectoryExists)
-	{
-		CreateDirectory(cstoreDatabaseDirectoryPath);
+		DoCopy(pstate, copyStatement, -1, -1, &processedCount);
+		free_parsestate(pstate);
 	}
+#else
+	copyStatement->query = rawQuery;
+
+	DoCopy(copyStatement, queryString, &processedCount);
+#endif
+
+	return processedCount;
 }
 
 
-/* DirectoryExists checks if a directory exists for the given directory name. */
-static bool
-DirectoryExists(StringInfo directoryName)
+/*
+ * CopyAttributeNumberList returns the attribute numbers of the columns in the
+ * given COPY column list, or of all columns if the list is empty.
+ */
+static List *
+CopyAttributeNumberList(Relation relation, List *attributeNameList)
 {
-	bool directoryExists = true;
-	struct stat directoryStat;
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	uint32 columnCount = tupleDescriptor->natts;
+	List *attributeNumberList = NIL;
+	ListCell *columnNameCell = NULL;
 
-	int statOK = stat(directoryName->data, &directoryStat);
-	if (statOK == 0)
+	if (attributeNameList == NIL)
 	{
-		/* file already exists; check that it is a directory */
-		if (!S_ISDIR(directoryStat.st_mode))
+		uint32 columnIndex = 0;
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 		{
-			ereport(ERROR, (errmsg("\"%s\" is not a directory", directoryName->data),
-							errhint("You need to remove or rename the file \"%s\".",
-									directoryName->data)));
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+															columnIndex);
+			if (!attributeForm->attisdropped)
+			{
+				attributeNumberList = lappend_int(attributeNumberList,
+												  columnIndex + 1);
+			}
 		}
 	}
-	else
+
+	foreach(columnNameCell, attributeNameList)
 	{
-		if (errno == ENOENT)
+		char *columnName = strVal(lfirst(columnNameCell));
+		AttrNumber attributeNumber = InvalidAttrNumber;
+		uint32 columnIndex = 0;
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 		{
-			directoryExists = false;
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+															columnIndex);
+			if (!attributeForm->attisdropped &&
+				namestrcmp(&(attributeForm->attname), columnName) == 0)
+			{
+				attributeNumber = columnIndex + 1;
+				break;
+			}
 		}
-		else
+
+		if (attributeNumber == InvalidAttrNumber)
 		{
-			ereport(ERROR, (errcode_for_file_access(),
-							errmsg("could not stat directory \"%s\": %m",
-								   directoryName->data)));
+			ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+							errmsg("column \"%s\" of relation \"%s\" does not exist",
+								   columnName, RelationGetRelationName(relation))));
 		}
-	}
-
-	return directoryExists;
-}
 
+		if (list_member_int(attributeNumberList, attributeNumber))
+		{
+			ereport(ERROR, (errcode(ERRCODE_DUPLICATE_COLUMN),
+							errmsg("column \"%s\" specified more than once",
+								   columnName)));
+		}
 
-/* CreateDirectory creates a new directory with the given directory name. */
-static void
-CreateDirectory(StringInfo directoryName)
-{
-	int makeOK = mkdir(directoryName->data, S_IRWXU);
-	if (makeOK != 0)
-	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not create directory \"%s\": %m",
-							   directoryName->data)));
+		attributeNumberList = lappend_int(attributeNumberList, attributeNumber);
 	}
+
+	return attributeNumberList;
 }
 
 
 /*
- * RemoveCStoreDatabaseDirectory removes CStore directory previously
- * created for this database.
- * However it does not remove 'cstore_fdw' directory even if there
- * are no other databases left.
+ * BeginNativeCopyOut checks whether we can export the cstore table of the given
+ * "COPY cstore_table TO" statement by formatting rows straight from decoded
+ * column blocks. If so, the function opens the copy destination and returns the
+ * state for the export. Otherwise, it returns NULL and we let PostgreSQL's COPY
+ * handle the statement; this covers programs, row level security, and options
+ * that are unknown, repeated or invalid, so that COPY reports the usual errors.
  */
-static void
-RemoveCStoreDatabaseDirectory(Oid databaseOid)
+static CStoreCopyOutState *
+BeginNativeCopyOut(const CopyStmt *copyStatement, Relation relation)
 {
-	StringInfo cstoreDirectoryPath = makeStringInfo();
-	StringInfo cstoreDatabaseDirectoryPath = makeStringInfo();
+	Oid relationId = RelationGetRelid(relation);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	uint32 columnCount = tupleDescriptor->natts;
+	CStoreCopyOutState *copyOutState = NULL;
+	char *formatName = NULL;
+	char *delimiterString = NULL;
+	char *nullString = NULL;
+	char *quoteString = NULL;
+	char *escapeString = NULL;
+	char *encodingName = NULL;
+	bool csvMode = false;
+	bool binary = false;
+	bool arrow = false;
+	bool header = false;
+	bool headerFound = false;
+	bool forceQuoteFound = false;
+	bool forceQuoteAll = false;
+	List *forceQuoteList = NIL;
+	List *attributeNumberList = NIL;
+	bool *forceQuoteArray = NULL;
+	FmgrInfo *outputFunctionArray = NULL;
+	int fileEncoding = -1;
+	AclResult aclResult = ACLCHECK_OK;
+	ListCell *optionCell = NULL;
+	ListCell *attributeNumberCell = NULL;
+	ListCell *columnNameCell = NULL;
 
-	appendStringInfo(cstoreDirectoryPath, "%s/%s", DataDir, CSTORE_FDW_NAME);
+	if (copyStatement->is_program)
+	{
+		return NULL;
+	}
 
-	appendStringInfo(cstoreDatabaseDirectoryPath, "%s/%s/%u", DataDir,
-					 CSTORE_FDW_NAME, databaseOid);
+	if (copyStatement->filename == NULL &&
+		(whereToSendOutput != DestRemote || PG_PROTOCOL_MAJOR(FrontendProtocol) < 3))
+	{
+		return NULL;
+	}
 
-	if (DirectoryExists(cstoreDatabaseDirectoryPath))
+	if (check_enable_rls(relationId, InvalidOid, false) == RLS_ENABLED)
 	{
-		rmtree(cstoreDatabaseDirectoryPath->data, true);
+		return NULL;
 	}
-}
 
+	foreach(optionCell, copyStatement->options)
+	{
+		DefElem *option = (DefElem *) lfirst(optionCell);
 
-/*
- * cstore_table_size returns the total on-disk size of a cstore table in bytes.
- * The result includes the sizes of data file and footer file.
- */
-Datum
-cstore_table_size(PG_FUNCTION_ARGS)
-{
-	Oid relationId = PG_GETARG_OID(0);
+		if (strcmp(option->defname, "format") == 0 && formatName == NULL)
+		{
+			formatName = defGetString(option);
+		}
+		else if (strcmp(option->defname, "delimiter") == 0 && delimiterString == NULL)
+		{
+			delimiterString = defGetString(option);
+		}
+		else if (strcmp(option->defname, "null") == 0 && nullString == NULL)
+		{
+			nullString = defGetString(option);
+		}
+		else if (strcmp(option->defname, "header") == 0 && !headerFound)
+		{
+			header = defGetBoolean(option);
+			headerFound = true;
+		}
+		else if (strcmp(option->defname, "quote") == 0 && quoteString == NULL)
+		{
+			quoteString = defGetString(option);
+		}
+		else if (strcmp(option->defname, "escape") == 0 && escapeString == NULL)
+		{
+			escapeString = defGetString(option);
+		}
+		else if (strcmp(option->defname, "force_quote") == 0 && !forceQuoteFound)
+		{
+			if (option->arg != NULL && IsA(option->arg, A_Star))
+			{
+				forceQuoteAll = true;
+			}
+			else if (option->arg != NULL && IsA(option->arg, List))
+			{
+				forceQuoteList = (List *) option->arg;
+			}
+			else
+			{
+				return NULL;
+			}
 
-	int64 tableSize = 0;
-	CStoreFdwOptions *cstoreFdwOptions = NULL;
-	char *dataFilename = NULL;
-	StringInfo footerFilename = NULL;
-	int dataFileStatResult = 0;
-	int footerFileStatResult = 0;
-	struct stat dataFileStatBuffer;
-	struct stat footerFileStatBuffer;
+			forceQuoteFound = true;
+		}
+		else if (strcmp(option->defname, "encoding") == 0 && encodingName == NULL)
+		{
+			encodingName = defGetString(option);
+		}
+		else
+		{
+			return NULL;
+		}
+	}
 
-	bool cstoreTable = CStoreTable(relationId);
-	if (!cstoreTable)
+	if (formatName == NULL || strcmp(formatName, "text") == 0)
 	{
-		ereport(ERROR, (errmsg("relation is not a cstore table")));
+		csvMode = false;
+	}
+	else if (strcmp(formatName, "csv") == 0)
+	{
+		csvMode = true;
+	}
+	else if (strcmp(formatName, "binary") == 0)
+	{
+		binary = true;
+	}
+	else if (strcmp(formatName, "arrow") == 0)
+	{
+		arrow = true;
+	}
+	else
+	{
+		return NULL;
 	}
 
-	cstoreFdwOptions = CStoreGetOptions(relationId);
-	dataFilename = cstoreFdwOptions->filename;
+	/* PostgreSQL's COPY doesn't know the arrow format, so we report errors */
+	if (arrow && (delimiterString != NULL || nullString != NULL || headerFound ||
+				  quoteString != NULL || escapeString != NULL || forceQuoteFound ||
+				  encodingName != NULL))
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("COPY options other than FORMAT are not supported "
+							   "in arrow format")));
+	}
 
-	dataFileStatResult = stat(dataFilename, &dataFileStatBuffer);
-	if (dataFileStatResult != 0)
+	if (binary && (delimiterString != NULL || nullString != NULL || headerFound))
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not stat file \"%s\": %m", dataFilename)));
+		return NULL;
 	}
 
-	footerFilename = makeStringInfo();
-	appendStringInfo(footerFilename, "%s%s", dataFilename,
-					 CSTORE_FOOTER_FILE_SUFFIX);
+	if (!csvMode && (header || quoteString != NULL || escapeString != NULL ||
+					 forceQuoteFound))
+	{
+		return NULL;
+	}
 
-	footerFileStatResult = stat(footerFilename->data, &footerFileStatBuffer);
-	if (footerFileStatResult != 0)
+	/* fill in defaults, and check the remaining cases that COPY rejects */
+	if (delimiterString == NULL)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not stat file \"%s\": %m",
-								footerFilename->data)));
+		delimiterString = csvMode ? "," : "\t";
 	}
 
-	tableSize += dataFileStatBuffer.st_size;
-	tableSize += footerFileStatBuffer.st_size;
+	if (nullString == NULL)
+	{
+		nullString = csvMode ? "" : "\\N";
+	}
 
-	PG_RETURN_INT64(tableSize);
-}
+	if (quoteString == NULL)
+	{
+		quoteString = "\"";
+	}
 
+	if (escapeString == NULL)
+	{
+		escapeString = quoteString;
+	}
 
-/*
- * cstore_fdw_handler creates and returns a struct with pointers to foreign
- * table callback functions.
- */
-Datum
-cstore_fdw_handler(PG_FUNCTION_ARGS)
-{
-	FdwRoutine *fdwRoutine = makeNode(FdwRoutine);
+	if (strlen(delimiterString) != 1 || strlen(quoteString) != 1 ||
+		strlen(escapeString) != 1)
+	{
+		return NULL;
+	}
 
-	fdwRoutine->GetForeignRelSize = CStoreGetForeignRelSize;
-	fdwRoutine->GetForeignPaths = CStoreGetForeignPaths;
-	fdwRoutine->GetForeignPlan = CStoreGetForeignPlan;
-	fdwRoutine->ExplainForeignScan = CStoreExplainForeignScan;
-	fdwRoutine->BeginForeignScan = CStoreBeginForeignScan;
-	fdwRoutine->IterateForeignScan = CStoreIterateForeignScan;
-	fdwRoutine->ReScanForeignScan = CStoreReScanForeignScan;
-	fdwRoutine->EndForeignScan = CStoreEndForeignScan;
-	fdwRoutine->AnalyzeForeignTable = CStoreAnalyzeForeignTable;
-	fdwRoutine->PlanForeignModify = CStorePlanForeignModify;
-	fdwRoutine->BeginForeignModify = CStoreBeginForeignModify;
-	fdwRoutine->ExecForeignInsert = CStoreExecForeignInsert;
-	fdwRoutine->EndForeignModify = CStoreEndForeignModify;
+	if (strchr(delimiterString, '\r') != NULL || strchr(delimiterString, '\n') != NULL ||
+		strchr(nullString, '\r') != NULL || strchr(nullString, '\n') != NULL)
+	{
+		return NULL;
+	}
 
-#if PG_VERSION_NUM >= 110000
-	fdwRoutine->BeginForeignInsert = CStoreBeginForeignInsert;
-	fdwRoutine->EndForeignInsert = CStoreEndForeignInsert;
-#endif
+	if (!binary && !arrow && strchr(nullString, delimiterString[0]) != NULL)
+	{
+		return NULL;
+	}
 
-#if PG_VERSION_NUM >= 90600
-	fdwRoutine->IsForeignScanParallelSafe = CStoreIsForeignScanParallelSafe;
-#endif
+	if (!csvMode && strchr("\\.abcdefghijklmnopqrstuvwxyz0123456789",
+						   delimiterString[0]) != NULL)
+	{
+		return NULL;
+	}
 
-	PG_RETURN_POINTER(fdwRoutine);
-}
+	if (csvMode && (delimiterString[0] == quoteString[0] ||
+					strchr(nullString, quoteString[0]) != NULL))
+	{
+		return NULL;
+	}
 
+	/* we escape in the server encoding, so the file encoding must be ASCII safe */
+	if (encodingName != NULL)
+	{
+		fileEncoding = pg_char_to_encoding(encodingName);
+	}
+	else
+	{
+		fileEncoding = pg_get_client_encoding();
+	}
 
-/*
- * cstore_fdw_validator validates options given to one of the following commands:
- * foreign data wrapper, server, user mapping, or foreign table. This function
- * errors out if the given option name or its value is considered invalid.
- */
-Datum
-cstore_fdw_validator(PG_FUNCTION_ARGS)
-{
-	Datum optionArray = PG_GETARG_DATUM(0);
-	Oid optionContextId = PG_GETARG_OID(1);
-	List *optionList = untransformRelOptions(optionArray);
-	ListCell *optionCell = NULL;
-	char *filename = NULL;
-	char *compressionTypeString = NULL;
-	char *stripeRowCountString = NULL;
-	char *blockRowCountString = NULL;
+	if (fileEncoding < 0 || PG_ENCODING_IS_CLIENT_ONLY(fileEncoding))
+	{
+		return NULL;
+	}
 
-	foreach(optionCell, optionList)
+	attributeNumberList = CopyAttributeNumberList(relation, copyStatement->attlist);
+
+	forceQuoteArray = palloc0(columnCount * sizeof(bool));
+	foreach(attributeNumberCell, attributeNumberList)
 	{
-		DefElem *optionDef = (DefElem *) lfirst(optionCell);
-		char *optionName = optionDef->defname;
-		bool optionValid = false;
+		forceQuoteArray[lfirst_int(attributeNumberCell) - 1] = forceQuoteAll;
+	}
 
-		int32 optionIndex = 0;
-		for (optionIndex = 0; optionIndex < ValidOptionCount; optionIndex++)
+	foreach(columnNameCell, forceQuoteList)
+	{
+		char *columnName = strVal(lfirst(columnNameCell));
+		bool columnFound = false;
+
+		foreach(attributeNumberCell, attributeNumberList)
 		{
-			const CStoreValidOption *validOption = &(ValidOptionArray[optionIndex]);
+			AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+															attributeNumber - 1);
 
-			if ((optionContextId == validOption->optionContextId) &&
-				(strncmp(optionName, validOption->optionName, NAMEDATALEN) == 0))
+			if (namestrcmp(&(attributeForm->attname), columnName) == 0)
 			{
-				optionValid = true;
-				break;
+				forceQuoteArray[attributeNumber - 1] = true;
+				columnFound = true;
 			}
 		}
 
-		/* if invalid option, display an informative error message */
-		if (!optionValid)
+		if (!columnFound)
 		{
-			StringInfo optionNamesString = OptionNamesString(optionContextId);
+			return NULL;
+		}
+	}
 
-			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-							errmsg("invalid option \"%s\"", optionName),
-							errhint("Valid options in this context are: %s",
-									optionNamesString->data)));
+	/* the user needs select privilege on the table, or on each exported column */
+	aclResult = pg_class_aclcheck(relationId, GetUserId(), ACL_SELECT);
+	if (aclResult != ACLCHECK_OK)
+	{
+		foreach(attributeNumberCell, attributeNumberList)
+		{
+			AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+			if (pg_attribute_aclcheck(relationId, attributeNumber, GetUserId(),
+									  ACL_SELECT) != ACLCHECK_OK)
+			{
+				aclcheck_error(aclResult, ACLCHECK_OBJECT_TABLE,
+							   RelationGetRelationName(relation));
+			}
 		}
+	}
 
-		if (strncmp(optionName, OPTION_NAME_FILENAME, NAMEDATALEN) == 0)
+	if (arrow)
+	{
+		ArrowCheckColumnTypes(tupleDescriptor, attributeNumberList);
+	}
+
+	/* look up output functions once, instead of for each value */
+	outputFunctionArray = palloc0(columnCount * sizeof(FmgrInfo));
+	foreach(attributeNumberCell, attributeNumberList)
+	{
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+		Oid outputFunctionId = InvalidOid;
+		bool typeVarLength = false;
+
+		if (binary)
 		{
-			filename = defGetString(optionDef);
+			getTypeBinaryOutputInfo(attributeForm->atttypid, &outputFunctionId,
+									&typeVarLength);
 		}
-		else if (strncmp(optionName, OPTION_NAME_COMPRESSION_TYPE, NAMEDATALEN) == 0)
+		else
 		{
-			compressionTypeString = defGetString(optionDef);
+			getTypeOutputInfo(attributeForm->atttypid, &outputFunctionId,
+							  &typeVarLength);
 		}
-		else if (strncmp(optionName, OPTION_NAME_STRIPE_ROW_COUNT, NAMEDATALEN) == 0)
+
+		fmgr_info(outputFunctionId, &outputFunctionArray[attributeNumber - 1]);
+	}
+
+	copyOutState = palloc0(sizeof(CStoreCopyOutState));
+	copyOutState->binary = binary;
+	copyOutState->arrow = arrow;
+	copyOutState->csvMode = csvMode;
+	copyOutState->header = header;
+	copyOutState->delimiter = delimiterString[0];
+	copyOutState->quote = quoteString[0];
+	copyOutState->escape = escapeString[0];
+	copyOutState->nullString = nullString;
+	copyOutState->fileEncoding = fileEncoding;
+	copyOutState->needTranscoding = (fileEncoding != GetDatabaseEncoding());
+	copyOutState->attributeNumberList = attributeNumberList;
+	copyOutState->forceQuoteArray = forceQuoteArray;
+	copyOutState->outputFunctionArray = outputFunctionArray;
+	copyOutState->rowBuffer = makeStringInfo();
+	copyOutState->outputBuffer = makeStringInfo();
+	copyOutState->rowContext = AllocSetContextCreate(CurrentMemoryContext,
+													 "CStore COPY TO Row Memory Context",
+													 ALLOCSET_DEFAULT_SIZES);
+
+	/* open the destination; these checks follow the ones in copy.c */
+	if (copyStatement->filename != NULL)
+	{
+		mode_t oldUmask = 0;
+		struct stat statBuffer;
+
+		if (!is_absolute_path(copyStatement->filename))
 		{
-			stripeRowCountString = defGetString(optionDef);
+			ereport(ERROR, (errcode(ERRCODE_INVALID_NAME),
+							errmsg("relative path not allowed for COPY to file")));
 		}
-		else if (strncmp(optionName, OPTION_NAME_BLOCK_ROW_COUNT, NAMEDATALEN) == 0)
+
+		oldUmask = umask(S_IWGRP | S_IWOTH);
+		copyOutState->copyFile = AllocateFile(copyStatement->filename, PG_BINARY_W);
+		umask(oldUmask);
+
+		if (copyOutState->copyFile == NULL)
 		{
-			blockRowCountString = defGetString(optionDef);
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not open file \"%s\" for writing: %m",
+								   copyStatement->filename)));
 		}
-	}
 
-	if (optionContextId == ForeignTableRelationId)
+		if (fstat(fileno(copyOutState->copyFile), &statBuffer) != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not stat file \"%s\": %m",
+								   copyStatement->filename)));
+		}
+
+		if (S_ISDIR(statBuffer.st_mode))
+		{
+			ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+							errmsg("\"%s\" is a directory", copyStatement->filename)));
+		}
+	}
+	else
 	{
-		ValidateForeignTableOptions(filename, compressionTypeString,
-									stripeRowCountString, blockRowCountString);
+		StringInfoData copyOutResponse;
+		int16 columnFormat = (binary || arrow) ? 1 : 0;
+
+		pq_beginmessage(&copyOutResponse, 'H');
+		pq_sendbyte(&copyOutResponse, columnFormat);
+		pq_sendint(&copyOutResponse, list_length(attributeNumberList), 2);
+		foreach(attributeNumberCell, attributeNumberList)
+		{
+			pq_sendint(&copyOutResponse, columnFormat, 2);
+		}
+		pq_endmessage(&copyOutResponse);
 	}
 
-	PG_RETURN_VOID();
+	return copyOutState;
 }
 
 
 /*
- * cstore_clean_table_resources cleans up table data and metadata with provided
- * relation id. The function is meant to be called from drop_event_trigger. It
- * has no way of knowing if the provided relation id belongs to a cstore table.
- * Therefore it first checks if data file exists at default location before
- * attempting to remove data and footer files. If the table is created at a
- * custom path than its resources would not be removed.
+ * NativeCopyOutCStoreTable exports the cstore table by reading whole column
+ * blocks, and formatting each row from the blocks' decoded values. The function
+ * returns the number of exported rows.
  */
-Datum
-cstore_clean_table_resources(PG_FUNCTION_ARGS)
+static uint64
+NativeCopyOutCStoreTable(CStoreCopyOutState *copyOutState, Relation relation)
 {
-	Oid relationId = PG_GETARG_OID(0);
-	StringInfo filePath = makeStringInfo();
-	struct stat fileStat;
-	int statResult = -1;
-
-	appendStringInfo(filePath, "%s/%s/%d/%d", DataDir, CSTORE_FDW_NAME,
-					 (int) MyDatabaseId, (int) relationId);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(RelationGetRelid(relation));
+	TableReadState *readState = NULL;
+	ColumnBlockData **blockDataArray = NULL;
+	ColumnBlockSkipNode **blockSkipNodeArray = NULL;
+	List *columnList = NIL;
+	ListCell *attributeNumberCell = NULL;
+	uint32 blockRowCount = 0;
+	uint64 processedRowCount = 0;
 
-	/*
-	 * Check to see if the file exist first. This is the only way to
-	 * find out if the table being dropped is a cstore table.
-	 */
-	statResult = stat(filePath->data, &fileStat);
-	if (statResult == 0)
+	foreach(attributeNumberCell, copyOutState->attributeNumberList)
 	{
-		DeleteCStoreTableFiles(filePath->data);
-	}
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+		const Index tableId = 1;
 
-	PG_RETURN_VOID();
-}
+		Var *column = makeVar(tableId, attributeNumber, attributeForm->atttypid,
+							  attributeForm->atttypmod, attributeForm->attcollation, 0);
+		columnList = lappend(columnList, column);
+	}
 
+	readState = CStoreBeginRead(cstoreFdwOptions->filename, tupleDescriptor,
+								columnList, NIL);
 
-/*
- * OptionNamesString finds all options that are valid for the current context,
- * and concatenates these option names in a comma separated string. The function
- * is unchanged from mongo_fdw.
- */
-static StringInfo
-OptionNamesString(Oid currentContextId)
-{
-	StringInfo optionNamesString = makeStringInfo();
-	bool firstOptionAppended = false;
+	if (copyOutState->arrow)
+	{
+		ArrowWriteSchema(copyOutState->outputBuffer, tupleDescriptor,
+						 copyOutState->attributeNumberList);
+	}
+	else
+	{
+		CopyOutHeader(copyOutState, tupleDescriptor);
+	}
 
-	int32 optionIndex = 0;
-	for (optionIndex = 0; optionIndex < ValidOptionCount; optionIndex++)
+	while ((blockRowCount = CStoreReadNextBlock(readState, &blockDataArray,
+												&blockSkipNodeArray)) > 0)
 	{
-		const CStoreValidOption *validOption = &(ValidOptionArray[optionIndex]);
+		uint32 rowIndex = 0;
 
-		/* if option belongs to current context, append option name */
-		if (currentContextId == validOption->optionContextId)
+		/* in arrow format, each block becomes one record batch */
+		if (copyOutState->arrow)
 		{
-			if (firstOptionAppended)
+			ArrowWriteRecordBatch(copyOutState->outputBuffer, tupleDescriptor,
+								  copyOutState->attributeNumberList, blockDataArray,
+								  blockRowCount);
+			if (copyOutState->outputBuffer->len >= COPY_OUT_BUFFER_SIZE)
 			{
-				appendStringInfoString(optionNamesString, ", ");
+				CopyOutFlush(copyOutState);
+			}
+		}
+		else
+		{
+			for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
+			{
+				CopyOutRow(copyOutState, blockDataArray, rowIndex);
 			}
+		}
 
-			appendStringInfoString(optionNamesString, validOption->optionName);
-			firstOptionAppended = true;
+		processedRowCount += blockRowCount;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (copyOutState->binary)
+	{
+		pq_sendint(copyOutState->outputBuffer, -1, 2);
+	}
+	else if (copyOutState->arrow)
+	{
+		ArrowWriteEndOfStream(copyOutState->outputBuffer);
+	}
+
+	CopyOutFlush(copyOutState);
+
+	if (copyOutState->copyFile != NULL)
+	{
+		if (FreeFile(copyOutState->copyFile) != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not close file: %m")));
 		}
 	}
+	else
+	{
+		pq_putemptymessage('c');
+	}
 
-	return optionNamesString;
+	CStoreEndRead(readState);
+	MemoryContextDelete(copyOutState->rowContext);
+
+	return processedRowCount;
 }
 
 
 /*
- * GetSlotHeapTuple abstracts getting HeapTuple from TupleTableSlot between versions
+ * CopyOutHeader writes the file signature in binary format, and the line of
+ * column names in csv format if the user asked for it.
  */
-static HeapTuple
-GetSlotHeapTuple(TupleTableSlot *tts)
+static void
+CopyOutHeader(CStoreCopyOutState *copyOutState, TupleDesc tupleDescriptor)
 {
-#if PG_VERSION_NUM >= 120000
-	return tts->tts_ops->copy_heap_tuple(tts);
-#else
-	return tts->tts_tuple;
-#endif
+	StringInfo rowBuffer = copyOutState->rowBuffer;
+	bool singleColumn = (list_length(copyOutState->attributeNumberList) == 1);
+	ListCell *attributeNumberCell = NULL;
+
+	if (copyOutState->binary)
+	{
+		appendBinaryStringInfo(copyOutState->outputBuffer, BinarySignature,
+							   sizeof(BinarySignature));
+
+		/* flags field and header extension length */
+		pq_sendint(copyOutState->outputBuffer, 0, 4);
+		pq_sendint(copyOutState->outputBuffer, 0, 4);
+		return;
+	}
+
+	if (!copyOutState->header)
+	{
+		return;
+	}
+
+	resetStringInfo(rowBuffer);
+
+	foreach(attributeNumberCell, copyOutState->attributeNumberList)
+	{
+		AttrNumber attributeNumber = lfirst_int(attributeNumberCell);
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														attributeNumber - 1);
+
+		if (attributeNumberCell != list_head(copyOutState->attributeNumberList))
+		{
+			appendStringInfoCharMacro(rowBuffer, copyOutState->delimiter);
+		}
+
+		CopyOutAttributeCSV(copyOutState, NameStr(attributeForm->attname), false,
+							singleColumn);
+	}
+
+	CopyOutEndRow(copyOutState);
 }
 
 
 /*
- * CStoreGetOptions returns the option values to be used when reading and writing
- * the cstore file. To resolve these values, the function checks options for the
- * foreign table, and if not present, falls back to default values. This function
- * errors out if given option values are considered invalid.
+ * CopyOutRow formats the row at the given index of the given column blocks into
+ * the row buffer, and then adds the row to the output buffer.
  */
-static CStoreFdwOptions *
-CStoreGetOptions(Oid foreignTableId)
+static void
+CopyOutRow(CStoreCopyOutState *copyOutState, ColumnBlockData **blockDataArray,
+		   uint32 rowIndex)
 {
-	CStoreFdwOptions *cstoreFdwOptions = NULL;
-	char *filename = NULL;
-	CompressionType compressionType = DEFAULT_COMPRESSION_TYPE;
-	int32 stripeRowCount = DEFAULT_STRIPE_ROW_COUNT;
-	int32 blockRowCount = DEFAULT_BLOCK_ROW_COUNT;
-	char *compressionTypeString = NULL;
-	char *stripeRowCountString = NULL;
-	char *blockRowCountString = NULL;
-
-	filename = CStoreGetOptionValue(foreignTableId, OPTION_NAME_FILENAME);
-	compressionTypeString = CStoreGetOptionValue(foreignTableId,
-												 OPTION_NAME_COMPRESSION_TYPE);
-	stripeRowCountString = CStoreGetOptionValue(foreignTableId,
-												OPTION_NAME_STRIPE_ROW_COUNT);
-	blockRowCountString = CStoreGetOptionValue(foreignTableId,
-											   OPTION_NAME_BLOCK_ROW_COUNT);
+	StringInfo rowBuffer = copyOutState->rowBuffer;
+	List *attributeNumberList = copyOutState->attributeNumberList;
+	bool singleColumn = (list_length(attributeNumberList) == 1);
+	MemoryContext oldContext = MemoryContextSwitchTo(copyOutState->rowContext);
+	ListCell *attributeNumberCell = NULL;
 
-	ValidateForeignTableOptions(filename, compressionTypeString,
-								stripeRowCountString, blockRowCountString);
+	resetStringInfo(rowBuffer);
 
-	/* parse provided options */
-	if (compressionTypeString != NULL)
+	if (copyOutState->binary)
 	{
-		compressionType = ParseCompressionType(compressionTypeString);
+		pq_sendint(rowBuffer, list_length(attributeNumberList), 2);
 	}
-	if (stripeRowCountString != NULL)
+
+	foreach(attributeNumberCell, attributeNumberList)
 	{
-		stripeRowCount = pg_atoi(stripeRowCountString, sizeof(int32), 0);
+		uint32 columnIndex = lfirst_int(attributeNumberCell) - 1;
+		ColumnBlockData *blockData = blockDataArray[columnIndex];
+		FmgrInfo *outputFunction = &copyOutState->outputFunctionArray[columnIndex];
+		bool valueExists = blockData->existsArray[rowIndex];
+		Datum value = blockData->valueArray[rowIndex];
+
+		if (copyOutState->binary)
+		{
+			if (valueExists)
+			{
+				CopyOutBinaryValue(copyOutState, outputFunction, value);
+			}
+			else
+			{
+				pq_sendint(rowBuffer, -1, 4);
+			}
+
+			continue;
+		}
+
+		if (attributeNumberCell != list_head(attributeNumberList))
+		{
+			appendStringInfoCharMacro(rowBuffer, copyOutState->delimiter);
+		}
+
+		if (!valueExists)
+		{
+			appendStringInfoString(rowBuffer, copyOutState->nullString);
+		}
+		else if (copyOutState->csvMode)
+		{
+			char *valueString = OutputFunctionCall(outputFunction, value);
+			CopyOutAttributeCSV(copyOutState, valueString,
+								copyOutState->forceQuoteArray[columnIndex],
+								singleColumn);
+		}
+		else
+		{
+			char *valueString = OutputFunctionCall(outputFunction, value);
+			CopyOutAttributeText(copyOutState, valueString);
+		}
 	}
-	if (blockRowCountString != NULL)
+
+	if (copyOutState->binary)
 	{
-		blockRowCount = pg_atoi(blockRowCountString, sizeof(int32), 0);
+		appendBinaryStringInfo(copyOutState->outputBuffer, rowBuffer->data,
+							   rowBuffer->len);
 	}
-
-	/* set default filename if it is not provided */
-	if (filename == NULL)
+	else
 	{
-		filename = CStoreDefaultFilePath(foreignTableId);
+		CopyOutEndRow(copyOutState);
 	}
 
-	cstoreFdwOptions = palloc0(sizeof(CStoreFdwOptions));
-	cstoreFdwOptions->filename = filename;
-	cstoreFdwOptions->compressionType = compressionType;
-	cstoreFdwOptions->stripeRowCount = stripeRowCount;
-	cstoreFdwOptions->blockRowCount = blockRowCount;
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextReset(copyOutState->rowContext);
 
-	return cstoreFdwOptions;
+	if (copyOutState->outputBuffer->len >= COPY_OUT_BUFFER_SIZE)
+	{
+		CopyOutFlush(copyOutState);
+	}
 }
 
 
 /*
- * CStoreGetOptionValue walks over foreign table and foreign server options, and
- * looks for the option with the given name. If found, the function returns the
- * option's value. This function is unchanged from mongo_fdw.
+ * CopyOutBinaryValue adds the given value in binary COPY format to the row
+ * buffer. Builtin fixed-width types are written directly in network byte order,
+ * the same way their send functions write them. Other types go through the
+ * column's send function.
  */
-static char *
-CStoreGetOptionValue(Oid foreignTableId, const char *optionName)
+static void
+CopyOutBinaryValue(CStoreCopyOutState *copyOutState, FmgrInfo *sendFunction,
+				   Datum value)
 {
-	ForeignTable *foreignTable = NULL;
-	ForeignServer *foreignServer = NULL;
-	List *optionList = NIL;
-	ListCell *optionCell = NULL;
-	char *optionValue = NULL;
+	StringInfo rowBuffer = copyOutState->rowBuffer;
+	bytea *valueBytes = NULL;
 
-	foreignTable = GetForeignTable(foreignTableId);
-	foreignServer = GetForeignServer(foreignTable->serverid);
+	switch (sendFunction->fn_oid)
+	{
+		case F_BOOLSEND:
+		{
+			pq_sendint(rowBuffer, 1, 4);
+			pq_sendbyte(rowBuffer, DatumGetBool(value) ? 1 : 0);
+			break;
+		}
 
-	optionList = list_concat(optionList, foreignTable->options);
-	optionList = list_concat(optionList, foreignServer->options);
+		case F_INT2SEND:
+		{
+			pq_sendint(rowBuffer, 2, 4);
+			pq_sendint(rowBuffer, DatumGetInt16(value), 2);
+			break;
+		}
 
-	foreach(optionCell, optionList)
-	{
-		DefElem *optionDef = (DefElem *) lfirst(optionCell);
-		char *optionDefName = optionDef->defname;
+		case F_INT4SEND:
+		case F_DATE_SEND:
+		case F_OIDSEND:
+		{
+			pq_sendint(rowBuffer, 4, 4);
+			pq_sendint(rowBuffer, DatumGetInt32(value), 4);
+			break;
+		}
 
-		if (strncmp(optionDefName, optionName, NAMEDATALEN) == 0)
+		case F_FLOAT4SEND:
 		{
-			optionValue = defGetString(optionDef);
+			pq_sendint(rowBuffer, 4, 4);
+			pq_sendfloat4(rowBuffer, DatumGetFloat4(value));
 			break;
 		}
-	}
 
-	return optionValue;
+		case F_INT8SEND:
+		case F_TIME_SEND:
+		case F_TIMESTAMP_SEND:
+		case F_TIMESTAMPTZ_SEND:
+		case F_CASH_SEND:
+		{
+			pq_sendint(rowBuffer, 8, 4);
+			pq_sendint64(rowBuffer, DatumGetInt64(value));
+			break;
+		}
+
+		case F_FLOAT8SEND:
+		{
+			pq_sendint(rowBuffer, 8, 4);
+			pq_sendfloat8(rowBuffer, DatumGetFloat8(value));
+			break;
+		}
+
+		default:
+		{
+			valueBytes = SendFunctionCall(sendFunction, value);
+			pq_sendint(rowBuffer, VARSIZE(valueBytes) - VARHDRSZ, 4);
+			appendBinaryStringInfo(rowBuffer, VARDATA(valueBytes),
+								   VARSIZE(valueBytes) - VARHDRSZ);
+			break;
+		}
+	}
 }
 
 
 /*
- * ValidateForeignTableOptions verifies if given options are valid cstore_fdw
- * foreign table options. This function errors out if given option value is
- * considered invalid.
+ * CopyOutAttributeText adds the given value to the row buffer in text format,
+ * escaping backslashes, the delimiter and control characters like COPY does.
  */
 static void
-ValidateForeignTableOptions(char *filename, char *compressionTypeString,
-							char *stripeRowCountString, char *blockRowCountString)
+CopyOutAttributeText(CStoreCopyOutState *copyOutState, const char *valueString)
 {
-	/* we currently do not have any checks for filename */
-	(void) filename;
+	StringInfo rowBuffer = copyOutState->rowBuffer;
+	char delimiter = copyOutState->delimiter;
+	const char *characterPointer = NULL;
 
-	/* check if the provided compression type is valid */
-	if (compressionTypeString != NULL)
+	for (characterPointer = valueString; *characterPointer != '\0'; characterPointer++)
 	{
-		CompressionType compressionType = ParseCompressionType(compressionTypeString);
-		if (compressionType == COMPRESSION_TYPE_INVALID)
+		char character = *characterPointer;
+		char escapedCharacter = '\0';
+
+		switch (character)
 		{
-			ereport(ERROR, (errmsg("invalid compression type"),
-							errhint("Valid options are: %s",
-									COMPRESSION_STRING_DELIMITED_LIST)));
+			case '\b':
+				escapedCharacter = 'b';
+				break;
+			case '\f':
+				escapedCharacter = 'f';
+				break;
+			case '\n':
+				escapedCharacter = 'n';
+				break;
+			case '\r':
+				escapedCharacter = 'r';
+				break;
+			case '\t':
+				escapedCharacter = 't';
+				break;
+			case '\v':
+				escapedCharacter = 'v';
+				break;
+			default:
+				if (character == '\\' || character == delimiter)
+				{
+					escapedCharacter = character;
+				}
+				break;
 		}
-	}
 
-	/* check if the provided stripe row count has correct format and range */
-	if (stripeRowCountString != NULL)
-	{
-		/* pg_atoi() errors out if the given string is not a valid 32-bit integer */
-		int32 stripeRowCount = pg_atoi(stripeRowCountString, sizeof(int32), 0);
-		if (stripeRowCount < STRIPE_ROW_COUNT_MINIMUM ||
-			stripeRowCount > STRIPE_ROW_COUNT_MAXIMUM)
+		if (escapedCharacter != '\0')
 		{
-			ereport(ERROR, (errmsg("invalid stripe row count"),
-							errhint("Stripe row count must be an integer between "
-									"%d and %d", STRIPE_ROW_COUNT_MINIMUM,
-									STRIPE_ROW_COUNT_MAXIMUM)));
+			appendStringInfoCharMacro(rowBuffer, '\\');
+			appendStringInfoCharMacro(rowBuffer, escapedCharacter);
 		}
-	}
-
-	/* check if the provided block row count has correct format and range */
-	if (blockRowCountString != NULL)
-	{
-		/* pg_atoi() errors out if the given string is not a valid 32-bit integer */
-		int32 blockRowCount = pg_atoi(blockRowCountString, sizeof(int32), 0);
-		if (blockRowCount < BLOCK_ROW_COUNT_MINIMUM ||
-			blockRowCount > BLOCK_ROW_COUNT_MAXIMUM)
+		else
 		{
-			ereport(ERROR, (errmsg("invalid block row count"),
-							errhint("Block row count must be an integer between "
-									"%d and %d", BLOCK_ROW_COUNT_MINIMUM,
-									BLOCK_ROW_COUNT_MAXIMUM)));
+			appendStringInfoCharMacro(rowBuffer, character);
 		}
 	}
 }
 
 
 /*
- * CStoreDefaultFilePath constructs the default file path to use for a cstore_fdw
- * table. The path is of the form $PGDATA/cstore_fdw/{databaseOid}/{relfilenode}.
+ * CopyOutAttributeCSV adds the given value to the row buffer in csv format. Like
+ * COPY, we quote values that are forced to be quoted, that contain the delimiter,
+ * quote or newlines, that match the null string, or that would read back as the
+ * end of data marker.
  */
-static char *
-CStoreDefaultFilePath(Oid foreignTableId)
+static void
+CopyOutAttributeCSV(CStoreCopyOutState *copyOutState, const char *valueString,
+					bool forceQuote, bool singleColumn)
 {
-	Relation relation = relation_open(foreignTableId, AccessShareLock);
-	RelFileNode relationFileNode = relation->rd_node;
-	Oid databaseOid = relationFileNode.dbNode;
-	Oid relationFileOid = relationFileNode.relNode;
-
-	relation_close(relation, AccessShareLock);
+	StringInfo rowBuffer = copyOutState->rowBuffer;
+	char quote = copyOutState->quote;
+	char escape = copyOutState->escape;
+	bool useQuote = forceQuote;
+	const char *characterPointer = NULL;
 
-	/* PG12 onward does not create relfilenode for foreign tables */
-	if (databaseOid == InvalidOid)
+	if (!useQuote && strcmp(valueString, copyOutState->nullString) == 0)
 	{
-		databaseOid = MyDatabaseId;
-		relationFileOid = foreignTableId;
+		useQuote = true;
+	}
+	else if (!useQuote && singleColumn && strcmp(valueString, "\\.") == 0)
+	{
+		useQuote = true;
+	}
+	else if (!useQuote)
+	{
+		for (characterPointer = valueString; *characterPointer != '\0';
+			 characterPointer++)
+		{
+			char character = *characterPointer;
+			if (character == copyOutState->delimiter || character == quote ||
+				character == '\n' || character == '\r')
+			{
+				useQuote = true;
+				break;
+			}
+		}
+	}
 
+	if (!useQuote)
+	{
+		appendStringInfoString(rowBuffer, valueString);
+		return;
 	}
 
-	StringInfo cstoreFilePath = makeStringInfo();
-	appendStringInfo(cstoreFilePath, "%s/%s/%u/%u", DataDir, CSTORE_FDW_NAME,
-					 databaseOid, relationFileOid);
+	appendStringInfoCharMacro(rowBuffer, quote);
+	for (characterPointer = valueString; *characterPointer != '\0'; characterPointer++)
+	{
+		char character = *characterPointer;
+		if (character == quote || character == escape)
+		{
+			appendStringInfoCharMacro(rowBuffer, escape);
+		}
 
-	return cstoreFilePath->data;
+		appendStringInfoCharMacro(rowBuffer, character);
+	}
+	appendStringInfoCharMacro(rowBuffer, quote);
 }
 
 
-/* ParseCompressionType converts a string to a compression type. */
-static CompressionType
-ParseCompressionType(const char *compressionTypeString)
+/*
+ * CopyOutEndRow ends the text or csv row in the row buffer, converts it to the
+ * file encoding if needed, and adds it to the output buffer.
+ */
+static void
+CopyOutEndRow(CStoreCopyOutState *copyOutState)
 {
-	CompressionType compressionType = COMPRESSION_TYPE_INVALID;
-	Assert(compressionTypeString != NULL);
+	StringInfo rowBuffer = copyOutState->rowBuffer;
 
-	if (strncmp(compressionTypeString, COMPRESSION_STRING_NONE, NAMEDATALEN) == 0)
+#ifndef WIN32
+	appendStringInfoCharMacro(rowBuffer, '\n');
+#else
+	if (copyOutState->copyFile != NULL)
 	{
-		compressionType = COMPRESSION_NONE;
+		appendStringInfoString(rowBuffer, "\r\n");
 	}
-	else if (strncmp(compressionTypeString, COMPRESSION_STRING_PG_LZ, NAMEDATALEN) == 0)
+	else
 	{
-		compressionType = COMPRESSION_PG_LZ;
+		appendStringInfoCharMacro(rowBuffer, '\n');
 	}
+#endif
 
-	return compressionType;
+	if (copyOutState->needTranscoding)
+	{
+		char *convertedRow = pg_server_to_any(rowBuffer->data, rowBuffer->len,
+											  copyOutState->fileEncoding);
+		appendStringInfoString(copyOutState->outputBuffer, convertedRow);
+	}
+	else
+	{
+		appendBinaryStringInfo(copyOutState->outputBuffer, rowBuffer->data,
+							   rowBuffer->len);
+	}
 }
 
 
 /*
- * CStoreGetForeignRelSize obtains relation size estimates for a foreign table and
- * puts its estimate for row count into baserel->rows.
+ * CopyOutFlush writes the rows in the output buffer to the copy file, or sends
+ * them to the frontend in a single CopyData message.
  */
 static void
-CStoreGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId)
+CopyOutFlush(CStoreCopyOutState *copyOutState)
 {
-	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
-	double tupleCountEstimate = TupleCountEstimate(baserel, cstoreFdwOptions->filename);
-	double rowSelectivity = clauselist_selectivity(root, baserel->baserestrictinfo,
-												   0, JOIN_INNER, NULL);
+	StringInfo outputBuffer = copyOutState->outputBuffer;
 
-	double outputRowCount = clamp_row_est(tupleCountEstimate * rowSelectivity);
-	baserel->rows = outputRowCount;
+	if (outputBuffer->len == 0)
+	{
+		return;
+	}
+
+	if (copyOutState->copyFile != NULL)
+	{
+		errno = 0;
+		if (fwrite(outputBuffer->data, outputBuffer->len, 1,
+				   copyOutState->copyFile) != 1 ||
+			ferror(copyOutState->copyFile))
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not write to COPY file: %m")));
+		}
+	}
+	else if (pq_putmessage('d', outputBuffer->data, outputBuffer->len) != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_CONNECTION_FAILURE),
+						errmsg("connection lost during COPY to stdout")));
+	}
+
+	resetStringInfo(outputBuffer);
 }
 
 
 /*
- * CStoreGetForeignPaths creates possible access paths for a scan on the foreign
- * table. We currently have one possible access path. This path filters out row
- * blocks that are refuted by where clauses, and only returns values for the
- * projected columns.
+ * CStoreProcessAlterTableCommand checks if given alter table statement is
+ * compatible with underlying data structure. Currently it only checks alter
+ * column type. The function errors out if current column type can not be safely
+ * converted to requested column type. This check is more restrictive than
+ * PostgreSQL's because we can not change existing data.
  */
 static void
-CStoreGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId)
+CStoreProcessAlterTableCommand(AlterTableStmt *alterStatement)
 {
-	Path *foreignScanPath = NULL;
-	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
-	Relation relation = heap_open(foreignTableId, AccessShareLock);
+	ObjectType objectType = alterStatement->relkind;
+	RangeVar *relationRangeVar = alterStatement->relation;
+	Oid relationId = InvalidOid;
+	List *commandList = alterStatement->cmds;
+	ListCell *commandCell = NULL;
 
-	/*
-	 * We skip reading columns that are not in query. Here we assume that all
-	 * columns in relation have the same width, and estimate the number pages
-	 * that will be read by query.
-	 *
-	 * Ideally, we should also take into account the row blocks that will be
-	 * suppressed. But for that we need to know which columns are used for
-	 * sorting. If we wrongly assume that we are sorted by a specific column
-	 * and underestimate the page count, planner may choose nested loop join
-	 * in a place it shouldn't be used. Choosing merge join or hash join is
-	 * usually safer than nested loop join, so we take the more conservative
+	/* we are only interested in foreign table changes */
+	if (objectType != OBJECT_TABLE && objectType != OBJECT_FOREIGN_TABLE)
+	{
+		return;
+	}
+
+	relationId = RangeVarGetRelid(relationRangeVar, AccessShareLock, true);
+	if (!CStoreTable(relationId))
+	{
+		return;
+	}
+
+	foreach(commandCell, commandList)
+	{
+		AlterTableCmd *alterCommand = (AlterTableCmd *) lfirst(commandCell);
+		if(alterCommand->subtype == AT_AlterColumnType)
+		{
+			char *columnName = alterCommand->name;
+			ColumnDef *columnDef = (ColumnDef *) alterCommand->def;
+			Oid targetTypeId = typenameTypeId(NULL, columnDef->typeName);
+			char *typeName = TypeNameToString(columnDef->typeName);
+			AttrNumber attributeNumber = get_attnum(relationId, columnName);
+			Oid currentTypeId = InvalidOid;
+
+			if (attributeNumber <= 0)
+			{
+				/* let standard utility handle this */
+				continue;
+			}
+
+			currentTypeId = get_atttype(relationId, attributeNumber);
+
+			/*
+			 * We are only interested in implicit coersion type compatibility.
+			 * Erroring out here to prevent further processing.
+			 */
+			if (!can_coerce_type(1, &currentTypeId, &targetTypeId, COERCION_IMPLICIT))
+			{
+				ereport(ERROR, (errmsg("Column %s cannot be cast automatically to "
+									   "type %s", columnName, typeName)));
+			}
+		}
+	}
+}
+
+
+/*
+ * IndexColumnDropRelationId checks if the given alter table statement drops the
+ * index column of a cstore table. If it does, the function returns the table's
+ * relation id. Otherwise, it returns InvalidOid.
+ */
+static Oid
+IndexColumnDropRelationId(AlterTableStmt *alterStatement)
+{
+	ObjectType objectType = alterStatement->relkind;
+	Oid relationId = InvalidOid;
+	char *indexColumnName = NULL;
+	ListCell *commandCell = NULL;
+
+	if (objectType != OBJECT_TABLE && objectType != OBJECT_FOREIGN_TABLE)
+	{
+		return InvalidOid;
+	}
+
+	relationId = RangeVarGetRelid(alterStatement->relation, AccessShareLock, true);
+	if (!CStoreTable(relationId))
+	{
+		return InvalidOid;
+	}
+
+	indexColumnName = CStoreGetOptionValue(relationId, OPTION_NAME_INDEX_COLUMN);
+	if (indexColumnName == NULL)
+	{
+		return InvalidOid;
+	}
+
+	foreach(commandCell, alterStatement->cmds)
+	{
+		AlterTableCmd *alterCommand = (AlterTableCmd *) lfirst(commandCell);
+
+		if (alterCommand->subtype == AT_DropColumn &&
+			strcmp(alterCommand->name, indexColumnName) == 0)
+		{
+			return relationId;
+		}
+	}
+
+	return InvalidOid;
+}
+
+
+/*
+ * IndexColumnRenameRelationId checks if the given rename statement renames the
+ * index column of a cstore table. If it does, the function returns the table's
+ * relation id. Otherwise, it returns InvalidOid.
+ */
+static Oid
+IndexColumnRenameRelationId(RenameStmt *renameStatement)
+{
+	ObjectType relationType = renameStatement->relationType;
+	Oid relationId = InvalidOid;
+	char *indexColumnName = NULL;
+
+	if (renameStatement->renameType != OBJECT_COLUMN ||
+		(relationType != OBJECT_TABLE && relationType != OBJECT_FOREIGN_TABLE))
+	{
+		return InvalidOid;
+	}
+
+	relationId = RangeVarGetRelid(renameStatement->relation, AccessShareLock, true);
+	if (!CStoreTable(relationId))
+	{
+		return InvalidOid;
+	}
+
+	indexColumnName = CStoreGetOptionValue(relationId, OPTION_NAME_INDEX_COLUMN);
+	if (indexColumnName == NULL || strcmp(indexColumnName, renameStatement->subname) != 0)
+	{
+		return InvalidOid;
+	}
+
+	return relationId;
+}
+
+
+/*
+ * SetIndexColumnOption sets the index column option of the given cstore table to
+ * the given column name, or removes the option if the name is NULL. We run this
+ * after renaming or dropping the index column, so that the option keeps naming
+ * the column that the table's stripes were indexed by.
+ */
+static void
+SetIndexColumnOption(Oid relationId, char *indexColumnName)
+{
+	DefElem *option = makeNode(DefElem);
+	AlterTableCmd *alterCommand = makeNode(AlterTableCmd);
+
+	option->defname = OPTION_NAME_INDEX_COLUMN;
+	if (indexColumnName != NULL)
+	{
+		option->defaction = DEFELEM_SET;
+		option->arg = (Node *) makeString(pstrdup(indexColumnName));
+	}
+	else
+	{
+		option->defaction = DEFELEM_DROP;
+	}
+
+	alterCommand->subtype = AT_GenericOptions;
+	alterCommand->def = (Node *) list_make1(option);
+
+	AlterTableInternal(relationId, list_make1(alterCommand), false);
+	CommandCounterIncrement();
+}
+
+
+/*
+ * DropppedCStoreFilenameList extracts and returns the list of cstore file names
+ * from DROP table statement
+ */
+static List *
+DroppedCStoreFilenameList(DropStmt *dropStatement)
+{
+	List *droppedCStoreFileList = NIL;
+
+	if (dropStatement->removeType == OBJECT_FOREIGN_TABLE)
+	{
+		ListCell *dropObjectCell = NULL;
+		foreach(dropObjectCell, dropStatement->objects)
+		{
+			List *tableNameList = (List *) lfirst(dropObjectCell);
+			RangeVar *rangeVar = makeRangeVarFromNameList(tableNameList);
+
+			Oid relationId = RangeVarGetRelid(rangeVar, AccessShareLock, true);
+			if (CStoreTable(relationId))
+			{
+				CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(relationId);
+				char *defaultfilename = CStoreDefaultFilePath(relationId);
+
+				/*
+				 * Skip files that are placed in default location, they are handled
+				 * by sql drop trigger. Both paths are generated by code, use
+				 * of strcmp is safe here.
+				 */
+				if (strcmp(defaultfilename, cstoreFdwOptions->filename) == 0)
+				{
+					continue;
+				}
+
+				droppedCStoreFileList = lappend(droppedCStoreFileList,
+												cstoreFdwOptions->filename);
+			}
+		}
+	}
+
+	return droppedCStoreFileList;
+}
+
+
+/* FindCStoreTables returns list of CStore tables from given table list */
+static List *
+FindCStoreTables(List *tableList)
+{
+	List *cstoreTableList = NIL;
+	ListCell *relationCell = NULL;
+	foreach(relationCell, tableList)
+	{
+		RangeVar *rangeVar = (RangeVar *) lfirst(relationCell);
+		Oid relationId = RangeVarGetRelid(rangeVar, AccessShareLock, true);
+		if (CStoreTable(relationId) && !DistributedTable(relationId))
+		{
+			cstoreTableList = lappend(cstoreTableList, rangeVar);
+		}
+	}
+
+	return cstoreTableList;
+}
+
+
+/*
+ * OpenRelationsForTruncate opens and locks relations for tables to be truncated.
+ *
+ * It also performs a permission checks to see if the user has truncate privilege
+ * on tables.
+ */
+static List *
+OpenRelationsForTruncate(List *cstoreTableList)
+{
+	ListCell *relationCell = NULL;
+	List *relationIdList = NIL;
+	List *relationList = NIL;
+	foreach(relationCell, cstoreTableList)
+	{
+		RangeVar *rangeVar = (RangeVar *) lfirst(relationCell);
+		Relation relation = heap_openrv(rangeVar, AccessExclusiveLock);
+		Oid relationId = relation->rd_id;
+		AclResult aclresult = pg_class_aclcheck(relationId, GetUserId(),
+											   ACL_TRUNCATE);
+		if (aclresult != ACLCHECK_OK)
+		{
+			aclcheck_error(aclresult, ACLCHECK_OBJECT_TABLE, get_rel_name(relationId));
+		}
+
+		/* check if this relation is repeated */
+		if (list_member_oid(relationIdList, relationId))
+		{
+			heap_close(relation, AccessExclusiveLock);
+		}
+		else
+		{
+			relationIdList = lappend_oid(relationIdList, relationId);
+			relationList = lappend(relationList, relation);
+		}
+	}
+
+	return relationList;
+}
+
+
+/* TruncateCStoreTable truncates given cstore tables */
+static void
+TruncateCStoreTables(List *cstoreRelationList)
+{
+	ListCell *relationCell = NULL;
+	foreach(relationCell, cstoreRelationList)
+	{
+		Relation relation = (Relation) lfirst(relationCell);
+		Oid relationId = relation->rd_id;
+		CStoreFdwOptions *cstoreFdwOptions = NULL;
+
+		Assert(CStoreTable(relationId));
+
+		cstoreFdwOptions = CStoreGetOptions(relationId);
+		DeleteCStoreTableFiles(cstoreFdwOptions->filename);
+		InitializeCStoreTableFile(relationId, relation);
+	}
+}
+
+
+/*
+ * LockWritableSegment finds a segment file of the table that no other load is
+ * writing into, and locks it until the caller unlocks it or the transaction ends.
+ * We use a page lock on the relation with the segment index as the lock for each
+ * segment. If all segments are busy, we add a new segment to the table's segment
+ * manifest while holding the relation extension lock, so that concurrent loads
+ * don't add the same segment. The function returns the locked segment's index.
+ */
+static uint32
+LockWritableSegment(Relation relation, const char *filename)
+{
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+	uint32 segmentIndex = 0;
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		if (ConditionalLockPage(relation, segmentIndex, ExclusiveLock))
+		{
+			return segmentIndex;
+		}
+	}
+
+	LockRelationForExtension(relation, ExclusiveLock);
+
+	/* other loads may have added segments since we read the manifest */
+	segmentCount = CStoreReadSegmentCount(filename);
+	for (; segmentIndex < segmentCount; segmentIndex++)
+	{
+		if (ConditionalLockPage(relation, segmentIndex, ExclusiveLock))
+		{
+			UnlockRelationForExtension(relation, ExclusiveLock);
+			return segmentIndex;
+		}
+	}
+
+	/* nobody else can know about the new segment yet, so this doesn't wait */
+	LockPage(relation, segmentIndex, ExclusiveLock);
+	RemoveSegmentFooter(filename, segmentIndex);
+	CStoreWriteSegmentCount(filename, segmentCount + 1);
+
+	UnlockRelationForExtension(relation, ExclusiveLock);
+
+	return segmentIndex;
+}
+
+
+/*
+ * LockAllSegments locks all segments of the given table until the transaction
+ * ends, and so waits for running loads to finish. Later loads then add their
+ * rows to new segments, whose stripes come after the locked segments' stripes.
+ * So stripes keep their index in the table, which UPDATE and DELETE use to
+ * identify rows. Loads only lock segments conditionally, and we lock segments in
+ * order, so this can't deadlock with loads or other deletes.
+ */
+static void
+LockAllSegments(Relation relation, const char *filename)
+{
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+	uint32 segmentIndex = 0;
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		LockPage(relation, segmentIndex, ExclusiveLock);
+	}
+}
+
+
+/*
+ * RemoveSegmentFooter removes the footer of a segment that isn't in the table's
+ * segment manifest yet. A failed parallel COPY may leave such footers behind, and
+ * we must not append to the stripes they point to when the segment is reused.
+ */
+static void
+RemoveSegmentFooter(const char *filename, uint32 segmentIndex)
+{
+	StringInfo tableFooterFilename = makeStringInfo();
+	appendStringInfo(tableFooterFilename, "%s%s",
+					 CStoreSegmentFilename(filename, segmentIndex),
+					 CSTORE_FOOTER_FILE_SUFFIX);
+
+	if (unlink(tableFooterFilename->data) != 0 && errno != ENOENT)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not delete file \"%s\": %m",
+							   tableFooterFilename->data)));
+	}
+
+	pfree(tableFooterFilename->data);
+	pfree(tableFooterFilename);
+}
+
+
+/*
+ * DeleteCStoreTableFiles deletes the data and footer files of all segments of a
+ * cstore table whose data filename is given, and then the table's segment
+ * manifest, delta file and pending footer.
+ */
+void
+DeleteCStoreTableFiles(char *filename)
+{
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+	uint32 segmentIndex = 0;
+	StringInfo manifestFilename = makeStringInfo();
+	StringInfo deltaFilename = makeStringInfo();
+	StringInfo pendingFooterFilename = makeStringInfo();
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		char *segmentFilename = CStoreSegmentFilename(filename, segmentIndex);
+		int dataFileRemoved = 0;
+		int footerFileRemoved = 0;
+
+		StringInfo tableFooterFilename = makeStringInfo();
+		appendStringInfo(tableFooterFilename, "%s%s", segmentFilename,
+						 CSTORE_FOOTER_FILE_SUFFIX);
+
+		/*
+		 * Delete the footer file. Segments whose first load didn't finish don't
+		 * have one, so we only warn about other segments.
+		 */
+		footerFileRemoved = unlink(tableFooterFilename->data);
+		if (footerFileRemoved != 0 && (segmentIndex == 0 || errno != ENOENT))
+		{
+			ereport(WARNING, (errcode_for_file_access(),
+							  errmsg("could not delete file \"%s\": %m",
+									 tableFooterFilename->data)));
+		}
+
+		/* delete the data file */
+		dataFileRemoved = unlink(segmentFilename);
+		if (dataFileRemoved != 0 && (segmentIndex == 0 || errno != ENOENT))
+		{
+			ereport(WARNING, (errcode_for_file_access(),
+							  errmsg("could not delete file \"%s\": %m",
+									 segmentFilename)));
+		}
+	}
+
+	/* tables that never had a concurrent load don't have a manifest */
+	appendStringInfo(manifestFilename, "%s%s", filename, CSTORE_MANIFEST_FILE_SUFFIX);
+	if (unlink(manifestFilename->data) != 0 && errno != ENOENT)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+						  errmsg("could not delete file \"%s\": %m",
+								 manifestFilename->data)));
+	}
+
+	/* tables that never had a single row insert don't have a delta file */
+	appendStringInfo(deltaFilename, "%s%s", filename, CSTORE_DELTA_FILE_SUFFIX);
+	if (unlink(deltaFilename->data) != 0 && errno != ENOENT)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+						  errmsg("could not delete file \"%s\": %m",
+								 deltaFilename->data)));
+	}
+
+	/* only tables of the access method have a pending footer, while written */
+	appendStringInfo(pendingFooterFilename, "%s%s", filename,
+					 CSTORE_PENDING_FOOTER_FILE_SUFFIX);
+	if (unlink(pendingFooterFilename->data) != 0 && errno != ENOENT)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+						  errmsg("could not delete file \"%s\": %m",
+								 pendingFooterFilename->data)));
+	}
+}
+
+
+/*
+ * InitializeCStoreTableFile creates data and footer file for a cstore table.
+ * The function assumes data and footer files do not exist, therefore
+ * it should be called on empty or non-existing table. Notice that the caller
+ * is expected to acquire AccessExclusiveLock on the relation.
+ */
+static void InitializeCStoreTableFile(Oid relationId, Relation relation)
+{
+	TableWriteState *writeState = NULL;
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	CStoreFdwOptions* cstoreFdwOptions = CStoreGetOptions(relationId);
+
+	/*
+	 * Initialize state to write to the cstore file. This creates an
+	 * empty data file and a valid footer file for the table.
+	 */
+	writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
+			cstoreFdwOptions->compressionType, cstoreFdwOptions->stripeRowCount,
+			cstoreFdwOptions->blockRowCount, cstoreFdwOptions->indexColumnIndex,
+			cstoreFdwOptions->maxSkipValueLengthArray, tupleDescriptor);
+	CStoreEndWrite(writeState);
+}
+
+
+
+/*
+ * CStoreTable checks if the given table name belongs to a foreign columnar store
+ * table. If it does, the function returns true. Otherwise, it returns false.
+ */
+static bool
+CStoreTable(Oid relationId)
+{
+	bool cstoreTable = false;
+	char relationKind = 0;
+
+	if (relationId == InvalidOid)
+	{
+		return false;
+	}
+
+	relationKind = get_rel_relkind(relationId);
+	if (relationKind == RELKIND_FOREIGN_TABLE)
+	{
+		ForeignTable *foreignTable = GetForeignTable(relationId);
+		ForeignServer *server = GetForeignServer(foreignTable->serverid);
+		if (CStoreServer(server))
+		{
+			cstoreTable = true;
+		}
+	}
+
+	return cstoreTable;
+}
+
+
+/*
+ * CStoreServer checks if the given foreign server belongs to cstore_fdw. If it
+ * does, the function returns true. Otherwise, it returns false.
+ */
+static bool
+CStoreServer(ForeignServer *server)
+{
+	ForeignDataWrapper *foreignDataWrapper = GetForeignDataWrapper(server->fdwid);
+	bool cstoreServer = false;
+
+	char *foreignWrapperName = foreignDataWrapper->fdwname;
+	if (strncmp(foreignWrapperName, CSTORE_FDW_NAME, NAMEDATALEN) == 0)
+	{
+		cstoreServer = true;
+	}
+
+	return cstoreServer;
+}
+
+
+/*
+ * DistributedTable checks if the given relationId is the OID of a distributed table,
+ * which may also be a cstore_fdw table, but in that case COPY should be handled by
+ * Citus.
+ */
+static bool
+DistributedTable(Oid relationId)
+{
+	bool distributedTable = false;
+	Oid partitionOid = InvalidOid;
+	Relation heapRelation = NULL;
+	TableScanDesc scanDesc = NULL;
+	const int scanKeyCount = 1;
+	ScanKeyData scanKey[1];
+	HeapTuple heapTuple = NULL;
+
+	bool missingOK = true;
+	Oid extensionOid = get_extension_oid(CITUS_EXTENSION_NAME, missingOK);
+	if (extensionOid == InvalidOid)
+	{
+		/* if the citus extension isn't created, no tables are distributed */
+		return false;
+	}
+
+	partitionOid = get_relname_relid(CITUS_PARTITION_TABLE_NAME, PG_CATALOG_NAMESPACE);
+	if (partitionOid == InvalidOid)
+	{
+		/* the pg_dist_partition table does not exist */
+		return false;
+	}
+
+	heapRelation = heap_open(partitionOid, AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], ATTR_NUM_PARTITION_RELATION_ID, InvalidStrategy,
+				F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDesc = table_beginscan(heapRelation, SnapshotSelf, scanKeyCount, scanKey);
+
+	heapTuple = heap_getnext(scanDesc, ForwardScanDirection);
+
+	distributedTable = HeapTupleIsValid(heapTuple);
+
+	table_endscan(scanDesc);
+	relation_close(heapRelation, AccessShareLock);
+
+	return distributedTable;
+}
+
+
+/*
+ * DistributedWorkerCopy returns whether the Citus-specific master_host option is
+ * present in the COPY options.
+ */
+static bool
+DistributedWorkerCopy(CopyStmt *copyStatement)
+{
+    ListCell *optionCell = NULL;
+    foreach(optionCell, copyStatement->options)
+    {
+        DefElem *defel = (DefElem *) lfirst(optionCell);
+        if (strncmp(defel->defname, "master_host", NAMEDATALEN) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * CreateCStoreDatabaseDirectory creates the directory (and parent directories,
+ * if needed) used to store automatically managed cstore_fdw files. The path to
+ * the directory is $PGDATA/cstore_fdw/{databaseOid}.
+ */
+void
+CreateCStoreDatabaseDirectory(Oid databaseOid)
+{
+	bool cstoreDirectoryExists = false;
+	bool databaseDirectoryExists = false;
+	StringInfo cstoreDatabaseDirectoryPath = NULL;
+
+	StringInfo cstoreDirectoryPath = makeStringInfo();
+	appendStringInfo(cstoreDirectoryPath, "%s/%s", DataDir, CSTORE_FDW_NAME);
+
+	cstoreDirectoryExists = DirectoryExists(cstoreDirectoryPath);
+	if (!cstoreDirectoryExists)
+	{
+		CreateDirectory(cstoreDirectoryPath);
+	}
+
+	cstoreDatabaseDirectoryPath = makeStringInfo();
+	appendStringInfo(cstoreDatabaseDirectoryPath, "%s/%s/%u", DataDir,
+					 CSTORE_FDW_NAME, databaseOid);
+
+	databaseDirectoryExists = DirectoryExists(cstoreDatabaseDirectoryPath);
+	if (!databaseDirectoryExists)
+	{
+		CreateDirectory(cstoreDatabaseDirectoryPath);
+	}
+}
+
+
+/* DirectoryExists checks if a directory exists for the given directory name. */
+static bool
+DirectoryExists(StringInfo directoryName)
+{
+	bool directoryExists = true;
+	struct stat directoryStat;
+
+	int statOK = stat(directoryName->data, &directoryStat);
+	if (statOK == 0)
+	{
+		/* file already exists; check that it is a directory */
+		if (!S_ISDIR(directoryStat.st_mode))
+		{
+			ereport(ERROR, (errmsg("\"%s\" is not a directory", directoryName->data),
+							errhint("You need to remove or rename the file \"%s\".",
+									directoryName->data)));
+		}
+	}
+	else
+	{
+		if (errno == ENOENT)
+		{
+			directoryExists = false;
+		}
+		else
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not stat directory \"%s\": %m",
+								   directoryName->data)));
+		}
+	}
+
+	return directoryExists;
+}
+
+
+/* CreateDirectory creates a new directory with the given directory name. */
+static void
+CreateDirectory(StringInfo directoryName)
+{
+	int makeOK = mkdir(directoryName->data, S_IRWXU);
+	if (makeOK != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not create directory \"%s\": %m",
+							   directoryName->data)));
+	}
+}
+
+
+/*
+ * RemoveCStoreDatabaseDirectory removes CStore directory previously
+ * created for this database.
+ * However it does not remove 'cstore_fdw' directory even if there
+ * are no other databases left.
+ */
+static void
+RemoveCStoreDatabaseDirectory(Oid databaseOid)
+{
+	StringInfo cstoreDirectoryPath = makeStringInfo();
+	StringInfo cstoreDatabaseDirectoryPath = makeStringInfo();
+
+	appendStringInfo(cstoreDirectoryPath, "%s/%s", DataDir, CSTORE_FDW_NAME);
+
+	appendStringInfo(cstoreDatabaseDirectoryPath, "%s/%s/%u", DataDir,
+					 CSTORE_FDW_NAME, databaseOid);
+
+	if (DirectoryExists(cstoreDatabaseDirectoryPath))
+	{
+		rmtree(cstoreDatabaseDirectoryPath->data, true);
+	}
+}
+
+
+/*
+ * cstore_table_size returns the total on-disk size of a cstore table in bytes.
+ * The result includes the sizes of data and footer files of all segments, and
+ * of the segment manifest and delta file.
+ */
+Datum
+cstore_table_size(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+
+	int64 tableSize = 0;
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	char *dataFilename = NULL;
+	StringInfo footerFilename = NULL;
+	StringInfo manifestFilename = NULL;
+	StringInfo deltaFilename = NULL;
+	int dataFileStatResult = 0;
+	int footerFileStatResult = 0;
+	struct stat dataFileStatBuffer;
+	struct stat footerFileStatBuffer;
+	struct stat manifestFileStatBuffer;
+	struct stat deltaFileStatBuffer;
+
+	bool cstoreTable = CStoreTable(relationId);
+	if (!cstoreTable)
+	{
+		ereport(ERROR, (errmsg("relation is not a cstore table")));
+	}
+
+	cstoreFdwOptions = CStoreGetOptions(relationId);
+	dataFilename = cstoreFdwOptions->filename;
+
+	dataFileStatResult = stat(dataFilename, &dataFileStatBuffer);
+	if (dataFileStatResult != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not stat file \"%s\": %m", dataFilename)));
+	}
+
+	footerFilename = makeStringInfo();
+	appendStringInfo(footerFilename, "%s%s", dataFilename,
+					 CSTORE_FOOTER_FILE_SUFFIX);
+
+	footerFileStatResult = stat(footerFilename->data, &footerFileStatBuffer);
+	if (footerFileStatResult != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not stat file \"%s\": %m",
+								footerFilename->data)));
+	}
+
+	tableSize += SegmentFilesSize(dataFilename, "");
+	tableSize += SegmentFilesSize(dataFilename, CSTORE_FOOTER_FILE_SUFFIX);
+
+	manifestFilename = makeStringInfo();
+	appendStringInfo(manifestFilename, "%s%s", dataFilename,
+					 CSTORE_MANIFEST_FILE_SUFFIX);
+
+	if (stat(manifestFilename->data, &manifestFileStatBuffer) == 0)
+	{
+		tableSize += manifestFileStatBuffer.st_size;
+	}
+
+	deltaFilename = makeStringInfo();
+	appendStringInfo(deltaFilename, "%s%s", dataFilename, CSTORE_DELTA_FILE_SUFFIX);
+
+	if (stat(deltaFilename->data, &deltaFileStatBuffer) == 0)
+	{
+		tableSize += deltaFileStatBuffer.st_size;
+	}
+
+	PG_RETURN_INT64(tableSize);
+}
+
+
+/*
+ * SegmentFilesSize returns the total size of the files of a cstore table's
+ * segments that have the given suffix. Segments whose first load didn't finish
+ * may not have all their files yet, so we skip files that don't exist.
+ */
+static int64
+SegmentFilesSize(const char *filename, const char *suffix)
+{
+	int64 filesSize = 0;
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+	uint32 segmentIndex = 0;
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		StringInfo segmentFilename = makeStringInfo();
+		struct stat statBuffer;
+
+		appendStringInfo(segmentFilename, "%s%s",
+						 CStoreSegmentFilename(filename, segmentIndex), suffix);
+
+		if (stat(segmentFilename->data, &statBuffer) == 0)
+		{
+			filesSize += statBuffer.st_size;
+		}
+
+		pfree(segmentFilename->data);
+		pfree(segmentFilename);
+	}
+
+	return filesSize;
+}
+
+
+/*
+ * cstore_attach_file adds a cstore data file and its footer, built outside this
+ * table by a COPY into a cstore table with the same columns on this or another
+ * server, to the table as a new segment. The files are checked without reading
+ * column data, and then renamed into place, so they must be on the same file
+ * system as the table's files. The function returns the number of added rows.
+ */
+Datum
+cstore_attach_file(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	char *attachFilename = text_to_cstring(PG_GETARG_TEXT_P(1));
+	StringInfo attachFooterFilename = makeStringInfo();
+	StringInfo tableFooterFilename = makeStringInfo();
+	StringInfo segmentFooterFilename = makeStringInfo();
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	TableFooter *tableFooter = NULL;
+	TableFooter *attachFooter = NULL;
+	Relation relation = NULL;
+	char *segmentFilename = NULL;
+	uint32 segmentCount = 0;
+	uint64 rowCount = 0;
+
+	if (!superuser())
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to attach cstore files")));
+	}
+
+	if (!CStoreTable(relationId))
+	{
+		ereport(ERROR, (errmsg("relation is not a cstore table")));
+	}
+
+	if (!is_absolute_path(attachFilename))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_NAME),
+						errmsg("relative path not allowed for cstore files")));
+	}
+
+	relation = heap_open(relationId, RowExclusiveLock);
+	cstoreFdwOptions = CStoreGetOptions(relationId);
+
+	/* readers need all segments to have the first segment's block row count */
+	appendStringInfo(tableFooterFilename, "%s%s", cstoreFdwOptions->filename,
+					 CSTORE_FOOTER_FILE_SUFFIX);
+	tableFooter = CStoreReadFooter(tableFooterFilename);
+
+	rowCount = CStoreValidateFile(attachFilename, RelationGetDescr(relation),
+								  tableFooter->blockRowCount);
+
+	/* a merge generation of another table's delta store could hide our delta */
+	appendStringInfo(attachFooterFilename, "%s%s", attachFilename,
+					 CSTORE_FOOTER_FILE_SUFFIX);
+	attachFooter = CStoreReadFooter(attachFooterFilename);
+	if (attachFooter->mergedDeltaGeneration != 0)
+	{
+		attachFooter->mergedDeltaGeneration = 0;
+		CStoreReplaceFooter(attachFilename, attachFooter);
+	}
+
+	/* add the files as a new segment, the same way loads do */
+	LockRelationForExtension(relation, ExclusiveLock);
+
+	segmentCount = CStoreReadSegmentCount(cstoreFdwOptions->filename);
+	segmentFilename = CStoreSegmentFilename(cstoreFdwOptions->filename, segmentCount);
+	appendStringInfo(segmentFooterFilename, "%s%s", segmentFilename,
+					 CSTORE_FOOTER_FILE_SUFFIX);
+
+	if (rename(attachFilename, segmentFilename) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   attachFilename, segmentFilename)));
+	}
+
+	if (rename(attachFooterFilename->data, segmentFooterFilename->data) != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   attachFooterFilename->data,
+							   segmentFooterFilename->data)));
+	}
+
+	CStoreWriteSegmentCount(cstoreFdwOptions->filename, segmentCount + 1);
+
+	UnlockRelationForExtension(relation, ExclusiveLock);
+	heap_close(relation, RowExclusiveLock);
+
+	PG_RETURN_INT64(rowCount);
+}
+
+
+/*
+ * cstore_drop_stripes removes the stripes of a cstore table in which all rows
+ * satisfy the given predicate, and returns the number of removed rows. We only
+ * use the stripes' skip lists to decide which stripes to remove, so a stripe is
+ * kept unless its min/max values prove that the predicate holds for all of its
+ * rows. Removing a stripe only rewrites its segment's footer, and then frees the
+ * stripe's file space. Like other changes to a table's files, this can't be
+ * rolled back.
+ */
+Datum
+cstore_drop_stripes(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	char *predicateString = text_to_cstring(PG_GETARG_TEXT_P(1));
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	Relation relation = NULL;
+	List *whereClauseList = NIL;
+	AclResult aclResult = ACLCHECK_OK;
+	uint32 segmentCount = 0;
+	uint32 segmentIndex = 0;
+	uint64 droppedRowCount = 0;
+
+	if (!CStoreTable(relationId))
+	{
+		ereport(ERROR, (errmsg("relation is not a cstore table")));
+	}
+
+	aclResult = pg_class_aclcheck(relationId, GetUserId(), ACL_DELETE);
+	if (aclResult != ACLCHECK_OK)
+	{
+		aclcheck_error(aclResult, ACLCHECK_OBJECT_TABLE, get_rel_name(relationId));
+	}
+
+	/* scans read stripes through the footers we replace, so we lock them out */
+	relation = heap_open(relationId, AccessExclusiveLock);
+	cstoreFdwOptions = CStoreGetOptions(relationId);
+
+	whereClauseList = ParseStripePredicate(relation, predicateString);
+
+	segmentCount = CStoreReadSegmentCount(cstoreFdwOptions->filename);
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		char *segmentFilename = CStoreSegmentFilename(cstoreFdwOptions->filename,
+													  segmentIndex);
+		StringInfo tableFooterFilename = makeStringInfo();
+		TableFooter *tableFooter = NULL;
+		List *droppedStripeList = NIL;
+		uint64 segmentRowCount = 0;
+		struct stat statBuffer;
+
+		appendStringInfo(tableFooterFilename, "%s%s", segmentFilename,
+						 CSTORE_FOOTER_FILE_SUFFIX);
+
+		/* segments get their footer when their first load finishes */
+		if (stat(tableFooterFilename->data, &statBuffer) < 0)
+		{
+			continue;
+		}
+
+		tableFooter = CStoreReadFooter(tableFooterFilename);
+		droppedStripeList = CStoreMatchingStripes(segmentFilename, tableFooter,
+												  RelationGetDescr(relation),
+												  whereClauseList, &segmentRowCount);
+		if (droppedStripeList != NIL)
+		{
+			CStoreDropStripes(segmentFilename, tableFooter, droppedStripeList);
+			droppedRowCount += segmentRowCount;
+		}
+
+		pfree(tableFooterFilename->data);
+		pfree(tableFooterFilename);
+		pfree(segmentFilename);
+	}
+
+	heap_close(relation, AccessExclusiveLock);
+
+	PG_RETURN_INT64(droppedRowCount);
+}
+
+
+/*
+ * cstore_compact rewrites the stripes of a cstore table that have deleted rows,
+ * and returns the number of deleted rows it removed. We write each segment's
+ * remaining rows from these stripes into new stripes at the segment's end, and
+ * then replace the segment's footer and release the old stripes' space. Like
+ * other changes to a table's files, this can't be rolled back.
+ */
+Datum
+cstore_compact(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	Relation relation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	List *columnList = NIL;
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
+	uint32 columnCount = 0;
+	uint32 columnIndex = 0;
+	uint32 segmentCount = 0;
+	uint32 segmentIndex = 0;
+	uint64 removedRowCount = 0;
+
+	if (!CStoreTable(relationId))
+	{
+		ereport(ERROR, (errmsg("relation is not a cstore table")));
+	}
+
+	if (!pg_class_ownercheck(relationId, GetUserId()))
+	{
+		aclcheck_error(ACLCHECK_NOT_OWNER, ACLCHECK_OBJECT_TABLE,
+					   get_rel_name(relationId));
+	}
+
+	/* scans read stripes through the footers we replace, so we lock them out */
+	relation = heap_open(relationId, AccessExclusiveLock);
+	cstoreFdwOptions = CStoreGetOptions(relationId);
+	tupleDescriptor = RelationGetDescr(relation);
+	columnCount = tupleDescriptor->natts;
+
+	/* create list of columns of the relation */
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		const Index tableId = 1;
+
+		if (!attributeForm->attisdropped)
+		{
+			Var *column = makeVar(tableId, columnIndex + 1, attributeForm->atttypid,
+								  attributeForm->atttypmod, attributeForm->attcollation, 0);
+			columnList = lappend(columnList, column);
+		}
+	}
+
+	columnValues = palloc0(columnCount * sizeof(Datum));
+	columnNulls = palloc0(columnCount * sizeof(bool));
+
+	segmentCount = CStoreReadSegmentCount(cstoreFdwOptions->filename);
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		char *segmentFilename = CStoreSegmentFilename(cstoreFdwOptions->filename,
+													  segmentIndex);
+		StringInfo tableFooterFilename = makeStringInfo();
+		TableFooter *tableFooter = NULL;
+		TableWriteState *writeState = NULL;
+		TableReadState *readState = NULL;
+		List *rewrittenStripeList = NIL;
+		ListCell *stripeMetadataCell = NULL;
+		bool hasDeletedRows = false;
+		struct stat statBuffer;
+
+		appendStringInfo(tableFooterFilename, "%s%s", segmentFilename,
+						 CSTORE_FOOTER_FILE_SUFFIX);
+
+		/* segments get their footer when their first load finishes */
+		if (stat(tableFooterFilename->data, &statBuffer) < 0)
+		{
+			continue;
+		}
+
+		tableFooter = CStoreReadFooter(tableFooterFilename);
+		foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+		{
+			StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+			hasDeletedRows = hasDeletedRows || (stripeMetadata->deletedRowCount > 0);
+		}
+
+		pfree(tableFooterFilename->data);
+		pfree(tableFooterFilename);
+
+		if (!hasDeletedRows)
+		{
+			pfree(segmentFilename);
+			continue;
+		}
+
+		writeState = CStoreBeginWrite(segmentFilename, cstoreFdwOptions->compressionType,
+									  cstoreFdwOptions->stripeRowCount,
+									  cstoreFdwOptions->blockRowCount,
+									  cstoreFdwOptions->indexColumnIndex,
+									  cstoreFdwOptions->maxSkipValueLengthArray,
+									  tupleDescriptor);
+
+		/* the stripes we rewrite must come from the write operation's footer */
+		foreach(stripeMetadataCell, writeState->tableFooter->stripeMetadataList)
+		{
+			StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+
+			if (stripeMetadata->deletedRowCount > 0)
+			{
+				rewrittenStripeList = lappend(rewrittenStripeList, stripeMetadata);
+				removedRowCount += stripeMetadata->deletedRowCount;
+			}
+		}
+
+		readState = CStoreBeginStripeRead(cstoreFdwOptions->filename, segmentIndex,
+										  rewrittenStripeList, tupleDescriptor,
+										  columnList);
+		while (CStoreReadNextRow(readState, columnValues, columnNulls))
+		{
+			CHECK_FOR_INTERRUPTS();
+
+			CStoreWriteRow(writeState, columnValues, columnNulls);
+		}
+
+		CStoreEndRead(readState);
+		CStoreEndRewrite(writeState, segmentFilename, rewrittenStripeList);
+
+		pfree(segmentFilename);
+	}
+
+	heap_close(relation, AccessExclusiveLock);
+
+	PG_RETURN_INT64(removedRowCount);
+}
+
+
+/*
+ * ParseStripePredicate parses and analyzes the given predicate as the WHERE
+ * clause of a query on the given relation, and returns the predicate as a list
+ * of implicitly ANDed clauses. We evaluate the parts of the predicate that
+ * don't depend on the relation's columns once, so that predicates such as
+ * "time < now() - interval '90 days'" can be checked against skip lists.
+ */
+static List *
+ParseStripePredicate(Relation relation, const char *predicateString)
+{
+	StringInfo queryString = makeStringInfo();
+	char *qualifiedName = NULL;
+	List *parseTreeList = NIL;
+	Query *query = NULL;
+	RangeTblEntry *rangeTableEntry = NULL;
+	Node *predicate = NULL;
+	List *whereClauseList = NIL;
+	ExprContext *exprContext = NULL;
+
+	qualifiedName = quote_qualified_identifier(
+		get_namespace_name(RelationGetNamespace(relation)),
+		RelationGetRelationName(relation));
+	appendStringInfo(queryString, "SELECT 1 FROM ONLY %s WHERE %s", qualifiedName,
+					 predicateString);
+
+	parseTreeList = pg_parse_query(queryString->data);
+	if (list_length(parseTreeList) != 1)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid stripe predicate \"%s\"", predicateString)));
+	}
+
+#if PG_VERSION_NUM >= 100000
+	query = parse_analyze((RawStmt *) linitial(parseTreeList), queryString->data,
+						  NULL, 0, NULL);
+#else
+	query = parse_analyze((Node *) linitial(parseTreeList), queryString->data,
+						  NULL, 0);
+#endif
+
+	/* the predicate must not change the shape of the query we built around it */
+	if (query->commandType != CMD_SELECT || query->utilityStmt != NULL ||
+		list_length(query->rtable) != 1 || list_length(query->targetList) != 1 ||
+		query->setOperations != NULL || query->cteList != NIL ||
+		query->groupClause != NIL || query->havingQual != NULL ||
+		query->distinctClause != NIL || query->sortClause != NIL ||
+		query->limitCount != NULL || query->limitOffset != NULL ||
+		query->rowMarks != NIL || query->hasSubLinks || query->hasAggs ||
+		query->hasWindowFuncs || query->jointree->quals == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid stripe predicate \"%s\"", predicateString)));
+	}
+
+	rangeTableEntry = (RangeTblEntry *) linitial(query->rtable);
+	if (rangeTableEntry->relid != RelationGetRelid(relation))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid stripe predicate \"%s\"", predicateString)));
+	}
+
+	predicate = query->jointree->quals;
+	if (contain_volatile_functions(predicate))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("stripe predicate cannot contain volatile functions")));
+	}
+
+	predicate = eval_const_expressions(NULL, predicate);
+	whereClauseList = make_ands_implicit((Expr *) predicate);
+
+	exprContext = CreateStandaloneExprContext();
+	whereClauseList = EvaluateRuntimeConstants(whereClauseList, exprContext, false);
+	FreeExprContext(exprContext, true);
+
+	return whereClauseList;
+}
+
+
+/*
+ * cstore_block_info returns a row for each column block stored in the files of
+ * a cstore table, with the block's location, sizes, compression, and min/max
+ * values, by reading the files' metadata directly. If verify is true, every
+ * block is also decompressed and deserialized, and the function errors out
+ * with the block's location on the first corrupt block.
+ */
+Datum
+cstore_block_info(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	bool verify = PG_GETARG_BOOL(1);
+	ReturnSetInfo *resultSetInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc resultDescriptor = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	MemoryContext oldContext = NULL;
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	FmgrInfo *outputFunctionArray = NULL;
+	Relation relation = NULL;
+	List *blockInfoList = NIL;
+	ListCell *blockInfoCell = NULL;
+	uint32 columnIndex = 0;
+	AclResult aclResult = ACLCHECK_OK;
+
+	if (resultSetInfo == NULL || !IsA(resultSetInfo, ReturnSetInfo) ||
+		(resultSetInfo->allowedModes & SFRM_Materialize) == 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("set-valued function called in context that cannot "
+							   "accept a set")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &resultDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	if (!CStoreTable(relationId))
+	{
+		ereport(ERROR, (errmsg("relation is not a cstore table")));
+	}
+
+	/* min/max values reveal the table's data */
+	aclResult = pg_class_aclcheck(relationId, GetUserId(), ACL_SELECT);
+	if (aclResult != ACLCHECK_OK)
+	{
+		aclcheck_error(aclResult, ACLCHECK_OBJECT_TABLE, get_rel_name(relationId));
+	}
+
+	relation = heap_open(relationId, AccessShareLock);
+	tupleDescriptor = RelationGetDescr(relation);
+	cstoreFdwOptions = CStoreGetOptions(relationId);
+
+	outputFunctionArray = palloc0(tupleDescriptor->natts * sizeof(FmgrInfo));
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid outputFunctionId = InvalidOid;
+		bool typeVarLength = false;
+
+		if (!attributeForm->attisdropped)
+		{
+			getTypeOutputInfo(attributeForm->atttypid, &outputFunctionId,
+							  &typeVarLength);
+			fmgr_info(outputFunctionId, &outputFunctionArray[columnIndex]);
+		}
+	}
+
+	blockInfoList = CStoreReadBlockInfo(cstoreFdwOptions->filename, tupleDescriptor,
+										verify);
+
+	oldContext = MemoryContextSwitchTo(resultSetInfo->econtext->ecxt_per_query_memory);
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	resultSetInfo->returnMode = SFRM_Materialize;
+	resultSetInfo->setResult = tupleStore;
+	resultSetInfo->setDesc = resultDescriptor;
+	MemoryContextSwitchTo(oldContext);
+
+	foreach(blockInfoCell, blockInfoList)
+	{
+		ColumnBlockInfo *blockInfo = (ColumnBlockInfo *) lfirst(blockInfoCell);
+		ColumnBlockSkipNode *blockSkipNode = &blockInfo->blockSkipNode;
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														blockInfo->columnIndex);
+		FmgrInfo *outputFunction = &outputFunctionArray[blockInfo->columnIndex];
+		Datum values[11];
+		bool nulls[11];
+		const char *compressionString = COMPRESSION_STRING_NONE;
+
+		if (attributeForm->attisdropped)
+		{
+			continue;
+		}
+
+		if (blockSkipNode->valueCompressionType == COMPRESSION_PG_LZ)
+		{
+			compressionString = COMPRESSION_STRING_PG_LZ;
+		}
+
+		memset(nulls, false, sizeof(nulls));
+		values[0] = Int32GetDatum(blockInfo->segmentIndex);
+		values[1] = Int32GetDatum(blockInfo->stripeIndex);
+		values[2] = NameGetDatum(&attributeForm->attname);
+		values[3] = Int32GetDatum(blockInfo->blockIndex);
+		values[4] = Int64GetDatum(blockSkipNode->rowCount);
+		values[5] = CStringGetTextDatum(compressionString);
+		values[6] = Int64GetDatum(blockSkipNode->existsLength);
+		values[7] = Int64GetDatum(blockSkipNode->valueLength);
+		values[8] = Int64GetDatum(blockInfo->decompressedLength);
+
+		if (blockSkipNode->hasMinMax)
+		{
+			char *minimumString = OutputFunctionCall(outputFunction,
+													 blockSkipNode->minimumValue);
+			char *maximumString = OutputFunctionCall(outputFunction,
+													 blockSkipNode->maximumValue);
+
+			values[9] = CStringGetTextDatum(minimumString);
+			values[10] = CStringGetTextDatum(maximumString);
+		}
+		else
+		{
+			nulls[9] = true;
+			nulls[10] = true;
+		}
+
+		tuplestore_putvalues(tupleStore, resultDescriptor, values, nulls);
+	}
+
+	tuplestore_donestoring(tupleStore);
+	heap_close(relation, AccessShareLock);
+
+	return (Datum) 0;
+}
+
+
+/*
+ * cstore_fdw_handler creates and returns a struct with pointers to foreign
+ * table callback functions.
+ */
+Datum
+cstore_fdw_handler(PG_FUNCTION_ARGS)
+{
+	FdwRoutine *fdwRoutine = makeNode(FdwRoutine);
+
+	fdwRoutine->GetForeignRelSize = CStoreGetForeignRelSize;
+	fdwRoutine->GetForeignPaths = CStoreGetForeignPaths;
+	fdwRoutine->GetForeignPlan = CStoreGetForeignPlan;
+	fdwRoutine->ExplainForeignScan = CStoreExplainForeignScan;
+	fdwRoutine->BeginForeignScan = CStoreBeginForeignScan;
+	fdwRoutine->IterateForeignScan = CStoreIterateForeignScan;
+	fdwRoutine->ReScanForeignScan = CStoreReScanForeignScan;
+	fdwRoutine->EndForeignScan = CStoreEndForeignScan;
+	fdwRoutine->AnalyzeForeignTable = CStoreAnalyzeForeignTable;
+	fdwRoutine->AddForeignUpdateTargets = CStoreAddForeignUpdateTargets;
+	fdwRoutine->PlanForeignModify = CStorePlanForeignModify;
+	fdwRoutine->BeginForeignModify = CStoreBeginForeignModify;
+	fdwRoutine->ExecForeignInsert = CStoreExecForeignInsert;
+	fdwRoutine->ExecForeignUpdate = CStoreExecForeignUpdate;
+	fdwRoutine->ExecForeignDelete = CStoreExecForeignDelete;
+	fdwRoutine->EndForeignModify = CStoreEndForeignModify;
+
+#if PG_VERSION_NUM >= 110000
+	fdwRoutine->BeginForeignInsert = CStoreBeginForeignInsert;
+	fdwRoutine->EndForeignInsert = CStoreEndForeignInsert;
+#endif
+
+#if PG_VERSION_NUM >= 90600
+	fdwRoutine->IsForeignScanParallelSafe = CStoreIsForeignScanParallelSafe;
+#endif
+
+#if PG_VERSION_NUM >= 100000
+	fdwRoutine->GetForeignUpperPaths = CStoreGetForeignUpperPaths;
+#endif
+
+	PG_RETURN_POINTER(fdwRoutine);
+}
+
+
+/*
+ * cstore_fdw_validator validates options given to one of the following commands:
+ * foreign data wrapper, server, user mapping, or foreign table. This function
+ * errors out if the given option name or its value is considered invalid.
+ */
+Datum
+cstore_fdw_validator(PG_FUNCTION_ARGS)
+{
+	Datum optionArray = PG_GETARG_DATUM(0);
+	Oid optionContextId = PG_GETARG_OID(1);
+	List *optionList = untransformRelOptions(optionArray);
+	ListCell *optionCell = NULL;
+	char *filename = NULL;
+	char *compressionTypeString = NULL;
+	char *stripeRowCountString = NULL;
+	char *blockRowCountString = NULL;
+	char *maxSkipValueLengthString = NULL;
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *optionDef = (DefElem *) lfirst(optionCell);
+		char *optionName = optionDef->defname;
+		bool optionValid = false;
+
+		int32 optionIndex = 0;
+		for (optionIndex = 0; optionIndex < ValidOptionCount; optionIndex++)
+		{
+			const CStoreValidOption *validOption = &(ValidOptionArray[optionIndex]);
+
+			if ((optionContextId == validOption->optionContextId) &&
+				(strncmp(optionName, validOption->optionName, NAMEDATALEN) == 0))
+			{
+				optionValid = true;
+				break;
+			}
+		}
+
+		/* if invalid option, display an informative error message */
+		if (!optionValid)
+		{
+			StringInfo optionNamesString = OptionNamesString(optionContextId);
+
+			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+							errmsg("invalid option \"%s\"", optionName),
+							errhint("Valid options in this context are: %s",
+									optionNamesString->data)));
+		}
+
+		if (strncmp(optionName, OPTION_NAME_FILENAME, NAMEDATALEN) == 0)
+		{
+			filename = defGetString(optionDef);
+		}
+		else if (strncmp(optionName, OPTION_NAME_COMPRESSION_TYPE, NAMEDATALEN) == 0)
+		{
+			compressionTypeString = defGetString(optionDef);
+		}
+		else if (strncmp(optionName, OPTION_NAME_STRIPE_ROW_COUNT, NAMEDATALEN) == 0)
+		{
+			stripeRowCountString = defGetString(optionDef);
+		}
+		else if (strncmp(optionName, OPTION_NAME_BLOCK_ROW_COUNT, NAMEDATALEN) == 0)
+		{
+			blockRowCountString = defGetString(optionDef);
+		}
+		else if (strncmp(optionName, OPTION_NAME_MAX_SKIP_VALUE_LENGTH,
+						 NAMEDATALEN) == 0)
+		{
+			maxSkipValueLengthString = defGetString(optionDef);
+		}
+	}
+
+	if (optionContextId == ForeignTableRelationId)
+	{
+		ValidateForeignTableOptions(filename, compressionTypeString,
+									stripeRowCountString, blockRowCountString);
+	}
+	else if (optionContextId == AttributeRelationId &&
+			 maxSkipValueLengthString != NULL)
+	{
+		/* ParseMaxSkipValueLength() errors out if the value is invalid */
+		(void) ParseMaxSkipValueLength(maxSkipValueLengthString);
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * cstore_clean_table_resources cleans up table data and metadata with provided
+ * relation id. The function is meant to be called from drop_event_trigger. It
+ * has no way of knowing if the provided relation id belongs to a cstore table.
+ * Therefore it first checks if data file exists at default location before
+ * attempting to remove data and footer files. If the table is created at a
+ * custom path than its resources would not be removed.
+ */
+Datum
+cstore_clean_table_resources(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+	StringInfo filePath = makeStringInfo();
+	struct stat fileStat;
+	int statResult = -1;
+
+#if PG_VERSION_NUM >= 120000
+
+	/* files of dropped access method tables are deleted when the drop commits */
+	if (CStoreTableAMRelationDropped(relationId))
+	{
+		PG_RETURN_VOID();
+	}
+#endif
+
+	appendStringInfo(filePath, "%s/%s/%d/%d", DataDir, CSTORE_FDW_NAME,
+					 (int) MyDatabaseId, (int) relationId);
+
+	/*
+	 * Check to see if the file exist first. This is the only way to
+	 * find out if the table being dropped is a cstore table.
+	 */
+	statResult = stat(filePath->data, &fileStat);
+	if (statResult == 0)
+	{
+		DeleteCStoreTableFiles(filePath->data);
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * OptionNamesString finds all options that are valid for the current context,
+ * and concatenates these option names in a comma separated string. The function
+ * is unchanged from mongo_fdw.
+ */
+static StringInfo
+OptionNamesString(Oid currentContextId)
+{
+	StringInfo optionNamesString = makeStringInfo();
+	bool firstOptionAppended = false;
+
+	int32 optionIndex = 0;
+	for (optionIndex = 0; optionIndex < ValidOptionCount; optionIndex++)
+	{
+		const CStoreValidOption *validOption = &(ValidOptionArray[optionIndex]);
+
+		/* if option belongs to current context, append option name */
+		if (currentContextId == validOption->optionContextId)
+		{
+			if (firstOptionAppended)
+			{
+				appendStringInfoString(optionNamesString, ", ");
+			}
+
+			appendStringInfoString(optionNamesString, validOption->optionName);
+			firstOptionAppended = true;
+		}
+	}
+
+	return optionNamesString;
+}
+
+
+/*
+ * GetSlotHeapTuple abstracts getting HeapTuple from TupleTableSlot between versions
+ */
+static HeapTuple
+GetSlotHeapTuple(TupleTableSlot *tts)
+{
+#if PG_VERSION_NUM >= 120000
+	return tts->tts_ops->copy_heap_tuple(tts);
+#else
+	return tts->tts_tuple;
+#endif
+}
+
+
+/*
+ * CStoreGetOptions returns the option values to be used when reading and writing
+ * the cstore file. To resolve these values, the function checks options for the
+ * foreign table, and if not present, falls back to default values. This function
+ * errors out if given option values are considered invalid.
+ */
+static CStoreFdwOptions *
+CStoreGetOptions(Oid foreignTableId)
+{
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	char *filename = NULL;
+	CompressionType compressionType = DEFAULT_COMPRESSION_TYPE;
+	int32 stripeRowCount = DEFAULT_STRIPE_ROW_COUNT;
+	int32 blockRowCount = DEFAULT_BLOCK_ROW_COUNT;
+	char *compressionTypeString = NULL;
+	char *stripeRowCountString = NULL;
+	char *blockRowCountString = NULL;
+	char *indexColumnName = NULL;
+	int32 indexColumnIndex = -1;
+
+	filename = CStoreGetOptionValue(foreignTableId, OPTION_NAME_FILENAME);
+	compressionTypeString = CStoreGetOptionValue(foreignTableId,
+												 OPTION_NAME_COMPRESSION_TYPE);
+	stripeRowCountString = CStoreGetOptionValue(foreignTableId,
+												OPTION_NAME_STRIPE_ROW_COUNT);
+	blockRowCountString = CStoreGetOptionValue(foreignTableId,
+											   OPTION_NAME_BLOCK_ROW_COUNT);
+	indexColumnName = CStoreGetOptionValue(foreignTableId, OPTION_NAME_INDEX_COLUMN);
+
+	ValidateForeignTableOptions(filename, compressionTypeString,
+								stripeRowCountString, blockRowCountString);
+
+	/* the validator doesn't know the table's columns, so we check them here */
+	if (indexColumnName != NULL)
+	{
+		indexColumnIndex = IndexColumnIndex(foreignTableId, indexColumnName);
+	}
+
+	/* parse provided options */
+	if (compressionTypeString != NULL)
+	{
+		compressionType = ParseCompressionType(compressionTypeString);
+	}
+	if (stripeRowCountString != NULL)
+	{
+		stripeRowCount = pg_atoi(stripeRowCountString, sizeof(int32), 0);
+	}
+	if (blockRowCountString != NULL)
+	{
+		blockRowCount = pg_atoi(blockRowCountString, sizeof(int32), 0);
+	}
+
+	/* set default filename if it is not provided */
+	if (filename == NULL)
+	{
+		filename = CStoreDefaultFilePath(foreignTableId);
+	}
+
+	cstoreFdwOptions = palloc0(sizeof(CStoreFdwOptions));
+	cstoreFdwOptions->filename = filename;
+	cstoreFdwOptions->compressionType = compressionType;
+	cstoreFdwOptions->stripeRowCount = stripeRowCount;
+	cstoreFdwOptions->blockRowCount = blockRowCount;
+	cstoreFdwOptions->indexColumnIndex = indexColumnIndex;
+	cstoreFdwOptions->maxSkipValueLengthArray = MaxSkipValueLengthArray(foreignTableId);
+
+	return cstoreFdwOptions;
+}
+
+
+/*
+ * CStoreGetOptionValue walks over foreign table and foreign server options, and
+ * looks for the option with the given name. If found, the function returns the
+ * option's value. This function is unchanged from mongo_fdw.
+ */
+static char *
+CStoreGetOptionValue(Oid foreignTableId, const char *optionName)
+{
+	ForeignTable *foreignTable = NULL;
+	ForeignServer *foreignServer = NULL;
+	List *optionList = NIL;
+	ListCell *optionCell = NULL;
+	char *optionValue = NULL;
+
+	foreignTable = GetForeignTable(foreignTableId);
+	foreignServer = GetForeignServer(foreignTable->serverid);
+
+	optionList = list_concat(optionList, foreignTable->options);
+	optionList = list_concat(optionList, foreignServer->options);
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *optionDef = (DefElem *) lfirst(optionCell);
+		char *optionDefName = optionDef->defname;
+
+		if (strncmp(optionDefName, optionName, NAMEDATALEN) == 0)
+		{
+			optionValue = defGetString(optionDef);
+			break;
+		}
+	}
+
+	return optionValue;
+}
+
+
+/*
+ * ValidateForeignTableOptions verifies if given options are valid cstore_fdw
+ * foreign table options. This function errors out if given option value is
+ * considered invalid.
+ */
+static void
+ValidateForeignTableOptions(char *filename, char *compressionTypeString,
+							char *stripeRowCountString, char *blockRowCountString)
+{
+	/* we currently do not have any checks for filename */
+	(void) filename;
+
+	/* check if the provided compression type is valid */
+	if (compressionTypeString != NULL)
+	{
+		CompressionType compressionType = ParseCompressionType(compressionTypeString);
+		if (compressionType == COMPRESSION_TYPE_INVALID)
+		{
+			ereport(ERROR, (errmsg("invalid compression type"),
+							errhint("Valid options are: %s",
+									COMPRESSION_STRING_DELIMITED_LIST)));
+		}
+	}
+
+	/* check if the provided stripe row count has correct format and range */
+	if (stripeRowCountString != NULL)
+	{
+		/* pg_atoi() errors out if the given string is not a valid 32-bit integer */
+		int32 stripeRowCount = pg_atoi(stripeRowCountString, sizeof(int32), 0);
+		if (stripeRowCount < STRIPE_ROW_COUNT_MINIMUM ||
+			stripeRowCount > STRIPE_ROW_COUNT_MAXIMUM)
+		{
+			ereport(ERROR, (errmsg("invalid stripe row count"),
+							errhint("Stripe row count must be an integer between "
+									"%d and %d", STRIPE_ROW_COUNT_MINIMUM,
+									STRIPE_ROW_COUNT_MAXIMUM)));
+		}
+	}
+
+	/* check if the provided block row count has correct format and range */
+	if (blockRowCountString != NULL)
+	{
+		/* pg_atoi() errors out if the given string is not a valid 32-bit integer */
+		int32 blockRowCount = pg_atoi(blockRowCountString, sizeof(int32), 0);
+		if (blockRowCount < BLOCK_ROW_COUNT_MINIMUM ||
+			blockRowCount > BLOCK_ROW_COUNT_MAXIMUM)
+		{
+			ereport(ERROR, (errmsg("invalid block row count"),
+							errhint("Block row count must be an integer between "
+									"%d and %d", BLOCK_ROW_COUNT_MINIMUM,
+									BLOCK_ROW_COUNT_MAXIMUM)));
+		}
+	}
+}
+
+
+/*
+ * IndexColumnIndex finds the column of the given foreign table that the given
+ * index column option names, and returns the column's index. The function errors
+ * out if the table has no such column, or if the column's data type has no hash
+ * function for the column's sparse index.
+ */
+static int32
+IndexColumnIndex(Oid foreignTableId, char *indexColumnName)
+{
+	AttrNumber attributeNumber = get_attnum(foreignTableId, indexColumnName);
+	Oid columnTypeId = InvalidOid;
+
+	if (attributeNumber == InvalidAttrNumber)
+	{
+		ereport(ERROR, (errmsg("invalid index column"),
+						errdetail("Column \"%s\" does not exist.", indexColumnName)));
+	}
+
+	columnTypeId = get_atttype(foreignTableId, attributeNumber);
+	if (GetFunctionInfoOrNull(columnTypeId, HASH_AM_OID, HASHSTANDARD_PROC) == NULL)
+	{
+		ereport(ERROR, (errmsg("invalid index column"),
+						errdetail("Data type %s has no default hash operator class.",
+								  format_type_be(columnTypeId))));
+	}
+
+	return attributeNumber - 1;
+}
+
+
+/*
+ * CheckIndexColumnOption errors out if the index column option of the given
+ * cstore table doesn't name a column that can have a sparse index. We check this
+ * when the option is set, since the validator doesn't know the table's columns.
+ */
+static void
+CheckIndexColumnOption(Oid foreignTableId)
+{
+	char *indexColumnName = CStoreGetOptionValue(foreignTableId,
+												 OPTION_NAME_INDEX_COLUMN);
+
+	if (indexColumnName != NULL)
+	{
+		IndexColumnIndex(foreignTableId, indexColumnName);
+	}
+}
+
+
+/*
+ * MaxSkipValueLengthArray returns the maximum skip value length of each column
+ * of the given foreign table. Columns that don't set the option get the default
+ * length.
+ */
+static uint32 *
+MaxSkipValueLengthArray(Oid foreignTableId)
+{
+	AttrNumber columnCount = get_relnatts(foreignTableId);
+	uint32 *maxSkipValueLengthArray = palloc0(columnCount * sizeof(uint32));
+	AttrNumber attributeNumber = 0;
+
+	for (attributeNumber = 1; attributeNumber <= columnCount; attributeNumber++)
+	{
+		List *optionList = GetForeignColumnOptions(foreignTableId, attributeNumber);
+		ListCell *optionCell = NULL;
+		uint32 maxSkipValueLength = DEFAULT_MAX_SKIP_VALUE_LENGTH;
+
+		foreach(optionCell, optionList)
+		{
+			DefElem *optionDef = (DefElem *) lfirst(optionCell);
+
+			if (strncmp(optionDef->defname, OPTION_NAME_MAX_SKIP_VALUE_LENGTH,
+						NAMEDATALEN) == 0)
+			{
+				maxSkipValueLength = ParseMaxSkipValueLength(defGetString(optionDef));
+			}
+		}
+
+		maxSkipValueLengthArray[attributeNumber - 1] = maxSkipValueLength;
+	}
+
+	return maxSkipValueLengthArray;
+}
+
+
+/*
+ * ParseMaxSkipValueLength converts a string to a maximum skip value length, and
+ * errors out if the string isn't an integer in the valid range. 0 means the
+ * column's skip values aren't limited.
+ */
+static uint32
+ParseMaxSkipValueLength(char *maxSkipValueLengthString)
+{
+	/* pg_atoi() errors out if the given string is not a valid 32-bit integer */
+	int32 maxSkipValueLength = pg_atoi(maxSkipValueLengthString, sizeof(int32), 0);
+	if (maxSkipValueLength < 0 || maxSkipValueLength > MAX_SKIP_VALUE_LENGTH_MAXIMUM)
+	{
+		ereport(ERROR, (errmsg("invalid maximum skip value length"),
+						errhint("Maximum skip value length must be an integer "
+								"between 0 and %d", MAX_SKIP_VALUE_LENGTH_MAXIMUM)));
+	}
+
+	return (uint32) maxSkipValueLength;
+}
+
+
+/*
+ * CStoreDefaultFilePath constructs the default file path to use for a cstore_fdw
+ * table. The path is of the form $PGDATA/cstore_fdw/{databaseOid}/{relfilenode}.
+ */
+static char *
+CStoreDefaultFilePath(Oid foreignTableId)
+{
+	Relation relation = relation_open(foreignTableId, AccessShareLock);
+	RelFileNode relationFileNode = relation->rd_node;
+	Oid databaseOid = relationFileNode.dbNode;
+	Oid relationFileOid = relationFileNode.relNode;
+
+	relation_close(relation, AccessShareLock);
+
+	/* PG12 onward does not create relfilenode for foreign tables */
+	if (databaseOid == InvalidOid)
+	{
+		databaseOid = MyDatabaseId;
+		relationFileOid = foreignTableId;
+
+	}
+
+	StringInfo cstoreFilePath = makeStringInfo();
+	appendStringInfo(cstoreFilePath, "%s/%s/%u/%u", DataDir, CSTORE_FDW_NAME,
+					 databaseOid, relationFileOid);
+
+	return cstoreFilePath->data;
+}
+
+
+/* ParseCompressionType converts a string to a compression type. */
+static CompressionType
+ParseCompressionType(const char *compressionTypeString)
+{
+	CompressionType compressionType = COMPRESSION_TYPE_INVALID;
+	Assert(compressionTypeString != NULL);
+
+	if (strncmp(compressionTypeString, COMPRESSION_STRING_NONE, NAMEDATALEN) == 0)
+	{
+		compressionType = COMPRESSION_NONE;
+	}
+	else if (strncmp(compressionTypeString, COMPRESSION_STRING_PG_LZ, NAMEDATALEN) == 0)
+	{
+		compressionType = COMPRESSION_PG_LZ;
+	}
+
+	return compressionType;
+}
+
+
+/*
+ * CStoreGetForeignRelSize obtains relation size estimates for a foreign table and
+ * puts its estimate for row count into baserel->rows.
+ */
+static void
+CStoreGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId)
+{
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+	double tupleCountEstimate = TupleCountEstimate(baserel, cstoreFdwOptions->filename);
+	double rowSelectivity = clauselist_selectivity(root, baserel->baserestrictinfo,
+												   0, JOIN_INNER, NULL);
+
+	double outputRowCount = clamp_row_est(tupleCountEstimate * rowSelectivity);
+	baserel->rows = outputRowCount;
+}
+
+
+/*
+ * CStoreGetForeignPaths creates possible access paths for a scan on the foreign
+ * table. The first path filters out row blocks that are refuted by where
+ * clauses, and only returns values for the projected columns. We then add
+ * parameterized paths that also use join clauses for filtering row blocks, and
+ * a sorted path for queries that only need the first rows in some order.
+ */
+static void
+CStoreGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId)
+{
+	Path *foreignScanPath = NULL;
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+	Relation relation = heap_open(foreignTableId, AccessShareLock);
+
+	/*
+	 * We skip reading columns that are not in query. Here we assume that all
+	 * columns in relation have the same width, and estimate the number pages
+	 * that will be read by query.
+	 *
+	 * Ideally, we should also take into account the row blocks that will be
+	 * suppressed. But for that we need to know which columns are used for
+	 * sorting. If we wrongly assume that we are sorted by a specific column
+	 * and underestimate the page count, planner may choose nested loop join
+	 * in a place it shouldn't be used. Choosing merge join or hash join is
+	 * usually safer than nested loop join, so we take the more conservative
 	 * approach and assume all rows in the columnar store file will be read.
-	 * We intend to fix this in later version by improving the row sampling
-	 * algorithm and using the correlation statistics to detect which columns
-	 * are in stored in sorted order.
+	 * Parameterized paths below use the correlation statistics instead.
+	 */
+	List *queryColumnList = ColumnList(baserel, foreignTableId);
+	uint32 queryColumnCount = list_length(queryColumnList);
+	BlockNumber relationPageCount = PageCount(cstoreFdwOptions->filename);
+	uint32 relationColumnCount = RelationGetNumberOfAttributes(relation);
+
+	double queryColumnRatio = (double) queryColumnCount / relationColumnCount;
+	double queryPageCount = relationPageCount * queryColumnRatio;
+	double totalDiskAccessCost = seq_page_cost * queryPageCount;
+
+	double tupleCountEstimate = TupleCountEstimate(baserel, cstoreFdwOptions->filename);
+
+	/*
+	 * We estimate costs almost the same way as cost_seqscan(), thus assuming
+	 * that I/O costs are equivalent to a regular table file of the same size.
+	 */
+	double filterCostPerTuple = baserel->baserestrictcost.per_tuple;
+	double cpuCostPerTuple = cpu_tuple_cost + filterCostPerTuple;
+	double totalCpuCost = cpuCostPerTuple * tupleCountEstimate;
+
+	double startupCost = baserel->baserestrictcost.startup;
+	double totalCost  = startupCost + totalCpuCost + totalDiskAccessCost;
+
+	/* create a foreign path node for the unparameterized scan */
+#if PG_VERSION_NUM >= 90600
+	foreignScanPath = (Path *) create_foreignscan_path(root, baserel,
+													   NULL, /* path target */
+													   baserel->rows,
+													   startupCost, totalCost,
+													   NIL,  /* no known ordering */
+													   NULL, /* not parameterized */
+													   NULL, /* no outer path */
+													   NIL); /* no fdw_private */
+
+#elif PG_VERSION_NUM >= 90500
+	foreignScanPath = (Path *) create_foreignscan_path(root, baserel, baserel->rows,
+													   startupCost, totalCost,
+													   NIL,  /* no known ordering */
+													   NULL, /* not parameterized */
+													   NULL, /* no outer path */
+													   NIL); /* no fdw_private */
+#else
+	foreignScanPath = (Path *) create_foreignscan_path(root, baserel, baserel->rows,
+													   startupCost, totalCost,
+													   NIL,  /* no known ordering */
+													   NULL, /* not parameterized */
+													   NIL); /* no fdw_private */
+#endif
+
+	add_path(baserel, foreignScanPath);
+
+	/* add paths that skip blocks using join key values from outer relations */
+	CStoreGetParameterizedPaths(root, baserel, foreignTableId, queryColumnList,
+								tupleCountEstimate, totalDiskAccessCost,
+								cstoreFdwOptions->blockRowCount);
+
+	/* add a path that returns the first rows of ORDER BY ... LIMIT queries */
+	CStoreGetTopNPaths(root, baserel, relation, queryColumnList, tupleCountEstimate,
+					   totalDiskAccessCost, cstoreFdwOptions->blockRowCount);
+
+	heap_close(relation, AccessShareLock);
+}
+
+
+/*
+ * CStoreGetParameterizedPaths creates parameterized scan paths on the foreign
+ * table. In these paths, join clauses that compare a column of the table with
+ * expressions over outer relations are evaluated with the outer row's values,
+ * and are used for skipping blocks on each rescan. This lets a nested loop with
+ * a small outer relation read only the blocks which may contain matching keys.
+ *
+ * We only know how many blocks are skipped if the table is sorted on the join
+ * column. We therefore interpolate between the sorted and unsorted cases with
+ * the column's correlation statistics, similar to how cost_index() estimates
+ * heap page fetches.
+ */
+static void
+CStoreGetParameterizedPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
+							List *queryColumnList, double tupleCountEstimate,
+							double totalDiskAccessCost, uint32 blockRowCount)
+{
+	List *paramInfoList = ParameterizedPathInfoList(root, baserel, queryColumnList);
+	ListCell *paramInfoCell = NULL;
+
+	foreach(paramInfoCell, paramInfoList)
+	{
+		ParamPathInfo *paramInfo = (ParamPathInfo *) lfirst(paramInfoCell);
+		Path *foreignScanPath = NULL;
+		QualCost joinClauseCost;
+		double blockFraction = 0.0;
+		double filterCostPerTuple = 0.0;
+		double cpuCostPerTuple = 0.0;
+		double totalCpuCost = 0.0;
+		double startupCost = 0.0;
+		double totalCost = 0.0;
+
+		blockFraction = ParameterizedBlockFraction(root, baserel, paramInfo,
+												   foreignTableId, tupleCountEstimate,
+												   blockRowCount);
+
+		/* parameterized join clauses are checked for every row we read */
+		cost_qual_eval(&joinClauseCost, paramInfo->ppi_clauses, root);
+
+		filterCostPerTuple = baserel->baserestrictcost.per_tuple +
+							 joinClauseCost.per_tuple;
+		cpuCostPerTuple = cpu_tuple_cost + filterCostPerTuple;
+		totalCpuCost = cpuCostPerTuple * tupleCountEstimate * blockFraction;
+
+		startupCost = baserel->baserestrictcost.startup + joinClauseCost.startup;
+		totalCost = startupCost + totalCpuCost + totalDiskAccessCost * blockFraction;
+
+#if PG_VERSION_NUM >= 90600
+		foreignScanPath = (Path *) create_foreignscan_path(root, baserel,
+														   NULL, /* path target */
+														   paramInfo->ppi_rows,
+														   startupCost, totalCost,
+														   NIL,  /* no known ordering */
+														   paramInfo->ppi_req_outer,
+														   NULL, /* no outer path */
+														   NIL); /* no fdw_private */
+#elif PG_VERSION_NUM >= 90500
+		foreignScanPath = (Path *) create_foreignscan_path(root, baserel,
+														   paramInfo->ppi_rows,
+														   startupCost, totalCost,
+														   NIL,  /* no known ordering */
+														   paramInfo->ppi_req_outer,
+														   NULL, /* no outer path */
+														   NIL); /* no fdw_private */
+#else
+		foreignScanPath = (Path *) create_foreignscan_path(root, baserel,
+														   paramInfo->ppi_rows,
+														   startupCost, totalCost,
+														   NIL,  /* no known ordering */
+														   paramInfo->ppi_req_outer,
+														   NIL); /* no fdw_private */
+#endif
+
+		add_path(baserel, foreignScanPath);
+	}
+}
+
+
+/*
+ * ParameterizedPathInfoList finds join clauses which can be used for skipping
+ * blocks in a parameterized scan, and returns the distinct parameterizations
+ * for these clauses. The function considers both regular join clauses and
+ * equality clauses implied by equivalence classes. This function is based on
+ * similar logic in postgres_fdw.
+ */
+static List *
+ParameterizedPathInfoList(PlannerInfo *root, RelOptInfo *baserel, List *queryColumnList)
+{
+	List *paramInfoList = NIL;
+	ListCell *restrictInfoCell = NULL;
+	ListCell *columnCell = NULL;
+
+	foreach(restrictInfoCell, baserel->joininfo)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+
+#if PG_VERSION_NUM >= 90500
+		if (!join_clause_is_movable_to(restrictInfo, baserel))
+#else
+		if (!join_clause_is_movable_to(restrictInfo, baserel->relid))
+#endif
+		{
+			continue;
+		}
+
+		if (JoinClauseFilterColumn(restrictInfo->clause, baserel) == NULL)
+		{
+			continue;
+		}
+
+		paramInfoList = AppendParamPathInfo(root, baserel, restrictInfo, paramInfoList);
+	}
+
+	if (!baserel->has_eclass_joins)
+	{
+		return paramInfoList;
+	}
+
+	foreach(columnCell, queryColumnList)
+	{
+		Var *column = (Var *) lfirst(columnCell);
+		List *clauseList = generate_implied_equalities_for_column(root, baserel,
+																  ColumnEquivalenceMemberMatches,
+																  (void *) column,
+																  baserel->lateral_referencers);
+
+		foreach(restrictInfoCell, clauseList)
+		{
+			RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+
+			if (JoinClauseFilterColumn(restrictInfo->clause, baserel) == NULL)
+			{
+				continue;
+			}
+
+			paramInfoList = AppendParamPathInfo(root, baserel, restrictInfo,
+												paramInfoList);
+		}
+	}
+
+	return paramInfoList;
+}
+
+
+/*
+ * AppendParamPathInfo finds the parameterization required by the given join
+ * clause, and appends it to the given list if it isn't already there.
+ */
+static List *
+AppendParamPathInfo(PlannerInfo *root, RelOptInfo *baserel, RestrictInfo *restrictInfo,
+					List *paramInfoList)
+{
+	ParamPathInfo *paramInfo = NULL;
+	Relids requiredOuter = bms_union(restrictInfo->clause_relids,
+									 baserel->lateral_relids);
+
+	requiredOuter = bms_del_member(requiredOuter, baserel->relid);
+	if (bms_is_empty(requiredOuter))
+	{
+		return paramInfoList;
+	}
+
+	paramInfo = get_baserel_parampathinfo(root, baserel, requiredOuter);
+
+	return list_append_unique_ptr(paramInfoList, paramInfo);
+}
+
+
+/*
+ * ColumnEquivalenceMemberMatches is the callback we use to find equivalence
+ * class members that refer to the given column of the foreign table.
+ */
+static bool
+ColumnEquivalenceMemberMatches(PlannerInfo *root, RelOptInfo *baserel,
+							   EquivalenceClass *equivalenceClass,
+							   EquivalenceMember *equivalenceMember, void *context)
+{
+	Var *column = (Var *) context;
+	Expr *memberExpression = equivalenceMember->em_expr;
+	Var *memberColumn = NULL;
+
+	while (IsA(memberExpression, RelabelType))
+	{
+		memberExpression = ((RelabelType *) memberExpression)->arg;
+	}
+
+	if (!IsA(memberExpression, Var))
+	{
+		return false;
+	}
+
+	memberColumn = (Var *) memberExpression;
+
+	return (memberColumn->varno == column->varno &&
+			memberColumn->varattno == column->varattno &&
+			memberColumn->varlevelsup == 0);
+}
+
+
+/*
+ * JoinClauseFilterColumn checks if the given clause compares a column of the
+ * foreign table against an expression over other relations with a btree
+ * operator of the column's type, that is if we can use the clause's runtime
+ * value to refute block min/max values. If so, the function returns the column.
+ * Otherwise, the function returns NULL.
+ */
+static Var *
+JoinClauseFilterColumn(Expr *clause, RelOptInfo *baserel)
+{
+	OpExpr *operatorExpression = NULL;
+	Node *leftOperand = NULL;
+	Node *rightOperand = NULL;
+	Node *otherOperand = NULL;
+	Var *column = NULL;
+	Oid operatorClassId = InvalidOid;
+	Oid operatorFamilyId = InvalidOid;
+
+	if (!is_opclause(clause))
+	{
+		return NULL;
+	}
+
+	operatorExpression = (OpExpr *) clause;
+	if (list_length(operatorExpression->args) != 2)
+	{
+		return NULL;
+	}
+
+	leftOperand = (Node *) linitial(operatorExpression->args);
+	rightOperand = (Node *) lsecond(operatorExpression->args);
+
+	while (IsA(leftOperand, RelabelType))
+	{
+		leftOperand = (Node *) ((RelabelType *) leftOperand)->arg;
+	}
+	while (IsA(rightOperand, RelabelType))
+	{
+		rightOperand = (Node *) ((RelabelType *) rightOperand)->arg;
+	}
+
+	if (IsA(leftOperand, Var) && ((Var *) leftOperand)->varno == baserel->relid)
+	{
+		column = (Var *) leftOperand;
+		otherOperand = rightOperand;
+	}
+	else if (IsA(rightOperand, Var) && ((Var *) rightOperand)->varno == baserel->relid)
+	{
+		column = (Var *) rightOperand;
+		otherOperand = leftOperand;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	if (column->varlevelsup != 0 || column->varattno <= 0)
+	{
+		return NULL;
+	}
+
+	if (bms_is_member(baserel->relid, pull_varnos(otherOperand)) ||
+		contain_volatile_functions(otherOperand))
+	{
+		return NULL;
+	}
+
+	operatorClassId = GetDefaultOpClass(column->vartype, BTREE_AM_OID);
+	if (operatorClassId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	operatorFamilyId = get_opclass_family(operatorClassId);
+	if (!op_in_opfamily(operatorExpression->opno, operatorFamilyId))
+	{
+		return NULL;
+	}
+
+	return column;
+}
+
+
+/*
+ * ParameterizedBlockFraction estimates the fraction of blocks a parameterized
+ * scan reads. If the table is sorted on a join column, we read the blocks that
+ * hold the matching rows plus one partial block. If the column is not
+ * correlated with the physical row order, we read all blocks.
+ */
+static double
+ParameterizedBlockFraction(PlannerInfo *root, RelOptInfo *baserel,
+						   ParamPathInfo *paramInfo, Oid foreignTableId,
+						   double tupleCountEstimate, uint32 blockRowCount)
+{
+	List *joinClauseList = paramInfo->ppi_clauses;
+	ListCell *restrictInfoCell = NULL;
+	double maximumCorrelationSquared = 0.0;
+	double rowFraction = 0.0;
+	double sortedBlockFraction = 0.0;
+	double blockFraction = 0.0;
+
+	foreach(restrictInfoCell, joinClauseList)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+		Var *column = JoinClauseFilterColumn(restrictInfo->clause, baserel);
+		double correlation = 0.0;
+
+		if (column == NULL)
+		{
+			continue;
+		}
+
+		correlation = ColumnCorrelation(foreignTableId, column->varattno);
+		if (correlation * correlation > maximumCorrelationSquared)
+		{
+			maximumCorrelationSquared = correlation * correlation;
+		}
+	}
+
+	rowFraction = clauselist_selectivity(root, joinClauseList, baserel->relid,
+										 JOIN_INNER, NULL);
+	sortedBlockFraction = rowFraction + blockRowCount / Max(tupleCountEstimate, 1.0);
+	sortedBlockFraction = Min(sortedBlockFraction, 1.0);
+
+	blockFraction = maximumCorrelationSquared * sortedBlockFraction +
+					(1.0 - maximumCorrelationSquared);
+
+	return blockFraction;
+}
+
+
+/*
+ * ColumnCorrelation returns the correlation between the physical row order and
+ * the logical order of the given column's values, as computed by ANALYZE. If
+ * the column doesn't have this statistic, the function returns zero.
+ */
+static double
+ColumnCorrelation(Oid relationId, AttrNumber attributeNumber)
+{
+	double correlation = 0.0;
+	HeapTuple statisticsTuple = SearchSysCache3(STATRELATTINH,
+												ObjectIdGetDatum(relationId),
+												Int16GetDatum(attributeNumber),
+												BoolGetDatum(false));
+	if (!HeapTupleIsValid(statisticsTuple))
+	{
+		return 0.0;
+	}
+
+#if PG_VERSION_NUM >= 100000
+	{
+		AttStatsSlot statisticsSlot;
+
+		if (get_attstatsslot(&statisticsSlot, statisticsTuple,
+							 STATISTIC_KIND_CORRELATION, InvalidOid,
+							 ATTSTATSSLOT_NUMBERS))
+		{
+			if (statisticsSlot.nnumbers == 1)
+			{
+				correlation = statisticsSlot.numbers[0];
+			}
+
+			free_attstatsslot(&statisticsSlot);
+		}
+	}
+#else
+	{
+		float4 *numberArray = NULL;
+		int numberCount = 0;
+
+		if (get_attstatsslot(statisticsTuple, InvalidOid, 0,
+							 STATISTIC_KIND_CORRELATION, InvalidOid, NULL,
+							 NULL, NULL, &numberArray, &numberCount))
+		{
+			if (numberCount == 1)
+			{
+				correlation = numberArray[0];
+			}
+
+			free_attstatsslot(InvalidOid, NULL, 0, numberArray, numberCount);
+		}
+	}
+#endif
+
+	ReleaseSysCache(statisticsTuple);
+
+	return correlation;
+}
+
+
+/*
+ * CStoreGetTopNPaths adds a sorted path for single table queries that only need
+ * the first rows in the order of a column, such as ORDER BY ts DESC LIMIT 50.
+ * The path reads blocks in the order of their min/max values for this column,
+ * and stops once the remaining blocks can't have rows among the first ones.
+ * We estimate the blocks read with the column's correlation statistics, the
+ * same way we do for parameterized paths.
+ */
+static void
+CStoreGetTopNPaths(PlannerInfo *root, RelOptInfo *baserel, Relation relation,
+				   List *queryColumnList, double tupleCountEstimate,
+				   double totalDiskAccessCost, uint32 blockRowCount)
+{
+	Path *foreignScanPath = NULL;
+	Var *sortColumn = NULL;
+	bool sortDescending = false;
+	bool sortNullsFirst = false;
+	List *topNList = NIL;
+	double limitCount = root->limit_tuples;
+	double rowCount = 0.0;
+	double correlation = 0.0;
+	double sortedBlockFraction = 0.0;
+	double blockFraction = 0.0;
+	double comparisonCost = 0.0;
+	double cpuCostPerTuple = 0.0;
+	double totalCpuCost = 0.0;
+	double totalCost = 0.0;
+
+	/* we need a known limit that is small enough to keep the rows in memory */
+	if (limitCount < 1.0 || limitCount > CSTORE_MAX_TOP_N_LIMIT)
+	{
+		return;
+	}
+
+	sortColumn = TopNSortColumn(root, baserel, queryColumnList, &sortDescending,
+								&sortNullsFirst);
+	if (sortColumn == NULL)
+	{
+		return;
+	}
+
+	rowCount = Min(baserel->rows, limitCount);
+
+	correlation = ColumnCorrelation(RelationGetRelid(relation), sortColumn->varattno);
+	sortedBlockFraction = limitCount / Max(baserel->rows, 1.0) +
+						  blockRowCount / Max(tupleCountEstimate, 1.0);
+	sortedBlockFraction = Min(sortedBlockFraction, 1.0);
+	blockFraction = correlation * correlation * sortedBlockFraction +
+					(1.0 - correlation * correlation);
+
+	/* we compare each row we read against the bounded heap, as in cost_sort() */
+	comparisonCost = 2.0 * cpu_operator_cost * log(Max(limitCount, 2.0)) / log(2.0);
+	cpuCostPerTuple = cpu_tuple_cost + baserel->baserestrictcost.per_tuple +
+					  comparisonCost;
+	totalCpuCost = cpuCostPerTuple * tupleCountEstimate * blockFraction;
+
+	/* we return the first row only after reading all the rows we need */
+	totalCost = baserel->baserestrictcost.startup + totalCpuCost +
+				totalDiskAccessCost * blockFraction;
+
+	topNList = list_make4(sortColumn, makeInteger(sortDescending),
+						  makeInteger(sortNullsFirst), makeInteger((long) limitCount));
+
+#if PG_VERSION_NUM >= 90600
+	foreignScanPath = (Path *) create_foreignscan_path(root, baserel,
+													   NULL, /* path target */
+													   rowCount,
+													   totalCost, totalCost,
+													   root->query_pathkeys,
+													   NULL, /* not parameterized */
+													   NULL, /* no outer path */
+													   topNList);
+#elif PG_VERSION_NUM >= 90500
+	foreignScanPath = (Path *) create_foreignscan_path(root, baserel, rowCount,
+													   totalCost, totalCost,
+													   root->query_pathkeys,
+													   NULL, /* not parameterized */
+													   NULL, /* no outer path */
+													   topNList);
+#else
+	foreignScanPath = (Path *) create_foreignscan_path(root, baserel, rowCount,
+													   totalCost, totalCost,
+													   root->query_pathkeys,
+													   NULL, /* not parameterized */
+													   topNList);
+#endif
+
+	add_path(baserel, foreignScanPath);
+}
+
+
+/*
+ * TopNSortColumn checks if the query only needs the first rows of the foreign
+ * table in the order of one of its columns, and if we can produce these rows
+ * using block min/max values. If so, the function returns the column and sets
+ * the sort direction and null ordering. Otherwise, the function returns NULL.
+ *
+ * The query must scan only this table, and must return the table's rows after
+ * sorting them. So we don't handle grouping, aggregates, window functions or
+ * set returning functions. The sort must use the column type's default btree
+ * operators and the column's collation, since we compute min/max values with
+ * them. Nulls may sort first or last; blocks' value counts tell us which blocks
+ * have nulls.
+ */
+static Var *
+TopNSortColumn(PlannerInfo *root, RelOptInfo *baserel, List *queryColumnList,
+			   bool *sortDescending, bool *sortNullsFirst)
+{
+	Query *query = root->parse;
+	PathKey *pathKey = NULL;
+	EquivalenceClass *equivalenceClass = NULL;
+	ListCell *memberCell = NULL;
+	ListCell *columnCell = NULL;
+	Var *memberColumn = NULL;
+	Oid operatorClassId = InvalidOid;
+
+	if (baserel->reloptkind != RELOPT_BASEREL ||
+		!bms_equal(baserel->relids, root->all_baserels))
+	{
+		return NULL;
+	}
+
+	if (query->groupClause != NIL || query->hasAggs || query->hasWindowFuncs ||
+		query->distinctClause != NIL || query->havingQual != NULL ||
+		query->setOperations != NULL ||
+		expression_returns_set((Node *) query->targetList))
+	{
+		return NULL;
+	}
+
+#if PG_VERSION_NUM >= 90500
+	if (query->groupingSets != NIL)
+	{
+		return NULL;
+	}
+#endif
+
+	if (root->query_pathkeys != root->sort_pathkeys ||
+		list_length(root->query_pathkeys) != 1)
+	{
+		return NULL;
+	}
+
+	pathKey = (PathKey *) linitial(root->query_pathkeys);
+	equivalenceClass = pathKey->pk_eclass;
+	if (equivalenceClass->ec_has_volatile)
+	{
+		return NULL;
+	}
+
+	foreach(memberCell, equivalenceClass->ec_members)
+	{
+		EquivalenceMember *member = (EquivalenceMember *) lfirst(memberCell);
+		Expr *memberExpression = member->em_expr;
+
+		while (IsA(memberExpression, RelabelType))
+		{
+			memberExpression = ((RelabelType *) memberExpression)->arg;
+		}
+
+		if (IsA(memberExpression, Var) &&
+			((Var *) memberExpression)->varno == baserel->relid &&
+			((Var *) memberExpression)->varlevelsup == 0 &&
+			((Var *) memberExpression)->varattno > 0)
+		{
+			memberColumn = (Var *) memberExpression;
+			break;
+		}
+	}
+
+	if (memberColumn == NULL)
+	{
+		return NULL;
+	}
+
+	operatorClassId = GetDefaultOpClass(memberColumn->vartype, BTREE_AM_OID);
+	if (operatorClassId == InvalidOid ||
+		pathKey->pk_opfamily != get_opclass_family(operatorClassId) ||
+		equivalenceClass->ec_collation != memberColumn->varcollid)
+	{
+		return NULL;
+	}
+
+	(*sortNullsFirst) = pathKey->pk_nulls_first;
+
+	if (pathKey->pk_strategy == BTLessStrategyNumber)
+	{
+		(*sortDescending) = false;
+	}
+	else if (pathKey->pk_strategy == BTGreaterStrategyNumber)
+	{
+		(*sortDescending) = true;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	/* use the query column, so the reader finds it among projected columns */
+	foreach(columnCell, queryColumnList)
+	{
+		Var *column = (Var *) lfirst(columnCell);
+		if (column->varattno == memberColumn->varattno)
+		{
+			return column;
+		}
+	}
+
+	return NULL;
+}
+
+
+#if PG_VERSION_NUM >= 100000
+
+/*
+ * CStoreGetForeignUpperPaths adds a path that computes simple aggregates, such
+ * as count, sum, avg, min and max, in the foreign scan itself. Instead of
+ * converting every row into a tuple and passing it to an aggregate node, the
+ * scan runs tight loops over the column values of each block. Optionally, the
+ * scan also groups rows by a single column. We keep all groups in memory, so we
+ * only do this when the column has few distinct values.
+ */
+#if PG_VERSION_NUM >= 110000
+static void
+CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+						   RelOptInfo *inputRel, RelOptInfo *outputRel, void *extra)
+#else
+static void
+CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+						   RelOptInfo *inputRel, RelOptInfo *outputRel)
+#endif
+{
+	Query *query = root->parse;
+	PathTarget *groupingTarget = root->upper_targets[UPPERREL_GROUP_AGG];
+	Path *aggregatePath = NULL;
+	Var *groupColumn = NULL;
+	List *whereClauseList = NIL;
+	List *scanTargetList = NIL;
+	List *aggregateList = NIL;
+	List *aggregateScanList = NIL;
+	List *columnList = NIL;
+	List *foreignPrivateList = NIL;
+	ListCell *restrictInfoCell = NULL;
+	ListCell *scanTargetCell = NULL;
+	Oid foreignTableId = InvalidOid;
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	Relation relation = NULL;
+	uint32 relationColumnCount = 0;
+	BlockNumber relationPageCount = 0;
+	double queryColumnRatio = 0.0;
+	double totalDiskAccessCost = 0.0;
+	double tupleCountEstimate = 0.0;
+	double groupCount = 1.0;
+	double cpuCostPerTuple = 0.0;
+	double startupCost = 0.0;
+	double totalCost = 0.0;
+
+	if (stage != UPPERREL_GROUP_AGG || inputRel->reloptkind != RELOPT_BASEREL)
+	{
+		return;
+	}
+
+	if (query->groupingSets != NIL || query->havingQual != NULL ||
+		query->hasTargetSRFs || list_length(query->groupClause) > 1)
+	{
+		return;
+	}
+
+	/*
+	 * We evaluate the restriction clauses ourselves. Security barrier clauses
+	 * must run before other clauses, and we can't set up executor parameters
+	 * or subplans in clauses that we keep in the plan's private list.
+	 */
+	foreach(restrictInfoCell, inputRel->baserestrictinfo)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+		bool evaluateExecParams = false;
+
+		if (restrictInfo->security_level > 0 ||
+			ContainsNonEvaluableNodeWalker((Node *) restrictInfo->clause,
+										   &evaluateExecParams))
+		{
+			return;
+		}
+
+		whereClauseList = lappend(whereClauseList, restrictInfo->clause);
+	}
+
+	if (query->groupClause != NIL)
+	{
+		SortGroupClause *groupClause = (SortGroupClause *) linitial(query->groupClause);
+		Node *groupExpression = get_sortgroupclause_expr(groupClause,
+														 query->targetList);
+
+		if (!IsA(groupExpression, Var))
+		{
+			return;
+		}
+
+		groupColumn = (Var *) groupExpression;
+		if (groupColumn->varno != inputRel->relid || groupColumn->varattno <= 0 ||
+			!(IntegerColumnType(groupColumn->vartype) ||
+			  groupColumn->vartype == BOOLOID))
+		{
+			return;
+		}
+	}
+
+	scanTargetList = AggregateScanTargetList(groupingTarget, groupColumn);
+	if (scanTargetList == NIL)
+	{
+		return;
+	}
+
+	/* the scan returns the grouping column and aggregates in this order */
+	foreach(scanTargetCell, scanTargetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(scanTargetCell);
+		List *aggregate = NIL;
+
+		if (IsA(targetEntry->expr, Var))
+		{
+			aggregate = list_make2_int(AGGREGATE_GROUP_COLUMN, groupColumn->varattno);
+		}
+		else
+		{
+			aggregate = ScanAggregateFunction((Aggref *) targetEntry->expr, inputRel);
+			if (aggregate == NIL)
+			{
+				return;
+			}
+		}
+
+		aggregateList = lappend(aggregateList, aggregate);
+	}
+
+	foreignTableId = planner_rt_fetch(inputRel->relid, root)->relid;
+	cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+	tupleCountEstimate = TupleCountEstimate(inputRel, cstoreFdwOptions->filename);
+
+	if (groupColumn != NULL)
+	{
+		double groupSize = MAXALIGN(sizeof(AggregateGroup)) +
+						   MAXALIGN(list_length(aggregateList) *
+									sizeof(AggregateTransition)) +
+						   MAXALIGN(sizeof(AggregateGroup *));
+
+		groupCount = estimate_num_groups(root, list_make1(groupColumn),
+										 inputRel->rows, NULL);
+		if (groupCount * groupSize > work_mem * 1024.0)
+		{
+			return;
+		}
+	}
+
+	/* we read the same columns as the regular scan, see CStoreGetForeignPaths */
+	relation = heap_open(foreignTableId, AccessShareLock);
+	relationColumnCount = RelationGetNumberOfAttributes(relation);
+	heap_close(relation, AccessShareLock);
+
+	columnList = ColumnList(inputRel, foreignTableId);
+	relationPageCount = PageCount(cstoreFdwOptions->filename);
+	queryColumnRatio = (double) list_length(columnList) / relationColumnCount;
+	totalDiskAccessCost = seq_page_cost * relationPageCount * queryColumnRatio;
+
+	/*
+	 * Compared to the aggregate node over a regular scan, we save forming a
+	 * tuple for each row. We still charge an operator per aggregate and row.
+	 */
+	cpuCostPerTuple = inputRel->baserestrictcost.per_tuple +
+					  cpu_operator_cost * list_length(aggregateList);
+	startupCost = inputRel->baserestrictcost.startup + totalDiskAccessCost +
+				  cpuCostPerTuple * tupleCountEstimate;
+	totalCost = startupCost + cpu_tuple_cost * groupCount;
+
+	aggregateScanList = list_make3(whereClauseList,
+								   makeInteger(groupColumn ? groupColumn->varattno : 0),
+								   aggregateList);
+	foreignPrivateList = list_make3(columnList, aggregateScanList, scanTargetList);
+
+#if PG_VERSION_NUM >= 120000
+	aggregatePath = (Path *) create_foreign_upper_path(root, outputRel, groupingTarget,
+													   groupCount,
+													   startupCost, totalCost,
+													   NIL,  /* no known ordering */
+													   NULL, /* no outer path */
+													   foreignPrivateList);
+#else
+	aggregatePath = (Path *) create_foreignscan_path(root, outputRel, groupingTarget,
+													 groupCount,
+													 startupCost, totalCost,
+													 NIL,  /* no known ordering */
+													 NULL, /* not parameterized */
+													 NULL, /* no outer path */
+													 foreignPrivateList);
+#endif
+
+	add_path(outputRel, aggregatePath);
+}
+
+
+/*
+ * AggregateScanTargetList returns the target list that an aggregate scan
+ * returns for the given grouping target. This list has the grouping column, if
+ * any, and the aggregates used in the grouping target's expressions. Parent
+ * nodes then compute these expressions over the scan's output. The function
+ * returns NIL if the expressions use columns outside of aggregates other than
+ * the grouping column.
+ */
+static List *
+AggregateScanTargetList(PathTarget *groupingTarget, Var *groupColumn)
+{
+	List *scanTargetList = NIL;
+	ListCell *targetCell = NULL;
+
+	foreach(targetCell, groupingTarget->exprs)
+	{
+		Node *targetExpr = (Node *) lfirst(targetCell);
+		List *targetNodeList = pull_var_clause(targetExpr, PVC_INCLUDE_AGGREGATES |
+														   PVC_INCLUDE_PLACEHOLDERS);
+		ListCell *targetNodeCell = NULL;
+
+		foreach(targetNodeCell, targetNodeList)
+		{
+			Node *targetNode = (Node *) lfirst(targetNodeCell);
+
+			if (IsA(targetNode, Aggref))
+			{
+				continue;
+			}
+
+			if (IsA(targetNode, Var) && groupColumn != NULL &&
+				((Var *) targetNode)->varno == groupColumn->varno &&
+				((Var *) targetNode)->varattno == groupColumn->varattno &&
+				((Var *) targetNode)->varlevelsup == 0)
+			{
+				continue;
+			}
+
+			return NIL;
+		}
+
+		scanTargetList = add_to_flat_tlist(scanTargetList, targetNodeList);
+	}
+
+	return scanTargetList;
+}
+
+
+/*
+ * ScanAggregateFunction checks if we can compute the given aggregate over column
+ * blocks. If so, the function returns a list with the aggregate's function type
+ * and column number. Otherwise, it returns NIL.
+ *
+ * We handle count over any column, and sum, avg, min and max over integer and
+ * floating point columns. We also handle min and max over date and timestamp
+ * columns, which we compare as integers. We compute these aggregates the same
+ * way as their builtin transition functions do, so sum and avg over integers
+ * use 64-bit sums, and we skip sum(bigint) as it needs numeric sums.
+ */
+static List *
+ScanAggregateFunction(Aggref *aggregate, RelOptInfo *baserel)
+{
+	AggregateFunctionType functionType = AGGREGATE_COUNT;
+	char *functionName = NULL;
+	TargetEntry *argument = NULL;
+	Var *column = NULL;
+	Oid columnTypeId = InvalidOid;
+	Oid resultTypeId = InvalidOid;
+	bool integerColumn = false;
+	bool floatColumn = false;
+
+	if (aggregate->aggorder != NIL || aggregate->aggdistinct != NIL ||
+		aggregate->aggdirectargs != NIL || aggregate->aggfilter != NULL ||
+		aggregate->aggkind != AGGKIND_NORMAL || aggregate->aggsplit != AGGSPLIT_SIMPLE ||
+		aggregate->agglevelsup != 0 || aggregate->aggvariadic)
+	{
+		return NIL;
+	}
+
+	if (get_func_namespace(aggregate->aggfnoid) != PG_CATALOG_NAMESPACE)
+	{
+		return NIL;
+	}
+
+	functionName = get_func_name(aggregate->aggfnoid);
+	if (aggregate->aggstar)
+	{
+		if (strncmp(functionName, "count", NAMEDATALEN) == 0)
+		{
+			return list_make2_int(AGGREGATE_COUNT_STAR, 0);
+		}
+
+		return NIL;
+	}
+
+	if (list_length(aggregate->args) != 1)
+	{
+		return NIL;
+	}
+
+	argument = (TargetEntry *) linitial(aggregate->args);
+	if (!IsA(argument->expr, Var))
+	{
+		return NIL;
+	}
+
+	column = (Var *) argument->expr;
+	if (column->varno != baserel->relid || column->varattno <= 0 ||
+		column->varlevelsup != 0)
+	{
+		return NIL;
+	}
+
+	columnTypeId = column->vartype;
+	integerColumn = IntegerColumnType(columnTypeId);
+	floatColumn = (columnTypeId == FLOAT4OID || columnTypeId == FLOAT8OID);
+
+	if (strncmp(functionName, "count", NAMEDATALEN) == 0)
+	{
+		functionType = AGGREGATE_COUNT;
+		resultTypeId = INT8OID;
+	}
+	else if (strncmp(functionName, "sum", NAMEDATALEN) == 0)
+	{
+		functionType = AGGREGATE_SUM;
+		if (columnTypeId == INT2OID || columnTypeId == INT4OID)
+		{
+			resultTypeId = INT8OID;
+		}
+		else if (floatColumn)
+		{
+			resultTypeId = columnTypeId;
+		}
+	}
+	else if (strncmp(functionName, "avg", NAMEDATALEN) == 0)
+	{
+		functionType = AGGREGATE_AVG;
+		if (columnTypeId == INT2OID || columnTypeId == INT4OID)
+		{
+			resultTypeId = NUMERICOID;
+		}
+		else if (floatColumn)
+		{
+			resultTypeId = FLOAT8OID;
+		}
+	}
+	else if (strncmp(functionName, "min", NAMEDATALEN) == 0)
+	{
+		functionType = AGGREGATE_MIN;
+		if (integerColumn || floatColumn)
+		{
+			resultTypeId = columnTypeId;
+		}
+	}
+	else if (strncmp(functionName, "max", NAMEDATALEN) == 0)
+	{
+		functionType = AGGREGATE_MAX;
+		if (integerColumn || floatColumn)
+		{
+			resultTypeId = columnTypeId;
+		}
+	}
+
+	if (resultTypeId == InvalidOid || aggregate->aggtype != resultTypeId)
+	{
+		return NIL;
+	}
+
+	return list_make2_int(functionType, column->varattno);
+}
+
+#endif
+
+
+/*
+ * IntegerColumnType checks if values of the given type are integers that we can
+ * aggregate and compare as 64-bit integers.
+ */
+static bool
+IntegerColumnType(Oid typeId)
+{
+	return (typeId == INT2OID || typeId == INT4OID || typeId == INT8OID ||
+			typeId == DATEOID || typeId == TIMESTAMPOID || typeId == TIMESTAMPTZOID);
+}
+
+
+/*
+ * CStoreGetForeignPlan creates a ForeignScan plan node for scanning the foreign
+ * table. We also add the query column list to scan nodes private list, because
+ * we need it later for skipping over unused columns in the query. For top-N
+ * paths, we also add the path's sort column, sort direction, and row limit.
+ * Aggregate scans instead get their qualifiers, grouping column, and aggregates,
+ * and return the aggregates' values as described by their scan target list.
+ */
+#if PG_VERSION_NUM >= 90500
+static ForeignScan *
+CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
+					 ForeignPath *bestPath, List *targetList, List *scanClauses,
+					 Plan *outerPlan)
+#else
+static ForeignScan *
+CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
+					 ForeignPath *bestPath, List *targetList, List *scanClauses)
+#endif
+{
+	ForeignScan *foreignScan = NULL;
+	List *columnList = NIL;
+	List *foreignPrivateList = NIL;
+
+#if PG_VERSION_NUM >= 100000
+	if (IS_UPPER_REL(baserel))
+	{
+		List *aggregateScanList = (List *) lsecond(bestPath->fdw_private);
+		List *scanTargetList = (List *) lthird(bestPath->fdw_private);
+
+		columnList = (List *) linitial(bestPath->fdw_private);
+		foreignPrivateList = list_make3(columnList, NIL, aggregateScanList);
+
+		return make_foreignscan(targetList, NIL, 0,
+								NIL, /* no expressions to evaluate */
+								foreignPrivateList,
+								scanTargetList,
+								NIL,
+								outerPlan);
+	}
+#endif
+
+	/*
+	 * Although we skip row blocks that are refuted by the WHERE clause, but
+	 * we have no native ability to evaluate restriction clauses and make sure
+	 * that all non-related rows are filtered out. So we just put all of the
+	 * scanClauses into the plan node's qual list for the executor to check.
+	 */
+	scanClauses = extract_actual_clauses(scanClauses,
+										 false); /* extract regular clauses */
+
+	/*
+	 * As an optimization, we only read columns that are present in the query.
+	 * To find these columns, we need baserel. We don't have access to baserel
+	 * in executor's callback functions, so we get the column list here and put
+	 * it into foreign scan node's private list.
+	 */
+	columnList = ColumnList(baserel, foreignTableId);
+	foreignPrivateList = list_make2(columnList, bestPath->fdw_private);
+
+	/* create the foreign scan node */
+#if PG_VERSION_NUM >= 90500
+	foreignScan = make_foreignscan(targetList, scanClauses, baserel->relid,
+								   NIL, /* no expressions to evaluate */
+								   foreignPrivateList,
+								   NIL,
+								   NIL,
+								   NULL); /* no outer path */
+#else
+	foreignScan = make_foreignscan(targetList, scanClauses, baserel->relid,
+								   NIL, /* no expressions to evaluate */
+								   foreignPrivateList);
+#endif
+
+	return foreignScan;
+}
+
+
+/*
+ * TupleCountEstimate estimates the number of base relation tuples in the given
+ * file.
+ */
+static double
+TupleCountEstimate(RelOptInfo *baserel, const char *filename)
+{
+	double tupleCountEstimate = 0.0;
+
+	/* check if the user executed Analyze on this foreign table before */
+	if (baserel->pages > 0)
+	{
+		/*
+		 * We have number of pages and number of tuples from pg_class (from a
+		 * previous ANALYZE), so compute a tuples-per-page estimate and scale
+		 * that by the current file size.
+		 */
+		double tupleDensity = baserel->tuples / (double) baserel->pages;
+		BlockNumber pageCount = PageCount(filename);
+
+		tupleCountEstimate = clamp_row_est(tupleDensity * (double) pageCount);
+	}
+	else
+	{
+		tupleCountEstimate = (double) CStoreTableRowCount(filename);
+	}
+
+	return tupleCountEstimate;
+}
+
+
+/*
+ * PageCount calculates and returns the number of pages in the data files of all
+ * segments of a table.
+ */
+static BlockNumber
+PageCount(const char *filename)
+{
+	BlockNumber pageCount = 0;
+	int64 dataFilesSize = 0;
+	struct stat statBuffer;
+
+	/* if file doesn't exist at plan time, use default estimate for its size */
+	int statResult = stat(filename, &statBuffer);
+	if (statResult < 0)
+	{
+		dataFilesSize = 10 * BLCKSZ;
+	}
+	else
+	{
+		dataFilesSize = SegmentFilesSize(filename, "");
+	}
+
+	pageCount = (dataFilesSize + (BLCKSZ - 1)) / BLCKSZ;
+	if (pageCount < 1)
+	{
+		pageCount = 1;
+	}
+
+	return pageCount;
+}
+
+
+/*
+ * ColumnList takes in the planner's information about this foreign table. The
+ * function then finds all columns needed for query execution, including those
+ * used in projections, joins, and filter clauses, de-duplicates these columns,
+ * and returns them in a new list. This function is taken from mongo_fdw with
+ * slight modifications.
+ */
+static List *
+ColumnList(RelOptInfo *baserel, Oid foreignTableId)
+{
+	List *columnList = NIL;
+	List *neededColumnList = NIL;
+	AttrNumber columnIndex = 1;
+	AttrNumber columnCount = baserel->max_attr;
+#if PG_VERSION_NUM >= 90600
+	List *targetColumnList = baserel->reltarget->exprs;
+#else
+	List *targetColumnList = baserel->reltargetlist;
+#endif
+	ListCell *targetColumnCell = NULL;
+	List *restrictInfoList = baserel->baserestrictinfo;
+	ListCell *restrictInfoCell = NULL;
+	const AttrNumber wholeRow = 0;
+	Relation relation = heap_open(foreignTableId, AccessShareLock);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+
+	/* first add the columns used in joins and projections */
+	foreach(targetColumnCell, targetColumnList)
+	{
+		List *targetVarList = NIL;
+		Node *targetExpr = (Node *) lfirst(targetColumnCell);
+
+#if PG_VERSION_NUM >= 90600
+		targetVarList = pull_var_clause(targetExpr,
+										PVC_RECURSE_AGGREGATES |
+										PVC_RECURSE_PLACEHOLDERS);
+#else
+		targetVarList = pull_var_clause(targetExpr,
+										PVC_RECURSE_AGGREGATES,
+										PVC_RECURSE_PLACEHOLDERS);
+#endif
+
+		neededColumnList = list_union(neededColumnList, targetVarList);
+	}
+
+	/* then walk over all restriction clauses, and pull up any used columns */
+	foreach(restrictInfoCell, restrictInfoList)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+		Node *restrictClause = (Node *) restrictInfo->clause;
+		List *clauseColumnList = NIL;
+
+		/* recursively pull up any columns used in the restriction clause */
+#if PG_VERSION_NUM >= 90600
+		clauseColumnList = pull_var_clause(restrictClause,
+										   PVC_RECURSE_AGGREGATES |
+										   PVC_RECURSE_PLACEHOLDERS);
+#else
+		clauseColumnList = pull_var_clause(restrictClause,
+										   PVC_RECURSE_AGGREGATES,
+										   PVC_RECURSE_PLACEHOLDERS);
+#endif
+
+		neededColumnList = list_union(neededColumnList, clauseColumnList);
+	}
+
+	/* walk over all column definitions, and de-duplicate column list */
+	for (columnIndex = 1; columnIndex <= columnCount; columnIndex++)
+	{
+		ListCell *neededColumnCell = NULL;
+		Var *column = NULL;
+		Form_pg_attribute attributeForm =  TupleDescAttr(tupleDescriptor, columnIndex - 1);
+
+		if (attributeForm->attisdropped)
+		{
+			continue;
+		}
+
+		/* look for this column in the needed column list */
+		foreach(neededColumnCell, neededColumnList)
+		{
+			Var *neededColumn = (Var *) lfirst(neededColumnCell);
+			if (neededColumn->varattno == columnIndex)
+			{
+				column = neededColumn;
+				break;
+			}
+			else if (neededColumn->varattno == wholeRow)
+			{
+				Index tableId = neededColumn->varno;
+
+				column = makeVar(tableId, columnIndex, attributeForm->atttypid,
+								 attributeForm->atttypmod, attributeForm->attcollation,
+								 0);
+				break;
+			}
+		}
+
+		if (column != NULL)
+		{
+			columnList = lappend(columnList, column);
+		}
+	}
+
+	heap_close(relation, AccessShareLock);
+
+	return columnList;
+}
+
+
+/*
+ * CStoreExplainForeignScan produces extra output for the Explain command. Since
+ * aggregate scans evaluate their qualifiers themselves, we also show how many
+ * rows these qualifiers removed.
+ */
+static void
+CStoreExplainForeignScan(ForeignScanState *scanState, ExplainState *explainState)
+{
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	Oid foreignTableId = InvalidOid;
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+
+	if (scanState->ss.ss_currentRelation != NULL)
+	{
+		foreignTableId = RelationGetRelid(scanState->ss.ss_currentRelation);
+	}
+	else
+	{
+		ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+		foreignTableId = AggregateScanRelationId(foreignScan, explainState->rtable);
+	}
+
+	cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+
+	ExplainPropertyText("CStore File", cstoreFdwOptions->filename, explainState);
+
+	if (cstoreScanState != NULL && cstoreScanState->aggregateClauseList != NIL &&
+		scanState->ss.ps.instrument != NULL)
+	{
+		Instrumentation *instrument = scanState->ss.ps.instrument;
+		double removedRowCount = instrument->nfiltered1;
+
+		if (instrument->nloops > 0)
+		{
+			removedRowCount = removedRowCount / instrument->nloops;
+		}
+
+		if (removedRowCount > 0 || explainState->format != EXPLAIN_FORMAT_TEXT)
+		{
+			ExplainPropertyLong("Rows Removed by Filter", (long) removedRowCount,
+								explainState);
+		}
+	}
+
+	/* supress file size if we're not showing cost details */
+	if (explainState->costs)
+	{
+		struct stat statBuffer;
+
+		int statResult = stat(cstoreFdwOptions->filename, &statBuffer);
+		if (statResult == 0)
+		{
+			int64 dataFilesSize = SegmentFilesSize(cstoreFdwOptions->filename, "");
+
+			ExplainPropertyLong("CStore File Size", (long) dataFilesSize,
+								explainState);
+		}
+	}
+}
+
+
+/*
+ * CStoreBeginForeignScan starts reading the underlying cstore file.
+ *
+ * Block filtering can only use qualifiers that compare columns against
+ * constants. We therefore first evaluate parameters and stable expressions, so
+ * that generic plans and expressions such as now() - '1 day' can also skip
+ * blocks. Executor parameters, which carry join key values in parameterized
+ * scans, aren't set yet; we evaluate them on rescans. The executor still checks
+ * the original qualifiers.
+ */
+static void
+CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags)
+{
+	CStoreScanState *cstoreScanState = NULL;
+	TableReadState *readState = NULL;
+	Oid foreignTableId = InvalidOid;
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	List *columnList = NIL;
+	ForeignScan *foreignScan = NULL;
+	List *foreignPrivateList = NIL;
+	List *whereClauseList = NIL;
+	ExprContext *exprContext = scanState->ss.ps.ps_ExprContext;
+	EState *executorState = scanState->ss.ps.state;
+	bool returnRowIds = false;
+
+	/* if Explain with no Analyze, do nothing */
+	if (executorFlags & EXEC_FLAG_EXPLAIN_ONLY)
+	{
+		return;
+	}
+
+	foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+	foreignPrivateList = (List *) foreignScan->fdw_private;
+	whereClauseList = foreignScan->scan.plan.qual;
+
+	/* aggregate scans have a third private list item for their aggregates */
+	if (list_length(foreignPrivateList) > 2)
+	{
+		BeginAggregateForeignScan(scanState);
+		return;
+	}
+
+	foreignTableId = RelationGetRelid(scanState->ss.ss_currentRelation);
+	cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+	tupleDescriptor = RelationGetDescr(scanState->ss.ss_currentRelation);
+
+	columnList = (List *) linitial(foreignPrivateList);
+
+	if (whereClauseList != NIL && exprContext != NULL)
+	{
+		whereClauseList = EvaluateRuntimeConstants(whereClauseList, exprContext, false);
+		ResetExprContext(exprContext);
+	}
+
+	/*
+	 * Scans of a DELETE's target table return each row's position as its ctid.
+	 * The positions must stay valid until the DELETE ends, so we keep loads out
+	 * of the table's existing segments before we read their footers. Rows in the
+	 * delta store don't have a position in a stripe, so we first merge them into
+	 * a stripe. We hold the delta lock until we read the footers, so no insert
+	 * adds rows to the delta store in between.
 	 */
-	List *queryColumnList = ColumnList(baserel, foreignTableId);
-	uint32 queryColumnCount = list_length(queryColumnList);
-	BlockNumber relationPageCount = PageCount(cstoreFdwOptions->filename);
-	uint32 relationColumnCount = RelationGetNumberOfAttributes(relation);
+	if (executorState != NULL &&
+		ExecRelationIsTargetRelation(executorState, foreignScan->scan.scanrelid))
+	{
+		Relation relation = scanState->ss.ss_currentRelation;
+
+		returnRowIds = true;
+		LockAllSegments(relation, cstoreFdwOptions->filename);
+
+		LockPage(relation, CSTORE_DELTA_LOCK_PAGE, ExclusiveLock);
+		MergeDelta(relation, cstoreFdwOptions);
+
+		readState = CStoreBeginRead(cstoreFdwOptions->filename, tupleDescriptor,
+									columnList, whereClauseList);
+
+		UnlockPage(relation, CSTORE_DELTA_LOCK_PAGE, ExclusiveLock);
+	}
+	else
+	{
+		readState = CStoreBeginRead(cstoreFdwOptions->filename, tupleDescriptor,
+									columnList, whereClauseList);
+	}
+
+	cstoreScanState = palloc0(sizeof(CStoreScanState));
+	cstoreScanState->readState = readState;
+	cstoreScanState->returnRowIds = returnRowIds;
+
+	/* the scan state we build for ANALYZE only has the column list */
+	if (list_length(foreignPrivateList) > 1 && lsecond(foreignPrivateList) != NIL)
+	{
+		List *topNList = (List *) lsecond(foreignPrivateList);
+
+		cstoreScanState->sortColumn = (Var *) linitial(topNList);
+		cstoreScanState->sortDescending = (bool) intVal(lsecond(topNList));
+		cstoreScanState->sortNullsFirst = (bool) intVal(lthird(topNList));
+		cstoreScanState->limitCount = (uint32) intVal(lfourth(topNList));
+		cstoreScanState->comparisonFunction =
+			GetFunctionInfoOrNull(cstoreScanState->sortColumn->vartype,
+								  BTREE_AM_OID, BTORDER_PROC);
+		cstoreScanState->topNContext = AllocSetContextCreate(CurrentMemoryContext,
+															 "CStore Top-N Context",
+															 ALLOCSET_DEFAULT_SIZES);
+	}
+
+	scanState->fdw_state = (void *) cstoreScanState;
+}
+
+
+/*
+ * EvaluateRuntimeConstants returns a copy of the given qualifier list in which
+ * all subexpressions whose values stay constant during the scan are replaced
+ * with their values. These subexpressions are parameters and variable free
+ * expressions that only call immutable or stable functions.
+ */
+static List *
+EvaluateRuntimeConstants(List *whereClauseList, ExprContext *exprContext,
+						 bool evaluateExecParams)
+{
+	RuntimeConstantContext context;
+	Node *evaluatedClauses = NULL;
+
+	context.exprContext = exprContext;
+	context.evaluateExecParams = evaluateExecParams;
+
+	evaluatedClauses = EvaluateRuntimeConstantsMutator((Node *) whereClauseList,
+													   &context);
+
+	return (List *) evaluatedClauses;
+}
+
+
+/*
+ * EvaluateRuntimeConstantsMutator walks over the given expression tree, and
+ * replaces the largest subtrees that are constant during the scan with Const
+ * nodes.
+ */
+static Node *
+EvaluateRuntimeConstantsMutator(Node *node, RuntimeConstantContext *context)
+{
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(node, Const) || IsA(node, Var) || IsA(node, List))
+	{
+		return expression_tree_mutator(node, EvaluateRuntimeConstantsMutator,
+									   (void *) context);
+	}
+
+	if (RuntimeConstantExpression(node, context->evaluateExecParams))
+	{
+		return (Node *) EvaluateExpressionToConst((Expr *) node, context->exprContext);
+	}
+
+	return expression_tree_mutator(node, EvaluateRuntimeConstantsMutator,
+								   (void *) context);
+}
+
+
+/*
+ * RuntimeConstantExpression checks if the given expression evaluates to the
+ * same value for every row of the scan, and if it can be evaluated before the
+ * scan starts.
+ */
+static bool
+RuntimeConstantExpression(Node *node, bool evaluateExecParams)
+{
+	if (contain_var_clause(node))
+	{
+		return false;
+	}
+
+	if (contain_volatile_functions(node))
+	{
+		return false;
+	}
+
+	if (ContainsNonEvaluableNodeWalker(node, &evaluateExecParams))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * ContainsNonEvaluableNodeWalker checks if the given expression contains nodes
+ * that we can't evaluate on their own before reading rows. Values of executor
+ * parameters are set by parent nodes only after the scan begins, and subplans
+ * and case test expressions need state from their parent nodes.
+ */
+static bool
+ContainsNonEvaluableNodeWalker(Node *node, bool *evaluateExecParams)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Param))
+	{
+		Param *param = (Param *) node;
+		if (param->paramkind == PARAM_EXTERN)
+		{
+			return false;
+		}
+		else if (param->paramkind == PARAM_EXEC)
+		{
+			return !(*evaluateExecParams);
+		}
+
+		return true;
+	}
+
+	if (IsA(node, SubPlan) || IsA(node, AlternativeSubPlan) ||
+		IsA(node, CaseTestExpr) || IsA(node, Aggref) || IsA(node, WindowFunc))
+	{
+		return true;
+	}
+
+	return expression_tree_walker(node, ContainsNonEvaluableNodeWalker,
+								  (void *) evaluateExecParams);
+}
+
+
+/*
+ * EvaluateExpressionToConst evaluates the given expression in the given
+ * expression context, and returns its value as a Const node. The value is
+ * copied into the current memory context.
+ */
+static Const *
+EvaluateExpressionToConst(Expr *expression, ExprContext *exprContext)
+{
+	Oid resultTypeId = exprType((Node *) expression);
+	int32 resultTypeMod = exprTypmod((Node *) expression);
+	Oid resultCollationId = exprCollation((Node *) expression);
+	int16 resultTypeLength = 0;
+	bool resultTypeByValue = false;
+	ExprState *expressionState = NULL;
+	Datum resultValue = 0;
+	bool resultIsNull = false;
+
+	get_typlenbyval(resultTypeId, &resultTypeLength, &resultTypeByValue);
+
+	expressionState = ExecInitExpr(expression, NULL);
+
+#if PG_VERSION_NUM >= 100000
+	resultValue = ExecEvalExprSwitchContext(expressionState, exprContext,
+											&resultIsNull);
+#else
+	resultValue = ExecEvalExprSwitchContext(expressionState, exprContext,
+											&resultIsNull, NULL);
+#endif
+
+	if (!resultIsNull)
+	{
+		resultValue = datumCopy(resultValue, resultTypeByValue, resultTypeLength);
+	}
+
+	return makeConst(resultTypeId, resultTypeMod, resultCollationId, resultTypeLength,
+					 resultValue, resultIsNull, resultTypeByValue);
+}
+
+
+/*
+ * CStoreIterateForeignScan reads the next record from the cstore file in the
+ * executor's scan direction, converts it to a Postgres tuple, and stores the
+ * converted tuple into the ScanTupleSlot as a virtual tuple.
+ */
+static TupleTableSlot *
+CStoreIterateForeignScan(ForeignScanState *scanState)
+{
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	TableReadState *readState = cstoreScanState->readState;
+	TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
+	EState *executorState = scanState->ss.ps.state;
+	ScanDirection direction = ForwardScanDirection;
+	bool nextRowFound = false;
+
+	TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
+	Datum *columnValues = tupleSlot->tts_values;
+	bool *columnNulls = tupleSlot->tts_isnull;
+	uint32 columnCount = tupleDescriptor->natts;
+
+	if (cstoreScanState->sortColumn != NULL)
+	{
+		return IterateTopNForeignScan(scanState);
+	}
+	else if (cstoreScanState->aggregateArray != NULL)
+	{
+		return IterateAggregateForeignScan(scanState);
+	}
+
+	/* initialize all values for this row to null */
+	memset(columnValues, 0, columnCount * sizeof(Datum));
+	memset(columnNulls, true, columnCount * sizeof(bool));
+
+	ExecClearTuple(tupleSlot);
+
+	/* the scan state we build for ANALYZE doesn't have an executor state */
+	if (executorState != NULL)
+	{
+		direction = executorState->es_direction;
+	}
+
+	nextRowFound = CStoreReadRow(readState, direction, columnValues, columnNulls);
+	if (nextRowFound && cstoreScanState->returnRowIds)
+	{
+		StoreRowWithRowId(readState, tupleSlot);
+	}
+	else if (nextRowFound)
+	{
+		ExecStoreVirtualTuple(tupleSlot);
+	}
+
+	return tupleSlot;
+}
+
+
+/*
+ * StoreRowWithRowId stores the row whose values were just read into the given
+ * slot as a heap tuple, and sets the tuple's ctid to the row's position in the
+ * table. The executor can only read the ctid of physical tuples, and foreign
+ * scan slots hold heap tuples for this reason.
+ */
+static void
+StoreRowWithRowId(TableReadState *readState, TupleTableSlot *tupleSlot)
+{
+	HeapTuple heapTuple = NULL;
+	uint32 stripeIndex = 0;
+	uint32 rowOffset = 0;
+
+	CStoreReadRowPosition(readState, &stripeIndex, &rowOffset);
+
+	heapTuple = heap_form_tuple(tupleSlot->tts_tupleDescriptor, tupleSlot->tts_values,
+								tupleSlot->tts_isnull);
+	EncodeRowId(stripeIndex, rowOffset, &heapTuple->t_self);
+
+#if PG_VERSION_NUM >= 120000
+	ExecForceStoreHeapTuple(heapTuple, tupleSlot, true);
+#else
+	ExecStoreTuple(heapTuple, tupleSlot, InvalidBuffer, true);
+#endif
+}
+
+
+/*
+ * EncodeRowId packs the given stripe index and row offset into the 48 bits of
+ * an item pointer. The row offset takes the low CSTORE_ROW_ID_OFFSET_BITS bits,
+ * which hold the largest stripe row count. Offset numbers can't be zero, so we
+ * store the low 15 bits plus one as the offset number, and the remaining bits
+ * as the block number.
+ */
+static void
+EncodeRowId(uint32 stripeIndex, uint32 rowOffset, ItemPointer rowId)
+{
+	uint64 rowIdValue = 0;
+
+	if (stripeIndex >= CSTORE_ROW_ID_STRIPE_COUNT_MAXIMUM)
+	{
+		ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						errmsg("cannot update or delete rows in cstore tables with more "
+							   "than %d stripes", CSTORE_ROW_ID_STRIPE_COUNT_MAXIMUM)));
+	}
+
+	rowIdValue = ((uint64) stripeIndex << CSTORE_ROW_ID_OFFSET_BITS) | rowOffset;
+
+	ItemPointerSet(rowId, (BlockNumber) (rowIdValue >> 15),
+				   (OffsetNumber) ((rowIdValue & 0x7FFF) + 1));
+}
+
+
+/* DecodeRowId unpacks the stripe index and row offset of the given row id. */
+static void
+DecodeRowId(ItemPointer rowId, uint32 *stripeIndex, uint32 *rowOffset)
+{
+	uint64 rowIdValue = ((uint64) ItemPointerGetBlockNumber(rowId) << 15) |
+						(ItemPointerGetOffsetNumber(rowId) - 1);
+
+	(*stripeIndex) = (uint32) (rowIdValue >> CSTORE_ROW_ID_OFFSET_BITS);
+	(*rowOffset) = (uint32) (rowIdValue & ((1 << CSTORE_ROW_ID_OFFSET_BITS) - 1));
+}
+
+
+/*
+ * IterateTopNForeignScan returns the next row of a top-N scan. On the first
+ * call, the function reads the rows that come first in the sort order.
+ */
+static TupleTableSlot *
+IterateTopNForeignScan(ForeignScanState *scanState)
+{
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
+	TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
+
+	if (!cstoreScanState->topNRowsComputed)
+	{
+		ComputeTopNRows(scanState);
+		cstoreScanState->topNRowsComputed = true;
+	}
+
+	ExecClearTuple(tupleSlot);
+
+	if (cstoreScanState->returnedRowCount < cstoreScanState->topNRowCount)
+	{
+		uint32 rowIndex = cstoreScanState->returnedRowCount;
+		TopNRow *topNRow = &cstoreScanState->topNRowArray[rowIndex];
+
+		heap_deform_tuple(topNRow->tuple, tupleDescriptor, tupleSlot->tts_values,
+						  tupleSlot->tts_isnull);
+		ExecStoreVirtualTuple(tupleSlot);
+
+		cstoreScanState->returnedRowCount++;
+	}
+
+	return tupleSlot;
+}
+
+
+/*
+ * ComputeTopNRows reads blocks in the order of their sort column bounds, and
+ * keeps the rows that pass the scan's qualifiers and come first in the sort
+ * order in a bounded heap. The heap's root is the row that comes last among
+ * them. Since blocks with no bounds come first and the rest are ordered by
+ * their bounds, we stop once the heap is full and the next block's bound
+ * doesn't come before the root. Then, we sort the kept rows.
+ */
+static void
+ComputeTopNRows(ForeignScanState *scanState)
+{
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	TableReadState *readState = cstoreScanState->readState;
+	TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
+	TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
+	Datum *columnValues = tupleSlot->tts_values;
+	bool *columnNulls = tupleSlot->tts_isnull;
+	uint32 columnCount = tupleDescriptor->natts;
+	ExprContext *exprContext = scanState->ss.ps.ps_ExprContext;
+	bool hasBound = false;
+	Datum boundValue = 0;
+
+	cstoreScanState->topNRowArray =
+		MemoryContextAllocZero(cstoreScanState->topNContext,
+							   cstoreScanState->limitCount * sizeof(TopNRow));
+	cstoreScanState->topNRowCount = 0;
+	cstoreScanState->returnedRowCount = 0;
+
+	CStoreBeginOrderedRead(readState, cstoreScanState->sortColumn,
+						   cstoreScanState->sortDescending,
+						   cstoreScanState->sortNullsFirst);
+
+	while (CStoreNextOrderedBlock(readState, &hasBound, &boundValue))
+	{
+		bool nextRowFound = false;
+
+		if (hasBound && cstoreScanState->topNRowCount == cstoreScanState->limitCount)
+		{
+			TopNRow *lastRow = &cstoreScanState->topNRowArray[0];
+			int comparison = CompareTopNValues(cstoreScanState, boundValue, false,
+											   lastRow->sortValue,
+											   lastRow->sortValueNull);
+			if (comparison >= 0)
+			{
+				break;
+			}
+		}
+
+		do
+		{
+			MemoryContext oldContext = NULL;
+
+			CHECK_FOR_INTERRUPTS();
+
+			memset(columnValues, 0, columnCount * sizeof(Datum));
+			memset(columnNulls, true, columnCount * sizeof(bool));
+			ExecClearTuple(tupleSlot);
+			ResetExprContext(exprContext);
+
+			oldContext = MemoryContextSwitchTo(exprContext->ecxt_per_tuple_memory);
+			nextRowFound = CStoreReadRow(readState, ForwardScanDirection,
+										 columnValues, columnNulls);
+			MemoryContextSwitchTo(oldContext);
+
+			if (!nextRowFound)
+			{
+				break;
+			}
+
+			ExecStoreVirtualTuple(tupleSlot);
+			exprContext->ecxt_scantuple = tupleSlot;
+
+			/* the executor checks the qualifiers again for returned rows */
+#if PG_VERSION_NUM >= 100000
+			if (!ExecQual(scanState->ss.ps.qual, exprContext))
+#else
+			if (!ExecQual(scanState->ss.ps.qual, exprContext, false))
+#endif
+			{
+				continue;
+			}
+
+			AddTopNRow(cstoreScanState, tupleDescriptor, columnValues, columnNulls);
+		}
+		while (nextRowFound);
+	}
+
+	ExecClearTuple(tupleSlot);
+	ResetExprContext(exprContext);
+
+	qsort_arg(cstoreScanState->topNRowArray, cstoreScanState->topNRowCount,
+			  sizeof(TopNRow), CompareTopNRows, cstoreScanState);
+}
+
+
+/*
+ * AddTopNRow adds the given row to the bounded heap of a top-N scan, if the heap
+ * isn't full yet or if the row comes before the heap's root in the sort order.
+ */
+static void
+AddTopNRow(CStoreScanState *cstoreScanState, TupleDesc tupleDescriptor,
+		   Datum *columnValues, bool *columnNulls)
+{
+	TopNRow *rowArray = cstoreScanState->topNRowArray;
+	uint32 sortColumnIndex = cstoreScanState->sortColumn->varattno - 1;
+	uint32 rowIndex = 0;
+	TopNRow newRow;
+	MemoryContext oldContext = NULL;
+
+	if (cstoreScanState->topNRowCount == cstoreScanState->limitCount)
+	{
+		int comparison = CompareTopNValues(cstoreScanState,
+										   columnValues[sortColumnIndex],
+										   columnNulls[sortColumnIndex],
+										   rowArray[0].sortValue,
+										   rowArray[0].sortValueNull);
+		if (comparison >= 0)
+		{
+			return;
+		}
+	}
+
+	oldContext = MemoryContextSwitchTo(cstoreScanState->topNContext);
+	newRow.tuple = heap_form_tuple(tupleDescriptor, columnValues, columnNulls);
+	MemoryContextSwitchTo(oldContext);
+
+	newRow.sortValue = heap_getattr(newRow.tuple, sortColumnIndex + 1, tupleDescriptor,
+									&newRow.sortValueNull);
+
+	if (cstoreScanState->topNRowCount < cstoreScanState->limitCount)
+	{
+		/* append the row, and move it up while it comes after its parent */
+		rowIndex = cstoreScanState->topNRowCount;
+		cstoreScanState->topNRowCount++;
+
+		while (rowIndex > 0)
+		{
+			uint32 parentIndex = (rowIndex - 1) / 2;
+			TopNRow *parentRow = &rowArray[parentIndex];
+
+			if (CompareTopNValues(cstoreScanState, newRow.sortValue,
+								  newRow.sortValueNull, parentRow->sortValue,
+								  parentRow->sortValueNull) <= 0)
+			{
+				break;
+			}
+
+			rowArray[rowIndex] = *parentRow;
+			rowIndex = parentIndex;
+		}
+	}
+	else
+	{
+		/* replace the root, and move the row down while a child comes after it */
+		uint32 rowCount = cstoreScanState->topNRowCount;
+
+		heap_freetuple(rowArray[0].tuple);
+
+		for (;;)
+		{
+			uint32 childIndex = 2 * rowIndex + 1;
+			TopNRow *childRow = NULL;
+
+			if (childIndex >= rowCount)
+			{
+				break;
+			}
+
+			if (childIndex + 1 < rowCount &&
+				CompareTopNValues(cstoreScanState, rowArray[childIndex + 1].sortValue,
+								  rowArray[childIndex + 1].sortValueNull,
+								  rowArray[childIndex].sortValue,
+								  rowArray[childIndex].sortValueNull) > 0)
+			{
+				childIndex++;
+			}
+
+			childRow = &rowArray[childIndex];
+			if (CompareTopNValues(cstoreScanState, childRow->sortValue,
+								  childRow->sortValueNull, newRow.sortValue,
+								  newRow.sortValueNull) <= 0)
+			{
+				break;
+			}
+
+			rowArray[rowIndex] = *childRow;
+			rowIndex = childIndex;
+		}
+	}
+
+	rowArray[rowIndex] = newRow;
+}
+
+
+/*
+ * CompareTopNValues compares two sort column values in the sort order of a
+ * top-N scan. The function returns a negative number if the left value comes
+ * first, and a positive number if the right value comes first. Nulls come first
+ * or last, as the scan's sort order says.
+ */
+static int
+CompareTopNValues(CStoreScanState *cstoreScanState, Datum leftValue, bool leftNull,
+				  Datum rightValue, bool rightNull)
+{
+	Oid collationId = cstoreScanState->sortColumn->varcollid;
+	Datum comparison = 0;
+
+	if (leftNull || rightNull)
+	{
+		int nullComparison = (int) leftNull - (int) rightNull;
+
+		return cstoreScanState->sortNullsFirst ? -nullComparison : nullComparison;
+	}
+
+	if (cstoreScanState->sortDescending)
+	{
+		comparison = FunctionCall2Coll(cstoreScanState->comparisonFunction,
+									   collationId, rightValue, leftValue);
+	}
+	else
+	{
+		comparison = FunctionCall2Coll(cstoreScanState->comparisonFunction,
+									   collationId, leftValue, rightValue);
+	}
+
+	return DatumGetInt32(comparison);
+}
+
+
+/* CompareTopNRows compares the given rows of a top-N scan by their sort order. */
+static int
+CompareTopNRows(const void *leftElement, const void *rightElement, void *context)
+{
+	const TopNRow *leftRow = (const TopNRow *) leftElement;
+	const TopNRow *rightRow = (const TopNRow *) rightElement;
+	CStoreScanState *cstoreScanState = (CStoreScanState *) context;
+
+	return CompareTopNValues(cstoreScanState, leftRow->sortValue, leftRow->sortValueNull,
+							 rightRow->sortValue, rightRow->sortValueNull);
+}
+
+
+/*
+ * BeginAggregateForeignScan starts an aggregate scan. These scans have no scan
+ * relation, so we open the foreign table ourselves. We prepare the qualifiers
+ * for evaluating them over rows of each block, and use a copy in which runtime
+ * constants are evaluated for block filtering.
+ */
+static void
+BeginAggregateForeignScan(ForeignScanState *scanState)
+{
+	CStoreScanState *cstoreScanState = palloc0(sizeof(CStoreScanState));
+	ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+	EState *executorState = scanState->ss.ps.state;
+	ExprContext *exprContext = scanState->ss.ps.ps_ExprContext;
+	List *foreignPrivateList = (List *) foreignScan->fdw_private;
+	List *columnList = (List *) linitial(foreignPrivateList);
+	List *aggregateScanList = (List *) lthird(foreignPrivateList);
+	List *whereClauseList = (List *) copyObject(linitial(aggregateScanList));
+	AttrNumber groupColumnNumber = (AttrNumber) intVal(lsecond(aggregateScanList));
+	List *aggregateList = (List *) lthird(aggregateScanList);
+	List *filterClauseList = NIL;
+	ListCell *aggregateCell = NULL;
+	uint32 aggregateIndex = 0;
+	Oid foreignTableId = AggregateScanRelationId(foreignScan,
+												 executorState->es_range_table);
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+	Relation relation = heap_open(foreignTableId, AccessShareLock);
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	uint32 blockRowCount = 0;
+	bool summaryAggregates = true;
+	ListCell *columnCell = NULL;
+
+	cstoreScanState->relation = relation;
+	cstoreScanState->groupColumnIndex = groupColumnNumber - 1;
+	cstoreScanState->aggregateCount = list_length(aggregateList);
+	cstoreScanState->aggregateArray = palloc0(cstoreScanState->aggregateCount *
+											  sizeof(ScanAggregate));
+
+	foreach(aggregateCell, aggregateList)
+	{
+		List *aggregate = (List *) lfirst(aggregateCell);
+		ScanAggregate *scanAggregate = &cstoreScanState->aggregateArray[aggregateIndex];
+		AttrNumber columnNumber = (AttrNumber) lsecond_int(aggregate);
+
+		scanAggregate->functionType = (AggregateFunctionType) linitial_int(aggregate);
+		if (columnNumber > 0)
+		{
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+															columnNumber - 1);
+
+			scanAggregate->columnIndex = columnNumber - 1;
+			scanAggregate->columnTypeId = attributeForm->atttypid;
+			scanAggregate->integerColumn = IntegerColumnType(attributeForm->atttypid);
+		}
+
+		/* skip lists only have sums of smallint and integer columns */
+		if ((scanAggregate->functionType == AGGREGATE_SUM ||
+			 scanAggregate->functionType == AGGREGATE_AVG) &&
+			!scanAggregate->integerColumn)
+		{
+			summaryAggregates = false;
+		}
+
+		aggregateIndex++;
+	}
+
+	if (whereClauseList != NIL)
+	{
+		fix_opfuncids((Node *) whereClauseList);
+
+#if PG_VERSION_NUM >= 100000
+		cstoreScanState->aggregateQual = ExecInitQual(whereClauseList,
+													  &scanState->ss.ps);
+#else
+		cstoreScanState->aggregateQual = (List *) ExecInitExpr((Expr *) whereClauseList,
+															   &scanState->ss.ps);
+#endif
+
+		filterClauseList = EvaluateRuntimeConstants(whereClauseList, exprContext, false);
+		ResetExprContext(exprContext);
+	}
+
+	cstoreScanState->aggregateClauseList = whereClauseList;
+	cstoreScanState->readState = CStoreBeginRead(cstoreFdwOptions->filename,
+												 tupleDescriptor, columnList,
+												 filterClauseList);
+
+	/* if skip lists have all we need, aggregate fully selected blocks from them */
+	if (summaryAggregates)
+	{
+		Var *groupColumn = NULL;
+
+		foreach(columnCell, columnList)
+		{
+			Var *column = (Var *) lfirst(columnCell);
+			if (column->varattno == groupColumnNumber)
+			{
+				groupColumn = column;
+			}
+		}
+
+		CStoreBeginSummaryRead(cstoreScanState->readState, groupColumn);
+	}
+
+#if PG_VERSION_NUM >= 120000
+	cstoreScanState->rowSlot = MakeSingleTupleTableSlot(tupleDescriptor,
+														&TTSOpsVirtual);
+#else
+	cstoreScanState->rowSlot = MakeSingleTupleTableSlot(tupleDescriptor);
+#endif
+
+	blockRowCount = cstoreScanState->readState->tableFooter->blockRowCount;
+	cstoreScanState->rowGroupArray = palloc0(blockRowCount * sizeof(AggregateGroup *));
+	cstoreScanState->aggregateContext = AllocSetContextCreate(CurrentMemoryContext,
+															  "CStore Aggregate Context",
+															  ALLOCSET_DEFAULT_SIZES);
+
+	scanState->fdw_state = (void *) cstoreScanState;
+}
+
+
+/*
+ * AggregateScanRelationId returns the foreign table that the given aggregate
+ * scan reads. Aggregate scans have no scan relation, but their relids have the
+ * table's range table index.
+ */
+static Oid
+AggregateScanRelationId(ForeignScan *foreignScan, List *rangeTable)
+{
+	Index rangeTableIndex = (Index) bms_singleton_member(foreignScan->fs_relids);
+
+	return getrelid(rangeTableIndex, rangeTable);
+}
+
+
+/*
+ * IterateAggregateForeignScan returns the next group of an aggregate scan. On
+ * the first call, the function reads the table and computes all groups.
+ */
+static TupleTableSlot *
+IterateAggregateForeignScan(ForeignScanState *scanState)
+{
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
+
+	if (!cstoreScanState->groupsComputed)
+	{
+		ComputeAggregateGroups(scanState);
+		cstoreScanState->groupsComputed = true;
+	}
+
+	ExecClearTuple(tupleSlot);
+
+	if (cstoreScanState->returnedGroupCount < cstoreScanState->groupCount)
+	{
+		uint32 groupIndex = cstoreScanState->returnedGroupCount;
+		AggregateGroup *group = cstoreScanState->groupArray[groupIndex];
+
+		SetAggregateGroupValues(cstoreScanState, group, tupleSlot->tts_values,
+								tupleSlot->tts_isnull);
+		ExecStoreVirtualTuple(tupleSlot);
+
+		cstoreScanState->returnedGroupCount++;
+	}
+
+	return tupleSlot;
+}
+
+
+/*
+ * ComputeAggregateGroups reads the table block by block. For each block, we
+ * first find the groups of rows that pass the qualifiers, and then update the
+ * transition values of each aggregate in a loop over the aggregated column's
+ * values. Blocks that the reader summarizes by their skip nodes are aggregated
+ * from these skip nodes instead. Scans without a grouping column have a single
+ * group, and return a row even if the table has no rows.
+ */
+static void
+ComputeAggregateGroups(ForeignScanState *scanState)
+{
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	TableReadState *readState = cstoreScanState->readState;
+	ColumnBlockData **blockDataArray = NULL;
+	ColumnBlockSkipNode **blockSkipNodeArray = NULL;
+	uint32 blockRowCount = 0;
+
+	if (cstoreScanState->groupColumnIndex >= 0)
+	{
+		HASHCTL hashInfo;
+
+		memset(&hashInfo, 0, sizeof(hashInfo));
+		hashInfo.keysize = sizeof(AggregateGroupKey);
+		hashInfo.entrysize = sizeof(AggregateGroup);
+		hashInfo.hcxt = cstoreScanState->aggregateContext;
+
+		cstoreScanState->groupHash = hash_create("CStore Aggregate Groups", 32,
+												 &hashInfo, HASH_ELEM | HASH_BLOBS |
+												 HASH_CONTEXT);
+	}
+	else
+	{
+		AggregateGroup *group = MemoryContextAllocZero(cstoreScanState->aggregateContext,
+													   sizeof(AggregateGroup));
+		AddAggregateGroup(cstoreScanState, group);
+	}
+
+	while ((blockRowCount = CStoreReadNextBlock(readState, &blockDataArray,
+												&blockSkipNodeArray)) > 0)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		if (blockSkipNodeArray != NULL)
+		{
+			AggregateBlockSummary(cstoreScanState, blockSkipNodeArray, blockRowCount);
+			continue;
+		}
+
+		AssignRowGroups(scanState, blockDataArray, blockRowCount);
+		AggregateBlockValues(cstoreScanState, blockDataArray, blockRowCount);
+	}
+
+	ExecClearTuple(cstoreScanState->rowSlot);
+	ResetExprContext(scanState->ss.ps.ps_ExprContext);
+}
+
 
-	double queryColumnRatio = (double) queryColumnCount / relationColumnCount;
-	double queryPageCount = relationPageCount * queryColumnRatio;
-	double totalDiskAccessCost = seq_page_cost * queryPageCount;
+/*
+ * AssignRowGroups sets the group of each row in the given block. Rows that
+ * don't pass the scan's qualifiers don't belong to any group. Since blocks of
+ * low cardinality columns often have runs of equal values, we look up the hash
+ * table only when a row's value differs from the previous row's value.
+ */
+static void
+AssignRowGroups(ForeignScanState *scanState, ColumnBlockData **blockDataArray,
+				uint32 blockRowCount)
+{
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	AggregateGroup **rowGroupArray = cstoreScanState->rowGroupArray;
+	ColumnBlockData *groupBlockData = NULL;
+	AggregateGroup *lastGroup = NULL;
+	uint32 rowIndex = 0;
 
-	double tupleCountEstimate = TupleCountEstimate(baserel, cstoreFdwOptions->filename);
+	if (cstoreScanState->groupColumnIndex >= 0)
+	{
+		groupBlockData = blockDataArray[cstoreScanState->groupColumnIndex];
+	}
+	else
+	{
+		lastGroup = cstoreScanState->groupArray[0];
+	}
 
-	/*
-	 * We estimate costs almost the same way as cost_seqscan(), thus assuming
-	 * that I/O costs are equivalent to a regular table file of the same size.
-	 */
-	double filterCostPerTuple = baserel->baserestrictcost.per_tuple;
-	double cpuCostPerTuple = cpu_tuple_cost + filterCostPerTuple;
-	double totalCpuCost = cpuCostPerTuple * tupleCountEstimate;
+	if (cstoreScanState->aggregateQual != NULL)
+	{
+		TupleTableSlot *rowSlot = cstoreScanState->rowSlot;
+		uint32 columnCount = rowSlot->tts_tupleDescriptor->natts;
 
-	double startupCost = baserel->baserestrictcost.startup;
-	double totalCost  = startupCost + totalCpuCost + totalDiskAccessCost;
+		ExecClearTuple(rowSlot);
+		memset(rowSlot->tts_values, 0, columnCount * sizeof(Datum));
+		memset(rowSlot->tts_isnull, true, columnCount * sizeof(bool));
+	}
 
-	/* create a foreign path node and add it as the only possible path */
-#if PG_VERSION_NUM >= 90600
-	foreignScanPath = (Path *) create_foreignscan_path(root, baserel,
-													   NULL, /* path target */
-													   baserel->rows,
-													   startupCost, totalCost,
-													   NIL,  /* no known ordering */
-													   NULL, /* not parameterized */
-													   NULL, /* no outer path */
-													   NIL); /* no fdw_private */
+	for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
+	{
+		AggregateGroup *group = lastGroup;
 
-#elif PG_VERSION_NUM >= 90500
-	foreignScanPath = (Path *) create_foreignscan_path(root, baserel, baserel->rows,
-													   startupCost, totalCost,
-													   NIL,  /* no known ordering */
-													   NULL, /* not parameterized */
-													   NULL, /* no outer path */
-													   NIL); /* no fdw_private */
-#else
-	foreignScanPath = (Path *) create_foreignscan_path(root, baserel, baserel->rows,
-													   startupCost, totalCost,
-													   NIL,  /* no known ordering */
-													   NULL, /* not parameterized */
-													   NIL); /* no fdw_private */
-#endif
+		if (cstoreScanState->aggregateQual != NULL &&
+			!BlockRowMatchesQual(scanState, blockDataArray, rowIndex))
+		{
+			InstrCountFiltered1(scanState, 1);
+			rowGroupArray[rowIndex] = NULL;
+			continue;
+		}
 
-	add_path(baserel, foreignScanPath);
-	heap_close(relation, AccessShareLock);
+		if (groupBlockData != NULL)
+		{
+			bool groupValueNull = !groupBlockData->existsArray[rowIndex];
+			Datum groupValue = groupValueNull ? 0 : groupBlockData->valueArray[rowIndex];
+
+			if (group == NULL || group->groupKey.isNull != groupValueNull ||
+				group->groupKey.value != groupValue)
+			{
+				group = LookupAggregateGroup(cstoreScanState, groupValue, groupValueNull);
+				lastGroup = group;
+			}
+		}
+
+		rowGroupArray[rowIndex] = group;
+	}
 }
 
 
 /*
- * CStoreGetForeignPlan creates a ForeignScan plan node for scanning the foreign
- * table. We also add the query column list to scan nodes private list, because
- * we need it later for skipping over unused columns in the query.
+ * BlockRowMatchesQual stores the given row of the block into the scan's row
+ * slot, and checks if the row passes the scan's qualifiers.
  */
-#if PG_VERSION_NUM >= 90500
-static ForeignScan *
-CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
-					 ForeignPath *bestPath, List *targetList, List *scanClauses,
-					 Plan *outerPlan)
-#else
-static ForeignScan *
-CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
-					 ForeignPath *bestPath, List *targetList, List *scanClauses)
-#endif
+static bool
+BlockRowMatchesQual(ForeignScanState *scanState, ColumnBlockData **blockDataArray,
+					uint32 rowIndex)
 {
-	ForeignScan *foreignScan = NULL;
-	List *columnList = NIL;
-	List *foreignPrivateList = NIL;
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	List *projectedColumnList = cstoreScanState->readState->projectedColumnList;
+	TupleTableSlot *rowSlot = cstoreScanState->rowSlot;
+	ExprContext *exprContext = scanState->ss.ps.ps_ExprContext;
+	ListCell *columnCell = NULL;
 
-	/*
-	 * Although we skip row blocks that are refuted by the WHERE clause, but
-	 * we have no native ability to evaluate restriction clauses and make sure
-	 * that all non-related rows are filtered out. So we just put all of the
-	 * scanClauses into the plan node's qual list for the executor to check.
-	 */
-	scanClauses = extract_actual_clauses(scanClauses,
-										 false); /* extract regular clauses */
+	ExecClearTuple(rowSlot);
 
-	/*
-	 * As an optimization, we only read columns that are present in the query.
-	 * To find these columns, we need baserel. We don't have access to baserel
-	 * in executor's callback functions, so we get the column list here and put
-	 * it into foreign scan node's private list.
-	 */
-	columnList = ColumnList(baserel, foreignTableId);
-	foreignPrivateList = list_make1(columnList);
+	foreach(columnCell, projectedColumnList)
+	{
+		Var *column = (Var *) lfirst(columnCell);
+		uint32 columnIndex = column->varattno - 1;
+		ColumnBlockData *blockData = blockDataArray[columnIndex];
 
-	/* create the foreign scan node */
-#if PG_VERSION_NUM >= 90500
-	foreignScan = make_foreignscan(targetList, scanClauses, baserel->relid,
-								   NIL, /* no expressions to evaluate */
-								   foreignPrivateList,
-								   NIL,
-								   NIL,
-								   NULL); /* no outer path */
+		rowSlot->tts_values[columnIndex] = blockData->valueArray[rowIndex];
+		rowSlot->tts_isnull[columnIndex] = !blockData->existsArray[rowIndex];
+	}
+
+	ExecStoreVirtualTuple(rowSlot);
+
+	ResetExprContext(exprContext);
+	exprContext->ecxt_scantuple = rowSlot;
+
+#if PG_VERSION_NUM >= 100000
+	return ExecQual(cstoreScanState->aggregateQual, exprContext);
 #else
-	foreignScan = make_foreignscan(targetList, scanClauses, baserel->relid,
-								   NIL, /* no expressions to evaluate */
-								   foreignPrivateList);
+	return ExecQual(cstoreScanState->aggregateQual, exprContext, false);
 #endif
+}
 
-	return foreignScan;
+
+/*
+ * LookupAggregateGroup finds the group with the given grouping column value,
+ * and creates the group if it doesn't exist yet.
+ */
+static AggregateGroup *
+LookupAggregateGroup(CStoreScanState *cstoreScanState, Datum groupValue,
+					 bool groupValueNull)
+{
+	AggregateGroupKey groupKey;
+	AggregateGroup *group = NULL;
+	bool groupFound = false;
+
+	/* the key is hashed as raw bytes, so we also zero its padding */
+	memset(&groupKey, 0, sizeof(AggregateGroupKey));
+	groupKey.value = groupValue;
+	groupKey.isNull = groupValueNull;
+
+	group = (AggregateGroup *) hash_search(cstoreScanState->groupHash, &groupKey,
+										   HASH_ENTER, &groupFound);
+	if (!groupFound)
+	{
+		AddAggregateGroup(cstoreScanState, group);
+	}
+
+	return group;
 }
 
 
 /*
- * TupleCountEstimate estimates the number of base relation tuples in the given
- * file.
+ * AddAggregateGroup initializes the transition values of the given new group,
+ * and appends the group to the scan's group array. We return groups in the
+ * order we first see them.
  */
-static double
-TupleCountEstimate(RelOptInfo *baserel, const char *filename)
+static void
+AddAggregateGroup(CStoreScanState *cstoreScanState, AggregateGroup *group)
 {
-	double tupleCountEstimate = 0.0;
+	MemoryContext aggregateContext = cstoreScanState->aggregateContext;
 
-	/* check if the user executed Analyze on this foreign table before */
-	if (baserel->pages > 0)
-	{
-		/*
-		 * We have number of pages and number of tuples from pg_class (from a
-		 * previous ANALYZE), so compute a tuples-per-page estimate and scale
-		 * that by the current file size.
-		 */
-		double tupleDensity = baserel->tuples / (double) baserel->pages;
-		BlockNumber pageCount = PageCount(filename);
+	group->transitionArray =
+		MemoryContextAllocZero(aggregateContext, cstoreScanState->aggregateCount *
+							   sizeof(AggregateTransition));
 
-		tupleCountEstimate = clamp_row_est(tupleDensity * (double) pageCount);
-	}
-	else
+	if (cstoreScanState->groupCount == cstoreScanState->groupArraySize)
 	{
-		tupleCountEstimate = (double) CStoreTableRowCount(filename);
+		uint32 groupArraySize = Max(cstoreScanState->groupArraySize * 2, 16);
+		Size groupArrayLength = groupArraySize * sizeof(AggregateGroup *);
+
+		if (cstoreScanState->groupArray == NULL)
+		{
+			cstoreScanState->groupArray = MemoryContextAlloc(aggregateContext,
+															 groupArrayLength);
+		}
+		else
+		{
+			cstoreScanState->groupArray = repalloc(cstoreScanState->groupArray,
+												   groupArrayLength);
+		}
+
+		cstoreScanState->groupArraySize = groupArraySize;
 	}
 
-	return tupleCountEstimate;
+	cstoreScanState->groupArray[cstoreScanState->groupCount] = group;
+	cstoreScanState->groupCount++;
 }
 
 
-/* PageCount calculates and returns the number of pages in a file. */
-static BlockNumber
-PageCount(const char *filename)
+/*
+ * AggregateBlockSummary updates the transition values of each aggregate with a
+ * block summarized by the given skip nodes. All rows of such a block pass the
+ * qualifiers and belong to the same group, so the skip nodes' row and value
+ * counts, sums, and min/max values are all we need.
+ */
+static void
+AggregateBlockSummary(CStoreScanState *cstoreScanState,
+					  ColumnBlockSkipNode **blockSkipNodeArray, uint32 blockRowCount)
 {
-	BlockNumber pageCount = 0;
-	struct stat statBuffer;
+	AggregateGroup *group = NULL;
+	uint32 aggregateIndex = 0;
 
-	/* if file doesn't exist at plan time, use default estimate for its size */
-	int statResult = stat(filename, &statBuffer);
-	if (statResult < 0)
+	if (cstoreScanState->groupColumnIndex >= 0)
 	{
-		statBuffer.st_size = 10 * BLCKSZ;
-	}
+		ColumnBlockSkipNode *groupSkipNode =
+			blockSkipNodeArray[cstoreScanState->groupColumnIndex];
+		bool groupValueNull = (groupSkipNode->valueCount == 0);
+		Datum groupValue = groupValueNull ? 0 : groupSkipNode->minimumValue;
 
-	pageCount = (statBuffer.st_size + (BLCKSZ - 1)) / BLCKSZ;
-	if (pageCount < 1)
+		group = LookupAggregateGroup(cstoreScanState, groupValue, groupValueNull);
+	}
+	else
 	{
-		pageCount = 1;
+		group = cstoreScanState->groupArray[0];
 	}
 
-	return pageCount;
+	for (aggregateIndex = 0; aggregateIndex < cstoreScanState->aggregateCount;
+		 aggregateIndex++)
+	{
+		ScanAggregate *aggregate = &cstoreScanState->aggregateArray[aggregateIndex];
+		AggregateFunctionType functionType = aggregate->functionType;
+		AggregateTransition *transition = &group->transitionArray[aggregateIndex];
+		ColumnBlockSkipNode *blockSkipNode = NULL;
+
+		if (functionType == AGGREGATE_GROUP_COLUMN)
+		{
+			continue;
+		}
+		else if (functionType == AGGREGATE_COUNT_STAR)
+		{
+			transition->count += blockRowCount;
+			continue;
+		}
+
+		blockSkipNode = blockSkipNodeArray[aggregate->columnIndex];
+		if (blockSkipNode->valueCount == 0)
+		{
+			continue;
+		}
+
+		if (functionType == AGGREGATE_SUM || functionType == AGGREGATE_AVG)
+		{
+			transition->integerSum += blockSkipNode->valueSum;
+		}
+		else if (functionType == AGGREGATE_MIN || functionType == AGGREGATE_MAX)
+		{
+			bool minimum = (functionType == AGGREGATE_MIN);
+			Datum value = minimum ? blockSkipNode->minimumValue :
+						  blockSkipNode->maximumValue;
+
+			if (aggregate->integerColumn)
+			{
+				int64 integerValue = IntegerDatumValue(value, aggregate->columnTypeId);
+
+				if (transition->count == 0 ||
+					(minimum && integerValue < transition->integerValue) ||
+					(!minimum && integerValue > transition->integerValue))
+				{
+					transition->integerValue = integerValue;
+				}
+			}
+			else
+			{
+				double floatValue = 0.0;
+				int comparison = 0;
+
+				if (aggregate->columnTypeId == FLOAT4OID)
+				{
+					floatValue = DatumGetFloat4(value);
+				}
+				else
+				{
+					floatValue = DatumGetFloat8(value);
+				}
+
+				comparison = CompareFloatValues(floatValue, transition->floatValue);
+				if (transition->count == 0 || (minimum && comparison < 0) ||
+					(!minimum && comparison > 0))
+				{
+					transition->floatValue = floatValue;
+				}
+			}
+		}
+
+		transition->count += blockSkipNode->valueCount;
+	}
 }
 
 
 /*
- * ColumnList takes in the planner's information about this foreign table. The
- * function then finds all columns needed for query execution, including those
- * used in projections, joins, and filter clauses, de-duplicates these columns,
- * and returns them in a new list. This function is taken from mongo_fdw with
- * slight modifications.
+ * AggregateBlockValues updates the transition values of each aggregate with the
+ * given block's rows. We handle each aggregate in a separate loop over its
+ * column's values, and skip rows that don't belong to any group.
  */
-static List *
-ColumnList(RelOptInfo *baserel, Oid foreignTableId)
+static void
+AggregateBlockValues(CStoreScanState *cstoreScanState, ColumnBlockData **blockDataArray,
+					 uint32 blockRowCount)
 {
-	List *columnList = NIL;
-	List *neededColumnList = NIL;
-	AttrNumber columnIndex = 1;
-	AttrNumber columnCount = baserel->max_attr;
-#if PG_VERSION_NUM >= 90600
-	List *targetColumnList = baserel->reltarget->exprs;
-#else
-	List *targetColumnList = baserel->reltargetlist;
-#endif
-	ListCell *targetColumnCell = NULL;
-	List *restrictInfoList = baserel->baserestrictinfo;
-	ListCell *restrictInfoCell = NULL;
-	const AttrNumber wholeRow = 0;
-	Relation relation = heap_open(foreignTableId, AccessShareLock);
-	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	AggregateGroup **rowGroupArray = cstoreScanState->rowGroupArray;
+	uint32 aggregateIndex = 0;
 
-	/* first add the columns used in joins and projections */
-	foreach(targetColumnCell, targetColumnList)
+	for (aggregateIndex = 0; aggregateIndex < cstoreScanState->aggregateCount;
+		 aggregateIndex++)
 	{
-		List *targetVarList = NIL;
-		Node *targetExpr = (Node *) lfirst(targetColumnCell);
+		ScanAggregate *aggregate = &cstoreScanState->aggregateArray[aggregateIndex];
+		AggregateFunctionType functionType = aggregate->functionType;
+		ColumnBlockData *blockData = NULL;
+		uint32 rowIndex = 0;
 
-#if PG_VERSION_NUM >= 90600
-		targetVarList = pull_var_clause(targetExpr,
-										PVC_RECURSE_AGGREGATES |
-										PVC_RECURSE_PLACEHOLDERS);
-#else
-		targetVarList = pull_var_clause(targetExpr,
-										PVC_RECURSE_AGGREGATES,
-										PVC_RECURSE_PLACEHOLDERS);
-#endif
+		if (functionType == AGGREGATE_GROUP_COLUMN)
+		{
+			continue;
+		}
+		else if (functionType == AGGREGATE_COUNT_STAR)
+		{
+			for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
+			{
+				AggregateGroup *group = rowGroupArray[rowIndex];
+				if (group != NULL)
+				{
+					group->transitionArray[aggregateIndex].count++;
+				}
+			}
 
-		neededColumnList = list_union(neededColumnList, targetVarList);
+			continue;
+		}
+
+		blockData = blockDataArray[aggregate->columnIndex];
+
+		if (functionType == AGGREGATE_COUNT)
+		{
+			bool *existsArray = blockData->existsArray;
+
+			for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
+			{
+				AggregateGroup *group = rowGroupArray[rowIndex];
+				if (group != NULL && existsArray[rowIndex])
+				{
+					group->transitionArray[aggregateIndex].count++;
+				}
+			}
+		}
+		else if (aggregate->integerColumn)
+		{
+			AggregateIntegerValues(aggregate, aggregateIndex, blockData,
+								   rowGroupArray, blockRowCount);
+		}
+		else
+		{
+			AggregateFloatValues(aggregate, aggregateIndex, blockData,
+								 rowGroupArray, blockRowCount);
+		}
 	}
+}
 
-	/* then walk over all restriction clauses, and pull up any used columns */
-	foreach(restrictInfoCell, restrictInfoList)
+
+/*
+ * AggregateIntegerValues updates sum, avg, min, or max transition values with
+ * the given block of integer, date, or timestamp values. Like the builtin
+ * transition functions, we sum smallint and integer values into 64-bit sums.
+ */
+static void
+AggregateIntegerValues(ScanAggregate *aggregate, uint32 aggregateIndex,
+					   ColumnBlockData *blockData, AggregateGroup **rowGroupArray,
+					   uint32 blockRowCount)
+{
+	AggregateFunctionType functionType = aggregate->functionType;
+	Oid columnTypeId = aggregate->columnTypeId;
+	bool *existsArray = blockData->existsArray;
+	Datum *valueArray = blockData->valueArray;
+	uint32 rowIndex = 0;
+
+	for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
 	{
-		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
-		Node *restrictClause = (Node *) restrictInfo->clause;
-		List *clauseColumnList = NIL;
+		AggregateGroup *group = rowGroupArray[rowIndex];
+		AggregateTransition *transition = NULL;
+		int64 value = 0;
 
-		/* recursively pull up any columns used in the restriction clause */
-#if PG_VERSION_NUM >= 90600
-		clauseColumnList = pull_var_clause(restrictClause,
-										   PVC_RECURSE_AGGREGATES |
-										   PVC_RECURSE_PLACEHOLDERS);
-#else
-		clauseColumnList = pull_var_clause(restrictClause,
-										   PVC_RECURSE_AGGREGATES,
-										   PVC_RECURSE_PLACEHOLDERS);
-#endif
+		if (group == NULL || !existsArray[rowIndex])
+		{
+			continue;
+		}
 
-		neededColumnList = list_union(neededColumnList, clauseColumnList);
+		transition = &group->transitionArray[aggregateIndex];
+		value = IntegerDatumValue(valueArray[rowIndex], columnTypeId);
+
+		if (functionType == AGGREGATE_SUM || functionType == AGGREGATE_AVG)
+		{
+			transition->integerSum += value;
+		}
+		else if (functionType == AGGREGATE_MIN)
+		{
+			if (transition->count == 0 || value < transition->integerValue)
+			{
+				transition->integerValue = value;
+			}
+		}
+		else if (functionType == AGGREGATE_MAX)
+		{
+			if (transition->count == 0 || value > transition->integerValue)
+			{
+				transition->integerValue = value;
+			}
+		}
+
+		transition->count++;
 	}
+}
 
-	/* walk over all column definitions, and de-duplicate column list */
-	for (columnIndex = 1; columnIndex <= columnCount; columnIndex++)
+
+/*
+ * AggregateFloatValues updates sum, avg, min, or max transition values with the
+ * given block of floating point values. As the builtin functions do, we sum
+ * real values as real values for sum, and as double precision values for avg.
+ * We also error out on overflows, and order NaN values after all other values.
+ */
+static void
+AggregateFloatValues(ScanAggregate *aggregate, uint32 aggregateIndex,
+					 ColumnBlockData *blockData, AggregateGroup **rowGroupArray,
+					 uint32 blockRowCount)
+{
+	AggregateFunctionType functionType = aggregate->functionType;
+	bool realColumn = (aggregate->columnTypeId == FLOAT4OID);
+	bool *existsArray = blockData->existsArray;
+	Datum *valueArray = blockData->valueArray;
+	uint32 rowIndex = 0;
+
+	for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
 	{
-		ListCell *neededColumnCell = NULL;
-		Var *column = NULL;
-		Form_pg_attribute attributeForm =  TupleDescAttr(tupleDescriptor, columnIndex - 1);
+		AggregateGroup *group = rowGroupArray[rowIndex];
+		AggregateTransition *transition = NULL;
+		double value = 0.0;
 
-		if (attributeForm->attisdropped)
+		if (group == NULL || !existsArray[rowIndex])
 		{
 			continue;
 		}
 
-		/* look for this column in the needed column list */
-		foreach(neededColumnCell, neededColumnList)
+		transition = &group->transitionArray[aggregateIndex];
+		if (realColumn)
 		{
-			Var *neededColumn = (Var *) lfirst(neededColumnCell);
-			if (neededColumn->varattno == columnIndex)
+			value = DatumGetFloat4(valueArray[rowIndex]);
+		}
+		else
+		{
+			value = DatumGetFloat8(valueArray[rowIndex]);
+		}
+
+		if (functionType == AGGREGATE_SUM || functionType == AGGREGATE_AVG)
+		{
+			double sum = 0.0;
+
+			if (functionType == AGGREGATE_SUM && realColumn)
 			{
-				column = neededColumn;
-				break;
+				sum = (float4) transition->floatSum + (float4) value;
 			}
-			else if (neededColumn->varattno == wholeRow)
+			else
 			{
-				Index tableId = neededColumn->varno;
+				sum = transition->floatSum + value;
+			}
 
-				column = makeVar(tableId, columnIndex, attributeForm->atttypid,
-								 attributeForm->atttypmod, attributeForm->attcollation,
-								 0);
-				break;
+			if (isinf(sum) && !isinf(transition->floatSum) && !isinf(value))
+			{
+				ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+								errmsg("value out of range: overflow")));
 			}
-		}
 
-		if (column != NULL)
+			transition->floatSum = sum;
+		}
+		else if (functionType == AGGREGATE_MIN)
 		{
-			columnList = lappend(columnList, column);
+			if (transition->count == 0 ||
+				CompareFloatValues(value, transition->floatValue) <= 0)
+			{
+				transition->floatValue = value;
+			}
+		}
+		else if (functionType == AGGREGATE_MAX)
+		{
+			if (transition->count == 0 ||
+				CompareFloatValues(value, transition->floatValue) >= 0)
+			{
+				transition->floatValue = value;
+			}
 		}
-	}
-
-	heap_close(relation, AccessShareLock);
 
-	return columnList;
+		transition->count++;
+	}
 }
 
 
-/* CStoreExplainForeignScan produces extra output for the Explain command. */
+/*
+ * SetAggregateGroupValues sets the output column values of the given group, in
+ * the order of the aggregate scan's target list.
+ */
 static void
-CStoreExplainForeignScan(ForeignScanState *scanState, ExplainState *explainState)
+SetAggregateGroupValues(CStoreScanState *cstoreScanState, AggregateGroup *group,
+						Datum *columnValues, bool *columnNulls)
 {
-	Oid foreignTableId = RelationGetRelid(scanState->ss.ss_currentRelation);
-	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
-
-	ExplainPropertyText("CStore File", cstoreFdwOptions->filename, explainState);
+	uint32 aggregateIndex = 0;
 
-	/* supress file size if we're not showing cost details */
-	if (explainState->costs)
+	for (aggregateIndex = 0; aggregateIndex < cstoreScanState->aggregateCount;
+		 aggregateIndex++)
 	{
-		struct stat statBuffer;
+		ScanAggregate *aggregate = &cstoreScanState->aggregateArray[aggregateIndex];
+		AggregateTransition *transition = &group->transitionArray[aggregateIndex];
+		Oid columnTypeId = aggregate->columnTypeId;
+		Datum value = 0;
+		bool valueNull = false;
 
-		int statResult = stat(cstoreFdwOptions->filename, &statBuffer);
-		if (statResult == 0)
+		switch (aggregate->functionType)
 		{
-			ExplainPropertyLong("CStore File Size", (long) statBuffer.st_size,
-								explainState);
+			case AGGREGATE_GROUP_COLUMN:
+			{
+				value = group->groupKey.value;
+				valueNull = group->groupKey.isNull;
+				break;
+			}
+
+			case AGGREGATE_COUNT_STAR:
+			case AGGREGATE_COUNT:
+			{
+				value = Int64GetDatum(transition->count);
+				break;
+			}
+
+			case AGGREGATE_SUM:
+			{
+				if (aggregate->integerColumn)
+				{
+					value = Int64GetDatum(transition->integerSum);
+				}
+				else if (columnTypeId == FLOAT4OID)
+				{
+					value = Float4GetDatum((float4) transition->floatSum);
+				}
+				else
+				{
+					value = Float8GetDatum(transition->floatSum);
+				}
+
+				valueNull = (transition->count == 0);
+				break;
+			}
+
+			case AGGREGATE_AVG:
+			{
+				/* we compute integer averages in numeric, as int8_avg() does */
+				if (transition->count == 0)
+				{
+					valueNull = true;
+				}
+				else if (aggregate->integerColumn)
+				{
+					Datum sum = DirectFunctionCall1(int8_numeric,
+													Int64GetDatum(transition->integerSum));
+					Datum count = DirectFunctionCall1(int8_numeric,
+													  Int64GetDatum(transition->count));
+
+					value = DirectFunctionCall2(numeric_div, sum, count);
+				}
+				else
+				{
+					value = Float8GetDatum(transition->floatSum / transition->count);
+				}
+
+				break;
+			}
+
+			case AGGREGATE_MIN:
+			case AGGREGATE_MAX:
+			{
+				if (aggregate->integerColumn)
+				{
+					value = IntegerValueDatum(transition->integerValue, columnTypeId);
+				}
+				else if (columnTypeId == FLOAT4OID)
+				{
+					value = Float4GetDatum((float4) transition->floatValue);
+				}
+				else
+				{
+					value = Float8GetDatum(transition->floatValue);
+				}
+
+				valueNull = (transition->count == 0);
+				break;
+			}
+
+			default:
+			{
+				ereport(ERROR, (errmsg("unsupported aggregate function type: %d",
+									   aggregate->functionType)));
+			}
 		}
+
+		columnValues[aggregateIndex] = value;
+		columnNulls[aggregateIndex] = valueNull;
 	}
 }
 
 
-/* CStoreBeginForeignScan starts reading the underlying cstore file. */
-static void
-CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags)
+/* IntegerDatumValue returns the given integer, date, or timestamp as an int64. */
+static int64
+IntegerDatumValue(Datum datum, Oid typeId)
 {
-	TableReadState *readState = NULL;
-	Oid foreignTableId = InvalidOid;
-	CStoreFdwOptions *cstoreFdwOptions = NULL;
-	Relation currentRelation = scanState->ss.ss_currentRelation;
-	TupleDesc tupleDescriptor = RelationGetDescr(currentRelation);
-	List *columnList = NIL;
-	ForeignScan *foreignScan = NULL;
-	List *foreignPrivateList = NIL;
-	List *whereClauseList = NIL;
-
-	/* if Explain with no Analyze, do nothing */
-	if (executorFlags & EXEC_FLAG_EXPLAIN_ONLY)
+	switch (typeId)
 	{
-		return;
+		case INT2OID:
+		{
+			return DatumGetInt16(datum);
+		}
+
+		case INT4OID:
+		case DATEOID:
+		{
+			return DatumGetInt32(datum);
+		}
+
+		default:
+		{
+			return DatumGetInt64(datum);
+		}
 	}
+}
 
-	foreignTableId = RelationGetRelid(scanState->ss.ss_currentRelation);
-	cstoreFdwOptions = CStoreGetOptions(foreignTableId);
 
-	foreignScan = (ForeignScan *) scanState->ss.ps.plan;
-	foreignPrivateList = (List *) foreignScan->fdw_private;
-	whereClauseList = foreignScan->scan.plan.qual;
+/* IntegerValueDatum converts the given int64 back into a datum of the given type. */
+static Datum
+IntegerValueDatum(int64 value, Oid typeId)
+{
+	switch (typeId)
+	{
+		case INT2OID:
+		{
+			return Int16GetDatum((int16) value);
+		}
 
-	columnList = (List *) linitial(foreignPrivateList);
-	readState = CStoreBeginRead(cstoreFdwOptions->filename, tupleDescriptor,
-								columnList, whereClauseList);
+		case INT4OID:
+		case DATEOID:
+		{
+			return Int32GetDatum((int32) value);
+		}
 
-	scanState->fdw_state = (void *) readState;
+		default:
+		{
+			return Int64GetDatum(value);
+		}
+	}
 }
 
 
 /*
- * CStoreIterateForeignScan reads the next record from the cstore file, converts
- * it to a Postgres tuple, and stores the converted tuple into the ScanTupleSlot
- * as a virtual tuple.
+ * CompareFloatValues compares two floating point values the same way as btree
+ * comparison functions do, which consider NaN values equal to each other and
+ * greater than all other values.
  */
-static TupleTableSlot *
-CStoreIterateForeignScan(ForeignScanState *scanState)
+static int
+CompareFloatValues(double leftValue, double rightValue)
 {
-	TableReadState *readState = (TableReadState *) scanState->fdw_state;
-	TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
-	bool nextRowFound = false;
-
-	TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
-	Datum *columnValues = tupleSlot->tts_values;
-	bool *columnNulls = tupleSlot->tts_isnull;
-	uint32 columnCount = tupleDescriptor->natts;
-
-	/* initialize all values for this row to null */
-	memset(columnValues, 0, columnCount * sizeof(Datum));
-	memset(columnNulls, true, columnCount * sizeof(bool));
-
-	ExecClearTuple(tupleSlot);
-
-	nextRowFound = CStoreReadNextRow(readState, columnValues, columnNulls);
-	if (nextRowFound)
+	if (isnan(leftValue))
 	{
-		ExecStoreVirtualTuple(tupleSlot);
+		return isnan(rightValue) ? 0 : 1;
+	}
+	else if (isnan(rightValue))
+	{
+		return -1;
 	}
 
-	return tupleSlot;
+	return (leftValue > rightValue) - (leftValue < rightValue);
 }
 
 
@@ -2013,20 +7427,85 @@ CStoreIterateForeignScan(ForeignScanState *scanState)
 static void
 CStoreEndForeignScan(ForeignScanState *scanState)
 {
-	TableReadState *readState = (TableReadState *) scanState->fdw_state;
-	if (readState != NULL)
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	if (cstoreScanState != NULL)
 	{
-		CStoreEndRead(readState);
+		CStoreEndRead(cstoreScanState->readState);
+
+		if (cstoreScanState->topNContext != NULL)
+		{
+			MemoryContextDelete(cstoreScanState->topNContext);
+		}
+
+		if (cstoreScanState->aggregateContext != NULL)
+		{
+			MemoryContextDelete(cstoreScanState->aggregateContext);
+			ExecDropSingleTupleTableSlot(cstoreScanState->rowSlot);
+			heap_close(cstoreScanState->relation, NoLock);
+		}
 	}
 }
 
 
-/* CStoreReScanForeignScan rescans the foreign table. */
+/*
+ * CStoreReScanForeignScan rescans the foreign table. Parent nodes set values
+ * of executor parameters before rescanning, so we evaluate the qualifiers again
+ * and use these values for block filtering in parameterized scans. We keep the
+ * open file and the metadata read so far, since a parameterized scan may be
+ * rescanned once for every outer row of a nested loop join.
+ */
 static void
 CStoreReScanForeignScan(ForeignScanState *scanState)
 {
-	CStoreEndForeignScan(scanState);
-	CStoreBeginForeignScan(scanState, 0);
+	CStoreScanState *cstoreScanState = (CStoreScanState *) scanState->fdw_state;
+	TableReadState *readState = cstoreScanState->readState;
+	ExprContext *exprContext = scanState->ss.ps.ps_ExprContext;
+	ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+	List *whereClauseList = foreignScan->scan.plan.qual;
+	MemoryContext oldContext = NULL;
+
+	if (cstoreScanState->aggregateArray != NULL)
+	{
+		whereClauseList = cstoreScanState->aggregateClauseList;
+	}
+
+	/*
+	 * Evaluated qualifiers are temporary, since the reader keeps its own copy
+	 * when they differ from the previous ones.
+	 */
+	oldContext = MemoryContextSwitchTo(exprContext->ecxt_per_tuple_memory);
+
+	if (whereClauseList != NIL)
+	{
+		whereClauseList = EvaluateRuntimeConstants(whereClauseList, exprContext, true);
+	}
+
+	CStoreRescanRead(readState, whereClauseList);
+
+	MemoryContextSwitchTo(oldContext);
+	ResetExprContext(exprContext);
+
+	/* top-N scans read their rows again with the new qualifiers */
+	if (cstoreScanState->topNContext != NULL)
+	{
+		MemoryContextReset(cstoreScanState->topNContext);
+		cstoreScanState->topNRowArray = NULL;
+		cstoreScanState->topNRowCount = 0;
+		cstoreScanState->returnedRowCount = 0;
+		cstoreScanState->topNRowsComputed = false;
+	}
+
+	/* aggregate scans compute their groups again */
+	if (cstoreScanState->aggregateContext != NULL)
+	{
+		MemoryContextReset(cstoreScanState->aggregateContext);
+		cstoreScanState->groupHash = NULL;
+		cstoreScanState->groupArray = NULL;
+		cstoreScanState->groupCount = 0;
+		cstoreScanState->groupArraySize = 0;
+		cstoreScanState->returnedGroupCount = 0;
+		cstoreScanState->groupsComputed = false;
+	}
 }
 
 
@@ -2066,10 +7545,10 @@ CStoreAnalyzeForeignTable(Relation relation,
  * in the collection and return it in total row count. We also always set dead
  * row count to zero.
  *
- * Note that the returned list of rows does not always follow their actual order
- * in the cstore file. Therefore, correlation estimates derived later could be
- * inaccurate, but that's OK. We currently don't use correlation estimates (the
- * planner only pays attention to correlation for index scans).
+ * Reservoir sampling replaces rows at random positions, so we remember each
+ * row's position in the cstore file and sort the sample by it before returning.
+ * This way, correlation estimates derived later reflect the physical order of
+ * rows, which we use for costing parameterized scans.
  */
 static int
 CStoreAcquireSampleRows(Relation relation, int logLevel,
@@ -2181,6 +7660,7 @@ CStoreAcquireSampleRows(Relation relation, int logLevel,
 		{
 			sampleRows[sampleRowCount] = heap_form_tuple(tupleDescriptor, columnValues,
 														 columnNulls);
+			SetSampleRowPosition(sampleRows[sampleRowCount], rowCount);
 			sampleRowCount++;
 		}
 		else
@@ -2209,6 +7689,7 @@ CStoreAcquireSampleRows(Relation relation, int logLevel,
 				heap_freetuple(sampleRows[rowIndex]);
 				sampleRows[rowIndex] = heap_form_tuple(tupleDescriptor,
 													   columnValues, columnNulls);
+				SetSampleRowPosition(sampleRows[rowIndex], rowCount);
 			}
 
 			rowCountToSkip--;
@@ -2222,25 +7703,77 @@ CStoreAcquireSampleRows(Relation relation, int logLevel,
 	pfree(columnValues);
 	pfree(columnNulls);
 
-	CStoreEndForeignScan(scanState);
+	CStoreEndForeignScan(scanState);
+
+	/* put sample rows back into their physical order */
+	qsort((void *) sampleRows, sampleRowCount, sizeof(HeapTuple), CompareSampleRows);
+
+	/* emit some interesting relation info */
+	relationName = RelationGetRelationName(relation);
+	ereport(logLevel, (errmsg("\"%s\": file contains %.0f rows; %d rows in sample",
+							  relationName, rowCount, sampleRowCount)));
+
+	(*totalRowCount) = rowCount;
+	(*totalDeadRowCount) = 0;
+
+	return sampleRowCount;
+}
+
+
+/*
+ * SetSampleRowPosition records the row's position in the cstore file in the
+ * tuple's item pointer, so we can later sort sample rows by this position.
+ */
+static void
+SetSampleRowPosition(HeapTuple sampleRow, double rowNumber)
+{
+	uint64 rowIndex = (uint64) rowNumber;
+	BlockNumber blockNumber = (BlockNumber) (rowIndex / MaxHeapTuplesPerPage);
+	OffsetNumber offsetNumber = (OffsetNumber) (rowIndex % MaxHeapTuplesPerPage) + 1;
+
+	ItemPointerSet(&sampleRow->t_self, blockNumber, offsetNumber);
+}
+
+
+/* CompareSampleRows compares sample rows by their position in the file. */
+static int
+CompareSampleRows(const void *leftElement, const void *rightElement)
+{
+	HeapTuple leftRow = *((const HeapTuple *) leftElement);
+	HeapTuple rightRow = *((const HeapTuple *) rightElement);
 
-	/* emit some interesting relation info */
-	relationName = RelationGetRelationName(relation);
-	ereport(logLevel, (errmsg("\"%s\": file contains %.0f rows; %d rows in sample",
-							  relationName, rowCount, sampleRowCount)));
+	return ItemPointerCompare(&leftRow->t_self, &rightRow->t_self);
+}
 
-	(*totalRowCount) = rowCount;
-	(*totalDeadRowCount) = 0;
 
-	return sampleRowCount;
+/*
+ * CStoreAddForeignUpdateTargets adds a junk ctid column to UPDATE and DELETE
+ * statements on cstore tables. Scans of the target table set this column to the
+ * position of each row, which then identifies the row to update or delete.
+ */
+static void
+CStoreAddForeignUpdateTargets(Query *parseTree, RangeTblEntry *tableEntry,
+							  Relation targetRelation)
+{
+	Var *rowIdColumn = makeVar(parseTree->resultRelation, SelfItemPointerAttributeNumber,
+							   TIDOID, -1, InvalidOid, 0);
+	TargetEntry *targetEntry = makeTargetEntry((Expr *) rowIdColumn,
+											   list_length(parseTree->targetList) + 1,
+											   pstrdup(CSTORE_ROW_ID_COLUMN_NAME),
+											   true);
+
+	parseTree->targetList = lappend(parseTree->targetList, targetEntry);
 }
 
 
 /*
- * CStorePlanForeignModify checks if operation is supported. Only insert
- * command with subquery (ie insert into <table> select ...) is supported.
- * Other forms of insert, delete, and update commands are not supported. It
- * throws an error when the command is not supported.
+ * CStorePlanForeignModify checks if operation is supported. Insert commands,
+ * and update and delete commands without a returning list are supported. It
+ * throws an error when the command is not supported. Inserts with a subquery
+ * (ie insert into <table> select ...) write their rows into stripes. Other
+ * inserts usually add a few rows, so they append their rows to the table's
+ * delta store instead. For inserts, the function returns a list with a flag
+ * that tells which of the two the insert does.
  */
 static List *
 CStorePlanForeignModify(PlannerInfo *plannerInfo, ModifyTable *plan,
@@ -2252,11 +7785,8 @@ CStorePlanForeignModify(PlannerInfo *plannerInfo, ModifyTable *plan,
 	{
 		ListCell *tableCell = NULL;
 		Query *query = NULL;
+		bool deltaInsert = true;
 
-		/*
-		 * Only insert operation with select subquery is supported. Other forms
-		 * of insert, update, and delete operations are not supported.
-		 */
 		query = plannerInfo->parse;
 		foreach(tableCell, query->rtable)
 		{
@@ -2266,10 +7796,25 @@ CStorePlanForeignModify(PlannerInfo *plannerInfo, ModifyTable *plan,
 				tableEntry->subquery != NULL &&
 				tableEntry->subquery->commandType == CMD_SELECT)
 			{
-				operationSupported = true;
+				deltaInsert = false;
 				break;
 			}
 		}
+
+		return list_make1(makeInteger(deltaInsert));
+	}
+	else if (plan->operation == CMD_UPDATE || plan->operation == CMD_DELETE)
+	{
+		/* we don't keep removed rows' values around for the returning list */
+		if (plannerInfo->parse->returningList != NIL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("%s with a RETURNING clause is not supported "
+								   "on cstore tables",
+								   plan->operation == CMD_UPDATE ? "UPDATE" : "DELETE")));
+		}
+
+		operationSupported = true;
 	}
 
 	if (!operationSupported)
@@ -2283,8 +7828,9 @@ CStorePlanForeignModify(PlannerInfo *plannerInfo, ModifyTable *plan,
 
 
 /*
- * CStoreBeginForeignModify prepares cstore table for a modification.
- * Only insert is currently supported.
+ * CStoreBeginForeignModify prepares cstore table for a modification. An update
+ * deletes the old versions of rows and inserts their new versions, so it needs
+ * the states of both.
  */
 static void
 CStoreBeginForeignModify(ModifyTableState *modifyTableState,
@@ -2297,38 +7843,140 @@ CStoreBeginForeignModify(ModifyTableState *modifyTableState,
 		return;
 	}
 
+	if (modifyTableState->operation == CMD_UPDATE)
+	{
+		CStoreModifyState *modifyState = NULL;
+
+		CStoreBeginForeignDelete(modifyTableState, relationInfo, subplanIndex);
+
+		modifyState = (CStoreModifyState *) relationInfo->ri_FdwState;
+		modifyState->operation = CMD_UPDATE;
+		modifyState->writeState = BeginModifyWrite(relationInfo);
+		return;
+	}
+	else if (modifyTableState->operation == CMD_DELETE)
+	{
+		CStoreBeginForeignDelete(modifyTableState, relationInfo, subplanIndex);
+		return;
+	}
+
 	Assert (modifyTableState->operation == CMD_INSERT);
 
+	if (fdwPrivate != NIL && intVal(linitial(fdwPrivate)))
+	{
+		CStoreBeginDeltaInsert(relationInfo);
+		return;
+	}
+
 	CStoreBeginForeignInsert(modifyTableState, relationInfo);
 }
 
 
+/*
+ * CStoreBeginDeltaInsert prepares a cstore table for an insert whose rows go to
+ * the table's delta store. We collect the rows in memory, and append them to the
+ * delta file when the insert ends.
+ */
+static void
+CStoreBeginDeltaInsert(ResultRelInfo *relationInfo)
+{
+	Oid foreignTableOid = RelationGetRelid(relationInfo->ri_RelationDesc);
+	CStoreModifyState *modifyState = palloc0(sizeof(CStoreModifyState));
+
+	modifyState->operation = CMD_INSERT;
+	modifyState->deltaInsert = true;
+	modifyState->relation = heap_open(foreignTableOid, RowExclusiveLock);
+	modifyState->filename = CStoreGetOptions(foreignTableOid)->filename;
+	modifyState->deltaRowBuffer = makeStringInfo();
+	modifyState->deltaRowCount = 0;
+
+	relationInfo->ri_FdwState = (void *) modifyState;
+}
+
+
 /*
  * CStoreBeginForeignInsert prepares a cstore table for an insert or rows
  * coming from a COPY.
  */
 static void
 CStoreBeginForeignInsert(ModifyTableState *modifyTableState, ResultRelInfo *relationInfo)
+{
+	CStoreModifyState *modifyState = palloc0(sizeof(CStoreModifyState));
+
+	modifyState->operation = CMD_INSERT;
+	modifyState->writeState = BeginModifyWrite(relationInfo);
+	relationInfo->ri_FdwState = (void *) modifyState;
+}
+
+
+/*
+ * BeginModifyWrite opens the given result relation, and starts a write operation
+ * on a segment of the relation that no other load is writing into. All rows that
+ * a statement inserts go to this write operation, and so fill full stripes.
+ */
+static TableWriteState *
+BeginModifyWrite(ResultRelInfo *relationInfo)
 {
 	Oid  foreignTableOid = InvalidOid;
 	CStoreFdwOptions *cstoreFdwOptions = NULL;
 	TupleDesc tupleDescriptor = NULL;
 	TableWriteState *writeState = NULL;
 	Relation relation = NULL;
+	uint32 segmentIndex = 0;
 
 	foreignTableOid = RelationGetRelid(relationInfo->ri_RelationDesc);
-	relation = heap_open(foreignTableOid, ShareUpdateExclusiveLock);
+	relation = heap_open(foreignTableOid, RowExclusiveLock);
 	cstoreFdwOptions = CStoreGetOptions(foreignTableOid);
 	tupleDescriptor = RelationGetDescr(relationInfo->ri_RelationDesc);
 
-	writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
+	segmentIndex = LockWritableSegment(relation, cstoreFdwOptions->filename);
+	writeState = CStoreBeginWrite(CStoreSegmentFilename(cstoreFdwOptions->filename,
+														segmentIndex),
 								  cstoreFdwOptions->compressionType,
 								  cstoreFdwOptions->stripeRowCount,
 								  cstoreFdwOptions->blockRowCount,
+								  cstoreFdwOptions->indexColumnIndex,
+								  cstoreFdwOptions->maxSkipValueLengthArray,
 								  tupleDescriptor);
 
 	writeState->relation = relation;
-	relationInfo->ri_FdwState = (void *) writeState;
+	writeState->segmentIndex = segmentIndex;
+
+	return writeState;
+}
+
+
+/*
+ * CStoreBeginForeignDelete prepares a cstore table for a delete, or for the
+ * delete part of an update. The scan of the table already locked the table's
+ * segments, and returns the position of each row in the junk ctid column.
+ */
+static void
+CStoreBeginForeignDelete(ModifyTableState *modifyTableState, ResultRelInfo *relationInfo,
+						 int subplanIndex)
+{
+	Oid foreignTableOid = RelationGetRelid(relationInfo->ri_RelationDesc);
+	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableOid);
+	Plan *subplan = modifyTableState->mt_plans[subplanIndex]->plan;
+	CStoreModifyState *modifyState = palloc0(sizeof(CStoreModifyState));
+
+	modifyState->operation = CMD_DELETE;
+	modifyState->filename = cstoreFdwOptions->filename;
+	modifyState->rowIdAttributeNumber =
+		ExecFindJunkAttributeInTlist(subplan->targetlist, CSTORE_ROW_ID_COLUMN_NAME);
+	if (!AttributeNumberIsValid(modifyState->rowIdAttributeNumber))
+	{
+		ereport(ERROR, (errmsg("could not find junk ctid column")));
+	}
+
+	modifyState->deleteContext = AllocSetContextCreate(CurrentMemoryContext,
+													   "CStore Delete Context",
+													   ALLOCSET_DEFAULT_SIZES);
+	modifyState->stripeCount = 0;
+	modifyState->deletedRowBitmapArray = NULL;
+	modifyState->deletedRowBitmapLengthArray = NULL;
+
+	relationInfo->ri_FdwState = (void *) modifyState;
 }
 
 
@@ -2340,10 +7988,11 @@ static TupleTableSlot *
 CStoreExecForeignInsert(EState *executorState, ResultRelInfo *relationInfo,
 						TupleTableSlot *tupleSlot, TupleTableSlot *planSlot)
 {
-	TableWriteState *writeState = (TableWriteState*) relationInfo->ri_FdwState;
+	CStoreModifyState *modifyState = (CStoreModifyState *) relationInfo->ri_FdwState;
+	TableWriteState *writeState = modifyState->writeState;
 	HeapTuple heapTuple;
 
-	Assert(writeState != NULL);
+	Assert(writeState != NULL || modifyState->deltaInsert);
 
 	heapTuple = GetSlotHeapTuple(tupleSlot);
 
@@ -2354,6 +8003,15 @@ CStoreExecForeignInsert(EState *executorState, ResultRelInfo *relationInfo,
 												 tupleSlot->tts_tupleDescriptor);
 
 		ExecForceStoreHeapTuple(newTuple, tupleSlot, true);
+		heapTuple = newTuple;
+	}
+
+	if (modifyState->deltaInsert)
+	{
+		CStoreAppendDeltaRow(modifyState->deltaRowBuffer, heapTuple);
+		modifyState->deltaRowCount++;
+
+		return tupleSlot;
 	}
 
 	slot_getallattrs(tupleSlot);
@@ -2365,13 +8023,165 @@ CStoreExecForeignInsert(EState *executorState, ResultRelInfo *relationInfo,
 
 
 /*
- * CStoreEndForeignModify ends the current modification. Only insert is currently
- * supported.
+ * CStoreExecForeignUpdate marks the old version of the row that the junk ctid
+ * column of the given plan slot identifies as deleted, and appends the row's new
+ * version in the given slot to the table. Joins may return a row more than once,
+ * and then we only update it the first time.
+ */
+static TupleTableSlot *
+CStoreExecForeignUpdate(EState *executorState, ResultRelInfo *relationInfo,
+						TupleTableSlot *tupleSlot, TupleTableSlot *planSlot)
+{
+	CStoreModifyState *modifyState = (CStoreModifyState *) relationInfo->ri_FdwState;
+
+	if (!MarkRowIdDeleted(modifyState, planSlot))
+	{
+		return NULL;
+	}
+
+	return CStoreExecForeignInsert(executorState, relationInfo, tupleSlot, planSlot);
+}
+
+
+/*
+ * CStoreExecForeignDelete marks the row that the junk ctid column of the given
+ * plan slot identifies as deleted. Joins may return a row more than once, and
+ * then we only count the first deletion.
+ */
+static TupleTableSlot *
+CStoreExecForeignDelete(EState *executorState, ResultRelInfo *relationInfo,
+						TupleTableSlot *tupleSlot, TupleTableSlot *planSlot)
+{
+	CStoreModifyState *modifyState = (CStoreModifyState *) relationInfo->ri_FdwState;
+
+	if (!MarkRowIdDeleted(modifyState, planSlot))
+	{
+		return NULL;
+	}
+
+	return tupleSlot;
+}
+
+
+/*
+ * MarkRowIdDeleted marks the row that the junk ctid column of the given plan
+ * slot identifies as deleted. The function returns false if the row was already
+ * marked.
+ */
+static bool
+MarkRowIdDeleted(CStoreModifyState *modifyState, TupleTableSlot *planSlot)
+{
+	Datum rowIdDatum = 0;
+	bool rowIdNull = false;
+	uint32 stripeIndex = 0;
+	uint32 rowOffset = 0;
+
+	rowIdDatum = ExecGetJunkAttribute(planSlot, modifyState->rowIdAttributeNumber,
+									  &rowIdNull);
+	if (rowIdNull)
+	{
+		ereport(ERROR, (errmsg("ctid is NULL")));
+	}
+
+	DecodeRowId((ItemPointer) DatumGetPointer(rowIdDatum), &stripeIndex, &rowOffset);
+
+	return MarkDeletedRow(modifyState, stripeIndex, rowOffset);
+}
+
+
+/*
+ * MarkDeletedRow sets the bit of the given row in its stripe's deletion bitmap,
+ * and grows the bitmap arrays as needed. The function returns false if the row
+ * was already marked.
+ */
+static bool
+MarkDeletedRow(CStoreModifyState *modifyState, uint32 stripeIndex, uint32 rowOffset)
+{
+	MemoryContext deleteContext = modifyState->deleteContext;
+	uint32 byteIndex = rowOffset / 8;
+	uint8 rowBit = (uint8) (1 << (rowOffset % 8));
+	uint8 *deletedRowBitmap = NULL;
+
+	if (stripeIndex >= modifyState->stripeCount)
+	{
+		uint32 stripeCount = Max(stripeIndex + 1, modifyState->stripeCount * 2);
+		uint8 **bitmapArray = MemoryContextAllocZero(deleteContext,
+													 stripeCount * sizeof(uint8 *));
+		uint32 *lengthArray = MemoryContextAllocZero(deleteContext,
+													 stripeCount * sizeof(uint32));
+
+		if (modifyState->stripeCount > 0)
+		{
+			memcpy(bitmapArray, modifyState->deletedRowBitmapArray,
+				   modifyState->stripeCount * sizeof(uint8 *));
+			memcpy(lengthArray, modifyState->deletedRowBitmapLengthArray,
+				   modifyState->stripeCount * sizeof(uint32));
+			pfree(modifyState->deletedRowBitmapArray);
+			pfree(modifyState->deletedRowBitmapLengthArray);
+		}
+
+		modifyState->stripeCount = stripeCount;
+		modifyState->deletedRowBitmapArray = bitmapArray;
+		modifyState->deletedRowBitmapLengthArray = lengthArray;
+	}
+
+	if (byteIndex >= modifyState->deletedRowBitmapLengthArray[stripeIndex])
+	{
+		uint32 oldLength = modifyState->deletedRowBitmapLengthArray[stripeIndex];
+		uint32 newLength = Max(byteIndex + 1, oldLength * 2);
+		uint8 *newBitmap = MemoryContextAllocZero(deleteContext, newLength);
+
+		if (oldLength > 0)
+		{
+			memcpy(newBitmap, modifyState->deletedRowBitmapArray[stripeIndex], oldLength);
+			pfree(modifyState->deletedRowBitmapArray[stripeIndex]);
+		}
+
+		modifyState->deletedRowBitmapArray[stripeIndex] = newBitmap;
+		modifyState->deletedRowBitmapLengthArray[stripeIndex] = newLength;
+	}
+
+	deletedRowBitmap = modifyState->deletedRowBitmapArray[stripeIndex];
+	if ((deletedRowBitmap[byteIndex] & rowBit) != 0)
+	{
+		return false;
+	}
+
+	deletedRowBitmap[byteIndex] |= rowBit;
+
+	return true;
+}
+
+
+/*
+ * CStoreEndForeignModify ends the current modification. An update first adds
+ * the rows it deleted to the footers, since the footer that its write operation
+ * writes at the end includes them.
  */
 static void
 CStoreEndForeignModify(EState *executorState, ResultRelInfo *relationInfo)
 {
-	CStoreEndForeignInsert(executorState, relationInfo);
+	CStoreModifyState *modifyState = (CStoreModifyState *) relationInfo->ri_FdwState;
+
+	/* modifyState is NULL during Explain queries */
+	if (modifyState != NULL && modifyState->operation == CMD_UPDATE)
+	{
+		MergeModifiedSegments(modifyState);
+		CStoreEndForeignInsert(executorState, relationInfo);
+		MemoryContextDelete(modifyState->deleteContext);
+	}
+	else if (modifyState != NULL && modifyState->operation == CMD_DELETE)
+	{
+		CStoreEndForeignDelete(modifyState);
+	}
+	else if (modifyState != NULL && modifyState->deltaInsert)
+	{
+		CStoreEndDeltaInsert(modifyState);
+	}
+	else
+	{
+		CStoreEndForeignInsert(executorState, relationInfo);
+	}
 }
 
 
@@ -2381,16 +8191,255 @@ CStoreEndForeignModify(EState *executorState, ResultRelInfo *relationInfo)
 static void
 CStoreEndForeignInsert(EState *executorState, ResultRelInfo *relationInfo)
 {
-	TableWriteState *writeState = (TableWriteState*) relationInfo->ri_FdwState;
+	CStoreModifyState *modifyState = (CStoreModifyState *) relationInfo->ri_FdwState;
 
-	/* writeState is NULL during Explain queries */
-	if (writeState != NULL)
+	/* modifyState is NULL during Explain queries */
+	if (modifyState != NULL)
 	{
+		TableWriteState *writeState = modifyState->writeState;
 		Relation relation = writeState->relation;
+		uint32 segmentIndex = writeState->segmentIndex;
 
 		CStoreEndWrite(writeState);
-		heap_close(relation, ShareUpdateExclusiveLock);
+		UnlockPage(relation, segmentIndex, ExclusiveLock);
+		heap_close(relation, RowExclusiveLock);
+	}
+}
+
+
+/*
+ * CStoreEndDeltaInsert appends the rows that the insert collected to the table's
+ * delta store. If the delta store then has as many rows as a stripe, we merge
+ * them into a stripe.
+ */
+static void
+CStoreEndDeltaInsert(CStoreModifyState *modifyState)
+{
+	Relation relation = modifyState->relation;
+
+	if (modifyState->deltaRowCount > 0)
+	{
+		CStoreFdwOptions *cstoreFdwOptions =
+			CStoreGetOptions(RelationGetRelid(relation));
+		uint64 deltaRowCount = 0;
+
+		LockPage(relation, CSTORE_DELTA_LOCK_PAGE, ExclusiveLock);
+
+		deltaRowCount = CStoreAppendDelta(modifyState->filename,
+										  modifyState->deltaRowBuffer,
+										  modifyState->deltaRowCount);
+		if (deltaRowCount >= (uint64) cstoreFdwOptions->stripeRowCount)
+		{
+			MergeDelta(relation, cstoreFdwOptions);
+		}
+
+		UnlockPage(relation, CSTORE_DELTA_LOCK_PAGE, ExclusiveLock);
+	}
+
+	heap_close(relation, RowExclusiveLock);
+}
+
+
+/*
+ * MergeDelta writes the rows of the given table's delta store into a stripe of a
+ * segment that no load is writing into, and starts the delta store's next
+ * generation. The caller must hold the table's delta lock. The footer that the
+ * write operation writes records the merged generation, so if we crash before
+ * the delta file is reset, readers still ignore the merged rows.
+ */
+static void
+MergeDelta(Relation relation, CStoreFdwOptions *cstoreFdwOptions)
+{
+	const char *filename = cstoreFdwOptions->filename;
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	uint64 mergedDeltaGeneration = CStoreMergedDeltaGeneration(filename);
+	TableDelta *tableDelta = CStoreReadDelta(filename, true);
+	TableWriteState *writeState = NULL;
+	uint32 segmentIndex = 0;
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
+	uint64 rowIndex = 0;
+
+	if (tableDelta->generation <= mergedDeltaGeneration || tableDelta->rowCount == 0)
+	{
+		return;
+	}
+
+	columnValues = palloc0(tupleDescriptor->natts * sizeof(Datum));
+	columnNulls = palloc0(tupleDescriptor->natts * sizeof(bool));
+
+	segmentIndex = LockWritableSegment(relation, filename);
+	writeState = CStoreBeginWrite(CStoreSegmentFilename(filename, segmentIndex),
+								  cstoreFdwOptions->compressionType,
+								  cstoreFdwOptions->stripeRowCount,
+								  cstoreFdwOptions->blockRowCount,
+								  cstoreFdwOptions->indexColumnIndex,
+								  cstoreFdwOptions->maxSkipValueLengthArray,
+								  tupleDescriptor);
+	writeState->tableFooter->mergedDeltaGeneration = tableDelta->generation;
+
+	for (rowIndex = 0; rowIndex < tableDelta->rowCount; rowIndex++)
+	{
+		heap_deform_tuple(tableDelta->rowArray[rowIndex], tupleDescriptor,
+						  columnValues, columnNulls);
+		CStoreWriteRow(writeState, columnValues, columnNulls);
+	}
+
+	CStoreEndWrite(writeState);
+	UnlockPage(relation, segmentIndex, ExclusiveLock);
+
+	CStoreResetDelta(filename, tableDelta->generation + 1);
+}
+
+
+/*
+ * CStoreEndForeignDelete adds the rows that the delete marked to the segment
+ * footers, and frees the delete's bitmaps.
+ */
+static void
+CStoreEndForeignDelete(CStoreModifyState *modifyState)
+{
+	MergeModifiedSegments(modifyState);
+
+	MemoryContextDelete(modifyState->deleteContext);
+}
+
+
+/*
+ * MergeModifiedSegments adds the rows that the statement marked to the deletion
+ * bitmaps in the segment footers, and replaces the footers of the segments that
+ * have deleted rows. We visit stripes in the order that reads see them, so each
+ * stripe's index matches the index in the deleted rows' ids. Since the segments
+ * are locked, loads could only add new segments after the ones the statement's
+ * scan read. An update also appends stripes to the segment it writes into, and
+ * it writes that segment's footer itself. So for that segment, we update the
+ * stripes in the write operation's footer instead.
+ */
+static void
+MergeModifiedSegments(CStoreModifyState *modifyState)
+{
+	TableWriteState *writeState = modifyState->writeState;
+	uint32 segmentCount = CStoreReadSegmentCount(modifyState->filename);
+	uint32 segmentIndex = 0;
+	uint32 stripeIndex = 0;
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		char *segmentFilename = CStoreSegmentFilename(modifyState->filename,
+													  segmentIndex);
+		StringInfo tableFooterFilename = makeStringInfo();
+		TableFooter *tableFooter = NULL;
+		List *stripeMetadataList = NIL;
+		ListCell *stripeMetadataCell = NULL;
+		uint32 segmentStripeCount = 0;
+		uint32 segmentStripeIndex = 0;
+		bool writtenSegment = false;
+		bool segmentChanged = false;
+		struct stat statBuffer;
+
+		if (stripeIndex >= modifyState->stripeCount)
+		{
+			break;
+		}
+
+		appendStringInfo(tableFooterFilename, "%s%s", segmentFilename,
+						 CSTORE_FOOTER_FILE_SUFFIX);
+
+		/* segments get their footer when their first load finishes */
+		if (segmentIndex > 0 && stat(tableFooterFilename->data, &statBuffer) < 0)
+		{
+			continue;
+		}
+
+		tableFooter = CStoreReadFooter(tableFooterFilename);
+		stripeMetadataList = tableFooter->stripeMetadataList;
+		segmentStripeCount = list_length(stripeMetadataList);
+
+		/* the write operation's footer has the same stripes first */
+		writtenSegment = (writeState != NULL && writeState->segmentIndex == segmentIndex);
+		if (writtenSegment)
+		{
+			stripeMetadataList = writeState->tableFooter->stripeMetadataList;
+		}
+
+		foreach(stripeMetadataCell, stripeMetadataList)
+		{
+			StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+
+			if (segmentStripeIndex >= segmentStripeCount)
+			{
+				break;
+			}
+
+			if (stripeIndex < modifyState->stripeCount &&
+				modifyState->deletedRowBitmapArray[stripeIndex] != NULL)
+			{
+				MergeDeletedRows(stripeMetadata,
+								 modifyState->deletedRowBitmapArray[stripeIndex],
+								 modifyState->deletedRowBitmapLengthArray[stripeIndex]);
+				segmentChanged = true;
+			}
+
+			segmentStripeIndex++;
+			stripeIndex++;
+		}
+
+		if (segmentChanged && !writtenSegment)
+		{
+			CStoreReplaceFooter(segmentFilename, tableFooter);
+		}
+
+		pfree(tableFooterFilename->data);
+		pfree(tableFooterFilename);
+	}
+}
+
+
+/*
+ * MergeDeletedRows adds the rows marked in the given deletion bitmap to the
+ * given stripe's deletion bitmap, and counts the stripe's deleted rows again.
+ * The merged bitmap ends at the stripe's last deleted row.
+ */
+static void
+MergeDeletedRows(StripeMetadata *stripeMetadata, uint8 *deletedRowBitmap,
+				 uint32 deletedRowBitmapLength)
+{
+	uint32 mergedLength = Max(stripeMetadata->deletedRowBitmapLength,
+							  deletedRowBitmapLength);
+	uint8 *mergedBitmap = palloc0(mergedLength);
+	uint64 deletedRowCount = 0;
+	uint32 byteIndex = 0;
+
+	if (stripeMetadata->deletedRowBitmap != NULL)
+	{
+		memcpy(mergedBitmap, stripeMetadata->deletedRowBitmap,
+			   stripeMetadata->deletedRowBitmapLength);
+	}
+
+	for (byteIndex = 0; byteIndex < deletedRowBitmapLength; byteIndex++)
+	{
+		mergedBitmap[byteIndex] |= deletedRowBitmap[byteIndex];
+	}
+
+	while (mergedLength > 0 && mergedBitmap[mergedLength - 1] == 0)
+	{
+		mergedLength--;
+	}
+
+	for (byteIndex = 0; byteIndex < mergedLength; byteIndex++)
+	{
+		uint8 bitmapByte = mergedBitmap[byteIndex];
+
+		while (bitmapByte != 0)
+		{
+			deletedRowCount += bitmapByte & 1;
+			bitmapByte >>= 1;
+		}
 	}
+
+	stripeMetadata->deletedRowBitmap = mergedBitmap;
+	stripeMetadata->deletedRowBitmapLength = mergedLength;
+	stripeMetadata->deletedRowCount = deletedRowCount;
 }
 
 
@@ -14,12 +14,19 @@
 #ifndef CSTORE_FDW_H
 #define CSTORE_FDW_H
 
+#include "access/sdir.h"
 #include "access/tupdesc.h"
 #include "fmgr.h"
 #include "catalog/pg_am.h"
+#include "catalog/pg_attribute.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
 #include "lib/stringinfo.h"
+#include "nodes/execnodes.h"
+#include "port/atomics.h"
+#include "storage/dsm.h"
+#include "storage/shm_toc.h"
+#include "utils/hsearch.h"
 #include "utils/rel.h"
 
 
@@ -28,17 +35,21 @@
 #define OPTION_NAME_COMPRESSION_TYPE "compression"
 #define OPTION_NAME_STRIPE_ROW_COUNT "stripe_row_count"
 #define OPTION_NAME_BLOCK_ROW_COUNT "block_row_count"
+#define OPTION_NAME_INDEX_COLUMN "index_column"
+#define OPTION_NAME_MAX_SKIP_VALUE_LENGTH "max_skip_value_length"
 
 /* Default values for option parameters */
 #define DEFAULT_COMPRESSION_TYPE COMPRESSION_NONE
 #define DEFAULT_STRIPE_ROW_COUNT 150000
 #define DEFAULT_BLOCK_ROW_COUNT 10000
+#define DEFAULT_MAX_SKIP_VALUE_LENGTH 256
 
 /* Limits for option parameters */
 #define STRIPE_ROW_COUNT_MINIMUM 1000
 #define STRIPE_ROW_COUNT_MAXIMUM 10000000
 #define BLOCK_ROW_COUNT_MINIMUM 1000
 #define BLOCK_ROW_COUNT_MAXIMUM 100000
+#define MAX_SKIP_VALUE_LENGTH_MAXIMUM 1048576
 
 /* String representations of compression types */
 #define COMPRESSION_STRING_NONE "none"
@@ -48,15 +59,33 @@
 /* CStore file signature */
 #define CSTORE_MAGIC_NUMBER "citus_cstore"
 #define CSTORE_VERSION_MAJOR 1
-#define CSTORE_VERSION_MINOR 7
+#define CSTORE_VERSION_MINOR 8
 
 /* miscellaneous defines */
 #define CSTORE_FDW_NAME "cstore_fdw"
 #define CSTORE_FOOTER_FILE_SUFFIX ".footer"
 #define CSTORE_TEMP_FILE_SUFFIX ".tmp"
+#define CSTORE_MANIFEST_FILE_SUFFIX ".manifest"
+#define CSTORE_DELTA_FILE_SUFFIX ".delta"
+#define CSTORE_PENDING_FOOTER_FILE_SUFFIX ".pending"
 #define CSTORE_TUPLE_COST_MULTIPLIER 10
 #define CSTORE_POSTSCRIPT_SIZE_LENGTH 1
 #define CSTORE_POSTSCRIPT_SIZE_MAX 256
+#define CSTORE_MAX_TOP_N_LIMIT 100000
+
+/* DELETE identifies rows by a junk ctid column, see EncodeRowId() */
+#define CSTORE_ROW_ID_COLUMN_NAME "ctid"
+#define CSTORE_ROW_ID_OFFSET_BITS 24
+#define CSTORE_ROW_ID_STRIPE_COUNT_MAXIMUM (1 << 22)
+
+/* page lock that serializes changes to the delta store; segments use the others */
+#define CSTORE_DELTA_LOCK_PAGE MaxBlockNumber
+
+/* keys for the parallel COPY state in the dynamic shared memory table of contents */
+#define PARALLEL_COPY_KEY_SHARED UINT64CONST(0xC5700C0900000001)
+#define PARALLEL_COPY_KEY_STATEMENT UINT64CONST(0xC5700C0900000002)
+#define PARALLEL_COPY_READ_BUFFER_SIZE (64 * 1024)
+#define COPY_OUT_BUFFER_SIZE (64 * 1024)
 
 /* table containing information about how to partition distributed tables */
 #define CITUS_EXTENSION_NAME "citus"
@@ -82,14 +111,18 @@ typedef struct CStoreValidOption
 
 
 /* Array of options that are valid for cstore_fdw */
-static const uint32 ValidOptionCount = 4;
+static const uint32 ValidOptionCount = 6;
 static const CStoreValidOption ValidOptionArray[] =
 {
 	/* foreign table options */
 	{ OPTION_NAME_FILENAME, ForeignTableRelationId },
 	{ OPTION_NAME_COMPRESSION_TYPE, ForeignTableRelationId },
 	{ OPTION_NAME_STRIPE_ROW_COUNT, ForeignTableRelationId },
-	{ OPTION_NAME_BLOCK_ROW_COUNT, ForeignTableRelationId }
+	{ OPTION_NAME_BLOCK_ROW_COUNT, ForeignTableRelationId },
+	{ OPTION_NAME_INDEX_COLUMN, ForeignTableRelationId },
+
+	/* foreign table column options */
+	{ OPTION_NAME_MAX_SKIP_VALUE_LENGTH, AttributeRelationId }
 };
 
 
@@ -109,6 +142,10 @@ typedef enum
  * CStoreFdwOptions holds the option values to be used when reading or writing
  * a cstore file. To resolve these values, we first check foreign table's options,
  * and if not present, we then fall back to the default values specified above.
+ * indexColumnIndex is the index of the column that stripes' sparse indexes cover,
+ * or -1 if the table has no index column. maxSkipValueLengthArray holds each
+ * column's limit on the length of skip list minimum and maximum values, which
+ * comes from the column's options.
  */
 typedef struct CStoreFdwOptions
 {
@@ -116,13 +153,21 @@ typedef struct CStoreFdwOptions
 	CompressionType compressionType;
 	uint64 stripeRowCount;
 	uint32 blockRowCount;
+	int32 indexColumnIndex;
+	uint32 *maxSkipValueLengthArray;
 
 } CStoreFdwOptions;
 
 
 /*
  * StripeMetadata represents information about a stripe. This information is
- * stored in the cstore file's footer.
+ * stored in the cstore file's footer. Rows removed by DELETE are marked in the
+ * deletion bitmap, in which bit i stands for the stripe's row at offset i. The
+ * bitmap only extends to the last deleted row, and is NULL if the stripe has no
+ * deleted rows. Stripes of tables with an index column have a sparse index of
+ * that column after their footer; indexLength is 0 for other stripes. These
+ * stripes also keep the minimum and maximum of the index column's values, in
+ * the format of value streams, if the column's type has a comparison function.
  */
 typedef struct StripeMetadata
 {
@@ -130,28 +175,111 @@ typedef struct StripeMetadata
 	uint64 skipListLength;
 	uint64 dataLength;
 	uint64 footerLength;
+	uint64 indexLength;
+	uint32 indexColumnIndex;
+	uint8 *indexMinimumValue;
+	uint32 indexMinimumValueLength;
+	uint8 *indexMaximumValue;
+	uint32 indexMaximumValueLength;
+	uint8 *deletedRowBitmap;
+	uint32 deletedRowBitmapLength;
+	uint64 deletedRowCount;
+
+	/* segment file that holds the stripe; set when reading footers */
+	uint32 segmentIndex;
 
 } StripeMetadata;
 
 
-/* TableFooter represents the footer of a cstore file. */
+/*
+ * TableFooter represents the footer of a cstore file. When a segment's stripes
+ * include the rows of a delta store generation, mergedDeltaGeneration is that
+ * generation. In footers that cover all segments, it is the largest one. Tables
+ * of the cstore access method number their rows, and reservedRowCount is the
+ * count of row numbers that writers may have handed out so far. Their footers
+ * also have the full transaction id of the last transaction that published
+ * them in writerTransactionId, and 0 if there was none.
+ */
 typedef struct TableFooter
 {
 	List *stripeMetadataList;
 	uint64 blockRowCount;
+	uint64 mergedDeltaGeneration;
+	uint64 reservedRowCount;
+	uint64 writerTransactionId;
+
+	/*
+	 * Type of each column when the footer was last written, and InvalidOid for
+	 * dropped columns. Footers written by older versions have no column types.
+	 */
+	uint32 columnCount;
+	Oid *columnTypeArray;
 
 } TableFooter;
 
 
+/*
+ * TableDelta represents the rows of a table's delta store, which single row
+ * inserts append to instead of writing a stripe each. Rows are heap tuples of
+ * the table's tuple descriptor. Each merge of the delta store into a stripe
+ * starts a new generation.
+ */
+typedef struct TableDelta
+{
+	uint64 generation;
+	uint64 rowCount;
+	HeapTuple *rowArray;
+
+} TableDelta;
+
+
+/*
+ * StripeIndexEntry is an entry of a stripe's sparse index, which maps hashes of
+ * the index column's values to the stripe's blocks that have these values. The
+ * index is an array of entries sorted by hash and block index, and has an entry
+ * for each distinct pair. Null values aren't indexed.
+ */
+typedef struct StripeIndexEntry
+{
+	uint32 valueHash;
+	uint32 blockIndex;
+
+} StripeIndexEntry;
+
+
 /* ColumnBlockSkipNode contains statistics for a ColumnBlockData. */
 typedef struct ColumnBlockSkipNode
 {
-	/* statistics about values of a column block */
+	/*
+	 * Statistics about values of a column block. If minMaxTruncated is set,
+	 * long values were cut to a prefix, and the minimum and maximum values are
+	 * only bounds of the block's values rather than values in the block.
+	 */
 	bool hasMinMax;
+	bool minMaxTruncated;
 	Datum minimumValue;
 	Datum maximumValue;
 	uint64 rowCount;
 
+	/*
+	 * Binary sort keys of the minimum and maximum values under the column's
+	 * collation, for text columns whose collation provides reliable sort keys.
+	 * Sort keys compare with memcmp(), and may be cut to a prefix like values.
+	 * Blocks with values too long for min/max values can still have them.
+	 */
+	bool hasSortKeys;
+	bytea *minimumSortKey;
+	bytea *maximumSortKey;
+
+	/*
+	 * Pre-aggregates of the block's values. Files written by older versions
+	 * don't have them, and only smallint and integer columns have sums.
+	 */
+	bool hasValueCount;
+	uint64 valueCount;
+	bool hasValueSum;
+	int64 valueSum;
+
 	/*
 	 * Offsets and sizes of value and exists streams in the column data.
 	 * These enable us to skip reading suppressed row blocks, and start reading
@@ -164,6 +292,15 @@ typedef struct ColumnBlockSkipNode
 
 	CompressionType valueCompressionType;
 
+	/*
+	 * CRC-32C checksums of the exists and value streams as stored on disk,
+	 * that is after compression. Files written by older versions don't have
+	 * them.
+	 */
+	bool hasChecksum;
+	uint32 existsChecksum;
+	uint32 valueChecksum;
+
 } ColumnBlockSkipNode;
 
 
@@ -181,6 +318,23 @@ typedef struct StripeSkipList
 } StripeSkipList;
 
 
+/*
+ * ColumnBlockInfo describes where and how a column block is stored, for
+ * inspecting a table's files. Indexes are zero based, and stripe indexes are
+ * within the block's segment.
+ */
+typedef struct ColumnBlockInfo
+{
+	uint32 segmentIndex;
+	uint32 stripeIndex;
+	uint32 columnIndex;
+	uint32 blockIndex;
+	ColumnBlockSkipNode blockSkipNode;
+	uint64 decompressedLength;
+
+} ColumnBlockInfo;
+
+
 /*
  * ColumnBlockData represents a block of data in a column. valueArray stores
  * the values of data, and existsArray stores whether a value is present.
@@ -233,13 +387,18 @@ typedef struct StripeBuffers
 	uint32 rowCount;
 	ColumnBuffers **columnBuffersArray;
 
+	/* when reading, the index in the stripe of each block we loaded */
+	uint32 *blockIndexArray;
+
 } StripeBuffers;
 
 
 /*
  * StripeFooter represents a stripe's footer. In this footer, we keep three
- * arrays of sizes. The number of elements in each of the arrays is equal
- * to the number of columns.
+ * arrays of sizes, and the checksums of the column skip lists. The number of
+ * elements in each of the arrays is equal to the number of columns. Stripes
+ * written by older versions don't have checksums, and then the checksum array
+ * is NULL.
  */
 typedef struct StripeFooter
 {
@@ -247,17 +406,100 @@ typedef struct StripeFooter
 	uint64 *skipListSizeArray;
 	uint64 *existsSizeArray;
 	uint64 *valueSizeArray;
+	uint32 *skipListChecksumArray;
 
 } StripeFooter;
 
 
+/*
+ * RuntimeConstantContext is used when evaluating the parts of scan qualifiers
+ * that stay constant during a scan. Executor parameters can only be evaluated
+ * after the parent node has set their values, that is on rescans.
+ */
+typedef struct RuntimeConstantContext
+{
+	ExprContext *exprContext;
+	bool evaluateExecParams;
+
+} RuntimeConstantContext;
+
+
+/*
+ * OrderedBlock represents a row block in an ordered read, together with the
+ * block's bound for the order column. This bound is the block's maximum value
+ * for descending orders, and its minimum value for ascending orders.
+ */
+typedef struct OrderedBlock
+{
+	uint32 stripeIndex;
+	uint32 blockIndex;
+	bool hasBound;
+	Datum boundValue;
+
+} OrderedBlock;
+
+
+/* OrderedBlockCompareContext keeps what we need to compare block bounds. */
+typedef struct OrderedBlockCompareContext
+{
+	FmgrInfo *comparisonFunction;
+	Oid collation;
+	bool descending;
+
+} OrderedBlockCompareContext;
+
+
+/*
+ * StripeRangeNode represents a stripe in the interval tree that reads build over
+ * the stripes' index column ranges. The tree's nodes are sorted by minimum value
+ * in an array, and the middle node of each subarray is the root of the subtree
+ * over that subarray. subtreeMaximumValue is the largest maximum in the subtree.
+ */
+typedef struct StripeRangeNode
+{
+	uint32 stripeIndex;
+	Datum minimumValue;
+	Datum maximumValue;
+	Datum subtreeMaximumValue;
+
+} StripeRangeNode;
+
+
+/*
+ * StripeRangeQuery keeps the bounds that a read's qualifiers put on the index
+ * column, and collects the stripes whose ranges overlap with these bounds.
+ */
+typedef struct StripeRangeQuery
+{
+	FmgrInfo *comparisonFunction;
+	Oid collation;
+	bool hasLowerBound;
+	Datum lowerBound;
+	bool hasUpperBound;
+	Datum upperBound;
+	uint32 *selectedStripeArray;
+	uint32 selectedStripeCount;
+	uint32 selectedStripeArraySize;
+
+} StripeRangeQuery;
+
+
 /* TableReadState represents state of a cstore file read operation. */
 typedef struct TableReadState
 {
-	FILE *tableFile;
+	/*
+	 * Data files of the table's segments, and a footer with the stripes of all
+	 * segments. Segments whose first load hasn't finished yet have no file.
+	 */
+	FILE **tableFileArray;
+	uint32 segmentCount;
 	TableFooter *tableFooter;
 	TupleDesc tupleDescriptor;
 
+	/* the footer's stripes as an array, so that we find stripes in constant time */
+	StripeMetadata **stripeMetadataArray;
+	uint32 stripeCount;
+
 	/*
 	 * List of Var pointers for columns in the query. We use this both for
 	 * getting vector of projected columns, and also when we want to build
@@ -266,16 +508,232 @@ typedef struct TableReadState
 	List *projectedColumnList;
 
 	List *whereClauseList;
+	MemoryContext whereClauseContext;
+
+	/*
+	 * Stripe footers and skip lists, each stripe's in its own memory context.
+	 * The first pass over the stripes only keeps those of the stripes it uses,
+	 * which cachedStripeList has. Once the read is rescanned or ordered, we keep
+	 * those of all stripes, so that the read can prune blocks again without
+	 * reading them from disk.
+	 */
+	MemoryContext stripeMetadataContext;
+	StripeFooter **stripeFooterArray;
+	StripeSkipList **stripeSkipListArray;
+	MemoryContext *stripeCacheContextArray;
+	List *cachedStripeList;
+	bool cacheAllStripes;
+
+	/*
+	 * The read position is the last row we returned from the current stripe.
+	 * When there is no current stripe, the stripe index is -1 before the first
+	 * stripe, and the stripe count after the last stripe.
+	 */
 	MemoryContext stripeReadContext;
 	StripeBuffers *stripeBuffers;
-	uint32 readStripeCount;
-	uint64 stripeReadRowCount;
+	int32 stripeIndex;
+	int64 stripeRowIndex;
 	ColumnBlockData **blockDataArray;
 	int32 deserializedBlockIndex;
 
+	/* deletion bitmap of the current stripe, or NULL if it has no deleted rows */
+	uint8 *deletedRowBitmap;
+	uint32 deletedRowBitmapLength;
+
+	/*
+	 * Rows of the delta store that aren't in stripes yet. Reads return them as
+	 * an extra stripe after the table's stripes.
+	 */
+	HeapTuple *deltaRowArray;
+	uint32 deltaRowCount;
+
+	/*
+	 * Counter in shared memory from which the reads of a parallel scan claim
+	 * stripes, or NULL if the read isn't part of a parallel scan.
+	 */
+	pg_atomic_uint32 *parallelStripeIndex;
+
+	/* number of the first row of each stripe, computed on first use */
+	uint64 *stripeFirstRowArray;
+
+	/*
+	 * Hash of the constant that an equality qualifier compares the column in
+	 * indexKeyColumnIndex with, if indexKeyFound. We look for the qualifier when
+	 * a stripe's sparse index covers another column than the one we checked.
+	 */
+	int32 indexKeyColumnIndex;
+	bool indexKeyFound;
+	uint32 indexKeyHash;
+
+	/*
+	 * Interval tree over the ranges of the index column in rangeColumnIndex, and
+	 * the stripes that have no range for that column. We build the tree when
+	 * qualifiers first bound the column, and keep it across rescans.
+	 */
+	bool rangeTreeBuilt;
+	int32 rangeColumnIndex;
+	FmgrInfo *rangeComparisonFunction;
+	StripeRangeNode *rangeNodeArray;
+	uint32 rangeNodeCount;
+	uint32 *unrangedStripeArray;
+	uint32 unrangedStripeCount;
+
+	/*
+	 * Sorted indexes of the stripes whose ranges the qualifiers don't refute,
+	 * including the delta store stripe, or NULL if the read covers all stripes.
+	 */
+	uint32 *selectedStripeArray;
+	uint32 selectedStripeCount;
+
+	/* index of the stripe whose buffers currently live in stripeReadContext */
+	int32 loadedStripeIndex;
+	StripeBuffers *loadedStripeBuffers;
+
+	/* blocks in the order we read them in ordered reads, or NULL */
+	OrderedBlock *orderedBlockArray;
+	uint32 orderedBlockCount;
+	int32 orderedBlockIndex;
+
+	/*
+	 * In summary reads, summaryBlockMask marks the loaded stripe's blocks that
+	 * are summarized by their skip nodes, and which we didn't load.
+	 */
+	bool summaryRead;
+	int32 summaryGroupColumnIndex;
+	bool *summaryBlockMask;
+	int32 summaryBlockIndex;
+	ColumnBlockSkipNode **summarySkipNodeArray;
+
 } TableReadState;
 
 
+/* TopNRow represents a row kept by a top-N scan, with its sort column value. */
+typedef struct TopNRow
+{
+	HeapTuple tuple;
+	Datum sortValue;
+	bool sortValueNull;
+
+} TopNRow;
+
+
+/* Enumeration for values that aggregate scans compute for each group */
+typedef enum
+{
+	AGGREGATE_GROUP_COLUMN = 0,
+	AGGREGATE_COUNT_STAR = 1,
+	AGGREGATE_COUNT = 2,
+	AGGREGATE_SUM = 3,
+	AGGREGATE_AVG = 4,
+	AGGREGATE_MIN = 5,
+	AGGREGATE_MAX = 6
+
+} AggregateFunctionType;
+
+
+/*
+ * ScanAggregate represents an output column of an aggregate scan, which is
+ * either the grouping column or an aggregate over a column. columnIndex is
+ * unused for count(*).
+ */
+typedef struct ScanAggregate
+{
+	AggregateFunctionType functionType;
+	uint32 columnIndex;
+	Oid columnTypeId;
+	bool integerColumn;
+
+} ScanAggregate;
+
+
+/*
+ * AggregateTransition keeps the transition values of an aggregate for a group.
+ * Integer and date/time columns are aggregated in integerValue and integerSum,
+ * and floating point columns are aggregated in floatValue and floatSum.
+ */
+typedef struct AggregateTransition
+{
+	int64 count;
+	int64 integerSum;
+	int64 integerValue;
+	double floatSum;
+	double floatValue;
+
+} AggregateTransition;
+
+
+/*
+ * AggregateGroup represents a group of an aggregate scan. The group key is the
+ * grouping column's value; scans without a grouping column have a single group.
+ */
+typedef struct AggregateGroupKey
+{
+	Datum value;
+	bool isNull;
+
+} AggregateGroupKey;
+
+typedef struct AggregateGroup
+{
+	AggregateGroupKey groupKey;
+	AggregateTransition *transitionArray;
+
+} AggregateGroup;
+
+
+/*
+ * CStoreScanState represents the executor state of a foreign scan. Top-N scans
+ * read blocks in the order of their sort column bounds, and keep the best rows
+ * in a bounded heap. They stop once no remaining block can hold a better row,
+ * and then return the kept rows in sorted order. Aggregate scans compute their
+ * groups over whole blocks of column values, and then return one row per group.
+ */
+typedef struct CStoreScanState
+{
+	TableReadState *readState;
+
+	/* top-N scan state; sortColumn is NULL for regular scans */
+	Var *sortColumn;
+	bool sortDescending;
+	bool sortNullsFirst;
+	uint32 limitCount;
+	FmgrInfo *comparisonFunction;
+	MemoryContext topNContext;
+	TopNRow *topNRowArray;
+	uint32 topNRowCount;
+	uint32 returnedRowCount;
+	bool topNRowsComputed;
+
+	/* set when the scan feeds a DELETE, which needs the position of each row */
+	bool returnRowIds;
+
+	/*
+	 * Aggregate scan state; aggregateArray is NULL for other scans. Aggregate
+	 * scans read the table themselves, so they also evaluate the qualifiers.
+	 */
+	Relation relation;
+	ScanAggregate *aggregateArray;
+	uint32 aggregateCount;
+	int32 groupColumnIndex;
+	List *aggregateClauseList;
+#if PG_VERSION_NUM >= 100000
+	ExprState *aggregateQual;
+#else
+	List *aggregateQual;
+#endif
+	TupleTableSlot *rowSlot;
+	MemoryContext aggregateContext;
+	HTAB *groupHash;
+	AggregateGroup **groupArray;
+	AggregateGroup **rowGroupArray;
+	uint32 groupCount;
+	uint32 groupArraySize;
+	uint32 returnedGroupCount;
+	bool groupsComputed;
+
+} CStoreScanState;
+
+
 /* TableWriteState represents state of a cstore file write operation. */
 typedef struct TableWriteState
 {
@@ -287,12 +745,34 @@ typedef struct TableWriteState
 	FmgrInfo **comparisonFunctionArray;
 	uint64 currentFileOffset;
 	Relation relation;
+	uint32 segmentIndex;
 
 	MemoryContext stripeWriteContext;
 	StripeBuffers *stripeBuffers;
 	StripeSkipList *stripeSkipList;
 	uint32 stripeMaxRowCount;
 	ColumnBlockData **blockDataArray;
+
+	/*
+	 * Sparse index entries of the stripe, if we index a column. Entries are
+	 * sorted and deduplicated when the stripe is flushed.
+	 */
+	int32 indexColumnIndex;
+	FmgrInfo *indexHashFunction;
+	StripeIndexEntry *indexEntryArray;
+	uint32 indexEntryCount;
+	uint32 indexEntryArraySize;
+
+	/*
+	 * Minimum and maximum values of pass-by-reference columns point into the
+	 * current block's value buffer until the block is serialized, so we keep
+	 * their offsets in the buffer. Then, we copy the values into the block's
+	 * skip nodes, cut to each column's maximum skip value length.
+	 */
+	uint32 *maxSkipValueLengthArray;
+	uint32 *minimumValueOffsetArray;
+	uint32 *maximumValueOffsetArray;
+
 	/*
 	 * compressionBuffer buffer is used as temporary storage during
 	 * data value compression operation. It is kept here to minimize
@@ -303,51 +783,245 @@ typedef struct TableWriteState
 
 } TableWriteState;
 
+
+/*
+ * CStoreModifyState represents an INSERT, UPDATE or DELETE statement on a cstore
+ * table, or a COPY into a cstore partition. Inserted rows and new versions of
+ * updated rows go to the write operation, except for rows of inserts that don't
+ * select from a query, which go to the delta store when the statement ends.
+ * UPDATE and DELETE identify rows by the index of their stripe in the table and
+ * their offset in the stripe. For each stripe, we mark removed rows in a
+ * deletion bitmap, and we add these bitmaps to the segment footers when the
+ * statement ends.
+ */
+typedef struct CStoreModifyState
+{
+	CmdType operation;
+	TableWriteState *writeState;
+
+	/* rows of inserts that go to the delta store, in the delta file's format */
+	bool deltaInsert;
+	Relation relation;
+	StringInfo deltaRowBuffer;
+	uint32 deltaRowCount;
+
+	char *filename;
+	AttrNumber rowIdAttributeNumber;
+	MemoryContext deleteContext;
+	uint32 stripeCount;
+	uint8 **deletedRowBitmapArray;
+	uint32 *deletedRowBitmapLengthArray;
+
+} CStoreModifyState;
+
+
+/*
+ * ParallelCopyChunk represents a byte range of the input file of a parallel COPY.
+ * Ranges start and end at row boundaries.
+ */
+typedef struct ParallelCopyChunk
+{
+	uint64 startOffset;
+	uint64 endOffset;
+
+	/* set by the process that loads the chunk */
+	uint64 processedRowCount;
+
+} ParallelCopyChunk;
+
+
+/*
+ * ParallelCopyShared is kept in dynamic shared memory during a parallel COPY.
+ * Chunk i of the input file is loaded into segment firstSegmentIndex + i of the
+ * table. Worker i loads chunk i, and the leader loads the last chunk and the
+ * chunks of workers that couldn't be launched.
+ */
+typedef struct ParallelCopyShared
+{
+	Oid relationId;
+	uint32 firstSegmentIndex;
+	uint32 chunkCount;
+	ParallelCopyChunk chunkArray[FLEXIBLE_ARRAY_MEMBER];
+
+} ParallelCopyShared;
+
+/*
+ * CStoreCopyOutState represents the state of a "COPY cstore_table TO" statement
+ * that formats rows straight from decoded column blocks. Per-column arrays are
+ * indexed by attribute number minus one.
+ */
+typedef struct CStoreCopyOutState
+{
+	/* output file, or NULL when sending rows to the frontend */
+	FILE *copyFile;
+
+	bool binary;
+	bool arrow;
+	bool csvMode;
+	bool header;
+	char delimiter;
+	char quote;
+	char escape;
+	char *nullString;
+	int fileEncoding;
+	bool needTranscoding;
+
+	List *attributeNumberList;
+	bool *forceQuoteArray;
+	FmgrInfo *outputFunctionArray;
+
+	/* the row being formatted, and formatted rows that aren't sent yet */
+	StringInfo rowBuffer;
+	StringInfo outputBuffer;
+	MemoryContext rowContext;
+
+} CStoreCopyOutState;
+
+
+/* Configuration variables */
+extern bool CStoreVerifyChecksums;
+
 /* Function declarations for extension loading and unloading */
 extern void _PG_init(void);
 extern void _PG_fini(void);
 
+/* Function declarations for parallel COPY workers */
+extern PGDLLEXPORT void ParallelCopyWorkerMain(dsm_segment *segment, shm_toc *toc);
+
 /* event trigger function declarations */
 extern Datum cstore_ddl_event_end_trigger(PG_FUNCTION_ARGS);
 
 /* Function declarations for utility UDFs */
 extern Datum cstore_table_size(PG_FUNCTION_ARGS);
+extern Datum cstore_attach_file(PG_FUNCTION_ARGS);
+extern Datum cstore_drop_stripes(PG_FUNCTION_ARGS);
+extern Datum cstore_compact(PG_FUNCTION_ARGS);
+extern Datum cstore_block_info(PG_FUNCTION_ARGS);
 extern Datum cstore_clean_table_resources(PG_FUNCTION_ARGS);
 
 /* Function declarations for foreign data wrapper */
 extern Datum cstore_fdw_handler(PG_FUNCTION_ARGS);
 extern Datum cstore_fdw_validator(PG_FUNCTION_ARGS);
 
+/* Function declarations for the table access method */
+#if PG_VERSION_NUM >= 120000
+extern void CStoreTableAMInit(void);
+extern void CStoreTableAMFini(void);
+extern bool CStoreTableAMRelationDropped(Oid relationId);
+extern Datum cstore_tableam_handler(PG_FUNCTION_ARGS);
+#endif
+
+/* Function declarations for managing table files */
+extern void CreateCStoreDatabaseDirectory(Oid databaseOid);
+extern void DeleteCStoreTableFiles(char *filename);
+
 /* Function declarations for writing to a cstore file */
 extern TableWriteState * CStoreBeginWrite(const char *filename,
 										  CompressionType compressionType,
 										  uint64 stripeMaxRowCount,
 										  uint32 blockRowCount,
+										  int32 indexColumnIndex,
+										  uint32 *maxSkipValueLengthArray,
 										  TupleDesc tupleDescriptor);
+extern TableWriteState * CStoreBeginPendingWrite(const char *filename,
+												 uint64 stripeMaxRowCount,
+												 TupleDesc tupleDescriptor);
 extern void CStoreWriteRow(TableWriteState *state, Datum *columnValues,
 						   bool *columnNulls);
 extern void CStoreEndWrite(TableWriteState * state);
+extern void CStoreDropStripes(const char *filename, TableFooter *tableFooter,
+							  List *droppedStripeList);
+extern void CStoreReplaceFooter(const char *filename, TableFooter *tableFooter);
+extern void CStoreReplacePendingFooter(const char *filename, TableFooter *tableFooter);
+extern void CStorePublishPendingFooter(const char *filename);
+extern void CStoreEndRewrite(TableWriteState *state, const char *filename,
+							 List *rewrittenStripeList);
 
 /* Function declarations for reading from a cstore file */
 extern TableReadState * CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
 										List *projectedColumnList, List *qualConditions);
+extern TableReadState * CStoreBeginPendingRead(const char *filename,
+											   TupleDesc tupleDescriptor,
+											   List *projectedColumnList);
+extern TableReadState * CStoreBeginStripeRead(const char *filename,
+											 uint32 segmentIndex,
+											 List *stripeMetadataList,
+											 TupleDesc tupleDescriptor,
+											 List *projectedColumnList);
 extern TableFooter * CStoreReadFooter(StringInfo tableFooterFilename);
 extern bool CStoreReadFinished(TableReadState *state);
 extern bool CStoreReadNextRow(TableReadState *state, Datum *columnValues,
 							  bool *columnNulls);
+extern bool CStoreReadRow(TableReadState *state, ScanDirection direction,
+						  Datum *columnValues, bool *columnNulls);
+extern uint32 CStoreReadNextBlock(TableReadState *state,
+								  ColumnBlockData ***blockDataArray,
+								  ColumnBlockSkipNode ***blockSkipNodeArray);
+extern void CStoreBeginSummaryRead(TableReadState *state, Var *groupColumn);
+extern void CStoreRescanRead(TableReadState *state, List *qualConditions);
+extern void CStoreBeginOrderedRead(TableReadState *state, Var *orderColumn,
+								   bool descending, bool nullsFirst);
+extern bool CStoreNextOrderedBlock(TableReadState *state, bool *hasBound,
+								   Datum *boundValue);
+extern void CStoreReadRowPosition(TableReadState *state, uint32 *stripeIndex,
+								  uint32 *rowOffset);
+extern void CStoreBeginParallelRead(TableReadState *state,
+									pg_atomic_uint32 *nextStripeIndex);
+extern uint64 CStoreReadRowNumber(TableReadState *state);
+extern bool CStoreReadRowByNumber(TableReadState *state, uint64 rowNumber,
+								  Datum *columnValues, bool *columnNulls);
 extern void CStoreEndRead(TableReadState *state);
 
 /* Function declarations for common functions */
 extern FmgrInfo * GetFunctionInfoOrNull(Oid typeId, Oid accessMethodId,
 										int16 procedureId);
+extern bool SortKeyCollation(Oid typeId, Oid collation);
+extern bytea * TextSortKey(Datum value, Oid collation);
+extern uint64 SortKeyVersion(Oid collation);
 extern ColumnBlockData ** CreateEmptyBlockDataArray(uint32 columnCount, bool *columnMask,
 													uint32 blockRowCount);
 extern void FreeColumnBlockDataArray(ColumnBlockData **blockDataArray,
 									 uint32 columnCount);
 extern uint64 CStoreTableRowCount(const char *filename);
+extern uint64 CStoreTableRowNumberCount(const char *filename);
+extern uint64 CStoreStripeRowCount(const char *filename,
+								   StripeMetadata *stripeMetadata);
+extern List * CStoreMatchingStripes(const char *filename, TableFooter *tableFooter,
+									TupleDesc tupleDescriptor, List *whereClauseList,
+									uint64 *matchingRowCount);
+extern uint64 CStoreValidateFile(const char *filename, TupleDesc tupleDescriptor,
+								 uint64 blockRowCount);
+extern List * CStoreReadBlockInfo(const char *filename, TupleDesc tupleDescriptor,
+								  bool verify);
+extern char * CStoreSegmentFilename(const char *filename, uint32 segmentIndex);
+extern uint32 CStoreReadSegmentCount(const char *filename);
+extern void CStoreWriteSegmentCount(const char *filename, uint32 segmentCount);
 extern bool CompressBuffer(StringInfo inputBuffer, StringInfo outputBuffer,
 						   CompressionType compressionType);
 extern StringInfo DecompressBuffer(StringInfo buffer, CompressionType compressionType);
+extern uint64 DecompressedSize(StringInfo buffer, CompressionType compressionType);
+#if PG_VERSION_NUM >= 90500
+extern uint32 BufferChecksum(StringInfo buffer);
+#endif
+
+/* Function declarations for the delta store */
+extern void CStoreAppendDeltaRow(StringInfo rowBuffer, HeapTuple heapTuple);
+extern uint64 CStoreAppendDelta(const char *filename, StringInfo rowBuffer,
+								uint32 rowCount);
+extern TableDelta * CStoreReadDelta(const char *filename, bool readRows);
+extern void CStoreResetDelta(const char *filename, uint64 generation);
+extern uint64 CStoreMergedDeltaGeneration(const char *filename);
+
+/* Function declarations for Arrow export and import */
+extern void ArrowCheckColumnTypes(TupleDesc tupleDescriptor, List *attributeNumberList);
+extern void ArrowWriteSchema(StringInfo outputBuffer, TupleDesc tupleDescriptor,
+							 List *attributeNumberList);
+extern void ArrowWriteRecordBatch(StringInfo outputBuffer, TupleDesc tupleDescriptor,
+								  List *attributeNumberList,
+								  ColumnBlockData **blockDataArray, uint32 rowCount);
+extern void ArrowWriteEndOfStream(StringInfo outputBuffer);
+extern uint64 ArrowLoadFile(const char *inputFilename, TupleDesc tupleDescriptor,
+							List *attributeNumberList, TableWriteState *writeState);
 
 
 #endif   /* CSTORE_FDW_H */ 
@@ -21,10 +21,17 @@
 
 
 /* local functions forward declarations */
-static ProtobufCBinaryData DatumToProtobufBinary(Datum datum, bool typeByValue,
-												 int typeLength);
 static Datum ProtobufBinaryToDatum(ProtobufCBinaryData protobufBinary,
 								   bool typeByValue, int typeLength);
+static FlatSkipListHeader * FlatSkipList(StringInfo buffer);
+static ColumnBlockSkipNode * DeserializeFlatColumnSkipList(StringInfo buffer,
+														   bool typeByValue,
+														   int typeLength,
+														   uint64 sortKeyVersion);
+static bytea * FlatSortKey(FlatSkipListHeader *skipListHeader, char *valueArea,
+							uint64 sortKeyOffset);
+static uint64 FlatSkipNodeValue(StringInfo valueArea, Datum datum, bool typeByValue,
+								int typeLength);
 
 
 /*
@@ -95,6 +102,38 @@ SerializeTableFooter(TableFooter *tableFooter)
 		protobufStripeMetadata->has_footerlength = true;
 		protobufStripeMetadata->footerlength = stripeMetadata->footerLength;
 
+		if (stripeMetadata->deletedRowCount > 0)
+		{
+			protobufStripeMetadata->has_deletedrowbitmap = true;
+			protobufStripeMetadata->deletedrowbitmap.data = stripeMetadata->deletedRowBitmap;
+			protobufStripeMetadata->deletedrowbitmap.len =
+				stripeMetadata->deletedRowBitmapLength;
+			protobufStripeMetadata->has_deletedrowcount = true;
+			protobufStripeMetadata->deletedrowcount = stripeMetadata->deletedRowCount;
+		}
+
+		if (stripeMetadata->indexLength > 0)
+		{
+			protobufStripeMetadata->has_indexlength = true;
+			protobufStripeMetadata->indexlength = stripeMetadata->indexLength;
+			protobufStripeMetadata->has_indexcolumnindex = true;
+			protobufStripeMetadata->indexcolumnindex = stripeMetadata->indexColumnIndex;
+		}
+
+		if (stripeMetadata->indexMinimumValueLength > 0)
+		{
+			protobufStripeMetadata->has_indexminimumvalue = true;
+			protobufStripeMetadata->indexminimumvalue.data =
+				stripeMetadata->indexMinimumValue;
+			protobufStripeMetadata->indexminimumvalue.len =
+				stripeMetadata->indexMinimumValueLength;
+			protobufStripeMetadata->has_indexmaximumvalue = true;
+			protobufStripeMetadata->indexmaximumvalue.data =
+				stripeMetadata->indexMaximumValue;
+			protobufStripeMetadata->indexmaximumvalue.len =
+				stripeMetadata->indexMaximumValueLength;
+		}
+
 		stripeMetadataArray[stripeIndex] = protobufStripeMetadata;
 		stripeIndex++;
 	}
@@ -104,6 +143,30 @@ SerializeTableFooter(TableFooter *tableFooter)
 	protobufTableFooter.has_blockrowcount = true;
 	protobufTableFooter.blockrowcount = tableFooter->blockRowCount;
 
+	if (tableFooter->mergedDeltaGeneration > 0)
+	{
+		protobufTableFooter.has_mergeddeltageneration = true;
+		protobufTableFooter.mergeddeltageneration = tableFooter->mergedDeltaGeneration;
+	}
+
+	if (tableFooter->reservedRowCount > 0)
+	{
+		protobufTableFooter.has_reservedrowcount = true;
+		protobufTableFooter.reservedrowcount = tableFooter->reservedRowCount;
+	}
+
+	if (tableFooter->writerTransactionId > 0)
+	{
+		protobufTableFooter.has_writertransactionid = true;
+		protobufTableFooter.writertransactionid = tableFooter->writerTransactionId;
+	}
+
+	if (tableFooter->columnCount > 0)
+	{
+		protobufTableFooter.n_columntypearray = tableFooter->columnCount;
+		protobufTableFooter.columntypearray = (uint32_t *) tableFooter->columnTypeArray;
+	}
+
 	tableFooterSize = protobuf__table_footer__get_packed_size(&protobufTableFooter);
 	tableFooterData = palloc0(tableFooterSize);
 	protobuf__table_footer__pack(&protobufTableFooter, tableFooterData);
@@ -136,6 +199,13 @@ SerializeStripeFooter(StripeFooter *stripeFooter)
 	protobufStripeFooter.n_valuesizearray = stripeFooter->columnCount;
 	protobufStripeFooter.valuesizearray = (uint64_t *) stripeFooter->valueSizeArray;
 
+	if (stripeFooter->skipListChecksumArray != NULL)
+	{
+		protobufStripeFooter.n_skiplistchecksumarray = stripeFooter->columnCount;
+		protobufStripeFooter.skiplistchecksumarray =
+			(uint32_t *) stripeFooter->skipListChecksumArray;
+	}
+
 	stripeFooterSize = protobuf__stripe_footer__get_packed_size(&protobufStripeFooter);
 	stripeFooterData = palloc0(stripeFooterSize);
 	protobuf__stripe_footer__pack(&protobufStripeFooter, stripeFooterData);
@@ -149,75 +219,132 @@ SerializeStripeFooter(StripeFooter *stripeFooter)
 }
 
 
+/*
+ * SerializeSegmentManifest serializes the manifest of a table's segment files,
+ * and returns the result as a StringInfo.
+ */
+StringInfo
+SerializeSegmentManifest(uint32 segmentCount)
+{
+	StringInfo manifestBuffer = NULL;
+	Protobuf__SegmentManifest protobufManifest = PROTOBUF__SEGMENT_MANIFEST__INIT;
+	uint8 *manifestData = NULL;
+	uint32 manifestSize = 0;
+
+	protobufManifest.has_segmentcount = true;
+	protobufManifest.segmentcount = segmentCount;
+
+	manifestSize = protobuf__segment_manifest__get_packed_size(&protobufManifest);
+	manifestData = palloc0(manifestSize);
+	protobuf__segment_manifest__pack(&protobufManifest, manifestData);
+
+	manifestBuffer = palloc0(sizeof(StringInfoData));
+	manifestBuffer->len = manifestSize;
+	manifestBuffer->maxlen = manifestSize;
+	manifestBuffer->data = (char *) manifestData;
+
+	return manifestBuffer;
+}
+
+
 /*
  * SerializeColumnSkipList serializes a column skip list, where the colum skip
- * list includes all block skip nodes for that column. The function then returns
- * the result as a string info.
+ * list includes all block skip nodes for that column. We write skip lists in the
+ * flat format, so that readers can use them without unpacking. Sort keys of the
+ * skip nodes have the given sort key version. The function then returns the
+ * result as a string info.
  */
 StringInfo
 SerializeColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCount,
-						bool typeByValue, int typeLength)
+						bool typeByValue, int typeLength, uint64 sortKeyVersion)
 {
-	StringInfo blockSkipListBuffer = NULL;
-	Protobuf__ColumnBlockSkipList protobufBlockSkipList =
-		PROTOBUF__COLUMN_BLOCK_SKIP_LIST__INIT;
-	Protobuf__ColumnBlockSkipNode **protobufBlockSkipNodeArray = NULL;
+	StringInfo blockSkipListBuffer = makeStringInfo();
+	StringInfo valueAreaBuffer = makeStringInfo();
+	FlatSkipListHeader skipListHeader;
+	FlatBlockSkipNode *flatBlockSkipNodeArray = NULL;
 	uint32 blockIndex = 0;
-	uint8 *blockSkipListData = NULL;
-	uint32 blockSkipListSize = 0;
 
-	protobufBlockSkipNodeArray = palloc0(blockCount *
-										 sizeof(Protobuf__ColumnBlockSkipNode *));
+	flatBlockSkipNodeArray = palloc0(Max(blockCount, 1) * sizeof(FlatBlockSkipNode));
 	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
 	{
-		ColumnBlockSkipNode blockSkipNode = blockSkipNodeArray[blockIndex];
-		Protobuf__ColumnBlockSkipNode *protobufBlockSkipNode = NULL;
-		ProtobufCBinaryData binaryMinimumValue = {0, 0};
-		ProtobufCBinaryData binaryMaximumValue = {0, 0};
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		FlatBlockSkipNode *flatBlockSkipNode = &flatBlockSkipNodeArray[blockIndex];
+
+		flatBlockSkipNode->rowCount = blockSkipNode->rowCount;
+		flatBlockSkipNode->valueBlockOffset = blockSkipNode->valueBlockOffset;
+		flatBlockSkipNode->valueLength = blockSkipNode->valueLength;
+		flatBlockSkipNode->existsBlockOffset = blockSkipNode->existsBlockOffset;
+		flatBlockSkipNode->existsLength = blockSkipNode->existsLength;
+		flatBlockSkipNode->valueCompressionType =
+			(uint8) blockSkipNode->valueCompressionType;
+
+		if (blockSkipNode->hasMinMax)
+		{
+			flatBlockSkipNode->flags |= FLAT_SKIP_NODE_HAS_MIN_MAX;
+			flatBlockSkipNode->minimumValue =
+				FlatSkipNodeValue(valueAreaBuffer, blockSkipNode->minimumValue,
+								  typeByValue, typeLength);
+			flatBlockSkipNode->maximumValue =
+				FlatSkipNodeValue(valueAreaBuffer, blockSkipNode->maximumValue,
+								  typeByValue, typeLength);
+
+			if (blockSkipNode->minMaxTruncated)
+			{
+				flatBlockSkipNode->flags |= FLAT_SKIP_NODE_MIN_MAX_TRUNCATED;
+			}
+		}
 
-		if (blockSkipNode.hasMinMax)
+		/* the maximum's sort key follows the minimum's in the value area */
+		if (blockSkipNode->hasSortKeys)
 		{
-			binaryMinimumValue = DatumToProtobufBinary(blockSkipNode.minimumValue,
-													   typeByValue, typeLength);
-			binaryMaximumValue = DatumToProtobufBinary(blockSkipNode.maximumValue,
-													   typeByValue, typeLength);
+			flatBlockSkipNode->flags |= FLAT_SKIP_NODE_HAS_SORT_KEYS;
+			flatBlockSkipNode->sortKeyOffset =
+				FlatSkipNodeValue(valueAreaBuffer,
+								  PointerGetDatum(blockSkipNode->minimumSortKey),
+								  false, -1);
+			(void) FlatSkipNodeValue(valueAreaBuffer,
+									 PointerGetDatum(blockSkipNode->maximumSortKey),
+									 false, -1);
 		}
 
-		protobufBlockSkipNode = palloc0(sizeof(Protobuf__ColumnBlockSkipNode));
-		protobuf__column_block_skip_node__init(protobufBlockSkipNode);
-		protobufBlockSkipNode->has_rowcount = true;
-		protobufBlockSkipNode->rowcount = blockSkipNode.rowCount;
-		protobufBlockSkipNode->has_minimumvalue = blockSkipNode.hasMinMax;
-		protobufBlockSkipNode->minimumvalue = binaryMinimumValue;
-		protobufBlockSkipNode->has_maximumvalue = blockSkipNode.hasMinMax;
-		protobufBlockSkipNode->maximumvalue = binaryMaximumValue;
-		protobufBlockSkipNode->has_valueblockoffset = true;
-		protobufBlockSkipNode->valueblockoffset = blockSkipNode.valueBlockOffset;
-		protobufBlockSkipNode->has_valuelength = true;
-		protobufBlockSkipNode->valuelength = blockSkipNode.valueLength;
-		protobufBlockSkipNode->has_existsblockoffset = true;
-		protobufBlockSkipNode->existsblockoffset = blockSkipNode.existsBlockOffset;
-		protobufBlockSkipNode->has_existslength = true;
-		protobufBlockSkipNode->existslength = blockSkipNode.existsLength;
-		protobufBlockSkipNode->has_valuecompressiontype = true;
-		protobufBlockSkipNode->valuecompressiontype =
-			(Protobuf__CompressionType) blockSkipNode.valueCompressionType;
-
-		protobufBlockSkipNodeArray[blockIndex] = protobufBlockSkipNode;
-	}
-
-	protobufBlockSkipList.n_blockskipnodearray = blockCount;
-	protobufBlockSkipList.blockskipnodearray = protobufBlockSkipNodeArray;
-
-	blockSkipListSize =
-		protobuf__column_block_skip_list__get_packed_size(&protobufBlockSkipList);
-	blockSkipListData = palloc0(blockSkipListSize);
-	protobuf__column_block_skip_list__pack(&protobufBlockSkipList, blockSkipListData);
-
-	blockSkipListBuffer = palloc0(sizeof(StringInfoData));
-	blockSkipListBuffer->len = blockSkipListSize;
-	blockSkipListBuffer->maxlen = blockSkipListSize;
-	blockSkipListBuffer->data = (char *) blockSkipListData;
+		if (blockSkipNode->hasValueCount)
+		{
+			flatBlockSkipNode->flags |= FLAT_SKIP_NODE_HAS_VALUE_COUNT;
+			flatBlockSkipNode->valueCount = blockSkipNode->valueCount;
+		}
+
+		if (blockSkipNode->hasValueSum)
+		{
+			flatBlockSkipNode->flags |= FLAT_SKIP_NODE_HAS_VALUE_SUM;
+			flatBlockSkipNode->valueSum = blockSkipNode->valueSum;
+		}
+
+		if (blockSkipNode->hasChecksum)
+		{
+			flatBlockSkipNode->flags |= FLAT_SKIP_NODE_HAS_CHECKSUM;
+			flatBlockSkipNode->existsChecksum = blockSkipNode->existsChecksum;
+			flatBlockSkipNode->valueChecksum = blockSkipNode->valueChecksum;
+		}
+	}
+
+	memset(&skipListHeader, 0, sizeof(FlatSkipListHeader));
+	skipListHeader.magicNumber = FLAT_SKIP_LIST_MAGIC_NUMBER;
+	skipListHeader.version = FLAT_SKIP_LIST_VERSION;
+	skipListHeader.blockSkipNodeSize = sizeof(FlatBlockSkipNode);
+	skipListHeader.blockCount = blockCount;
+	skipListHeader.valueAreaLength = valueAreaBuffer->len;
+	skipListHeader.sortKeyVersion = sortKeyVersion;
+
+	appendBinaryStringInfo(blockSkipListBuffer, (char *) &skipListHeader,
+						   sizeof(FlatSkipListHeader));
+	appendBinaryStringInfo(blockSkipListBuffer, (char *) flatBlockSkipNodeArray,
+						   blockCount * sizeof(FlatBlockSkipNode));
+	appendBinaryStringInfo(blockSkipListBuffer, valueAreaBuffer->data,
+						   valueAreaBuffer->len);
+
+	pfree(flatBlockSkipNodeArray);
+	pfree(valueAreaBuffer->data);
+	pfree(valueAreaBuffer);
 
 	return blockSkipListBuffer;
 }
@@ -269,6 +396,11 @@ DeserializeTableFooter(StringInfo buffer)
 	Protobuf__TableFooter *protobufTableFooter = NULL;
 	List *stripeMetadataList = NIL;
 	uint64 blockRowCount = 0;
+	uint64 mergedDeltaGeneration = 0;
+	uint64 reservedRowCount = 0;
+	uint64 writerTransactionId = 0;
+	uint32 columnCount = 0;
+	Oid *columnTypeArray = NULL;
 	uint32 stripeCount = 0;
 	uint32 stripeIndex = 0;
 
@@ -293,6 +425,33 @@ DeserializeTableFooter(StringInfo buffer)
 	}
 	blockRowCount = protobufTableFooter->blockrowcount;
 
+	/* footers written before the delta store existed have no merged generation */
+	if (protobufTableFooter->has_mergeddeltageneration)
+	{
+		mergedDeltaGeneration = protobufTableFooter->mergeddeltageneration;
+	}
+
+	/* only footers of access method tables have reserved row numbers */
+	if (protobufTableFooter->has_reservedrowcount)
+	{
+		reservedRowCount = protobufTableFooter->reservedrowcount;
+	}
+
+	/* only published footers of access method tables have a writer */
+	if (protobufTableFooter->has_writertransactionid)
+	{
+		writerTransactionId = protobufTableFooter->writertransactionid;
+	}
+
+	/* footers written by older versions have no column types */
+	columnCount = protobufTableFooter->n_columntypearray;
+	if (columnCount > 0)
+	{
+		columnTypeArray = palloc0(columnCount * sizeof(Oid));
+		memcpy(columnTypeArray, protobufTableFooter->columntypearray,
+			   columnCount * sizeof(Oid));
+	}
+
 	stripeCount = protobufTableFooter->n_stripemetadataarray;
 	for (stripeIndex = 0; stripeIndex < stripeCount; stripeIndex++)
 	{
@@ -315,6 +474,47 @@ DeserializeTableFooter(StringInfo buffer)
 		stripeMetadata->dataLength = protobufStripeMetadata->datalength;
 		stripeMetadata->footerLength = protobufStripeMetadata->footerlength;
 
+		/* stripes without deleted rows don't have a deletion bitmap */
+		if (protobufStripeMetadata->has_deletedrowbitmap &&
+			protobufStripeMetadata->has_deletedrowcount &&
+			protobufStripeMetadata->deletedrowcount > 0)
+		{
+			ProtobufCBinaryData deletedRowBitmap = protobufStripeMetadata->deletedrowbitmap;
+
+			stripeMetadata->deletedRowBitmap = palloc0(deletedRowBitmap.len);
+			memcpy(stripeMetadata->deletedRowBitmap, deletedRowBitmap.data,
+				   deletedRowBitmap.len);
+			stripeMetadata->deletedRowBitmapLength = deletedRowBitmap.len;
+			stripeMetadata->deletedRowCount = protobufStripeMetadata->deletedrowcount;
+		}
+
+		/* only stripes of tables with an index column have a sparse index */
+		if (protobufStripeMetadata->has_indexlength &&
+			protobufStripeMetadata->has_indexcolumnindex)
+		{
+			stripeMetadata->indexLength = protobufStripeMetadata->indexlength;
+			stripeMetadata->indexColumnIndex = protobufStripeMetadata->indexcolumnindex;
+		}
+
+		/* indexed stripes whose column has no values or no ordering have no range */
+		if (stripeMetadata->indexLength > 0 &&
+			protobufStripeMetadata->has_indexminimumvalue &&
+			protobufStripeMetadata->has_indexmaximumvalue)
+		{
+			ProtobufCBinaryData minimumValue = protobufStripeMetadata->indexminimumvalue;
+			ProtobufCBinaryData maximumValue = protobufStripeMetadata->indexmaximumvalue;
+
+			stripeMetadata->indexMinimumValue = palloc0(minimumValue.len);
+			memcpy(stripeMetadata->indexMinimumValue, minimumValue.data,
+				   minimumValue.len);
+			stripeMetadata->indexMinimumValueLength = minimumValue.len;
+
+			stripeMetadata->indexMaximumValue = palloc0(maximumValue.len);
+			memcpy(stripeMetadata->indexMaximumValue, maximumValue.data,
+				   maximumValue.len);
+			stripeMetadata->indexMaximumValueLength = maximumValue.len;
+		}
+
 		stripeMetadataList = lappend(stripeMetadataList, stripeMetadata);
 	}
 
@@ -323,6 +523,11 @@ DeserializeTableFooter(StringInfo buffer)
 	tableFooter = palloc0(sizeof(TableFooter));
 	tableFooter->stripeMetadataList = stripeMetadataList;
 	tableFooter->blockRowCount = blockRowCount;
+	tableFooter->mergedDeltaGeneration = mergedDeltaGeneration;
+	tableFooter->reservedRowCount = reservedRowCount;
+	tableFooter->writerTransactionId = writerTransactionId;
+	tableFooter->columnCount = columnCount;
+	tableFooter->columnTypeArray = columnTypeArray;
 
 	return tableFooter;
 }
@@ -340,6 +545,7 @@ DeserializeStripeFooter(StringInfo buffer)
 	uint64 *skipListSizeArray = NULL;
 	uint64 *existsSizeArray = NULL;
 	uint64 *valueSizeArray = NULL;
+	uint32 *skipListChecksumArray = NULL;
 	uint64 sizeArrayLength = 0;
 	uint32 columnCount = 0;
 
@@ -359,6 +565,14 @@ DeserializeStripeFooter(StringInfo buffer)
 						errdetail("stripe size array lengths don't match")));
 	}
 
+	/* stripes written by older versions don't have skip list checksums */
+	if (protobufStripeFooter->n_skiplistchecksumarray != 0 &&
+		protobufStripeFooter->n_skiplistchecksumarray != columnCount)
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("stripe checksum array length doesn't match")));
+	}
+
 	sizeArrayLength = columnCount * sizeof(uint64);
 
 	skipListSizeArray = palloc0(sizeArrayLength);
@@ -369,18 +583,58 @@ DeserializeStripeFooter(StringInfo buffer)
 	memcpy(existsSizeArray, protobufStripeFooter->existssizearray, sizeArrayLength);
 	memcpy(valueSizeArray, protobufStripeFooter->valuesizearray, sizeArrayLength);
 
+	if (protobufStripeFooter->n_skiplistchecksumarray != 0)
+	{
+		skipListChecksumArray = palloc0(columnCount * sizeof(uint32));
+		memcpy(skipListChecksumArray, protobufStripeFooter->skiplistchecksumarray,
+			   columnCount * sizeof(uint32));
+	}
+
 	protobuf__stripe_footer__free_unpacked(protobufStripeFooter, NULL);
 
 	stripeFooter = palloc0(sizeof(StripeFooter));
 	stripeFooter->skipListSizeArray = skipListSizeArray;
 	stripeFooter->existsSizeArray = existsSizeArray;
 	stripeFooter->valueSizeArray = valueSizeArray;
+	stripeFooter->skipListChecksumArray = skipListChecksumArray;
 	stripeFooter->columnCount = columnCount;
 
 	return stripeFooter;
 }
 
 
+/*
+ * DeserializeSegmentManifest deserializes the given segment manifest buffer and
+ * returns the number of segment files in the table.
+ */
+uint32
+DeserializeSegmentManifest(StringInfo buffer)
+{
+	Protobuf__SegmentManifest *protobufManifest = NULL;
+	uint32 segmentCount = 0;
+
+	protobufManifest = protobuf__segment_manifest__unpack(NULL, buffer->len,
+														  (uint8 *) buffer->data);
+	if (protobufManifest == NULL)
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("invalid segment manifest buffer")));
+	}
+
+	if (!protobufManifest->has_segmentcount || protobufManifest->segmentcount == 0)
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("invalid segment count")));
+	}
+
+	segmentCount = protobufManifest->segmentcount;
+
+	protobuf__segment_manifest__free_unpacked(protobufManifest, NULL);
+
+	return segmentCount;
+}
+
+
 /*
  * DeserializeBlockCount deserializes the given column skip list buffer and
  * returns the number of blocks in column skip list.
@@ -390,6 +644,12 @@ DeserializeBlockCount(StringInfo buffer)
 {
 	uint32 blockCount = 0;
 	Protobuf__ColumnBlockSkipList *protobufBlockSkipList = NULL;
+	FlatSkipListHeader *skipListHeader = FlatSkipList(buffer);
+
+	if (skipListHeader != NULL)
+	{
+		return skipListHeader->blockCount;
+	}
 
 	protobufBlockSkipList =
 		protobuf__column_block_skip_list__unpack(NULL, buffer->len,
@@ -419,6 +679,20 @@ DeserializeRowCount(StringInfo buffer)
 	Protobuf__ColumnBlockSkipList *protobufBlockSkipList = NULL;
 	uint32 blockIndex = 0;
 	uint32 blockCount = 0;
+	FlatSkipListHeader *skipListHeader = FlatSkipList(buffer);
+
+	if (skipListHeader != NULL)
+	{
+		FlatBlockSkipNode *flatBlockSkipNodeArray =
+			(FlatBlockSkipNode *) (buffer->data + sizeof(FlatSkipListHeader));
+
+		for (blockIndex = 0; blockIndex < skipListHeader->blockCount; blockIndex++)
+		{
+			rowCount += flatBlockSkipNodeArray[blockIndex].rowCount;
+		}
+
+		return rowCount;
+	}
 
 	protobufBlockSkipList =
 		protobuf__column_block_skip_list__unpack(NULL, buffer->len,
@@ -446,15 +720,31 @@ DeserializeRowCount(StringInfo buffer)
 /*
  * DeserializeColumnSkipList deserializes the given buffer and returns the result as
  * a ColumnBlockSkipNode array. If the number of unpacked block skip nodes are not
- * equal to the given block count function errors out.
+ * equal to the given block count function errors out. Min/max values of flat
+ * skip lists point into the buffer, so the caller must keep the buffer as long
+ * as the skip nodes. Sort keys are only kept if they have the given sort key
+ * version, which is 0 for columns whose collation has no sort keys.
  */
 ColumnBlockSkipNode *
 DeserializeColumnSkipList(StringInfo buffer, bool typeByValue, int typeLength,
-						  uint32 blockCount)
+						  uint32 blockCount, uint64 sortKeyVersion)
 {
 	ColumnBlockSkipNode *blockSkipNodeArray = NULL;
 	uint32 blockIndex = 0;
 	Protobuf__ColumnBlockSkipList *protobufBlockSkipList = NULL;
+	FlatSkipListHeader *skipListHeader = FlatSkipList(buffer);
+
+	if (skipListHeader != NULL)
+	{
+		if (skipListHeader->blockCount != blockCount)
+		{
+			ereport(ERROR, (errmsg("could not unpack column store"),
+							errdetail("block skip node count and block count don't match")));
+		}
+
+		return DeserializeFlatColumnSkipList(buffer, typeByValue, typeLength,
+											 sortKeyVersion);
+	}
 
 	protobufBlockSkipList =
 		protobuf__column_block_skip_list__unpack(NULL, buffer->len,
@@ -521,6 +811,14 @@ DeserializeColumnSkipList(StringInfo buffer, bool typeByValue, int typeLength,
 		blockSkipNode->valueLength = protobufBlockSkipNode->valuelength;
 		blockSkipNode->valueCompressionType =
 			(CompressionType) protobufBlockSkipNode->valuecompressiontype;
+		blockSkipNode->hasValueCount = protobufBlockSkipNode->has_valuecount;
+		blockSkipNode->valueCount = protobufBlockSkipNode->valuecount;
+		blockSkipNode->hasValueSum = protobufBlockSkipNode->has_valuesum;
+		blockSkipNode->valueSum = protobufBlockSkipNode->valuesum;
+		blockSkipNode->hasChecksum = protobufBlockSkipNode->has_existschecksum &&
+									 protobufBlockSkipNode->has_valuechecksum;
+		blockSkipNode->existsChecksum = protobufBlockSkipNode->existschecksum;
+		blockSkipNode->valueChecksum = protobufBlockSkipNode->valuechecksum;
 	}
 
 	protobuf__column_block_skip_list__free_unpacked(protobufBlockSkipList, NULL);
@@ -529,35 +827,209 @@ DeserializeColumnSkipList(StringInfo buffer, bool typeByValue, int typeLength,
 }
 
 
-/* Converts a datum to a ProtobufCBinaryData. */
-static ProtobufCBinaryData
-DatumToProtobufBinary(Datum datum, bool datumTypeByValue, int datumTypeLength)
+/*
+ * FlatSkipList returns the header of the given column skip list buffer if the
+ * skip list is in the flat format, and NULL if it is in the protobuf format of
+ * older versions. The function errors out if a flat skip list has an unknown
+ * version, was written with a different byte order, or doesn't match the
+ * buffer's length.
+ */
+static FlatSkipListHeader *
+FlatSkipList(StringInfo buffer)
 {
-	ProtobufCBinaryData protobufBinary = {0, 0};
+	FlatSkipListHeader *skipListHeader = NULL;
+	uint64 skipListLength = 0;
+
+	if (buffer->len < (int) sizeof(FlatSkipListHeader))
+	{
+		return NULL;
+	}
+
+	skipListHeader = (FlatSkipListHeader *) buffer->data;
+	if (skipListHeader->magicNumber == FLAT_SKIP_LIST_SWAPPED_MAGIC_NUMBER)
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("skip list was written with a different byte order")));
+	}
+	else if (skipListHeader->magicNumber != FLAT_SKIP_LIST_MAGIC_NUMBER)
+	{
+		return NULL;
+	}
 
-	int datumLength = att_addlength_datum(0, datumTypeLength, datum);
-	char *datumBuffer = palloc0(datumLength);
+	if (skipListHeader->version != FLAT_SKIP_LIST_VERSION ||
+		skipListHeader->blockSkipNodeSize != sizeof(FlatBlockSkipNode))
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("invalid skip list version number")));
+	}
 
-	if (datumTypeLength > 0)
+	skipListLength = sizeof(FlatSkipListHeader) +
+					 (uint64) skipListHeader->blockCount * sizeof(FlatBlockSkipNode) +
+					 skipListHeader->valueAreaLength;
+	if (skipListLength != (uint64) buffer->len)
 	{
-		if (datumTypeByValue)
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("invalid skip list buffer")));
+	}
+
+	return skipListHeader;
+}
+
+
+/*
+ * DeserializeFlatColumnSkipList converts the block skip nodes of the given flat
+ * skip list buffer to a ColumnBlockSkipNode array. This only copies fixed-width
+ * fields; min/max values of by-value types are read in place, and those of other
+ * types point into the buffer's value area. Sort keys of other versions than the
+ * given one are left out, since they may not order like the column's collation.
+ */
+static ColumnBlockSkipNode *
+DeserializeFlatColumnSkipList(StringInfo buffer, bool typeByValue, int typeLength,
+							  uint64 sortKeyVersion)
+{
+	FlatSkipListHeader *skipListHeader = (FlatSkipListHeader *) buffer->data;
+	uint32 blockCount = skipListHeader->blockCount;
+	FlatBlockSkipNode *flatBlockSkipNodeArray =
+		(FlatBlockSkipNode *) (buffer->data + sizeof(FlatSkipListHeader));
+	char *valueArea = (char *) (flatBlockSkipNodeArray + blockCount);
+	ColumnBlockSkipNode *blockSkipNodeArray = NULL;
+	uint32 blockIndex = 0;
+	bool sortKeysValid = (sortKeyVersion != 0 &&
+						  skipListHeader->sortKeyVersion == sortKeyVersion);
+
+	blockSkipNodeArray = palloc0(Max(blockCount, 1) * sizeof(ColumnBlockSkipNode));
+
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		FlatBlockSkipNode *flatBlockSkipNode = &flatBlockSkipNodeArray[blockIndex];
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		uint8 flags = flatBlockSkipNode->flags;
+
+		blockSkipNode->rowCount = flatBlockSkipNode->rowCount;
+		blockSkipNode->existsBlockOffset = flatBlockSkipNode->existsBlockOffset;
+		blockSkipNode->valueBlockOffset = flatBlockSkipNode->valueBlockOffset;
+		blockSkipNode->existsLength = flatBlockSkipNode->existsLength;
+		blockSkipNode->valueLength = flatBlockSkipNode->valueLength;
+		blockSkipNode->valueCompressionType =
+			(CompressionType) flatBlockSkipNode->valueCompressionType;
+		blockSkipNode->hasValueCount = (flags & FLAT_SKIP_NODE_HAS_VALUE_COUNT) != 0;
+		blockSkipNode->valueCount = flatBlockSkipNode->valueCount;
+		blockSkipNode->hasValueSum = (flags & FLAT_SKIP_NODE_HAS_VALUE_SUM) != 0;
+		blockSkipNode->valueSum = flatBlockSkipNode->valueSum;
+		blockSkipNode->hasChecksum = (flags & FLAT_SKIP_NODE_HAS_CHECKSUM) != 0;
+		blockSkipNode->existsChecksum = flatBlockSkipNode->existsChecksum;
+		blockSkipNode->valueChecksum = flatBlockSkipNode->valueChecksum;
+
+		blockSkipNode->hasSortKeys =
+			sortKeysValid && (flags & FLAT_SKIP_NODE_HAS_SORT_KEYS) != 0;
+		if (blockSkipNode->hasSortKeys)
+		{
+			uint64 minimumKeyOffset = flatBlockSkipNode->sortKeyOffset;
+			uint64 maximumKeyOffset = 0;
+
+			blockSkipNode->minimumSortKey = FlatSortKey(skipListHeader, valueArea,
+														minimumKeyOffset);
+
+			maximumKeyOffset =
+				MAXALIGN(minimumKeyOffset + VARSIZE(blockSkipNode->minimumSortKey));
+			blockSkipNode->maximumSortKey = FlatSortKey(skipListHeader, valueArea,
+														maximumKeyOffset);
+		}
+
+		blockSkipNode->hasMinMax = (flags & FLAT_SKIP_NODE_HAS_MIN_MAX) != 0;
+		blockSkipNode->minMaxTruncated =
+			(flags & FLAT_SKIP_NODE_MIN_MAX_TRUNCATED) != 0;
+		if (!blockSkipNode->hasMinMax)
 		{
-			store_att_byval(datumBuffer, datum, datumTypeLength);
+			continue;
+		}
+
+		if (typeByValue)
+		{
+			blockSkipNode->minimumValue = fetch_att(&flatBlockSkipNode->minimumValue,
+													typeByValue, typeLength);
+			blockSkipNode->maximumValue = fetch_att(&flatBlockSkipNode->maximumValue,
+													typeByValue, typeLength);
 		}
 		else
 		{
-			memcpy(datumBuffer, DatumGetPointer(datum), datumTypeLength);
+			if (flatBlockSkipNode->minimumValue >= skipListHeader->valueAreaLength ||
+				flatBlockSkipNode->maximumValue >= skipListHeader->valueAreaLength)
+			{
+				ereport(ERROR, (errmsg("could not unpack column store"),
+								errdetail("invalid skip list value offset")));
+			}
+
+			blockSkipNode->minimumValue =
+				PointerGetDatum(valueArea + flatBlockSkipNode->minimumValue);
+			blockSkipNode->maximumValue =
+				PointerGetDatum(valueArea + flatBlockSkipNode->maximumValue);
 		}
 	}
-	else
+
+	return blockSkipNodeArray;
+}
+
+
+/*
+ * FlatSortKey returns a pointer to the sort key at the given offset of the value
+ * area of the given flat skip list, and errors out if the key doesn't fit into
+ * the value area.
+ */
+static bytea *
+FlatSortKey(FlatSkipListHeader *skipListHeader, char *valueArea,
+			uint64 sortKeyOffset)
+{
+	uint64 valueAreaLength = skipListHeader->valueAreaLength;
+	bytea *sortKey = NULL;
+
+	if (sortKeyOffset + VARHDRSZ > valueAreaLength)
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("invalid skip list sort key offset")));
+	}
+
+	sortKey = (bytea *) (valueArea + sortKeyOffset);
+	if (sortKeyOffset + VARSIZE(sortKey) > valueAreaLength)
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("invalid skip list sort key offset")));
+	}
+
+	return sortKey;
+}
+
+
+/*
+ * FlatSkipNodeValue returns what flat block skip nodes keep for the given min or
+ * max value. By-value types keep the value itself. For other types, we append
+ * the value to the given value area at a maximally aligned offset, and return
+ * that offset.
+ */
+static uint64
+FlatSkipNodeValue(StringInfo valueArea, Datum datum, bool typeByValue, int typeLength)
+{
+	uint64 nodeValue = 0;
+	uint32 datumLength = 0;
+	uint32 valueOffset = 0;
+
+	if (typeByValue)
 	{
-		memcpy(datumBuffer, DatumGetPointer(datum), datumLength);
+		store_att_byval(&nodeValue, datum, typeLength);
+		return nodeValue;
 	}
 
-	protobufBinary.data = (uint8 *) datumBuffer;
-	protobufBinary.len = datumLength;
+	datumLength = att_addlength_datum(0, typeLength, datum);
+	valueOffset = MAXALIGN(valueArea->len);
+
+	enlargeStringInfo(valueArea, (valueOffset - valueArea->len) + datumLength);
+	memset(valueArea->data + valueArea->len, 0, valueOffset - valueArea->len);
+	memcpy(valueArea->data + valueOffset, DatumGetPointer(datum), datumLength);
+
+	valueArea->len = valueOffset + datumLength;
+	valueArea->data[valueArea->len] = '\0';
 
-	return protobufBinary;
+	return valueOffset;
 }
 
 
@@ -20,13 +20,83 @@
 #include "cstore_fdw.h"
 
 
+/* Magic number and version of column skip lists in the flat format */
+#define FLAT_SKIP_LIST_MAGIC_NUMBER 0x4C4B5346
+#define FLAT_SKIP_LIST_SWAPPED_MAGIC_NUMBER 0x46534B4C
+#define FLAT_SKIP_LIST_VERSION 1
+
+/* Flags of flat block skip nodes */
+#define FLAT_SKIP_NODE_HAS_MIN_MAX 0x01
+#define FLAT_SKIP_NODE_HAS_VALUE_COUNT 0x02
+#define FLAT_SKIP_NODE_HAS_VALUE_SUM 0x04
+#define FLAT_SKIP_NODE_HAS_CHECKSUM 0x08
+#define FLAT_SKIP_NODE_MIN_MAX_TRUNCATED 0x10
+#define FLAT_SKIP_NODE_HAS_SORT_KEYS 0x20
+
+
+/*
+ * FlatSkipListHeader starts a column skip list in the flat format, which readers
+ * use in place instead of unpacking it. The header is followed by an array of
+ * blockCount block skip nodes, and then by the value area. Skip lists that older
+ * versions encoded with protobuf start with a field tag instead of the magic
+ * number, or are empty, so readers can tell the two formats apart.
+ *
+ * Flat skip lists are written in the byte order of the machine that wrote them,
+ * and the magic number records that order. Readers use skip lists in place, so
+ * they reject skip lists whose magic number has its bytes swapped. Block skip
+ * nodes of text columns may have sort keys, and sortKeyVersion identifies the
+ * collation and collator version that computed them.
+ */
+typedef struct FlatSkipListHeader
+{
+	uint32 magicNumber;
+	uint16 version;
+	uint16 blockSkipNodeSize;
+	uint32 blockCount;
+	uint32 valueAreaLength;
+	uint64 sortKeyVersion;
+
+} FlatSkipListHeader;
+
+
+/*
+ * FlatBlockSkipNode is the fixed-width form of a block skip node in flat skip
+ * lists. Minimum and maximum values of by-value types are kept in place, and
+ * those of other types are offsets of the values in the value area. Values in
+ * the value area start at maximally aligned offsets, so that readers can point
+ * to them. If the node has sort keys, the minimum's sort key is at sortKeyOffset
+ * of the value area, and the maximum's sort key follows it at the next maximally
+ * aligned offset.
+ */
+typedef struct FlatBlockSkipNode
+{
+	uint64 rowCount;
+	uint64 valueBlockOffset;
+	uint64 valueLength;
+	uint64 existsBlockOffset;
+	uint64 existsLength;
+	uint64 valueCount;
+	int64 valueSum;
+	uint64 minimumValue;
+	uint64 maximumValue;
+	uint32 existsChecksum;
+	uint32 valueChecksum;
+	uint8 valueCompressionType;
+	uint8 flags;
+	uint16 padding;
+	uint32 sortKeyOffset;
+
+} FlatBlockSkipNode;
+
+
 /* Function declarations for metadata serialization */
 extern StringInfo SerializePostScript(uint64 tableFooterLength);
 extern StringInfo SerializeTableFooter(TableFooter *tableFooter);
 extern StringInfo SerializeStripeFooter(StripeFooter *stripeFooter);
+extern StringInfo SerializeSegmentManifest(uint32 segmentCount);
 extern StringInfo SerializeColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray,
 										  uint32 blockCount, bool typeByValue,
-										  int typeLength);
+										  int typeLength, uint64 sortKeyVersion);
 
 /* Function declarations for metadata deserialization */
 extern void DeserializePostScript(StringInfo buffer, uint64 *tableFooterLength);
@@ -34,9 +104,11 @@ extern TableFooter * DeserializeTableFooter(StringInfo buffer);
 extern uint32 DeserializeBlockCount(StringInfo buffer);
 extern uint32 DeserializeRowCount(StringInfo buffer);
 extern StripeFooter * DeserializeStripeFooter(StringInfo buffer);
+extern uint32 DeserializeSegmentManifest(StringInfo buffer);
 extern ColumnBlockSkipNode * DeserializeColumnSkipList(StringInfo buffer,
 													   bool typeByValue, int typeLength,
-													   uint32 blockCount);
+													   uint32 blockCount,
+													   uint64 sortKeyVersion);
 
 
 #endif   /* CSTORE_SERIALIZATION_H */ 
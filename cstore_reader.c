@@ -19,8 +19,14 @@
 #include "cstore_metadata_serialization.h"
 #include "cstore_version_compat.h"
 
+#include <sys/stat.h>
+#include "access/hash.h"
+#include "access/htup_details.h"
 #include "access/nbtree.h"
+#include "access/transam.h"
 #include "access/skey.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "nodes/makefuncs.h"
 #if PG_VERSION_NUM >= 120000
@@ -35,17 +41,67 @@
 #include "optimizer/restrictinfo.h"
 #include "port.h"
 #include "storage/fd.h"
+#include "utils/datum.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
 #include "utils/rel.h"
+#include "utils/syscache.h"
 
 
 /* static function declarations */
-static StripeBuffers * LoadFilteredStripeBuffers(FILE *tableFile,
+/*
+ * BlockVerifyContext identifies the stripe and column block that we are reading
+ * when inspecting a table's files, for error context messages. The column index
+ * is -1 while we read stripe metadata.
+ */
+typedef struct BlockVerifyContext
+{
+	const char *filename;
+	uint32 stripeIndex;
+	int32 columnIndex;
+	uint32 blockIndex;
+
+} BlockVerifyContext;
+
+
+static void SetReadStripe(TableReadState *readState, int32 stripeIndex);
+static int32 ReadStripeCount(TableReadState *readState);
+static int32 NextReadStripeIndex(TableReadState *readState, bool backward);
+static void LoadStripeFirstRowArray(TableReadState *readState);
+static int32 RowNumberStripeIndex(TableReadState *readState, uint64 rowNumber);
+static int32 LoadedBlockIndex(TableReadState *readState, int32 stripeIndex,
+							  uint32 blockIndex);
+static bool DeltaStripe(TableReadState *readState, int32 stripeIndex);
+static void SetReadDeltaBlocks(TableReadState *readState, uint32 firstBlockIndex,
+							   uint32 blockCount);
+static void DeserializeDeltaBlock(TableReadState *readState, uint32 blockIndex,
+								  uint32 blockRowCount);
+static void LoadCachedStripeMetadata(TableReadState *readState, uint32 stripeIndex);
+static void EvictStripeMetadata(TableReadState *readState);
+static void SetReadOrderedBlock(TableReadState *readState, OrderedBlock *orderedBlock);
+static bool ReadOrderedBlockRow(TableReadState *readState, Datum *columnValues,
+								bool *columnNulls);
+static void ReadCurrentRow(TableReadState *readState, Datum *columnValues,
+						   bool *columnNulls);
+static uint32 DeserializeStripeBlock(TableReadState *readState, uint32 blockIndex);
+static uint32 StripeRowOffset(TableReadState *readState);
+static bool RowDeleted(uint8 *deletedRowBitmap, uint32 deletedRowBitmapLength,
+					   uint64 rowOffset);
+static bool BlockHasDeletedRows(TableReadState *readState, uint32 blockIndex);
+static uint32 RemoveDeletedBlockRows(TableReadState *readState, uint32 blockIndex,
+									 uint32 blockRowCount);
+static uint32 ReadNextSummaryBlock(TableReadState *readState,
+								   ColumnBlockSkipNode ***blockSkipNodeArray);
+static int CompareOrderedBlocks(const void *leftElement, const void *rightElement,
+								void *context);
+static StripeBuffers * LoadSelectedStripeBuffers(FILE *tableFile,
 												 StripeMetadata *stripeMetadata,
+												 StripeFooter *stripeFooter,
+												 StripeSkipList *stripeSkipList,
 												 TupleDesc tupleDescriptor,
 												 List *projectedColumnList,
-												 List *whereClauseList);
+												 bool *selectedBlockMask);
 static void ReadStripeNextRow(StripeBuffers *stripeBuffers, List *projectedColumnList,
 							  uint64 blockIndex, uint64 blockRowIndex,
 							  ColumnBlockData **blockDataArray,
@@ -62,9 +118,53 @@ static StripeSkipList * LoadStripeSkipList(FILE *tableFile,
 										   StripeFooter *stripeFooter,
 										   uint32 columnCount,
 										   bool *projectedColumnMask,
-										   TupleDesc tupleDescriptor);
+										   TupleDesc tupleDescriptor,
+										   bool verifyChecksums);
+static StringInfo SkipListBuffer(StringInfo skipListRegionBuffer, uint64 offset,
+								 uint64 length, bool copy);
+static void FreeSkipListBuffer(StringInfo skipListRegionBuffer,
+							   StringInfo skipListBuffer);
+static void CheckBufferChecksum(StringInfo buffer, uint32 expectedChecksum,
+								const char *streamName, Form_pg_attribute attributeForm);
 static bool * SelectedBlockMask(StripeSkipList *stripeSkipList,
 								List *projectedColumnList, List *whereClauseList);
+static bool SortKeyBounds(List *whereClauseList, Var *column,
+						  FmgrInfo *comparisonFunction, bytea **lowerSortKey,
+						  bytea **upperSortKey);
+static bool SortKeysRefuted(ColumnBlockSkipNode *blockSkipNode, bytea *lowerSortKey,
+							bytea *upperSortKey);
+static int CompareSortKeys(bytea *leftSortKey, bytea *rightSortKey);
+static bool StripeIndexBlockList(TableReadState *readState,
+								 StripeMetadata *stripeMetadata,
+								 List **indexedBlockList);
+static bool IndexKeyHash(TableReadState *readState, uint32 columnIndex,
+						 uint32 *keyHash);
+static bool FindIndexKeyHash(List *whereClauseList, Form_pg_attribute attributeForm,
+							 uint32 *keyHash);
+static StripeIndexEntry ReadStripeIndexEntry(FILE *tableFile, uint64 indexOffset,
+											 uint64 entryIndex);
+static void RemoveUnindexedBlocks(bool *selectedBlockMask, uint32 blockCount,
+								  List *indexedBlockList);
+static StripeMetadata ** StripeMetadataArray(List *stripeMetadataList);
+static void SelectReadStripes(TableReadState *readState);
+static bool StripeSelected(TableReadState *readState, uint32 stripeIndex);
+static void BuildStripeRangeTree(TableReadState *readState);
+static Datum SetSubtreeMaximumValues(StripeRangeNode *rangeNodeArray,
+									 int32 firstNodeIndex, int32 lastNodeIndex,
+									 StripeRangeQuery *rangeQuery);
+static void FindRangeBounds(List *whereClauseList, AttrNumber attributeNumber,
+							Oid columnTypeId, StripeRangeQuery *rangeQuery);
+static void QueryStripeRangeTree(StripeRangeNode *rangeNodeArray,
+								 int32 firstNodeIndex, int32 lastNodeIndex,
+								 StripeRangeQuery *rangeQuery);
+static void AppendSelectedStripe(StripeRangeQuery *rangeQuery, uint32 stripeIndex);
+static int CompareRangeValues(StripeRangeQuery *rangeQuery, Datum leftValue,
+							  Datum rightValue);
+static int CompareStripeRangeNodes(const void *leftElement, const void *rightElement,
+								   void *context);
+static int CompareStripeIndexes(const void *leftElement, const void *rightElement);
+static bool * SummaryBlockMask(TableReadState *readState, StripeSkipList *stripeSkipList,
+							   bool *selectedBlockMask);
 static List * BuildRestrictInfoList(List *whereClauseList);
 static Node * BuildBaseConstraint(Var *variable);
 static OpExpr * MakeOpExpression(Var *variable, int16 strategyNumber);
@@ -91,39 +191,80 @@ static StringInfo ReadFromFile(FILE *file, uint64 offset, uint32 size);
 static void ResetUncompressedBlockData(ColumnBlockData **blockDataArray,
 									   uint32 columnCount);
 static uint64 StripeRowCount(FILE *tableFile, StripeMetadata *stripeMetadata);
+static uint64 VerifyBlockData(StringInfo existsBuffer, StringInfo valueBuffer,
+							  ColumnBlockSkipNode *blockSkipNode,
+							  Form_pg_attribute attributeForm);
+static void BlockVerifyErrorCallback(void *arg);
+static TableFooter * ReadSegmentFooters(const char *filename, uint32 segmentCount,
+										FILE **tableFileArray,
+										StringInfo firstFooterFilename);
+static TableReadState * BeginRead(const char *filename, StringInfo firstFooterFilename,
+								  TupleDesc tupleDescriptor, List *projectedColumnList,
+								  List *whereClauseList);
 
 
 /*
  * CStoreBeginRead initializes a cstore read operation. This function returns a
  * read handle that's used during reading rows and finishing the read operation.
+ * The read covers the stripes of all the table's segment files, in the order of
+ * segments.
  */
 TableReadState *
 CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
 				List *projectedColumnList, List *whereClauseList)
+{
+	return BeginRead(filename, NULL, tupleDescriptor, projectedColumnList,
+					 whereClauseList);
+}
+
+
+/*
+ * CStoreBeginPendingRead initializes a read operation like CStoreBeginRead, but
+ * the read covers the stripes of the table's pending footer instead of its
+ * footer. Tables of the cstore access method have a single segment, and their
+ * writers keep the stripes that they haven't committed yet in this footer.
+ */
+TableReadState *
+CStoreBeginPendingRead(const char *filename, TupleDesc tupleDescriptor,
+					   List *projectedColumnList)
+{
+	TableReadState *readState = NULL;
+	StringInfo pendingFooterFilename = makeStringInfo();
+	appendStringInfo(pendingFooterFilename, "%s%s", filename,
+					 CSTORE_PENDING_FOOTER_FILE_SUFFIX);
+
+	readState = BeginRead(filename, pendingFooterFilename, tupleDescriptor,
+						  projectedColumnList, NIL);
+
+	pfree(pendingFooterFilename->data);
+	pfree(pendingFooterFilename);
+
+	return readState;
+}
+
+
+/*
+ * BeginRead initializes a read operation of the given table. If the first
+ * footer filename isn't NULL, we read the first segment's footer from that file.
+ */
+static TableReadState *
+BeginRead(const char *filename, StringInfo firstFooterFilename,
+		  TupleDesc tupleDescriptor, List *projectedColumnList,
+		  List *whereClauseList)
 {
 	TableReadState *readState = NULL;
 	TableFooter *tableFooter = NULL;
-	FILE *tableFile = NULL;
+	FILE **tableFileArray = NULL;
 	MemoryContext stripeReadContext = NULL;
+	MemoryContext stripeMetadataContext = NULL;
+	MemoryContext whereClauseContext = NULL;
+	uint32 stripeCount = 0;
 	uint32 columnCount = 0;
+	uint32 segmentCount = 0;
 	bool *projectedColumnMask = NULL;
 	ColumnBlockData **blockDataArray  = NULL;
-
-	StringInfo tableFooterFilename = makeStringInfo();
-	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
-
-	tableFooter = CStoreReadFooter(tableFooterFilename);
-
-	pfree(tableFooterFilename->data);
-	pfree(tableFooterFilename);
-
-	tableFile = AllocateFile(filename, PG_BINARY_R);
-	if (tableFile == NULL)
-	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not open file \"%s\" for reading: %m",
-							   filename)));
-	}
+	TableDelta *tableDelta = NULL;
+	MemoryContext oldContext = NULL;
 
 	/*
 	 * We allocate all stripe specific data in the stripeReadContext, and reset
@@ -134,23 +275,152 @@ CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
 											  "Stripe Read Memory Context",
 											  ALLOCSET_DEFAULT_SIZES);
 
+	/*
+	 * Stripe footers and skip lists live in child contexts of the stripe
+	 * metadata context, which we free when the read no longer needs them.
+	 * Qualifiers given on rescans live until the next rescan.
+	 */
+	stripeMetadataContext = AllocSetContextCreate(CurrentMemoryContext,
+												  "Stripe Metadata Memory Context",
+												  ALLOCSET_DEFAULT_SIZES);
+	whereClauseContext = AllocSetContextCreate(CurrentMemoryContext,
+											   "Where Clause Memory Context",
+											   ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * We read the delta store before the footers. If a merge of the delta store
+	 * finishes in between, the footers then show that its rows are in stripes.
+	 */
+	oldContext = MemoryContextSwitchTo(stripeMetadataContext);
+	tableDelta = CStoreReadDelta(filename, true);
+	MemoryContextSwitchTo(oldContext);
+
+	segmentCount = CStoreReadSegmentCount(filename);
+	tableFileArray = palloc0(segmentCount * sizeof(FILE *));
+	tableFooter = ReadSegmentFooters(filename, segmentCount, tableFileArray,
+									 firstFooterFilename);
+
+	stripeCount = list_length(tableFooter->stripeMetadataList);
+
 	columnCount = tupleDescriptor->natts;
 	projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
 	blockDataArray = CreateEmptyBlockDataArray(columnCount, projectedColumnMask,
 										 	   tableFooter->blockRowCount);
 
 	readState = palloc0(sizeof(TableReadState));
-	readState->tableFile = tableFile;
+	readState->tableFileArray = tableFileArray;
+	readState->segmentCount = segmentCount;
 	readState->tableFooter = tableFooter;
+	readState->stripeMetadataArray = StripeMetadataArray(tableFooter->stripeMetadataList);
+	readState->stripeCount = stripeCount;
 	readState->projectedColumnList = projectedColumnList;
 	readState->whereClauseList = whereClauseList;
+	readState->whereClauseContext = whereClauseContext;
+	readState->stripeMetadataContext = stripeMetadataContext;
+	readState->stripeFooterArray = MemoryContextAllocZero(stripeMetadataContext,
+														  stripeCount *
+														  sizeof(StripeFooter *));
+	readState->stripeSkipListArray = MemoryContextAllocZero(stripeMetadataContext,
+															stripeCount *
+															sizeof(StripeSkipList *));
+	readState->stripeCacheContextArray = MemoryContextAllocZero(stripeMetadataContext,
+																stripeCount *
+																sizeof(MemoryContext));
+	readState->cachedStripeList = NIL;
+	readState->cacheAllStripes = false;
 	readState->stripeBuffers = NULL;
-	readState->readStripeCount = 0;
-	readState->stripeReadRowCount = 0;
+	readState->stripeIndex = -1;
+	readState->stripeRowIndex = -1;
+	readState->orderedBlockArray = NULL;
+	readState->orderedBlockCount = 0;
+	readState->orderedBlockIndex = -1;
 	readState->tupleDescriptor = tupleDescriptor;
 	readState->stripeReadContext = stripeReadContext;
 	readState->blockDataArray = blockDataArray;
 	readState->deserializedBlockIndex = -1;
+	readState->deletedRowBitmap = NULL;
+	readState->deletedRowBitmapLength = 0;
+	readState->deltaRowArray = NULL;
+	readState->deltaRowCount = 0;
+	readState->parallelStripeIndex = NULL;
+	readState->stripeFirstRowArray = NULL;
+	readState->indexKeyColumnIndex = -1;
+	readState->indexKeyFound = false;
+	readState->indexKeyHash = 0;
+	readState->rangeTreeBuilt = false;
+	readState->rangeColumnIndex = -1;
+	readState->rangeComparisonFunction = NULL;
+	readState->rangeNodeArray = NULL;
+	readState->rangeNodeCount = 0;
+	readState->unrangedStripeArray = NULL;
+	readState->unrangedStripeCount = 0;
+	readState->selectedStripeArray = NULL;
+	readState->selectedStripeCount = 0;
+	readState->loadedStripeIndex = -1;
+	readState->loadedStripeBuffers = NULL;
+	readState->summaryRead = false;
+	readState->summaryGroupColumnIndex = -1;
+	readState->summaryBlockMask = NULL;
+	readState->summaryBlockIndex = -1;
+	readState->summarySkipNodeArray = NULL;
+
+	if (tableDelta->generation > tableFooter->mergedDeltaGeneration)
+	{
+		readState->deltaRowArray = tableDelta->rowArray;
+		readState->deltaRowCount = tableDelta->rowCount;
+	}
+
+	SelectReadStripes(readState);
+
+	return readState;
+}
+
+
+/*
+ * CStoreBeginStripeRead initializes a read operation like CStoreBeginRead, but
+ * the read only covers the given stripes of the given segment, and has no
+ * qualifiers or delta store rows. The stripes come from the segment's footer,
+ * so we find them among the table's stripes by their file offsets.
+ */
+TableReadState *
+CStoreBeginStripeRead(const char *filename, uint32 segmentIndex,
+					  List *stripeMetadataList, TupleDesc tupleDescriptor,
+					  List *projectedColumnList)
+{
+	TableReadState *readState = CStoreBeginRead(filename, tupleDescriptor,
+												projectedColumnList, NIL);
+	List *readStripeList = NIL;
+	ListCell *tableStripeCell = NULL;
+
+	foreach(tableStripeCell, readState->tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *tableStripe = (StripeMetadata *) lfirst(tableStripeCell);
+		ListCell *stripeMetadataCell = NULL;
+
+		if (tableStripe->segmentIndex != segmentIndex)
+		{
+			continue;
+		}
+
+		foreach(stripeMetadataCell, stripeMetadataList)
+		{
+			StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+
+			if (stripeMetadata->fileOffset == tableStripe->fileOffset)
+			{
+				readStripeList = lappend(readStripeList, tableStripe);
+				break;
+			}
+		}
+	}
+
+	pfree(readState->stripeMetadataArray);
+
+	readState->tableFooter->stripeMetadataList = readStripeList;
+	readState->stripeMetadataArray = StripeMetadataArray(readStripeList);
+	readState->stripeCount = list_length(readStripeList);
+	readState->deltaRowArray = NULL;
+	readState->deltaRowCount = 0;
 
 	return readState;
 }
@@ -234,576 +504,3794 @@ CStoreReadFooter(StringInfo tableFooterFilename)
 bool
 CStoreReadNextRow(TableReadState *readState, Datum *columnValues, bool *columnNulls)
 {
-	uint32 blockIndex = 0;
-	uint32 blockRowIndex = 0;
-	TableFooter *tableFooter = readState->tableFooter;
-	MemoryContext oldContext = NULL;
+	return CStoreReadRow(readState, ForwardScanDirection, columnValues, columnNulls);
+}
+
+
+/*
+ * CStoreReadRow tries to read the row that comes after the current position in
+ * the given scan direction. On success, it sets column values and nulls, and
+ * returns true. If there are no more rows to read in this direction, the
+ * function returns false, and leaves the position before the first or after
+ * the last row. As with heap scans, reading in the other direction from there
+ * returns rows again.
+ */
+bool
+CStoreReadRow(TableReadState *readState, ScanDirection direction,
+			  Datum *columnValues, bool *columnNulls)
+{
+	int32 stripeCount = ReadStripeCount(readState);
+	bool backward = ScanDirectionIsBackward(direction);
+
+	/* ordered reads return rows of the current ordered block only */
+	if (readState->orderedBlockArray != NULL)
+	{
+		return ReadOrderedBlockRow(readState, columnValues, columnNulls);
+	}
 
 	/*
-	 * If no stripes are loaded, load the next non-empty stripe. Note that when
+	 * Move to the next row in the scan direction, loading stripes in that
+	 * direction when we reach the end of the current stripe. Note that when
 	 * loading stripes, we skip over blocks whose contents can be filtered with
 	 * the query's restriction qualifiers. So, even when a stripe is physically
-	 * not empty, we may end up loading it as an empty stripe.
+	 * not empty, we may end up loading it as an empty stripe. We also skip rows
+	 * that are marked in the stripe's deletion bitmap.
 	 */
-	while (readState->stripeBuffers == NULL)
+	for (;;)
 	{
-		StripeBuffers *stripeBuffers = NULL;
-		StripeMetadata *stripeMetadata = NULL;
-		List *stripeMetadataList = tableFooter->stripeMetadataList;
-		uint32 stripeCount = list_length(stripeMetadataList);
+		StripeBuffers *stripeBuffers = readState->stripeBuffers;
+		int32 nextStripeIndex = 0;
 
-		/* if we have read all stripes, return false */
-		if (readState->readStripeCount == stripeCount)
+		if (stripeBuffers != NULL)
 		{
-			return false;
+			bool rowFound = false;
+
+			if (!backward && readState->stripeRowIndex + 1 < (int64) stripeBuffers->rowCount)
+			{
+				readState->stripeRowIndex++;
+				rowFound = true;
+			}
+			else if (backward && readState->stripeRowIndex > 0)
+			{
+				readState->stripeRowIndex--;
+				rowFound = true;
+			}
+
+			if (rowFound && readState->deletedRowBitmap != NULL &&
+				RowDeleted(readState->deletedRowBitmap,
+						   readState->deletedRowBitmapLength,
+						   StripeRowOffset(readState)))
+			{
+				continue;
+			}
+			else if (rowFound)
+			{
+				break;
+			}
 		}
 
-		oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
-		MemoryContextReset(readState->stripeReadContext);
+		nextStripeIndex = NextReadStripeIndex(readState, backward);
 
-		stripeMetadata = list_nth(stripeMetadataList, readState->readStripeCount);
-		stripeBuffers = LoadFilteredStripeBuffers(readState->tableFile, stripeMetadata,
-												  readState->tupleDescriptor,
-												  readState->projectedColumnList,
-												  readState->whereClauseList);
-		readState->readStripeCount++;
+		/* if we have read all stripes in this direction, return false */
+		if (nextStripeIndex < 0 || nextStripeIndex >= stripeCount)
+		{
+			readState->stripeIndex = backward ? -1 : stripeCount;
+			readState->stripeBuffers = NULL;
+			readState->stripeRowIndex = -1;
+			return false;
+		}
 
-		MemoryContextSwitchTo(oldContext);
+		SetReadStripe(readState, nextStripeIndex);
 
-		if (stripeBuffers->rowCount != 0)
+		/* position before the first or after the last row of the stripe */
+		if (backward)
 		{
-			readState->stripeBuffers = stripeBuffers;
-			readState->stripeReadRowCount = 0;
-			readState->deserializedBlockIndex = -1;
-			ResetUncompressedBlockData(readState->blockDataArray,
-									   stripeBuffers->columnCount);
-			break;
+			readState->stripeRowIndex = readState->stripeBuffers->rowCount;
 		}
 	}
 
-	blockIndex = readState->stripeReadRowCount / tableFooter->blockRowCount;
-	blockRowIndex = readState->stripeReadRowCount % tableFooter->blockRowCount;
+	ReadCurrentRow(readState, columnValues, columnNulls);
+
+	return true;
+}
+
+
+/*
+ * ReadCurrentRow reads the row at the current position of the read operation
+ * into the given column values and nulls. The function deserializes the row's
+ * block if it isn't deserialized yet.
+ */
+static void
+ReadCurrentRow(TableReadState *readState, Datum *columnValues, bool *columnNulls)
+{
+	uint32 blockIndex = 0;
+	uint32 blockRowIndex = 0;
+	TableFooter *tableFooter = readState->tableFooter;
+
+	blockIndex = readState->stripeRowIndex / tableFooter->blockRowCount;
+	blockRowIndex = readState->stripeRowIndex % tableFooter->blockRowCount;
+
+	DeserializeStripeBlock(readState, blockIndex);
+
+	ReadStripeNextRow(readState->stripeBuffers, readState->projectedColumnList,
+					  blockIndex, blockRowIndex, readState->blockDataArray,
+					  columnValues, columnNulls);
+}
+
+
+/*
+ * DeserializeStripeBlock deserializes the given block of the current stripe
+ * into the read operation's block data array, unless the block is already
+ * deserialized. The function returns the number of rows in the block.
+ */
+static uint32
+DeserializeStripeBlock(TableReadState *readState, uint32 blockIndex)
+{
+	TableFooter *tableFooter = readState->tableFooter;
+	uint32 stripeRowCount = readState->stripeBuffers->rowCount;
+	uint32 lastBlockIndex = stripeRowCount / tableFooter->blockRowCount;
+	uint32 blockRowCount = 0;
+
+	if (blockIndex == lastBlockIndex)
+	{
+		blockRowCount = stripeRowCount % tableFooter->blockRowCount;
+	}
+	else
+	{
+		blockRowCount = tableFooter->blockRowCount;
+	}
 
 	if (blockIndex != readState->deserializedBlockIndex)
 	{
-		uint32 lastBlockIndex = 0;
-		uint32 blockRowCount = 0;
-		uint32 stripeRowCount = 0;
+		MemoryContext oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
 
-		stripeRowCount = readState->stripeBuffers->rowCount;
-		lastBlockIndex = stripeRowCount / tableFooter->blockRowCount;
-		if (blockIndex == lastBlockIndex)
+		if (DeltaStripe(readState, readState->stripeIndex))
 		{
-			blockRowCount = stripeRowCount % tableFooter->blockRowCount;
+			DeserializeDeltaBlock(readState, blockIndex, blockRowCount);
 		}
 		else
 		{
-			blockRowCount = tableFooter->blockRowCount;
+			DeserializeBlockData(readState->stripeBuffers, blockIndex,
+								 blockRowCount, readState->blockDataArray,
+								 readState->tupleDescriptor);
 		}
 
-		oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
-
-		DeserializeBlockData(readState->stripeBuffers, blockIndex,
-							 blockRowCount, readState->blockDataArray,
-							 readState->tupleDescriptor);
-
 		MemoryContextSwitchTo(oldContext);
 
 		readState->deserializedBlockIndex = blockIndex;
 	}
 
-	ReadStripeNextRow(readState->stripeBuffers, readState->projectedColumnList,
-					  blockIndex, blockRowIndex, readState->blockDataArray,
-					  columnValues, columnNulls);
-
-	/*
-	 * If we finished reading the current stripe, set stripe data to NULL. That
-	 * way, we will load a new stripe the next time this function gets called.
-	 */
-	readState->stripeReadRowCount++;
-	if (readState->stripeReadRowCount == readState->stripeBuffers->rowCount)
-	{
-		readState->stripeBuffers = NULL;
-	}
-
-	return true;
+	return blockRowCount;
 }
 
 
-/* Finishes a cstore read operation. */
-void
-CStoreEndRead(TableReadState *readState)
+/*
+ * StripeRowOffset returns the offset of the row at the current position of the
+ * read operation in its stripe. Stripe buffers only have the stripe's selected
+ * blocks, so we first map the row's block to the block's index in the stripe.
+ */
+static uint32
+StripeRowOffset(TableReadState *readState)
 {
-	int columnCount = readState->tupleDescriptor->natts;
+	uint64 blockRowCount = readState->tableFooter->blockRowCount;
+	uint32 blockIndex = readState->stripeRowIndex / blockRowCount;
+	uint32 blockRowIndex = readState->stripeRowIndex % blockRowCount;
+	uint32 stripeBlockIndex = readState->stripeBuffers->blockIndexArray[blockIndex];
 
-	MemoryContextDelete(readState->stripeReadContext);
-	FreeFile(readState->tableFile);
-	list_free_deep(readState->tableFooter->stripeMetadataList);
-	FreeColumnBlockDataArray(readState->blockDataArray, columnCount);
-	pfree(readState->tableFooter);
-	pfree(readState);
+	return (stripeBlockIndex * blockRowCount) + blockRowIndex;
 }
 
 
 /*
- * CreateEmptyBlockDataArray creates data buffers to keep deserialized exist and
- * value arrays for requested columns in columnMask.
+ * RowDeleted checks if the given deletion bitmap marks the row at the given
+ * offset as deleted. Bitmaps end at their last deleted row.
  */
-ColumnBlockData **
-CreateEmptyBlockDataArray(uint32 columnCount, bool *columnMask, uint32 blockRowCount)
+static bool
+RowDeleted(uint8 *deletedRowBitmap, uint32 deletedRowBitmapLength, uint64 rowOffset)
 {
-	uint32 columnIndex = 0;
-	ColumnBlockData **blockDataArray = palloc0(columnCount * sizeof(ColumnBlockData*));
+	uint64 byteIndex = rowOffset / 8;
 
-	/* allocate block memory for deserialized data */
-	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	if (byteIndex >= deletedRowBitmapLength)
 	{
-		if (columnMask[columnIndex])
-		{
-			ColumnBlockData *blockData = palloc0(sizeof(ColumnBlockData));
-
-			blockData->existsArray = palloc0(blockRowCount * sizeof(bool));
-			blockData->valueArray = palloc0(blockRowCount * sizeof(Datum));
-			blockData->valueBuffer = NULL;
-			blockDataArray[columnIndex] = blockData;
-		}
+		return false;
 	}
 
-	return blockDataArray;
+	return (deletedRowBitmap[byteIndex] & (1 << (rowOffset % 8))) != 0;
 }
 
 
 /*
- * FreeColumnBlockDataArray deallocates data buffers to keep deserialized exist and
- * value arrays for requested columns in columnMask.
- * ColumnBlockData->serializedValueBuffer lives in memory read/write context
- * so it is deallocated automatically when the context is deleted.
+ * BlockHasDeletedRows checks if the current stripe's deletion bitmap marks any
+ * row of the given block of the stripe as deleted.
  */
-void
-FreeColumnBlockDataArray(ColumnBlockData **blockDataArray, uint32 columnCount)
+static bool
+BlockHasDeletedRows(TableReadState *readState, uint32 blockIndex)
 {
-	uint32 columnIndex = 0;
-	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	uint64 blockRowCount = readState->tableFooter->blockRowCount;
+	uint64 firstRowOffset = blockIndex * blockRowCount;
+	uint64 rowOffset = 0;
+
+	if (readState->deletedRowBitmap == NULL)
 	{
-		ColumnBlockData *blockData = blockDataArray[columnIndex];
-		if (blockData != NULL)
+		return false;
+	}
+
+	for (rowOffset = firstRowOffset; rowOffset < firstRowOffset + blockRowCount;
+		 rowOffset++)
+	{
+		if (RowDeleted(readState->deletedRowBitmap, readState->deletedRowBitmapLength,
+					   rowOffset))
 		{
-			pfree(blockData->existsArray);
-			pfree(blockData->valueArray);
-			pfree(blockData);
+			return true;
 		}
 	}
 
-	pfree(blockDataArray);
+	return false;
 }
 
 
-/* CStoreTableRowCount returns the exact row count of a table using skiplists */
-uint64
-CStoreTableRowCount(const char *filename)
+/*
+ * RemoveDeletedBlockRows removes the rows that the current stripe's deletion
+ * bitmap marks as deleted from the given deserialized block, by moving the
+ * values of the remaining rows to the front of the projected columns' arrays.
+ * The function returns the number of remaining rows.
+ */
+static uint32
+RemoveDeletedBlockRows(TableReadState *readState, uint32 blockIndex,
+					   uint32 blockRowCount)
 {
-	TableFooter *tableFooter = NULL;
-	FILE *tableFile;
-	ListCell *stripeMetadataCell = NULL;
-	uint64 totalRowCount = 0;
-
-	StringInfo tableFooterFilename = makeStringInfo();
+	uint32 columnCount = readState->tupleDescriptor->natts;
+	uint64 stripeBlockIndex = readState->stripeBuffers->blockIndexArray[blockIndex];
+	uint64 firstRowOffset = stripeBlockIndex * readState->tableFooter->blockRowCount;
+	uint32 remainingRowCount = 0;
+	uint32 rowIndex = 0;
 
-	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+	for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
+	{
+		uint32 columnIndex = 0;
 
-	tableFooter = CStoreReadFooter(tableFooterFilename);
+		if (RowDeleted(readState->deletedRowBitmap, readState->deletedRowBitmapLength,
+					   firstRowOffset + rowIndex))
+		{
+			continue;
+		}
 
-	pfree(tableFooterFilename->data);
-	pfree(tableFooterFilename);
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			ColumnBlockData *blockData = readState->blockDataArray[columnIndex];
+			if (blockData != NULL)
+			{
+				blockData->existsArray[remainingRowCount] = blockData->existsArray[rowIndex];
+				blockData->valueArray[remainingRowCount] = blockData->valueArray[rowIndex];
+			}
+		}
 
-	tableFile = AllocateFile(filename, PG_BINARY_R);
-	if (tableFile == NULL)
-	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not open file \"%s\" for reading: %m", filename)));
+		remainingRowCount++;
 	}
 
-	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	/* the block data arrays don't hold the whole block anymore */
+	if (remainingRowCount < blockRowCount)
 	{
-		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
-		totalRowCount += StripeRowCount(tableFile, stripeMetadata);
+		readState->deserializedBlockIndex = -1;
 	}
 
-	FreeFile(tableFile);
-
-	return totalRowCount;
+	return remainingRowCount;
 }
 
 
 /*
- * StripeRowCount reads serialized stripe footer, the first column's
- * skip list, and returns number of rows for given stripe.
+ * CStoreReadNextBlock reads the next block of rows from the cstore file, and
+ * sets the given pointer to the deserialized column values of that block. Only
+ * projected columns have block data. The function returns the number of rows in
+ * the block, or zero if there are no more blocks to read. This lets callers run
+ * tight loops over column values instead of converting each row into a tuple.
+ * Callers shouldn't mix reading rows and blocks in the same read operation.
+ * Deleted rows are removed from the returned block data, and blocks whose rows
+ * were all deleted are skipped.
+ *
+ * In summary reads, the function returns blocks that are summarized by their
+ * skip nodes without reading their data. For these blocks, it sets the block
+ * data pointer to NULL, and the skip node pointer to an array that has the
+ * block's skip node for each projected column. Otherwise, the skip node pointer
+ * is set to NULL.
  */
-static uint64
-StripeRowCount(FILE *tableFile, StripeMetadata *stripeMetadata)
+uint32
+CStoreReadNextBlock(TableReadState *readState, ColumnBlockData ***blockDataArray,
+					ColumnBlockSkipNode ***blockSkipNodeArray)
 {
-	uint64 rowCount = 0;
-	StripeFooter *stripeFooter = NULL;
-	StringInfo footerBuffer = NULL;
-	StringInfo firstColumnSkipListBuffer = NULL;
-	uint64 footerOffset = 0;
-
-	footerOffset += stripeMetadata->fileOffset;
-	footerOffset += stripeMetadata->skipListLength;
-	footerOffset += stripeMetadata->dataLength;
+	TableFooter *tableFooter = readState->tableFooter;
+	int32 stripeCount = ReadStripeCount(readState);
+	uint32 blockIndex = 0;
+	uint32 blockRowCount = 0;
 
-	footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
-	stripeFooter = DeserializeStripeFooter(footerBuffer);
+	Assert(readState->orderedBlockArray == NULL);
 
-	firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
-	                                         stripeFooter->skipListSizeArray[0]);
-	rowCount =  DeserializeRowCount(firstColumnSkipListBuffer);
+	(*blockDataArray) = NULL;
+	(*blockSkipNodeArray) = NULL;
 
-	return rowCount;
-}
+	while (blockRowCount == 0)
+	{
+		/* skip over stripes that have no more blocks after block filtering */
+		while (readState->stripeBuffers == NULL ||
+			   readState->stripeRowIndex + 1 >= (int64) readState->stripeBuffers->rowCount)
+		{
+			int32 nextStripeIndex = 0;
+
+			/* summarized blocks of a stripe come after its loaded blocks */
+			if (readState->stripeBuffers != NULL)
+			{
+				blockRowCount = ReadNextSummaryBlock(readState, blockSkipNodeArray);
+				if (blockRowCount > 0)
+				{
+					return blockRowCount;
+				}
+			}
+
+			nextStripeIndex = NextReadStripeIndex(readState, false);
+			if (nextStripeIndex >= stripeCount)
+			{
+				readState->stripeIndex = stripeCount;
+				readState->stripeBuffers = NULL;
+				readState->stripeRowIndex = -1;
+				return 0;
+			}
+
+			SetReadStripe(readState, nextStripeIndex);
+		}
+
+		/* position at the last row of the next block */
+		blockIndex = (readState->stripeRowIndex + 1) / tableFooter->blockRowCount;
+		blockRowCount = DeserializeStripeBlock(readState, blockIndex);
+
+		readState->stripeRowIndex = ((int64) blockIndex * tableFooter->blockRowCount) +
+									blockRowCount - 1;
+
+		if (readState->deletedRowBitmap != NULL)
+		{
+			blockRowCount = RemoveDeletedBlockRows(readState, blockIndex, blockRowCount);
+		}
+	}
+
+	(*blockDataArray) = readState->blockDataArray;
+
+	return blockRowCount;
+}
+
+
+/*
+ * ReadNextSummaryBlock moves to the current stripe's next summarized block, and
+ * sets the given pointer to the block's skip nodes. The function returns the
+ * number of rows in the block, or zero if the stripe has no more summarized
+ * blocks.
+ */
+static uint32
+ReadNextSummaryBlock(TableReadState *readState, ColumnBlockSkipNode ***blockSkipNodeArray)
+{
+	StripeSkipList *stripeSkipList = NULL;
+	bool *summaryBlockMask = readState->summaryBlockMask;
+	uint32 columnIndex = 0;
+	int32 blockIndex = 0;
+
+	if (summaryBlockMask == NULL)
+	{
+		return 0;
+	}
+
+	stripeSkipList = readState->stripeSkipListArray[readState->stripeIndex];
+
+	blockIndex = readState->summaryBlockIndex + 1;
+	while (blockIndex < (int32) stripeSkipList->blockCount &&
+		   !summaryBlockMask[blockIndex])
+	{
+		blockIndex++;
+	}
+
+	readState->summaryBlockIndex = blockIndex;
+	if (blockIndex >= (int32) stripeSkipList->blockCount)
+	{
+		return 0;
+	}
+
+	for (columnIndex = 0; columnIndex < stripeSkipList->columnCount; columnIndex++)
+	{
+		ColumnBlockSkipNode *columnSkipNodeArray =
+			stripeSkipList->blockSkipNodeArray[columnIndex];
+
+		readState->summarySkipNodeArray[columnIndex] = NULL;
+		if (columnSkipNodeArray != NULL)
+		{
+			readState->summarySkipNodeArray[columnIndex] =
+				&columnSkipNodeArray[blockIndex];
+		}
+	}
+
+	(*blockSkipNodeArray) = readState->summarySkipNodeArray;
+
+	/* the first column's skip list is always read */
+	return stripeSkipList->blockSkipNodeArray[0][blockIndex].rowCount;
+}
+
+
+/*
+ * CStoreRescanRead restarts the given read operation from the first stripe,
+ * using the given qualifier conditions for filtering blocks. The file and the
+ * table footer are kept, and from now on the read caches the skip lists of all
+ * stripes it reads, so changed qualifiers only require pruning blocks again. If
+ * the qualifiers didn't change, we also keep the last loaded stripe's buffers.
+ */
+void
+CStoreRescanRead(TableReadState *readState, List *whereClauseList)
+{
+	readState->cacheAllStripes = true;
+
+	if (!equal(whereClauseList, readState->whereClauseList))
+	{
+		MemoryContext oldContext = NULL;
+
+		MemoryContextReset(readState->whereClauseContext);
+
+		oldContext = MemoryContextSwitchTo(readState->whereClauseContext);
+		readState->whereClauseList = copyObject(whereClauseList);
+		MemoryContextSwitchTo(oldContext);
+
+		/* loaded stripe buffers were filtered with the previous qualifiers */
+		readState->loadedStripeIndex = -1;
+		readState->loadedStripeBuffers = NULL;
+		readState->indexKeyColumnIndex = -1;
+
+		SelectReadStripes(readState);
+	}
+
+	if (readState->orderedBlockArray != NULL)
+	{
+		pfree(readState->orderedBlockArray);
+		readState->orderedBlockArray = NULL;
+		readState->orderedBlockCount = 0;
+		readState->orderedBlockIndex = -1;
+	}
+
+	readState->stripeBuffers = NULL;
+	readState->stripeIndex = -1;
+	readState->stripeRowIndex = -1;
+	readState->deserializedBlockIndex = -1;
+}
+
+
+/*
+ * CStoreBeginSummaryRead switches the given read operation to summarizing blocks
+ * by their skip nodes where possible, for callers that aggregate blocks with
+ * CStoreReadNextBlock. A selected block is summarized when the read's qualifiers
+ * hold for all of its rows, and the skip nodes of all projected columns have
+ * value counts and, if the block has values, min/max values. If a grouping
+ * column is given, the column must also have a single value in the block. We
+ * then skip reading these blocks' data.
+ */
+void
+CStoreBeginSummaryRead(TableReadState *readState, Var *groupColumn)
+{
+	uint32 columnCount = readState->tupleDescriptor->natts;
+
+	Assert(groupColumn == NULL ||
+		   list_member(readState->projectedColumnList, groupColumn));
+
+	readState->summaryRead = true;
+	readState->summaryGroupColumnIndex = -1;
+	if (groupColumn != NULL)
+	{
+		readState->summaryGroupColumnIndex = groupColumn->varattno - 1;
+	}
+
+	readState->summarySkipNodeArray =
+		MemoryContextAllocZero(readState->stripeMetadataContext,
+							   columnCount * sizeof(ColumnBlockSkipNode *));
+
+	/* stripes loaded so far weren't summarized */
+	readState->loadedStripeIndex = -1;
+	readState->loadedStripeBuffers = NULL;
+	readState->summaryBlockMask = NULL;
+}
+
+
+/*
+ * CStoreBeginOrderedRead switches the given read operation to reading blocks in
+ * the order of their bounds for the given column. These bounds are the blocks'
+ * maximum values for descending, and minimum values for ascending orders. The
+ * function skips blocks that are refuted by the read's qualifiers. Blocks with
+ * no bounds, for example those of columns added after the stripe was written
+ * and blocks of delta store rows, come first. When nulls come first, so do
+ * blocks that may have nulls, which their value counts tell us. The caller then moves over blocks
+ * with CStoreNextOrderedBlock, and reads each block's rows with CStoreReadRow.
+ * This lets the caller stop reading once no remaining block can contain rows
+ * that come earlier in the order than the rows it already has.
+ */
+void
+CStoreBeginOrderedRead(TableReadState *readState, Var *orderColumn, bool descending,
+					   bool nullsFirst)
+{
+	uint32 stripeCount = readState->stripeCount;
+	uint32 stripeIndex = 0;
+	uint64 blockRowCount = readState->tableFooter->blockRowCount;
+	uint32 deltaBlockCount = (readState->deltaRowCount + blockRowCount - 1) / blockRowCount;
+	uint32 deltaBlockIndex = 0;
+	uint32 orderedBlockCount = 0;
+	uint32 maxOrderedBlockCount = 0;
+	OrderedBlock *orderedBlockArray = NULL;
+	OrderedBlockCompareContext compareContext;
+	uint32 columnIndex = orderColumn->varattno - 1;
+
+	/* the order column must be projected, so that its skip lists are read */
+	Assert(list_member(readState->projectedColumnList, orderColumn));
+
+	compareContext.comparisonFunction = GetFunctionInfoOrNull(orderColumn->vartype,
+															  BTREE_AM_OID,
+															  BTORDER_PROC);
+	compareContext.collation = orderColumn->varcollid;
+	compareContext.descending = descending;
+
+	/* block bounds point into the skip lists, which we then read blocks with */
+	readState->cacheAllStripes = true;
+
+	/* stripes usually have the same block count, so this is a good start */
+	maxOrderedBlockCount = Max(stripeCount, 1) * 8;
+	orderedBlockArray = MemoryContextAllocZero(readState->stripeMetadataContext,
+											   maxOrderedBlockCount *
+											   sizeof(OrderedBlock));
+
+	for (stripeIndex = 0; stripeIndex < stripeCount; stripeIndex++)
+	{
+		StripeMetadata *stripeMetadata = readState->stripeMetadataArray[stripeIndex];
+		StripeSkipList *stripeSkipList = NULL;
+		ColumnBlockSkipNode *blockSkipNodeArray = NULL;
+		bool *selectedBlockMask = NULL;
+		List *indexedBlockList = NIL;
+		bool stripeIndexed = false;
+		uint32 blockIndex = 0;
+
+		if (!StripeSelected(readState, stripeIndex))
+		{
+			continue;
+		}
+
+		stripeIndexed = StripeIndexBlockList(readState, stripeMetadata,
+											 &indexedBlockList);
+		if (stripeIndexed && indexedBlockList == NIL)
+		{
+			continue;
+		}
+
+		LoadCachedStripeMetadata(readState, stripeIndex);
+
+		stripeSkipList = readState->stripeSkipListArray[stripeIndex];
+		blockSkipNodeArray = stripeSkipList->blockSkipNodeArray[columnIndex];
+		selectedBlockMask = SelectedBlockMask(stripeSkipList,
+											  readState->projectedColumnList,
+											  readState->whereClauseList);
+		if (stripeIndexed)
+		{
+			RemoveUnindexedBlocks(selectedBlockMask, stripeSkipList->blockCount,
+								  indexedBlockList);
+			list_free(indexedBlockList);
+		}
+
+		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		{
+			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+			OrderedBlock *orderedBlock = NULL;
+			bool hasBound = (compareContext.comparisonFunction != NULL &&
+							 blockSkipNode->hasMinMax);
+
+			if (nullsFirst && (!blockSkipNode->hasValueCount ||
+							   blockSkipNode->valueCount < blockSkipNode->rowCount))
+			{
+				hasBound = false;
+			}
+
+			if (!selectedBlockMask[blockIndex])
+			{
+				continue;
+			}
+
+			if (orderedBlockCount == maxOrderedBlockCount)
+			{
+				maxOrderedBlockCount *= 2;
+				orderedBlockArray = repalloc(orderedBlockArray, maxOrderedBlockCount *
+											 sizeof(OrderedBlock));
+			}
+
+			orderedBlock = &orderedBlockArray[orderedBlockCount];
+			orderedBlock->stripeIndex = stripeIndex;
+			orderedBlock->blockIndex = blockIndex;
+			orderedBlock->hasBound = hasBound;
+			orderedBlock->boundValue = descending ? blockSkipNode->maximumValue :
+									   blockSkipNode->minimumValue;
+			orderedBlockCount++;
+		}
+
+		pfree(selectedBlockMask);
+	}
+
+	/* blocks of delta store rows have no bounds */
+	for (deltaBlockIndex = 0; deltaBlockIndex < deltaBlockCount; deltaBlockIndex++)
+	{
+		OrderedBlock *orderedBlock = NULL;
+
+		if (orderedBlockCount == maxOrderedBlockCount)
+		{
+			maxOrderedBlockCount *= 2;
+			orderedBlockArray = repalloc(orderedBlockArray, maxOrderedBlockCount *
+										 sizeof(OrderedBlock));
+		}
+
+		orderedBlock = &orderedBlockArray[orderedBlockCount];
+		orderedBlock->stripeIndex = stripeCount;
+		orderedBlock->blockIndex = deltaBlockIndex;
+		orderedBlock->hasBound = false;
+		orderedBlock->boundValue = 0;
+		orderedBlockCount++;
+	}
+
+	qsort_arg(orderedBlockArray, orderedBlockCount, sizeof(OrderedBlock),
+			  CompareOrderedBlocks, &compareContext);
+
+	readState->orderedBlockArray = orderedBlockArray;
+	readState->orderedBlockCount = orderedBlockCount;
+	readState->orderedBlockIndex = -1;
+	readState->stripeBuffers = NULL;
+}
+
+
+/*
+ * CStoreNextOrderedBlock moves an ordered read to its next block, and returns
+ * the block's bound. The block's data is only read when the caller reads its
+ * first row. If there are no more blocks, the function returns false.
+ */
+bool
+CStoreNextOrderedBlock(TableReadState *readState, bool *hasBound, Datum *boundValue)
+{
+	OrderedBlock *orderedBlock = NULL;
+
+	Assert(readState->orderedBlockArray != NULL);
+
+	readState->stripeBuffers = NULL;
+	if (readState->orderedBlockIndex + 1 >= (int32) readState->orderedBlockCount)
+	{
+		readState->orderedBlockIndex = readState->orderedBlockCount;
+		return false;
+	}
+
+	readState->orderedBlockIndex++;
+
+	orderedBlock = &readState->orderedBlockArray[readState->orderedBlockIndex];
+	(*hasBound) = orderedBlock->hasBound;
+	(*boundValue) = orderedBlock->boundValue;
+
+	return true;
+}
+
+
+/*
+ * CStoreReadRowPosition sets the given pointers to the position of the row that
+ * the read operation returned last: the index of the row's stripe among the
+ * table's stripes, and the row's offset in that stripe. DELETE identifies rows
+ * by these positions.
+ */
+void
+CStoreReadRowPosition(TableReadState *readState, uint32 *stripeIndex,
+					  uint32 *rowOffset)
+{
+	Assert(readState->stripeBuffers != NULL && readState->stripeRowIndex >= 0);
+	Assert(!DeltaStripe(readState, readState->stripeIndex));
+
+	(*stripeIndex) = readState->stripeIndex;
+	(*rowOffset) = StripeRowOffset(readState);
+}
+
+
+/*
+ * CStoreBeginParallelRead makes the given read one of the reads of a parallel
+ * scan. Instead of reading all stripes, the read then claims stripes from the
+ * given counter, which all reads of the scan share, until no stripes are left.
+ * Parallel reads only move forward.
+ */
+void
+CStoreBeginParallelRead(TableReadState *readState, pg_atomic_uint32 *nextStripeIndex)
+{
+	readState->parallelStripeIndex = nextStripeIndex;
+}
+
+
+/*
+ * CStoreReadRowNumber returns the number of the row that the read operation
+ * returned last. Rows are numbered from zero in the order of the table's
+ * stripes, and deleted rows keep their numbers. Since loads only append
+ * stripes to the end of a segment, rows of single segment tables keep their
+ * numbers as the table grows.
+ */
+uint64
+CStoreReadRowNumber(TableReadState *readState)
+{
+	Assert(readState->stripeBuffers != NULL && readState->stripeRowIndex >= 0);
+
+	LoadStripeFirstRowArray(readState);
+
+	return readState->stripeFirstRowArray[readState->stripeIndex] +
+		   StripeRowOffset(readState);
+}
+
+
+/*
+ * CStoreReadRowByNumber reads the row with the given number, as returned by
+ * CStoreReadRowNumber, into the given column values and nulls. If the row's
+ * block isn't the current one, the function only loads that block. The
+ * function returns false if there is no such row, or if the row was deleted.
+ * Reads by row number jump between stripes, so they cache all stripes' skip
+ * lists.
+ */
+bool
+CStoreReadRowByNumber(TableReadState *readState, uint64 rowNumber,
+					  Datum *columnValues, bool *columnNulls)
+{
+	uint64 blockRowCount = readState->tableFooter->blockRowCount;
+	int32 stripeIndex = 0;
+	uint64 rowOffset = 0;
+	int32 loadedBlockIndex = 0;
+
+	Assert(readState->orderedBlockArray == NULL);
+
+	readState->cacheAllStripes = true;
+	LoadStripeFirstRowArray(readState);
+
+	stripeIndex = RowNumberStripeIndex(readState, rowNumber);
+	if (stripeIndex < 0)
+	{
+		return false;
+	}
+
+	rowOffset = rowNumber - readState->stripeFirstRowArray[stripeIndex];
+
+	loadedBlockIndex = LoadedBlockIndex(readState, stripeIndex,
+										rowOffset / blockRowCount);
+	if (loadedBlockIndex < 0)
+	{
+		OrderedBlock rowBlock;
+
+		memset(&rowBlock, 0, sizeof(OrderedBlock));
+		rowBlock.stripeIndex = stripeIndex;
+		rowBlock.blockIndex = rowOffset / blockRowCount;
+
+		SetReadOrderedBlock(readState, &rowBlock);
+		loadedBlockIndex = 0;
+	}
+
+	readState->stripeRowIndex = (loadedBlockIndex * blockRowCount) +
+								(rowOffset % blockRowCount);
+
+	if (readState->deletedRowBitmap != NULL &&
+		RowDeleted(readState->deletedRowBitmap, readState->deletedRowBitmapLength,
+				   rowOffset))
+	{
+		return false;
+	}
+
+	ReadCurrentRow(readState, columnValues, columnNulls);
+
+	return true;
+}
+
+
+/*
+ * ReadOrderedBlockRow reads the next row of the current block in an ordered
+ * read, and loads the block first if needed. If the block has no more rows, the
+ * function returns false.
+ */
+static bool
+ReadOrderedBlockRow(TableReadState *readState, Datum *columnValues, bool *columnNulls)
+{
+	int32 orderedBlockIndex = readState->orderedBlockIndex;
+
+	if (orderedBlockIndex < 0 || orderedBlockIndex >= (int32) readState->orderedBlockCount)
+	{
+		return false;
+	}
+
+	if (readState->stripeBuffers == NULL)
+	{
+		SetReadOrderedBlock(readState, &readState->orderedBlockArray[orderedBlockIndex]);
+	}
+
+	do
+	{
+		if (readState->stripeRowIndex + 1 >= (int64) readState->stripeBuffers->rowCount)
+		{
+			return false;
+		}
+
+		readState->stripeRowIndex++;
+	}
+	while (readState->deletedRowBitmap != NULL &&
+		   RowDeleted(readState->deletedRowBitmap, readState->deletedRowBitmapLength,
+					  StripeRowOffset(readState)));
+
+	ReadCurrentRow(readState, columnValues, columnNulls);
+
+	return true;
+}
+
+
+/*
+ * SetReadOrderedBlock loads the given block's buffers as the current stripe of
+ * the read operation, and positions the read before the block's first row.
+ */
+static void
+SetReadOrderedBlock(TableReadState *readState, OrderedBlock *orderedBlock)
+{
+	uint32 stripeIndex = orderedBlock->stripeIndex;
+	StripeMetadata *stripeMetadata = NULL;
+	StripeSkipList *stripeSkipList = NULL;
+	FILE *tableFile = NULL;
+	StripeBuffers *stripeBuffers = NULL;
+	bool *selectedBlockMask = NULL;
+	MemoryContext oldContext = NULL;
+
+	if (DeltaStripe(readState, stripeIndex))
+	{
+		SetReadDeltaBlocks(readState, orderedBlock->blockIndex, 1);
+		return;
+	}
+
+	LoadCachedStripeMetadata(readState, stripeIndex);
+
+	stripeMetadata = readState->stripeMetadataArray[stripeIndex];
+	stripeSkipList = readState->stripeSkipListArray[stripeIndex];
+	tableFile = readState->tableFileArray[stripeMetadata->segmentIndex];
+
+	oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+	MemoryContextReset(readState->stripeReadContext);
+
+	selectedBlockMask = palloc0(stripeSkipList->blockCount * sizeof(bool));
+	selectedBlockMask[orderedBlock->blockIndex] = true;
+
+	stripeBuffers = LoadSelectedStripeBuffers(tableFile, stripeMetadata,
+											  readState->stripeFooterArray[stripeIndex],
+											  stripeSkipList,
+											  readState->tupleDescriptor,
+											  readState->projectedColumnList,
+											  selectedBlockMask);
+
+	MemoryContextSwitchTo(oldContext);
+
+	/* the stripe memory context doesn't hold a whole filtered stripe anymore */
+	readState->loadedStripeIndex = -1;
+	readState->loadedStripeBuffers = NULL;
+	readState->summaryBlockMask = NULL;
+
+	ResetUncompressedBlockData(readState->blockDataArray, stripeBuffers->columnCount);
+
+	readState->stripeIndex = stripeIndex;
+	readState->stripeBuffers = stripeBuffers;
+	readState->stripeRowIndex = -1;
+	readState->deserializedBlockIndex = -1;
+	readState->deletedRowBitmap = stripeMetadata->deletedRowBitmap;
+	readState->deletedRowBitmapLength = stripeMetadata->deletedRowBitmapLength;
+}
+
+
+/*
+ * CompareOrderedBlocks compares two blocks by their bounds in an ordered read.
+ * Blocks with no bounds come first, since we can't skip them.
+ */
+static int
+CompareOrderedBlocks(const void *leftElement, const void *rightElement, void *context)
+{
+	const OrderedBlock *leftBlock = (const OrderedBlock *) leftElement;
+	const OrderedBlock *rightBlock = (const OrderedBlock *) rightElement;
+	OrderedBlockCompareContext *compareContext = (OrderedBlockCompareContext *) context;
+	Datum firstValue = leftBlock->boundValue;
+	Datum secondValue = rightBlock->boundValue;
+	int comparison = 0;
+
+	if (!leftBlock->hasBound || !rightBlock->hasBound)
+	{
+		return (int) leftBlock->hasBound - (int) rightBlock->hasBound;
+	}
+
+	/* for descending orders, larger bounds come first */
+	if (compareContext->descending)
+	{
+		firstValue = rightBlock->boundValue;
+		secondValue = leftBlock->boundValue;
+	}
+
+	comparison = DatumGetInt32(FunctionCall2Coll(compareContext->comparisonFunction,
+												 compareContext->collation,
+												 firstValue, secondValue));
+
+	return comparison;
+}
+
+
+/*
+ * SetReadStripe makes the given stripe the current stripe of the read operation,
+ * and positions the read before its first row. If the stripe's buffers are
+ * still in memory, for example after a rescan with unchanged qualifiers or
+ * when a backward scan returns to it, the function reuses them. Otherwise, it
+ * loads the stripe's filtered buffers from the file. If the stripe's sparse index
+ * shows that no block has the key of the read's equality qualifier, we make the
+ * stripe empty without reading its metadata.
+ */
+static void
+SetReadStripe(TableReadState *readState, int32 stripeIndex)
+{
+	StripeMetadata *stripeMetadata = NULL;
+	StripeBuffers *stripeBuffers = NULL;
+	bool stripeReused = false;
+
+	if (DeltaStripe(readState, stripeIndex))
+	{
+		uint64 blockRowCount = readState->tableFooter->blockRowCount;
+		uint32 deltaBlockCount = (readState->deltaRowCount + blockRowCount - 1) /
+								 blockRowCount;
+
+		SetReadDeltaBlocks(readState, 0, deltaBlockCount);
+		return;
+	}
+
+	stripeMetadata = readState->stripeMetadataArray[stripeIndex];
+
+	/* summary reads check the stripe's deleted rows when picking blocks */
+	readState->deletedRowBitmap = stripeMetadata->deletedRowBitmap;
+	readState->deletedRowBitmapLength = stripeMetadata->deletedRowBitmapLength;
+
+	if (readState->loadedStripeIndex == stripeIndex)
+	{
+		stripeBuffers = readState->loadedStripeBuffers;
+		stripeReused = true;
+	}
+	else
+	{
+		FILE *tableFile = readState->tableFileArray[stripeMetadata->segmentIndex];
+		List *indexedBlockList = NIL;
+		bool stripeIndexed = false;
+		MemoryContext oldContext = NULL;
+
+		oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+		MemoryContextReset(readState->stripeReadContext);
+
+		stripeIndexed = StripeIndexBlockList(readState, stripeMetadata,
+											 &indexedBlockList);
+		if (stripeIndexed && indexedBlockList == NIL)
+		{
+			stripeBuffers = palloc0(sizeof(StripeBuffers));
+			stripeBuffers->columnCount = readState->tupleDescriptor->natts;
+			stripeBuffers->rowCount = 0;
+
+			readState->summaryBlockMask = NULL;
+		}
+		else
+		{
+			StripeSkipList *stripeSkipList = NULL;
+			bool *selectedBlockMask = NULL;
+
+			LoadCachedStripeMetadata(readState, stripeIndex);
+
+			stripeSkipList = readState->stripeSkipListArray[stripeIndex];
+			selectedBlockMask = SelectedBlockMask(stripeSkipList,
+												  readState->projectedColumnList,
+												  readState->whereClauseList);
+			if (stripeIndexed)
+			{
+				RemoveUnindexedBlocks(selectedBlockMask, stripeSkipList->blockCount,
+									  indexedBlockList);
+			}
+
+			/* summarized blocks are removed from the selected blocks */
+			if (readState->summaryRead)
+			{
+				readState->summaryBlockMask = SummaryBlockMask(readState, stripeSkipList,
+															   selectedBlockMask);
+			}
+
+			stripeBuffers =
+				LoadSelectedStripeBuffers(tableFile, stripeMetadata,
+										  readState->stripeFooterArray[stripeIndex],
+										  stripeSkipList, readState->tupleDescriptor,
+										  readState->projectedColumnList,
+										  selectedBlockMask);
+		}
+
+		MemoryContextSwitchTo(oldContext);
+
+		readState->loadedStripeIndex = stripeIndex;
+		readState->loadedStripeBuffers = stripeBuffers;
+	}
+
+	/*
+	 * Block data buffers of a reused stripe are still valid, and get freed when
+	 * we deserialize the next block. Buffers of other stripes were freed when
+	 * we reset the stripe memory context.
+	 */
+	if (!stripeReused)
+	{
+		ResetUncompressedBlockData(readState->blockDataArray,
+								   stripeBuffers->columnCount);
+	}
+
+	readState->stripeIndex = stripeIndex;
+	readState->stripeBuffers = stripeBuffers;
+	readState->stripeRowIndex = -1;
+	readState->deserializedBlockIndex = -1;
+	readState->summaryBlockIndex = -1;
+}
+
+
+/*
+ * ReadStripeCount returns the number of stripes that the read operation covers.
+ * If the read has delta store rows, they come as one more stripe after the
+ * table's stripes.
+ */
+static int32
+ReadStripeCount(TableReadState *readState)
+{
+	int32 stripeCount = (int32) readState->stripeCount;
+
+	if (readState->deltaRowCount > 0)
+	{
+		stripeCount++;
+	}
+
+	return stripeCount;
+}
+
+
+/*
+ * NextReadStripeIndex returns the index of the stripe that the read operation
+ * reads after the current one in the given direction. Parallel reads instead
+ * claim the next stripe that no other read of their scan claimed. If the read's
+ * qualifiers refute the index column ranges of some stripes, we only return
+ * selected stripes, and find the next one by binary search.
+ */
+static int32
+NextReadStripeIndex(TableReadState *readState, bool backward)
+{
+	uint32 *selectedStripeArray = readState->selectedStripeArray;
+	int32 selectedStripeCount = (int32) readState->selectedStripeCount;
+	int32 stripeIndex = readState->stripeIndex;
+	int32 lowIndex = 0;
+	int32 highIndex = selectedStripeCount;
+
+	if (readState->parallelStripeIndex != NULL)
+	{
+		uint32 claimedIndex = 0;
+
+		Assert(!backward);
+
+		/* reads of a parallel scan have the same qualifiers and selected stripes */
+		claimedIndex = pg_atomic_fetch_add_u32(readState->parallelStripeIndex, 1);
+		if (selectedStripeArray == NULL)
+		{
+			return (int32) claimedIndex;
+		}
+		else if (claimedIndex >= (uint32) selectedStripeCount)
+		{
+			return ReadStripeCount(readState);
+		}
+
+		return (int32) selectedStripeArray[claimedIndex];
+	}
+
+	if (selectedStripeArray == NULL)
+	{
+		return stripeIndex + (backward ? -1 : 1);
+	}
+
+	/* find the first selected stripe that doesn't come before the current one */
+	while (lowIndex < highIndex)
+	{
+		int32 middleIndex = lowIndex + (highIndex - lowIndex) / 2;
+
+		if ((int32) selectedStripeArray[middleIndex] < stripeIndex)
+		{
+			lowIndex = middleIndex + 1;
+		}
+		else
+		{
+			highIndex = middleIndex;
+		}
+	}
+
+	if (backward)
+	{
+		return (lowIndex > 0) ? (int32) selectedStripeArray[lowIndex - 1] : -1;
+	}
+
+	if (lowIndex < selectedStripeCount &&
+		(int32) selectedStripeArray[lowIndex] == stripeIndex)
+	{
+		lowIndex++;
+	}
+
+	if (lowIndex < selectedStripeCount)
+	{
+		return (int32) selectedStripeArray[lowIndex];
+	}
+
+	return ReadStripeCount(readState);
+}
+
+
+/*
+ * LoadStripeFirstRowArray computes the number of the first row of each stripe
+ * of the read, unless it was computed before. The array has one more element
+ * for the delta store rows, which come after the rows of all stripes. This
+ * reads the metadata of all stripes, which the read keeps if it caches all
+ * stripes.
+ */
+static void
+LoadStripeFirstRowArray(TableReadState *readState)
+{
+	uint32 stripeCount = readState->stripeCount;
+	uint64 *stripeFirstRowArray = NULL;
+	uint32 stripeIndex = 0;
+
+	if (readState->stripeFirstRowArray != NULL)
+	{
+		return;
+	}
+
+	stripeFirstRowArray = MemoryContextAllocZero(readState->stripeMetadataContext,
+												 (stripeCount + 1) * sizeof(uint64));
+	for (stripeIndex = 0; stripeIndex < stripeCount; stripeIndex++)
+	{
+		StripeSkipList *stripeSkipList = NULL;
+
+		LoadCachedStripeMetadata(readState, stripeIndex);
+		stripeSkipList = readState->stripeSkipListArray[stripeIndex];
+
+		stripeFirstRowArray[stripeIndex + 1] = stripeFirstRowArray[stripeIndex] +
+											   StripeSkipListRowCount(stripeSkipList);
+	}
+
+	readState->stripeFirstRowArray = stripeFirstRowArray;
+}
+
+
+/*
+ * RowNumberStripeIndex returns the index of the stripe that holds the row with
+ * the given number, or -1 if the read has no such row.
+ */
+static int32
+RowNumberStripeIndex(TableReadState *readState, uint64 rowNumber)
+{
+	uint64 *stripeFirstRowArray = readState->stripeFirstRowArray;
+	int32 stripeCount = (int32) readState->stripeCount;
+	int32 lowIndex = 0;
+	int32 highIndex = stripeCount - 1;
+
+	if (rowNumber >= stripeFirstRowArray[stripeCount] + readState->deltaRowCount)
+	{
+		return -1;
+	}
+	else if (rowNumber >= stripeFirstRowArray[stripeCount])
+	{
+		return stripeCount;
+	}
+
+	/* find the last stripe whose first row comes at or before the row */
+	while (lowIndex < highIndex)
+	{
+		int32 middleIndex = lowIndex + (highIndex - lowIndex + 1) / 2;
+
+		if (stripeFirstRowArray[middleIndex] <= rowNumber)
+		{
+			lowIndex = middleIndex;
+		}
+		else
+		{
+			highIndex = middleIndex - 1;
+		}
+	}
+
+	return lowIndex;
+}
+
+
+/*
+ * LoadedBlockIndex returns the index of the given block of the given stripe
+ * among the blocks in the current stripe buffers, or -1 if the block isn't
+ * loaded.
+ */
+static int32
+LoadedBlockIndex(TableReadState *readState, int32 stripeIndex, uint32 blockIndex)
+{
+	StripeBuffers *stripeBuffers = readState->stripeBuffers;
+	uint64 blockRowCount = readState->tableFooter->blockRowCount;
+	uint32 loadedBlockCount = 0;
+	uint32 loadedBlockIndex = 0;
+
+	if (stripeBuffers == NULL || readState->stripeIndex != stripeIndex)
+	{
+		return -1;
+	}
+
+	loadedBlockCount = (stripeBuffers->rowCount + blockRowCount - 1) / blockRowCount;
+	for (loadedBlockIndex = 0; loadedBlockIndex < loadedBlockCount; loadedBlockIndex++)
+	{
+		if (stripeBuffers->blockIndexArray[loadedBlockIndex] == blockIndex)
+		{
+			return (int32) loadedBlockIndex;
+		}
+	}
+
+	return -1;
+}
+
+
+/* DeltaStripe checks if the given stripe of the read holds delta store rows. */
+static bool
+DeltaStripe(TableReadState *readState, int32 stripeIndex)
+{
+	return stripeIndex == (int32) readState->stripeCount;
+}
+
+
+/*
+ * SetReadDeltaBlocks makes the given blocks of delta store rows the current
+ * stripe of the read operation, and positions the read before their first row.
+ * Delta store rows are already in memory, so the stripe buffers only have the
+ * blocks' row count and indexes, and we deserialize blocks from the rows.
+ */
+static void
+SetReadDeltaBlocks(TableReadState *readState, uint32 firstBlockIndex, uint32 blockCount)
+{
+	uint64 blockRowCount = readState->tableFooter->blockRowCount;
+	uint64 firstRowIndex = firstBlockIndex * blockRowCount;
+	uint64 lastRowIndex = Min((firstBlockIndex + blockCount) * blockRowCount,
+							  readState->deltaRowCount);
+	StripeBuffers *stripeBuffers = NULL;
+	uint32 blockIndex = 0;
+	MemoryContext oldContext = NULL;
+
+	oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+	MemoryContextReset(readState->stripeReadContext);
+
+	stripeBuffers = palloc0(sizeof(StripeBuffers));
+	stripeBuffers->columnCount = readState->tupleDescriptor->natts;
+	stripeBuffers->rowCount = lastRowIndex - firstRowIndex;
+	stripeBuffers->blockIndexArray = palloc0(blockCount * sizeof(uint32));
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		stripeBuffers->blockIndexArray[blockIndex] = firstBlockIndex + blockIndex;
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	readState->loadedStripeIndex = -1;
+	readState->loadedStripeBuffers = NULL;
+	readState->summaryBlockMask = NULL;
+
+	ResetUncompressedBlockData(readState->blockDataArray, stripeBuffers->columnCount);
+
+	readState->stripeIndex = (int32) readState->stripeCount;
+	readState->stripeBuffers = stripeBuffers;
+	readState->stripeRowIndex = -1;
+	readState->deserializedBlockIndex = -1;
+	readState->summaryBlockIndex = -1;
+	readState->deletedRowBitmap = NULL;
+	readState->deletedRowBitmapLength = 0;
+}
+
+
+/*
+ * DeserializeDeltaBlock fills the read operation's block data array with the
+ * projected column values of the given block of delta store rows. The values of
+ * by-reference columns point into the rows, which live as long as the read.
+ */
+static void
+DeserializeDeltaBlock(TableReadState *readState, uint32 blockIndex, uint32 blockRowCount)
+{
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	uint32 columnCount = tupleDescriptor->natts;
+	uint64 firstRowIndex = (uint64) readState->stripeBuffers->blockIndexArray[blockIndex] *
+						   readState->tableFooter->blockRowCount;
+	Datum *columnValues = palloc0(columnCount * sizeof(Datum));
+	bool *columnNulls = palloc0(columnCount * sizeof(bool));
+	uint32 rowIndex = 0;
+
+	for (rowIndex = 0; rowIndex < blockRowCount; rowIndex++)
+	{
+		HeapTuple deltaRow = readState->deltaRowArray[firstRowIndex + rowIndex];
+		uint32 columnIndex = 0;
+
+		heap_deform_tuple(deltaRow, tupleDescriptor, columnValues, columnNulls);
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			ColumnBlockData *blockData = readState->blockDataArray[columnIndex];
+			if (blockData != NULL)
+			{
+				blockData->existsArray[rowIndex] = !columnNulls[columnIndex];
+				blockData->valueArray[rowIndex] = columnValues[columnIndex];
+			}
+		}
+	}
+
+	pfree(columnValues);
+	pfree(columnNulls);
+}
+
+
+/* Finishes a cstore read operation. */
+void
+CStoreEndRead(TableReadState *readState)
+{
+	int columnCount = readState->tupleDescriptor->natts;
+	uint32 segmentIndex = 0;
+
+	MemoryContextDelete(readState->stripeReadContext);
+	MemoryContextDelete(readState->stripeMetadataContext);
+	MemoryContextDelete(readState->whereClauseContext);
+
+	for (segmentIndex = 0; segmentIndex < readState->segmentCount; segmentIndex++)
+	{
+		if (readState->tableFileArray[segmentIndex] != NULL)
+		{
+			FreeFile(readState->tableFileArray[segmentIndex]);
+		}
+	}
+
+	pfree(readState->tableFileArray);
+	pfree(readState->stripeMetadataArray);
+	list_free_deep(readState->tableFooter->stripeMetadataList);
+	FreeColumnBlockDataArray(readState->blockDataArray, columnCount);
+	pfree(readState->tableFooter);
+	pfree(readState);
+}
+
+
+/*
+ * CreateEmptyBlockDataArray creates data buffers to keep deserialized exist and
+ * value arrays for requested columns in columnMask.
+ */
+ColumnBlockData **
+CreateEmptyBlockDataArray(uint32 columnCount, bool *columnMask, uint32 blockRowCount)
+{
+	uint32 columnIndex = 0;
+	ColumnBlockData **blockDataArray = palloc0(columnCount * sizeof(ColumnBlockData*));
+
+	/* allocate block memory for deserialized data */
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		if (columnMask[columnIndex])
+		{
+			ColumnBlockData *blockData = palloc0(sizeof(ColumnBlockData));
+
+			blockData->existsArray = palloc0(blockRowCount * sizeof(bool));
+			blockData->valueArray = palloc0(blockRowCount * sizeof(Datum));
+			blockData->valueBuffer = NULL;
+			blockDataArray[columnIndex] = blockData;
+		}
+	}
+
+	return blockDataArray;
+}
+
+
+/*
+ * FreeColumnBlockDataArray deallocates data buffers to keep deserialized exist and
+ * value arrays for requested columns in columnMask.
+ * ColumnBlockData->serializedValueBuffer lives in memory read/write context
+ * so it is deallocated automatically when the context is deleted.
+ */
+void
+FreeColumnBlockDataArray(ColumnBlockData **blockDataArray, uint32 columnCount)
+{
+	uint32 columnIndex = 0;
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnBlockData *blockData = blockDataArray[columnIndex];
+		if (blockData != NULL)
+		{
+			pfree(blockData->existsArray);
+			pfree(blockData->valueArray);
+			pfree(blockData);
+		}
+	}
+
+	pfree(blockDataArray);
+}
+
+
+/* CStoreTableRowCount returns the exact row count of a table using skiplists */
+uint64
+CStoreTableRowCount(const char *filename)
+{
+	TableFooter *tableFooter = NULL;
+	FILE **tableFileArray = NULL;
+	ListCell *stripeMetadataCell = NULL;
+	uint64 totalRowCount = 0;
+	uint32 segmentIndex = 0;
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+
+	/* like reads, we read the delta store before the footers */
+	TableDelta *tableDelta = CStoreReadDelta(filename, false);
+
+	tableFileArray = palloc0(segmentCount * sizeof(FILE *));
+	tableFooter = ReadSegmentFooters(filename, segmentCount, tableFileArray, NULL);
+
+	if (tableDelta->generation > tableFooter->mergedDeltaGeneration)
+	{
+		totalRowCount += tableDelta->rowCount;
+	}
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		FILE *tableFile = tableFileArray[stripeMetadata->segmentIndex];
+
+		totalRowCount += StripeRowCount(tableFile, stripeMetadata) -
+						 stripeMetadata->deletedRowCount;
+	}
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		if (tableFileArray[segmentIndex] != NULL)
+		{
+			FreeFile(tableFileArray[segmentIndex]);
+		}
+	}
+
+	return totalRowCount;
+}
+
+
+/*
+ * CStoreTableRowNumberCount returns the number of rows in a table's stripes,
+ * counting deleted rows. Since CStoreReadRowNumber numbers rows in stripe order,
+ * this is the number that the next row appended to the table's last stripe gets.
+ */
+uint64
+CStoreTableRowNumberCount(const char *filename)
+{
+	TableFooter *tableFooter = NULL;
+	FILE **tableFileArray = NULL;
+	ListCell *stripeMetadataCell = NULL;
+	uint64 totalRowCount = 0;
+	uint32 segmentIndex = 0;
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+
+	tableFileArray = palloc0(segmentCount * sizeof(FILE *));
+	tableFooter = ReadSegmentFooters(filename, segmentCount, tableFileArray, NULL);
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		FILE *tableFile = tableFileArray[stripeMetadata->segmentIndex];
+
+		totalRowCount += StripeRowCount(tableFile, stripeMetadata);
+	}
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		if (tableFileArray[segmentIndex] != NULL)
+		{
+			FreeFile(tableFileArray[segmentIndex]);
+		}
+	}
+
+	return totalRowCount;
+}
+
+
+/*
+ * CStoreStripeRowCount returns the number of rows in the given stripe of a
+ * table, counting deleted rows.
+ */
+uint64
+CStoreStripeRowCount(const char *filename, StripeMetadata *stripeMetadata)
+{
+	char *segmentFilename = CStoreSegmentFilename(filename, stripeMetadata->segmentIndex);
+	FILE *tableFile = NULL;
+	uint64 rowCount = 0;
+
+	tableFile = AllocateFile(segmentFilename, PG_BINARY_R);
+	if (tableFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for reading: %m",
+							   segmentFilename)));
+	}
+
+	rowCount = StripeRowCount(tableFile, stripeMetadata);
+
+	FreeFile(tableFile);
+	pfree(segmentFilename);
+
+	return rowCount;
+}
+
+
+/*
+ * CStoreMatchingStripes returns the stripes in the given segment footer whose
+ * rows all satisfy the given qualifiers, and sets matchingRowCount to the number
+ * of rows in these stripes. We check each block of a stripe the same way summary
+ * reads do: we build min/max constraints for the block's columns that have no
+ * nulls, and check if these constraints imply the qualifiers. Blocks written by
+ * versions that didn't count values never match.
+ */
+List *
+CStoreMatchingStripes(const char *filename, TableFooter *tableFooter,
+					  TupleDesc tupleDescriptor, List *whereClauseList,
+					  uint64 *matchingRowCount)
+{
+	uint32 columnCount = tupleDescriptor->natts;
+	bool *projectedColumnMask = palloc0(columnCount * sizeof(bool));
+	List *matchingStripeList = NIL;
+	List *columnList = NIL;
+	List *baseConstraintList = NIL;
+	ListCell *stripeMetadataCell = NULL;
+	ListCell *columnCell = NULL;
+	FILE *tableFile = NULL;
+
+	*matchingRowCount = 0;
+
+#if PG_VERSION_NUM >= 90600
+	columnList = pull_var_clause((Node *) whereClauseList,
+								 PVC_RECURSE_AGGREGATES | PVC_RECURSE_PLACEHOLDERS);
+#else
+	columnList = pull_var_clause((Node *) whereClauseList,
+								 PVC_RECURSE_AGGREGATES, PVC_RECURSE_PLACEHOLDERS);
+#endif
+	columnList = list_union(NIL, columnList);
+
+	foreach(columnCell, columnList)
+	{
+		Var *column = lfirst(columnCell);
+		FmgrInfo *comparisonFunction = GetFunctionInfoOrNull(column->vartype,
+															 BTREE_AM_OID,
+															 BTORDER_PROC);
+		Node *baseConstraint = NULL;
+
+		if (comparisonFunction != NULL)
+		{
+			baseConstraint = BuildBaseConstraint(column);
+		}
+
+		baseConstraintList = lappend(baseConstraintList, baseConstraint);
+		projectedColumnMask[column->varattno - 1] = true;
+	}
+
+	tableFile = AllocateFile(filename, PG_BINARY_R);
+	if (tableFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for reading: %m",
+							   filename)));
+	}
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		StripeFooter *stripeFooter = LoadStripeFooter(tableFile, stripeMetadata,
+													  columnCount);
+		StripeSkipList *stripeSkipList = LoadStripeSkipList(tableFile, stripeMetadata,
+															stripeFooter, columnCount,
+															projectedColumnMask,
+															tupleDescriptor,
+															CStoreVerifyChecksums);
+		bool stripeMatches = true;
+		uint32 blockIndex = 0;
+
+		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		{
+			List *constraintList = NIL;
+			ListCell *constraintCell = NULL;
+
+			forboth(columnCell, columnList, constraintCell, baseConstraintList)
+			{
+				Var *column = lfirst(columnCell);
+				Node *baseConstraint = lfirst(constraintCell);
+				uint32 columnIndex = column->varattno - 1;
+				ColumnBlockSkipNode *blockSkipNode =
+					&stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+
+				/* qualifiers on columns with nulls aren't implied by min/max values */
+				if (baseConstraint != NULL && blockSkipNode->hasValueCount &&
+					blockSkipNode->hasMinMax &&
+					blockSkipNode->valueCount == blockSkipNode->rowCount)
+				{
+					UpdateConstraint(baseConstraint, blockSkipNode->minimumValue,
+									 blockSkipNode->maximumValue);
+					constraintList = lappend(constraintList, copyObject(baseConstraint));
+				}
+			}
+
+#if (PG_VERSION_NUM >= 100000)
+			stripeMatches = predicate_implied_by(whereClauseList, constraintList, false);
+#else
+			stripeMatches = predicate_implied_by(whereClauseList, constraintList);
+#endif
+			if (!stripeMatches)
+			{
+				break;
+			}
+		}
+
+		if (stripeMatches)
+		{
+			matchingStripeList = lappend(matchingStripeList, stripeMetadata);
+			(*matchingRowCount) += StripeSkipListRowCount(stripeSkipList) -
+								   stripeMetadata->deletedRowCount;
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	FreeFile(tableFile);
+
+	return matchingStripeList;
+}
+
+
+/*
+ * CStoreValidateFile checks that the data and footer files with the given data
+ * filename can be read as a segment of a table with the given tuple descriptor
+ * and block row count. The check reads the footer and each stripe's footer and
+ * first skip list, but no column data. The function returns the file's row count.
+ */
+uint64
+CStoreValidateFile(const char *filename, TupleDesc tupleDescriptor,
+				   uint64 blockRowCount)
+{
+	StringInfo tableFooterFilename = makeStringInfo();
+	TableFooter *tableFooter = NULL;
+	FILE *tableFile = NULL;
+	ListCell *stripeMetadataCell = NULL;
+	uint32 columnCount = tupleDescriptor->natts;
+	uint32 columnIndex = 0;
+	uint64 tableFileSize = 0;
+	uint64 previousStripeEnd = 0;
+	uint64 totalRowCount = 0;
+
+	tableFile = AllocateFile(filename, PG_BINARY_R);
+	if (tableFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for reading: %m",
+							   filename)));
+	}
+
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+	tableFooter = CStoreReadFooter(tableFooterFilename);
+	if (tableFooter->blockRowCount != blockRowCount)
+	{
+		ereport(ERROR, (errmsg("invalid cstore file \"%s\"", filename),
+						errdetail("File has block row count " UINT64_FORMAT
+								  ", but the table has " UINT64_FORMAT ".",
+								  tableFooter->blockRowCount, blockRowCount)));
+	}
+
+	/*
+	 * Files written by older versions don't record column types. The values of
+	 * columns that the table dropped are never read, so their types don't matter.
+	 * User-defined types get different OIDs on each server, so we can only tell
+	 * that they differ from built-in types.
+	 */
+	for (columnIndex = 0; columnIndex < Min(tableFooter->columnCount, columnCount);
+		 columnIndex++)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid fileTypeId = tableFooter->columnTypeArray[columnIndex];
+
+		if (attributeForm->attisdropped || fileTypeId == attributeForm->atttypid ||
+			(fileTypeId >= FirstNormalObjectId &&
+			 attributeForm->atttypid >= FirstNormalObjectId))
+		{
+			continue;
+		}
+
+		if (fileTypeId == InvalidOid)
+		{
+			ereport(ERROR, (errmsg("invalid cstore file "%s"", filename),
+							errdetail("File column %u was dropped, but the table "
+									  "column has type %s.", columnIndex + 1,
+									  format_type_be(attributeForm->atttypid))));
+		}
+
+		ereport(ERROR, (errmsg("invalid cstore file "%s"", filename),
+						errdetail("File column %u has type %s, but the table column "
+								  "has type %s.", columnIndex + 1,
+								  format_type_be(fileTypeId),
+								  format_type_be(attributeForm->atttypid))));
+	}
+
+	tableFileSize = FILESize(tableFile);
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		StripeFooter *stripeFooter = NULL;
+		StringInfo footerBuffer = NULL;
+		StringInfo firstColumnSkipListBuffer = NULL;
+		uint64 stripeEnd = stripeMetadata->fileOffset;
+		uint64 skipListLength = 0;
+		uint64 dataLength = 0;
+
+		stripeEnd += stripeMetadata->skipListLength;
+		stripeEnd += stripeMetadata->dataLength;
+		stripeEnd += stripeMetadata->footerLength;
+		stripeEnd += stripeMetadata->indexLength;
+
+		/* stripes are written one after another, and each fits in the file */
+		if (stripeMetadata->fileOffset < previousStripeEnd ||
+			stripeEnd < stripeMetadata->fileOffset || stripeEnd > tableFileSize ||
+			stripeMetadata->footerLength >= MaxAllocSize)
+		{
+			ereport(ERROR, (errmsg("invalid cstore file \"%s\"", filename),
+							errdetail("Stripe at offset " UINT64_FORMAT " is outside "
+									  "of the data file.", stripeMetadata->fileOffset)));
+		}
+
+		footerBuffer = ReadFromFile(tableFile, stripeEnd - stripeMetadata->indexLength -
+									stripeMetadata->footerLength,
+									stripeMetadata->footerLength);
+		stripeFooter = DeserializeStripeFooter(footerBuffer);
+
+		/* stripes written before columns were added have fewer columns */
+		if (stripeFooter->columnCount == 0 || stripeFooter->columnCount > columnCount)
+		{
+			ereport(ERROR, (errmsg("invalid cstore file \"%s\"", filename),
+							errdetail("Stripe has %u columns, but the table has %u.",
+									  stripeFooter->columnCount, columnCount)));
+		}
+
+		for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+		{
+			skipListLength += stripeFooter->skipListSizeArray[columnIndex];
+			dataLength += stripeFooter->existsSizeArray[columnIndex];
+			dataLength += stripeFooter->valueSizeArray[columnIndex];
+		}
+
+		if (skipListLength != stripeMetadata->skipListLength ||
+			dataLength != stripeMetadata->dataLength)
+		{
+			ereport(ERROR, (errmsg("invalid cstore file \"%s\"", filename),
+							errdetail("Stripe at offset " UINT64_FORMAT " has "
+									  "inconsistent lengths.",
+									  stripeMetadata->fileOffset)));
+		}
+
+		firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
+												 stripeFooter->skipListSizeArray[0]);
+		totalRowCount += DeserializeRowCount(firstColumnSkipListBuffer);
+
+		previousStripeEnd = stripeEnd;
+	}
+
+	FreeFile(tableFile);
+
+	return totalRowCount;
+}
+
+
+/*
+ * CStoreReadBlockInfo reads the skip lists of all stripes in all segments of the
+ * table with the given data filename, and returns a list of ColumnBlockInfo for
+ * each stored column block. We read the compression header of each compressed
+ * block to find its decompressed size. If verify is true, we also check the
+ * checksums of skip lists and blocks regardless of cstore_fdw.verify_checksums,
+ * decompress and deserialize each block, and error out when a block is corrupt.
+ */
+List *
+CStoreReadBlockInfo(const char *filename, TupleDesc tupleDescriptor, bool verify)
+{
+	uint32 segmentCount = CStoreReadSegmentCount(filename);
+	uint32 columnCount = tupleDescriptor->natts;
+	FILE **tableFileArray = palloc0(segmentCount * sizeof(FILE *));
+	bool *projectedColumnMask = palloc0(columnCount * sizeof(bool));
+	TableFooter *tableFooter = NULL;
+	List *blockInfoList = NIL;
+	ListCell *stripeMetadataCell = NULL;
+	uint32 segmentIndex = 0;
+	uint32 stripeIndex = 0;
+	uint32 previousSegmentIndex = 0;
+	BlockVerifyContext verifyContext;
+	ErrorContextCallback errorCallback;
+
+	tableFooter = ReadSegmentFooters(filename, segmentCount, tableFileArray, NULL);
+	memset(projectedColumnMask, true, columnCount * sizeof(bool));
+
+	memset(&verifyContext, 0, sizeof(BlockVerifyContext));
+	errorCallback.callback = BlockVerifyErrorCallback;
+	errorCallback.arg = (void *) &verifyContext;
+	errorCallback.previous = error_context_stack;
+	error_context_stack = &errorCallback;
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		FILE *tableFile = tableFileArray[stripeMetadata->segmentIndex];
+		StripeFooter *stripeFooter = NULL;
+		StripeSkipList *stripeSkipList = NULL;
+		uint64 columnFileOffset = 0;
+		uint32 columnIndex = 0;
+
+		if (stripeMetadata->segmentIndex != previousSegmentIndex)
+		{
+			previousSegmentIndex = stripeMetadata->segmentIndex;
+			stripeIndex = 0;
+		}
+
+		verifyContext.filename = CStoreSegmentFilename(filename,
+													   stripeMetadata->segmentIndex);
+		verifyContext.stripeIndex = stripeIndex;
+		verifyContext.columnIndex = -1;
+
+		stripeFooter = LoadStripeFooter(tableFile, stripeMetadata, columnCount);
+		stripeSkipList = LoadStripeSkipList(tableFile, stripeMetadata, stripeFooter,
+											columnCount, projectedColumnMask,
+											tupleDescriptor,
+											verify || CStoreVerifyChecksums);
+
+		columnFileOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength;
+
+		/* columns added after the stripe was written aren't stored in it */
+		for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+		{
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+			uint64 existsSize = stripeFooter->existsSizeArray[columnIndex];
+			uint64 valueSize = stripeFooter->valueSizeArray[columnIndex];
+			uint32 blockIndex = 0;
+
+			for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+			{
+				ColumnBlockSkipNode *blockSkipNode =
+					&stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+				CompressionType compressionType = blockSkipNode->valueCompressionType;
+				ColumnBlockInfo *blockInfo = palloc0(sizeof(ColumnBlockInfo));
+				uint64 existsOffset = columnFileOffset + blockSkipNode->existsBlockOffset;
+				uint64 valueOffset = columnFileOffset + existsSize +
+									 blockSkipNode->valueBlockOffset;
+
+				verifyContext.columnIndex = columnIndex;
+				verifyContext.blockIndex = blockIndex;
+
+				if (blockSkipNode->existsBlockOffset + blockSkipNode->existsLength >
+					existsSize ||
+					blockSkipNode->valueBlockOffset + blockSkipNode->valueLength >
+					valueSize)
+				{
+					ereport(ERROR, (errmsg("column block is outside of its column's "
+										   "data")));
+				}
+
+				blockInfo->segmentIndex = stripeMetadata->segmentIndex;
+				blockInfo->stripeIndex = stripeIndex;
+				blockInfo->columnIndex = columnIndex;
+				blockInfo->blockIndex = blockIndex;
+				blockInfo->blockSkipNode = *blockSkipNode;
+
+				if (verify)
+				{
+					StringInfo existsBuffer = ReadFromFile(tableFile, existsOffset,
+														   blockSkipNode->existsLength);
+					StringInfo valueBuffer = ReadFromFile(tableFile, valueOffset,
+														  blockSkipNode->valueLength);
+
+					if (blockSkipNode->hasChecksum)
+					{
+						CheckBufferChecksum(existsBuffer, blockSkipNode->existsChecksum,
+											"exists stream", attributeForm);
+						CheckBufferChecksum(valueBuffer, blockSkipNode->valueChecksum,
+											"value stream", attributeForm);
+					}
+
+					blockInfo->decompressedLength =
+						VerifyBlockData(existsBuffer, valueBuffer, blockSkipNode,
+										attributeForm);
+
+					pfree(existsBuffer->data);
+					pfree(existsBuffer);
+					pfree(valueBuffer->data);
+					pfree(valueBuffer);
+				}
+				else if (compressionType != COMPRESSION_NONE)
+				{
+					uint64 headerLength = Min(blockSkipNode->valueLength,
+											  2 * sizeof(int32));
+					StringInfo headerBuffer = ReadFromFile(tableFile, valueOffset,
+														   headerLength);
+
+					blockInfo->decompressedLength = DecompressedSize(headerBuffer,
+																	 compressionType);
+
+					pfree(headerBuffer->data);
+					pfree(headerBuffer);
+				}
+				else
+				{
+					blockInfo->decompressedLength = blockSkipNode->valueLength;
+				}
+
+				blockInfoList = lappend(blockInfoList, blockInfo);
+			}
+
+			columnFileOffset += existsSize;
+			columnFileOffset += valueSize;
+		}
+
+		stripeIndex++;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	error_context_stack = errorCallback.previous;
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		if (tableFileArray[segmentIndex] != NULL)
+		{
+			FreeFile(tableFileArray[segmentIndex]);
+		}
+	}
+
+	return blockInfoList;
+}
+
+
+/*
+ * VerifyBlockData decompresses the given column block, and checks that its
+ * exists and value streams have as many values as the block skip node says,
+ * and that each value fits in the value stream. The function returns the
+ * decompressed size of the value stream.
+ */
+static uint64
+VerifyBlockData(StringInfo existsBuffer, StringInfo valueBuffer,
+				ColumnBlockSkipNode *blockSkipNode, Form_pg_attribute attributeForm)
+{
+	uint32 rowCount = blockSkipNode->rowCount;
+	bool *existsArray = palloc0(rowCount * sizeof(bool));
+	StringInfo datumBuffer = DecompressBuffer(valueBuffer,
+											  blockSkipNode->valueCompressionType);
+	uint64 decompressedLength = datumBuffer->len;
+	uint64 valueCount = 0;
+	uint32 datumOffset = 0;
+	uint32 rowIndex = 0;
+
+	DeserializeBoolArray(existsBuffer, existsArray, rowCount);
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		char *datumPointer = datumBuffer->data + datumOffset;
+		uint32 bytesLeft = datumBuffer->len - datumOffset;
+		uint32 datumLength = 0;
+
+		if (!existsArray[rowIndex])
+		{
+			continue;
+		}
+
+		if (attributeForm->attlen > 0)
+		{
+			datumLength = attributeForm->attlen;
+		}
+		else if (attributeForm->attlen == -1)
+		{
+			if (bytesLeft > 0 && (VARATT_IS_1B(datumPointer) || bytesLeft >= VARHDRSZ))
+			{
+				datumLength = VARSIZE_ANY(datumPointer);
+			}
+		}
+		else if (bytesLeft > 0)
+		{
+			datumLength = strnlen(datumPointer, bytesLeft) + 1;
+		}
+
+		if (datumLength == 0 || datumLength > bytesLeft)
+		{
+			ereport(ERROR, (errmsg("value %u of the block doesn't fit in its value "
+								   "stream", rowIndex + 1)));
+		}
+
+		datumOffset = att_align_nominal(datumOffset + datumLength,
+										attributeForm->attalign);
+		valueCount++;
+	}
+
+	if (datumOffset != datumBuffer->len)
+	{
+		ereport(ERROR, (errmsg("value stream has %d bytes after its last value",
+							   (int) (datumBuffer->len - datumOffset))));
+	}
+
+	if (blockSkipNode->hasValueCount && blockSkipNode->valueCount != valueCount)
+	{
+		ereport(ERROR, (errmsg("block has " UINT64_FORMAT " values, but its skip "
+							   "list says " UINT64_FORMAT, valueCount,
+							   blockSkipNode->valueCount)));
+	}
+
+	if (datumBuffer != valueBuffer)
+	{
+		pfree(datumBuffer->data);
+		pfree(datumBuffer);
+	}
+
+	pfree(existsArray);
+
+	return decompressedLength;
+}
+
+
+/* BlockVerifyErrorCallback adds the block being read to error messages. */
+static void
+BlockVerifyErrorCallback(void *arg)
+{
+	BlockVerifyContext *verifyContext = (BlockVerifyContext *) arg;
+
+	if (verifyContext->columnIndex < 0)
+	{
+		errcontext("stripe %u of file \"%s\"", verifyContext->stripeIndex,
+				   verifyContext->filename);
+	}
+	else
+	{
+		errcontext("block %u of column %d in stripe %u of file \"%s\"",
+				   verifyContext->blockIndex, verifyContext->columnIndex + 1,
+				   verifyContext->stripeIndex, verifyContext->filename);
+	}
+}
+
+
+/*
+ * ReadSegmentFooters reads the footers of the given number of segment files of
+ * a table, opens the segments' data files into the given file array, and returns
+ * a footer that has the stripes of all segments. Segments other than the first
+ * one get their footer when their first load finishes, so we skip segments that
+ * don't have a footer yet. All segments must have the same block row count. The
+ * returned footer has the last delta store generation merged into any segment.
+ * If the first footer filename isn't NULL, the first segment's footer is read
+ * from that file.
+ */
+static TableFooter *
+ReadSegmentFooters(const char *filename, uint32 segmentCount, FILE **tableFileArray,
+				   StringInfo firstFooterFilename)
+{
+	TableFooter *tableFooter = NULL;
+	uint32 segmentIndex = 0;
+
+	for (segmentIndex = 0; segmentIndex < segmentCount; segmentIndex++)
+	{
+		char *segmentFilename = CStoreSegmentFilename(filename, segmentIndex);
+		StringInfo tableFooterFilename = makeStringInfo();
+		TableFooter *segmentFooter = NULL;
+		ListCell *stripeMetadataCell = NULL;
+		FILE *tableFile = NULL;
+		struct stat statBuffer;
+
+		if (segmentIndex == 0 && firstFooterFilename != NULL)
+		{
+			appendStringInfoString(tableFooterFilename, firstFooterFilename->data);
+		}
+		else
+		{
+			appendStringInfo(tableFooterFilename, "%s%s", segmentFilename,
+							 CSTORE_FOOTER_FILE_SUFFIX);
+		}
+
+		if (segmentIndex > 0 && stat(tableFooterFilename->data, &statBuffer) < 0)
+		{
+			continue;
+		}
+
+		segmentFooter = CStoreReadFooter(tableFooterFilename);
+
+		tableFile = AllocateFile(segmentFilename, PG_BINARY_R);
+		if (tableFile == NULL)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not open file \"%s\" for reading: %m",
+								   segmentFilename)));
+		}
+
+		foreach(stripeMetadataCell, segmentFooter->stripeMetadataList)
+		{
+			StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+			stripeMetadata->segmentIndex = segmentIndex;
+		}
+
+		if (tableFooter == NULL)
+		{
+			tableFooter = segmentFooter;
+		}
+		else if (segmentFooter->blockRowCount != tableFooter->blockRowCount)
+		{
+			ereport(ERROR, (errmsg("could not read column store"),
+							errdetail("segment files have different block row "
+									  "counts")));
+		}
+		else
+		{
+			tableFooter->stripeMetadataList =
+				list_concat(tableFooter->stripeMetadataList,
+							segmentFooter->stripeMetadataList);
+			tableFooter->mergedDeltaGeneration =
+				Max(tableFooter->mergedDeltaGeneration,
+					segmentFooter->mergedDeltaGeneration);
+		}
+
+		tableFileArray[segmentIndex] = tableFile;
+
+		pfree(tableFooterFilename->data);
+		pfree(tableFooterFilename);
+	}
+
+	return tableFooter;
+}
+
+
+/*
+ * CStoreSegmentFilename returns the data filename of the given segment of a
+ * table. The first segment uses the table's filename, so tables created before
+ * segments existed have a single segment.
+ */
+char *
+CStoreSegmentFilename(const char *filename, uint32 segmentIndex)
+{
+	StringInfo segmentFilename = makeStringInfo();
+
+	if (segmentIndex == 0)
+	{
+		appendStringInfoString(segmentFilename, filename);
+	}
+	else
+	{
+		appendStringInfo(segmentFilename, "%s.%u", filename, segmentIndex);
+	}
+
+	return segmentFilename->data;
+}
+
+
+/*
+ * CStoreReadSegmentCount reads the table's segment manifest, and returns the
+ * number of segment files in the table. Tables without a manifest have a single
+ * segment.
+ */
+uint32
+CStoreReadSegmentCount(const char *filename)
+{
+	uint32 segmentCount = 0;
+	StringInfo manifestFilename = makeStringInfo();
+	StringInfo manifestBuffer = NULL;
+	FILE *manifestFile = NULL;
+
+	appendStringInfo(manifestFilename, "%s%s", filename, CSTORE_MANIFEST_FILE_SUFFIX);
+
+	manifestFile = AllocateFile(manifestFilename->data, PG_BINARY_R);
+	if (manifestFile == NULL)
+	{
+		if (errno != ENOENT)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not open file \"%s\" for reading: %m",
+								   manifestFilename->data)));
+		}
+
+		return 1;
+	}
+
+	manifestBuffer = ReadFromFile(manifestFile, 0, FILESize(manifestFile));
+	segmentCount = DeserializeSegmentManifest(manifestBuffer);
+
+	FreeFile(manifestFile);
+	pfree(manifestFilename->data);
+	pfree(manifestFilename);
+
+	return segmentCount;
+}
+
+
+/*
+ * StripeRowCount reads serialized stripe footer, the first column's
+ * skip list, and returns number of rows for given stripe.
+ */
+static uint64
+StripeRowCount(FILE *tableFile, StripeMetadata *stripeMetadata)
+{
+	uint64 rowCount = 0;
+	StripeFooter *stripeFooter = NULL;
+	StringInfo footerBuffer = NULL;
+	StringInfo firstColumnSkipListBuffer = NULL;
+	uint64 footerOffset = 0;
+
+	footerOffset += stripeMetadata->fileOffset;
+	footerOffset += stripeMetadata->skipListLength;
+	footerOffset += stripeMetadata->dataLength;
+
+	footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
+	stripeFooter = DeserializeStripeFooter(footerBuffer);
+
+	firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
+	                                         stripeFooter->skipListSizeArray[0]);
+	rowCount =  DeserializeRowCount(firstColumnSkipListBuffer);
+
+	return rowCount;
+}
+
+
+/*
+ * LoadCachedStripeMetadata reads the given stripe's footer and skip list into
+ * the read state's stripe metadata cache, unless they were read before. Unless
+ * the read caches all stripes, we first free the metadata of stripes that the
+ * read no longer uses.
+ */
+static void
+LoadCachedStripeMetadata(TableReadState *readState, uint32 stripeIndex)
+{
+	StripeMetadata *stripeMetadata = NULL;
+	StripeFooter *stripeFooter = NULL;
+	StripeSkipList *stripeSkipList = NULL;
+	FILE *tableFile = NULL;
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	uint32 columnCount = tupleDescriptor->natts;
+	bool *projectedColumnMask = NULL;
+	MemoryContext oldContext = NULL;
+
+	if (readState->stripeSkipListArray[stripeIndex] != NULL)
+	{
+		return;
+	}
+
+	EvictStripeMetadata(readState);
+
+	oldContext = MemoryContextSwitchTo(readState->stripeMetadataContext);
+
+	if (!readState->cacheAllStripes)
+	{
+		readState->cachedStripeList = lappend_int(readState->cachedStripeList,
+												  (int) stripeIndex);
+	}
+
+	readState->stripeCacheContextArray[stripeIndex] =
+		AllocSetContextCreate(readState->stripeMetadataContext,
+							  "Stripe Skip List Memory Context",
+							  ALLOCSET_DEFAULT_SIZES);
+	MemoryContextSwitchTo(readState->stripeCacheContextArray[stripeIndex]);
+
+	stripeMetadata = readState->stripeMetadataArray[stripeIndex];
+	tableFile = readState->tableFileArray[stripeMetadata->segmentIndex];
+	projectedColumnMask = ProjectedColumnMask(columnCount,
+											  readState->projectedColumnList);
+
+	stripeFooter = LoadStripeFooter(tableFile, stripeMetadata, columnCount);
+	stripeSkipList = LoadStripeSkipList(tableFile, stripeMetadata,
+										stripeFooter, columnCount,
+										projectedColumnMask, tupleDescriptor,
+										CStoreVerifyChecksums);
+
+	readState->stripeFooterArray[stripeIndex] = stripeFooter;
+	readState->stripeSkipListArray[stripeIndex] = stripeSkipList;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * EvictStripeMetadata frees the cached footers and skip lists of the stripes
+ * that the read no longer uses, which are all but its current stripe and the
+ * stripe whose buffers are loaded. Reads that cache all stripes keep them.
+ */
+static void
+EvictStripeMetadata(TableReadState *readState)
+{
+	List *keptStripeList = NIL;
+	ListCell *cachedStripeCell = NULL;
+	MemoryContext oldContext = NULL;
+
+	if (readState->cacheAllStripes || readState->cachedStripeList == NIL)
+	{
+		return;
+	}
+
+	oldContext = MemoryContextSwitchTo(readState->stripeMetadataContext);
+
+	foreach(cachedStripeCell, readState->cachedStripeList)
+	{
+		int cachedStripeIndex = lfirst_int(cachedStripeCell);
+
+		if (cachedStripeIndex == readState->stripeIndex ||
+			cachedStripeIndex == readState->loadedStripeIndex)
+		{
+			keptStripeList = lappend_int(keptStripeList, cachedStripeIndex);
+			continue;
+		}
+
+		MemoryContextDelete(readState->stripeCacheContextArray[cachedStripeIndex]);
+		readState->stripeCacheContextArray[cachedStripeIndex] = NULL;
+		readState->stripeFooterArray[cachedStripeIndex] = NULL;
+		readState->stripeSkipListArray[cachedStripeIndex] = NULL;
+	}
+
+	list_free(readState->cachedStripeList);
+	readState->cachedStripeList = keptStripeList;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * LoadSelectedStripeBuffers reads serialized stripe data from the given file for
+ * blocks that are set in the selected block mask, and only loads columns that
+ * are projected in the query.
+ */
+static StripeBuffers *
+LoadSelectedStripeBuffers(FILE *tableFile, StripeMetadata *stripeMetadata,
+						  StripeFooter *stripeFooter, StripeSkipList *stripeSkipList,
+						  TupleDesc tupleDescriptor, List *projectedColumnList,
+						  bool *selectedBlockMask)
+{
+	StripeBuffers *stripeBuffers = NULL;
+	ColumnBuffers **columnBuffersArray = NULL;
+	uint32 *blockIndexArray = NULL;
+	uint64 currentColumnFileOffset = 0;
+	uint32 columnIndex = 0;
+	uint32 columnCount = tupleDescriptor->natts;
+	uint32 blockIndex = 0;
+	uint32 selectedBlockIndex = 0;
+
+	bool *projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
+
+	StripeSkipList *selectedBlockSkipList =
+		SelectedBlockSkipList(stripeSkipList, projectedColumnMask,
+							  selectedBlockMask);
+
+	/* load column data for projected columns */
+	columnBuffersArray = palloc0(columnCount * sizeof(ColumnBuffers *));
+	currentColumnFileOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength;
+
+	for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+	{
+		uint64 existsSize = stripeFooter->existsSizeArray[columnIndex];
+		uint64 valueSize = stripeFooter->valueSizeArray[columnIndex];
+		uint64 existsFileOffset = currentColumnFileOffset;
+		uint64 valueFileOffset = currentColumnFileOffset + existsSize;
+
+		if (projectedColumnMask[columnIndex])
+		{
+			ColumnBlockSkipNode *blockSkipNode =
+				selectedBlockSkipList->blockSkipNodeArray[columnIndex];
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+			uint32 blockCount = selectedBlockSkipList->blockCount;
+
+			ColumnBuffers *columnBuffers = LoadColumnBuffers(tableFile, blockSkipNode,
+															 blockCount,
+															 existsFileOffset,
+															 valueFileOffset,
+															 attributeForm);
+
+			columnBuffersArray[columnIndex] = columnBuffers;
+		}
+
+		currentColumnFileOffset += existsSize;
+		currentColumnFileOffset += valueSize;
+	}
+
+	/* remember selected blocks' indexes in the stripe to find deleted rows */
+	blockIndexArray = palloc0(selectedBlockSkipList->blockCount * sizeof(uint32));
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	{
+		if (selectedBlockMask[blockIndex])
+		{
+			blockIndexArray[selectedBlockIndex] = blockIndex;
+			selectedBlockIndex++;
+		}
+	}
+
+	stripeBuffers = palloc0(sizeof(StripeBuffers));
+	stripeBuffers->columnCount = columnCount;
+	stripeBuffers->rowCount = StripeSkipListRowCount(selectedBlockSkipList);
+	stripeBuffers->columnBuffersArray = columnBuffersArray;
+	stripeBuffers->blockIndexArray = blockIndexArray;
+
+	return stripeBuffers;
+}
+
+
+/*
+ * ReadStripeNextRow reads the next row from the given stripe, finds the projected
+ * column values within this row, and accordingly sets the column values and nulls.
+ * Note that this function sets the values for all non-projected columns to null.
+ */
+static void
+ReadStripeNextRow(StripeBuffers *stripeBuffers, List *projectedColumnList,
+				  uint64 blockIndex, uint64 blockRowIndex,
+				  ColumnBlockData **blockDataArray, Datum *columnValues,
+				  bool *columnNulls)
+{
+	ListCell *projectedColumnCell = NULL;
+
+	/* set all columns to null by default */
+	memset(columnNulls, 1, stripeBuffers->columnCount * sizeof(bool));
+
+	foreach(projectedColumnCell, projectedColumnList)
+	{
+		Var *projectedColumn = lfirst(projectedColumnCell);
+		uint32 projectedColumnIndex = projectedColumn->varattno - 1;
+		ColumnBlockData *blockData = blockDataArray[projectedColumnIndex];
+
+		if (blockData->existsArray[blockRowIndex])
+		{
+			columnValues[projectedColumnIndex] = blockData->valueArray[blockRowIndex];
+			columnNulls[projectedColumnIndex] = false;
+		}
+	}
+}
+
+
+/*
+ * LoadColumnBuffers reads serialized column data from the given file. These
+ * column data are laid out as sequential blocks in the file; and block positions
+ * and lengths are retrieved from the column block skip node array.
+ */
+static ColumnBuffers *
+LoadColumnBuffers(FILE *tableFile, ColumnBlockSkipNode *blockSkipNodeArray,
+				  uint32 blockCount, uint64 existsFileOffset, uint64 valueFileOffset,
+				  Form_pg_attribute attributeForm)
+{
+	ColumnBuffers *columnBuffers = NULL;
+	uint32 blockIndex = 0;
+	ColumnBlockBuffers **blockBuffersArray =
+			palloc0(blockCount * sizeof(ColumnBlockBuffers *));
+
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		blockBuffersArray[blockIndex] = palloc0(sizeof(ColumnBlockBuffers));
+	}
+
+	/*
+	 * We first read the "exists" blocks. We don't read "values" array here,
+	 * because "exists" blocks are stored sequentially on disk, and we want to
+	 * minimize disk seeks.
+	 */
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		uint64 existsOffset = existsFileOffset + blockSkipNode->existsBlockOffset;
+		StringInfo rawExistsBuffer = ReadFromFile(tableFile, existsOffset,
+												  blockSkipNode->existsLength);
+
+		if (CStoreVerifyChecksums && blockSkipNode->hasChecksum)
+		{
+			CheckBufferChecksum(rawExistsBuffer, blockSkipNode->existsChecksum,
+								"exists stream", attributeForm);
+		}
+
+		blockBuffersArray[blockIndex]->existsBuffer = rawExistsBuffer;
+	}
+
+	/* then read "values" blocks, which are also stored sequentially on disk */
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		CompressionType compressionType = blockSkipNode->valueCompressionType;
+		uint64 valueOffset = valueFileOffset + blockSkipNode->valueBlockOffset;
+		StringInfo rawValueBuffer = ReadFromFile(tableFile, valueOffset,
+												 blockSkipNode->valueLength);
+
+		if (CStoreVerifyChecksums && blockSkipNode->hasChecksum)
+		{
+			CheckBufferChecksum(rawValueBuffer, blockSkipNode->valueChecksum,
+								"value stream", attributeForm);
+		}
+
+		blockBuffersArray[blockIndex]->valueBuffer = rawValueBuffer;
+		blockBuffersArray[blockIndex]->valueCompressionType = compressionType;
+	}
+
+	columnBuffers = palloc0(sizeof(ColumnBuffers));
+	columnBuffers->blockBuffersArray = blockBuffersArray;
+
+	return columnBuffers;
+}
+
+
+/* Reads and returns the given stripe's footer. */
+static StripeFooter *
+LoadStripeFooter(FILE *tableFile, StripeMetadata *stripeMetadata,
+				 uint32 columnCount)
+{
+	StripeFooter *stripeFooter = NULL;
+	StringInfo footerBuffer = NULL;
+	uint64 footerOffset = 0;
+
+	footerOffset += stripeMetadata->fileOffset;
+	footerOffset += stripeMetadata->skipListLength;
+	footerOffset += stripeMetadata->dataLength;
+
+	footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
+	stripeFooter = DeserializeStripeFooter(footerBuffer);
+	if (stripeFooter->columnCount > columnCount)
+	{
+		ereport(ERROR, (errmsg("stripe footer column count and table column count "
+							   "don't match")));
+	}
+
+	return stripeFooter;
+}
+
+
+/*
+ * Reads the skip list for the given stripe. We read the skip lists of all the
+ * stripe's columns with one read, and then deserialize the projected columns'
+ * skip lists from that buffer. Skip nodes of flat skip lists point into their
+ * buffer for columns of by-reference types, so we copy these columns' skip
+ * lists out of the region, and free the region when we are done. If
+ * verifyChecksums is true and the stripe has skip list checksums, the function
+ * checks the skip lists it deserializes.
+ */
+static StripeSkipList *
+LoadStripeSkipList(FILE *tableFile, StripeMetadata *stripeMetadata,
+				   StripeFooter *stripeFooter, uint32 columnCount,
+				   bool *projectedColumnMask,
+				   TupleDesc tupleDescriptor, bool verifyChecksums)
+{
+	StripeSkipList *stripeSkipList = NULL;
+	ColumnBlockSkipNode **blockSkipNodeArray = NULL;
+	StringInfo skipListRegionBuffer = NULL;
+	StringInfo firstColumnSkipListBuffer = NULL;
+	uint64 skipListRegionLength = 0;
+	uint64 currentColumnSkipListOffset = 0;
+	uint32 columnIndex = 0;
+	uint32 stripeBlockCount = 0;
+	uint32 stripeColumnCount = stripeFooter->columnCount;
+	uint32 *skipListChecksumArray = stripeFooter->skipListChecksumArray;
+
+	if (!verifyChecksums)
+	{
+		skipListChecksumArray = NULL;
+	}
+
+	/* read the skip lists of all columns, which come first in the stripe */
+	for (columnIndex = 0; columnIndex < stripeColumnCount; columnIndex++)
+	{
+		skipListRegionLength += stripeFooter->skipListSizeArray[columnIndex];
+	}
+
+	skipListRegionBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
+										skipListRegionLength);
+
+	/* deserialize block count */
+	firstColumnSkipListBuffer = SkipListBuffer(skipListRegionBuffer, 0,
+											   stripeFooter->skipListSizeArray[0],
+											   !TupleDescAttr(tupleDescriptor, 0)->attbyval);
+	if (skipListChecksumArray != NULL)
+	{
+		CheckBufferChecksum(firstColumnSkipListBuffer, skipListChecksumArray[0],
+							"skip list", TupleDescAttr(tupleDescriptor, 0));
+	}
+
+	stripeBlockCount = DeserializeBlockCount(firstColumnSkipListBuffer);
+
+	/* deserialize column skip lists */
+	blockSkipNodeArray = palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
+
+	for (columnIndex = 0; columnIndex < stripeColumnCount; columnIndex++)
+	{
+		uint64 columnSkipListSize = stripeFooter->skipListSizeArray[columnIndex];
+		bool firstColumn = columnIndex == 0;
+
+		/*
+		 * Only selected columns' column skip lists are read. However, the first
+		 * column's skip list is read regardless of being selected. It is used by
+		 * StripeSkipListRowCount later.
+		 */
+		if (projectedColumnMask[columnIndex] || firstColumn)
+		{
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+
+			StringInfo columnSkipListBuffer = firstColumnSkipListBuffer;
+			ColumnBlockSkipNode *columnSkipList = NULL;
+			uint64 sortKeyVersion = 0;
+
+			if (!firstColumn)
+			{
+				columnSkipListBuffer = SkipListBuffer(skipListRegionBuffer,
+													  currentColumnSkipListOffset,
+													  columnSkipListSize,
+													  !attributeForm->attbyval);
+			}
+
+			if (skipListChecksumArray != NULL && !firstColumn)
+			{
+				CheckBufferChecksum(columnSkipListBuffer,
+									skipListChecksumArray[columnIndex],
+									"skip list", attributeForm);
+			}
+
+			if (SortKeyCollation(attributeForm->atttypid, attributeForm->attcollation))
+			{
+				sortKeyVersion = SortKeyVersion(attributeForm->attcollation);
+			}
+
+			columnSkipList = DeserializeColumnSkipList(columnSkipListBuffer,
+													   attributeForm->attbyval,
+													   attributeForm->attlen,
+													   stripeBlockCount,
+													   sortKeyVersion);
+			blockSkipNodeArray[columnIndex] = columnSkipList;
+
+			if (attributeForm->attbyval)
+			{
+				FreeSkipListBuffer(skipListRegionBuffer, columnSkipListBuffer);
+			}
+		}
+
+		currentColumnSkipListOffset += columnSkipListSize;
+	}
+
+	pfree(skipListRegionBuffer->data);
+	pfree(skipListRegionBuffer);
+
+	/* table contains additional columns added after this stripe is created */
+	for (columnIndex = stripeColumnCount; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnBlockSkipNode *columnSkipList = NULL;
+		uint32 blockIndex = 0;
+		bool firstColumn = columnIndex == 0;
+
+		/* no need to create ColumnBlockSkipList if the column is not selected */
+		if (!projectedColumnMask[columnIndex] && !firstColumn)
+		{
+			blockSkipNodeArray[columnIndex] = NULL;
+			continue;
+		}
+
+		/* create empty ColumnBlockSkipNode for missing columns*/
+		columnSkipList = palloc0(stripeBlockCount * sizeof(ColumnBlockSkipNode));
+
+		for (blockIndex = 0; blockIndex < stripeBlockCount; blockIndex++)
+		{
+			columnSkipList[blockIndex].rowCount = 0;
+			columnSkipList[blockIndex].hasMinMax = false;
+			columnSkipList[blockIndex].minimumValue = 0;
+			columnSkipList[blockIndex].maximumValue = 0;
+			columnSkipList[blockIndex].hasValueCount = false;
+			columnSkipList[blockIndex].hasValueSum = false;
+			columnSkipList[blockIndex].existsBlockOffset = 0;
+			columnSkipList[blockIndex].valueBlockOffset = 0;
+			columnSkipList[blockIndex].existsLength = 0;
+			columnSkipList[blockIndex].valueLength = 0;
+			columnSkipList[blockIndex].valueCompressionType = COMPRESSION_NONE;
+			columnSkipList[blockIndex].hasChecksum = false;
+		}
+		blockSkipNodeArray[columnIndex] = columnSkipList;
+	}
+
+	stripeSkipList = palloc0(sizeof(StripeSkipList));
+	stripeSkipList->blockSkipNodeArray = blockSkipNodeArray;
+	stripeSkipList->columnCount = columnCount;
+	stripeSkipList->blockCount = stripeBlockCount;
+
+	return stripeSkipList;
+}
+
+
+/*
+ * SkipListBuffer returns the column skip list at the given offset of a stripe's
+ * skip list region as a buffer. Flat skip lists are used in place, so unless
+ * the caller asks for a copy that outlives the region, we only copy the skip
+ * list if it doesn't start at a maximally aligned address.
+ */
+static StringInfo
+SkipListBuffer(StringInfo skipListRegionBuffer, uint64 offset, uint64 length, bool copy)
+{
+	StringInfo skipListBuffer = NULL;
+	char *skipListData = skipListRegionBuffer->data + offset;
+
+	Assert(offset + length <= (uint64) skipListRegionBuffer->len);
+
+	if (!copy && skipListData == (char *) MAXALIGN(skipListData))
+	{
+		skipListBuffer = palloc0(sizeof(StringInfoData));
+		skipListBuffer->data = skipListData;
+		skipListBuffer->len = length;
+		skipListBuffer->maxlen = length;
+	}
+	else
+	{
+		skipListBuffer = makeStringInfo();
+		appendBinaryStringInfo(skipListBuffer, skipListData, length);
+	}
+
+	return skipListBuffer;
+}
+
+
+/*
+ * FreeSkipListBuffer frees the given buffer that SkipListBuffer returned, and
+ * its data unless the data is in the given skip list region.
+ */
+static void
+FreeSkipListBuffer(StringInfo skipListRegionBuffer, StringInfo skipListBuffer)
+{
+	char *regionStart = skipListRegionBuffer->data;
+	char *regionEnd = skipListRegionBuffer->data + skipListRegionBuffer->len;
+
+	if (skipListBuffer->data < regionStart || skipListBuffer->data >= regionEnd)
+	{
+		pfree(skipListBuffer->data);
+	}
+
+	pfree(skipListBuffer);
+}
+
+
+/*
+ * CheckBufferChecksum errors out if the CRC-32C checksum of the given buffer,
+ * which is the named stream or skip list of the given column, doesn't match the
+ * checksum that was stored with it. PostgreSQL versions before 9.5 don't have
+ * CRC-32C, so we don't write or check checksums on them.
+ */
+static void
+CheckBufferChecksum(StringInfo buffer, uint32 expectedChecksum,
+					const char *streamName, Form_pg_attribute attributeForm)
+{
+#if PG_VERSION_NUM >= 90500
+	uint32 checksum = BufferChecksum(buffer);
+
+	if (checksum != expectedChecksum)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("checksum mismatch in %s of column \"%s\"",
+							   streamName, NameStr(attributeForm->attname)),
+						errdetail("expected checksum %u, but computed %u",
+								  expectedChecksum, checksum)));
+	}
+#endif
+}
+
+
+/*
+ * SelectedBlockMask walks over each column's blocks and checks if a block can
+ * be filtered without reading its data. The filtering happens when all rows in
+ * the block can be refuted by the given qualifier conditions.
+ */
+static bool *
+SelectedBlockMask(StripeSkipList *stripeSkipList, List *projectedColumnList,
+				  List *whereClauseList)
+{
+	bool *selectedBlockMask = NULL;
+	ListCell *columnCell = NULL;
+	uint32 blockIndex = 0;
+	List *restrictInfoList = BuildRestrictInfoList(whereClauseList);
+
+	selectedBlockMask = palloc0(stripeSkipList->blockCount * sizeof(bool));
+	memset(selectedBlockMask, true, stripeSkipList->blockCount * sizeof(bool));
+
+	foreach(columnCell, projectedColumnList)
+	{
+		Var *column = lfirst(columnCell);
+		uint32 columnIndex = column->varattno - 1;
+		FmgrInfo *comparisonFunction = NULL;
+		Node *baseConstraint = NULL;
+		bool hasSortKeyBounds = false;
+		bytea *lowerSortKey = NULL;
+		bytea *upperSortKey = NULL;
+
+		/* if this column's data type doesn't have a comparator, skip it */
+		comparisonFunction = GetFunctionInfoOrNull(column->vartype, BTREE_AM_OID,
+												   BTORDER_PROC);
+		if (comparisonFunction == NULL)
+		{
+			continue;
+		}
+
+		hasSortKeyBounds = SortKeyBounds(whereClauseList, column, comparisonFunction,
+										 &lowerSortKey, &upperSortKey);
+
+		baseConstraint = BuildBaseConstraint(column);
+		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		{
+			bool predicateRefuted = false;
+			List *constraintList = NIL;
+			ColumnBlockSkipNode *blockSkipNodeArray =
+				stripeSkipList->blockSkipNodeArray[columnIndex];
+			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+			/*
+			 * Sort keys refute range qualifiers with memcmp() instead of
+			 * comparing values under the collation. If they don't, other
+			 * qualifiers on the column may still refute the block.
+			 */
+			if (hasSortKeyBounds && blockSkipNode->hasSortKeys &&
+				SortKeysRefuted(blockSkipNode, lowerSortKey, upperSortKey))
+			{
+				selectedBlockMask[blockIndex] = false;
+				continue;
+			}
+
+			/*
+			 * A column block with comparable data type can miss min/max values
+			 * if all values in the block are NULL.
+			 */
+			if (!blockSkipNode->hasMinMax)
+			{
+				continue;
+			}
+
+			UpdateConstraint(baseConstraint, blockSkipNode->minimumValue,
+							 blockSkipNode->maximumValue);
+
+			constraintList = list_make1(baseConstraint);
+#if (PG_VERSION_NUM >= 100000)
+			predicateRefuted = predicate_refuted_by(constraintList, restrictInfoList, false);
+#else
+			predicateRefuted = predicate_refuted_by(constraintList, restrictInfoList);
+#endif
+			if (predicateRefuted)
+			{
+				selectedBlockMask[blockIndex] = false;
+			}
+		}
+	}
+
+	return selectedBlockMask;
+}
+
+
+/*
+ * SortKeyBounds finds the bounds that the given qualifiers put on the given text
+ * column, and sets the sort keys of these bounds under the column's collation.
+ * Missing bounds get NULL sort keys. The function returns false if the column's
+ * collation has no sort keys, or if the qualifiers don't bound the column.
+ */
+static bool
+SortKeyBounds(List *whereClauseList, Var *column, FmgrInfo *comparisonFunction,
+			  bytea **lowerSortKey, bytea **upperSortKey)
+{
+	StripeRangeQuery rangeQuery;
+
+	(*lowerSortKey) = NULL;
+	(*upperSortKey) = NULL;
+
+	if (!SortKeyCollation(column->vartype, column->varcollid))
+	{
+		return false;
+	}
+
+	memset(&rangeQuery, 0, sizeof(StripeRangeQuery));
+	rangeQuery.comparisonFunction = comparisonFunction;
+	rangeQuery.collation = column->varcollid;
+
+	FindRangeBounds(whereClauseList, column->varattno, column->vartype, &rangeQuery);
+	if (!rangeQuery.hasLowerBound && !rangeQuery.hasUpperBound)
+	{
+		return false;
+	}
+
+	if (rangeQuery.hasLowerBound)
+	{
+		(*lowerSortKey) = TextSortKey(rangeQuery.lowerBound, column->varcollid);
+	}
+
+	if (rangeQuery.hasUpperBound)
+	{
+		(*upperSortKey) = TextSortKey(rangeQuery.upperBound, column->varcollid);
+	}
+
+	return true;
+}
+
+
+/*
+ * SortKeysRefuted returns true if the sort keys of the given block skip node show
+ * that none of the block's values is between the given inclusive bounds. Since
+ * values with equal sort keys may still differ, only strict comparisons refute.
+ */
+static bool
+SortKeysRefuted(ColumnBlockSkipNode *blockSkipNode, bytea *lowerSortKey,
+				bytea *upperSortKey)
+{
+	if (lowerSortKey != NULL &&
+		CompareSortKeys(blockSkipNode->maximumSortKey, lowerSortKey) < 0)
+	{
+		return true;
+	}
+
+	if (upperSortKey != NULL &&
+		CompareSortKeys(blockSkipNode->minimumSortKey, upperSortKey) > 0)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * CompareSortKeys compares two sort keys byte by byte, and orders a key before
+ * the longer keys that it is a prefix of.
+ */
+static int
+CompareSortKeys(bytea *leftSortKey, bytea *rightSortKey)
+{
+	uint32 leftLength = VARSIZE_ANY_EXHDR(leftSortKey);
+	uint32 rightLength = VARSIZE_ANY_EXHDR(rightSortKey);
+	int comparison = memcmp(VARDATA_ANY(leftSortKey), VARDATA_ANY(rightSortKey),
+							Min(leftLength, rightLength));
+
+	if (comparison == 0 && leftLength != rightLength)
+	{
+		comparison = (leftLength < rightLength) ? -1 : 1;
+	}
+
+	return comparison;
+}
+
+
+/*
+ * StripeIndexBlockList looks up the key of the read's equality qualifier on the
+ * given stripe's index column in the stripe's sparse index. If the stripe has a
+ * sparse index and the read has such a qualifier, the function sets the given
+ * list to the indexes of the stripe's blocks that may have the key, and returns
+ * true. Since the index keeps value hashes, these blocks may still not have it.
+ * The index is sorted by hash, so we binary search for the key's first entry.
+ */
+static bool
+StripeIndexBlockList(TableReadState *readState, StripeMetadata *stripeMetadata,
+					 List **indexedBlockList)
+{
+	FILE *tableFile = readState->tableFileArray[stripeMetadata->segmentIndex];
+	uint64 indexOffset = 0;
+	uint64 entryCount = stripeMetadata->indexLength / sizeof(StripeIndexEntry);
+	uint64 lowerEntryIndex = 0;
+	uint64 upperEntryIndex = entryCount;
+	uint64 entryIndex = 0;
+	uint32 keyHash = 0;
+
+	(*indexedBlockList) = NIL;
+
+	if (entryCount == 0 ||
+		!IndexKeyHash(readState, stripeMetadata->indexColumnIndex, &keyHash))
+	{
+		return false;
+	}
+
+	indexOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength +
+				  stripeMetadata->dataLength + stripeMetadata->footerLength;
+
+	while (lowerEntryIndex < upperEntryIndex)
+	{
+		uint64 middleEntryIndex = lowerEntryIndex +
+								  (upperEntryIndex - lowerEntryIndex) / 2;
+		StripeIndexEntry indexEntry = ReadStripeIndexEntry(tableFile, indexOffset,
+														   middleEntryIndex);
+
+		if (indexEntry.valueHash < keyHash)
+		{
+			lowerEntryIndex = middleEntryIndex + 1;
+		}
+		else
+		{
+			upperEntryIndex = middleEntryIndex;
+		}
+	}
+
+	for (entryIndex = lowerEntryIndex; entryIndex < entryCount; entryIndex++)
+	{
+		StripeIndexEntry indexEntry = ReadStripeIndexEntry(tableFile, indexOffset,
+														   entryIndex);
+		if (indexEntry.valueHash != keyHash)
+		{
+			break;
+		}
+
+		(*indexedBlockList) = lappend_int(*indexedBlockList, indexEntry.blockIndex);
+	}
+
+	return true;
+}
+
+
+/*
+ * IndexKeyHash sets the given key hash to the hash of the constant that one of
+ * the read's qualifiers checks the given column for equality with, and returns
+ * true if there is such a qualifier. We remember the result for the column, as
+ * the stripes of a table usually index the same column.
+ */
+static bool
+IndexKeyHash(TableReadState *readState, uint32 columnIndex, uint32 *keyHash)
+{
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+
+	if (columnIndex >= (uint32) tupleDescriptor->natts)
+	{
+		return false;
+	}
+
+	if (readState->indexKeyColumnIndex != (int32) columnIndex)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		readState->indexKeyColumnIndex = columnIndex;
+		readState->indexKeyFound = false;
+		if (!attributeForm->attisdropped)
+		{
+			readState->indexKeyFound = FindIndexKeyHash(readState->whereClauseList,
+														attributeForm,
+														&readState->indexKeyHash);
+		}
+	}
+
+	(*keyHash) = readState->indexKeyHash;
+
+	return readState->indexKeyFound;
+}
+
+
+/*
+ * FindIndexKeyHash looks for a qualifier that compares the given column with a
+ * constant using the equality operator of the column type's default hash
+ * operator class. If found, the function sets the given key hash to the hash
+ * that writers compute for the constant, and returns true. The qualifier must
+ * use the column's collation, since writers hash values with it.
+ */
+static bool
+FindIndexKeyHash(List *whereClauseList, Form_pg_attribute attributeForm,
+				 uint32 *keyHash)
+{
+	Oid columnTypeId = attributeForm->atttypid;
+	Oid operatorClassId = GetDefaultOpClass(columnTypeId, HASH_AM_OID);
+	Oid operatorFamilyId = InvalidOid;
+	FmgrInfo *hashFunction = NULL;
+	ListCell *clauseCell = NULL;
+
+	if (operatorClassId == InvalidOid)
+	{
+		return false;
+	}
+
+	operatorFamilyId = get_opclass_family(operatorClassId);
+	hashFunction = GetFunctionInfoOrNull(columnTypeId, HASH_AM_OID, HASHSTANDARD_PROC);
+	if (hashFunction == NULL)
+	{
+		return false;
+	}
+
+	foreach(clauseCell, whereClauseList)
+	{
+		Node *clause = (Node *) lfirst(clauseCell);
+		OpExpr *operatorExpression = NULL;
+		Node *leftOperand = NULL;
+		Node *rightOperand = NULL;
+		Var *column = NULL;
+		Const *constant = NULL;
+		Datum hashDatum = 0;
+
+		if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2)
+		{
+			continue;
+		}
+
+		operatorExpression = (OpExpr *) clause;
+		leftOperand = get_leftop((Expr *) operatorExpression);
+		rightOperand = get_rightop((Expr *) operatorExpression);
+
+		if (IsA(leftOperand, Var) && IsA(rightOperand, Const))
+		{
+			column = (Var *) leftOperand;
+			constant = (Const *) rightOperand;
+		}
+		else if (IsA(leftOperand, Const) && IsA(rightOperand, Var))
+		{
+			column = (Var *) rightOperand;
+			constant = (Const *) leftOperand;
+		}
+		else
+		{
+			continue;
+		}
+
+		if (column->varattno != attributeForm->attnum || constant->constisnull ||
+			constant->consttype != columnTypeId ||
+			operatorExpression->inputcollid != attributeForm->attcollation ||
+			get_op_opfamily_strategy(operatorExpression->opno,
+									 operatorFamilyId) != HTEqualStrategyNumber)
+		{
+			continue;
+		}
+
+		hashDatum = FunctionCall1Coll(hashFunction, attributeForm->attcollation,
+									  constant->constvalue);
+		(*keyHash) = DatumGetUInt32(hashDatum);
+
+		return true;
+	}
+
+	return false;
+}
+
+
+/* ReadStripeIndexEntry reads the entry at the given index of a sparse index. */
+static StripeIndexEntry
+ReadStripeIndexEntry(FILE *tableFile, uint64 indexOffset, uint64 entryIndex)
+{
+	StripeIndexEntry indexEntry;
+	StringInfo entryBuffer = ReadFromFile(tableFile,
+										  indexOffset +
+										  entryIndex * sizeof(StripeIndexEntry),
+										  sizeof(StripeIndexEntry));
+
+	memcpy(&indexEntry, entryBuffer->data, sizeof(StripeIndexEntry));
+
+	pfree(entryBuffer->data);
+	pfree(entryBuffer);
+
+	return indexEntry;
+}
 
 
 /*
- * LoadFilteredStripeBuffers reads serialized stripe data from the given file.
- * The function skips over blocks whose rows are refuted by restriction qualifiers,
- * and only loads columns that are projected in the query.
+ * RemoveUnindexedBlocks removes the blocks that aren't in the given list of
+ * blocks found in a stripe's sparse index from the given selected block mask.
  */
-static StripeBuffers *
-LoadFilteredStripeBuffers(FILE *tableFile, StripeMetadata *stripeMetadata,
-						  TupleDesc tupleDescriptor, List *projectedColumnList,
-						  List *whereClauseList)
+static void
+RemoveUnindexedBlocks(bool *selectedBlockMask, uint32 blockCount,
+					  List *indexedBlockList)
 {
-	StripeBuffers *stripeBuffers = NULL;
-	ColumnBuffers **columnBuffersArray = NULL;
-	uint64 currentColumnFileOffset = 0;
-	uint32 columnIndex = 0;
-	uint32 columnCount = tupleDescriptor->natts;
+	bool *indexedBlockMask = palloc0(blockCount * sizeof(bool));
+	ListCell *blockIndexCell = NULL;
+	uint32 blockIndex = 0;
 
-	StripeFooter *stripeFooter = LoadStripeFooter(tableFile, stripeMetadata,
-												  columnCount);
-	bool *projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
+	foreach(blockIndexCell, indexedBlockList)
+	{
+		uint32 indexedBlockIndex = (uint32) lfirst_int(blockIndexCell);
 
-	StripeSkipList *stripeSkipList = LoadStripeSkipList(tableFile, stripeMetadata,
-														stripeFooter, columnCount,
-														projectedColumnMask,
-														tupleDescriptor);
+		if (indexedBlockIndex < blockCount)
+		{
+			indexedBlockMask[indexedBlockIndex] = true;
+		}
+	}
 
-	bool *selectedBlockMask = SelectedBlockMask(stripeSkipList, projectedColumnList,
-												whereClauseList);
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		selectedBlockMask[blockIndex] = selectedBlockMask[blockIndex] &&
+										indexedBlockMask[blockIndex];
+	}
 
-	StripeSkipList *selectedBlockSkipList =
-		SelectedBlockSkipList(stripeSkipList, projectedColumnMask,
-							  selectedBlockMask);
+	pfree(indexedBlockMask);
+}
 
-	/* load column data for projected columns */
-	columnBuffersArray = palloc0(columnCount * sizeof(ColumnBuffers *));
-	currentColumnFileOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength;
 
-	for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+/*
+ * StripeMetadataArray returns an array with the stripes of the given stripe
+ * metadata list, so that reads find the metadata of any stripe in constant time.
+ */
+static StripeMetadata **
+StripeMetadataArray(List *stripeMetadataList)
+{
+	StripeMetadata **stripeMetadataArray = NULL;
+	ListCell *stripeMetadataCell = NULL;
+	uint32 stripeIndex = 0;
+
+	stripeMetadataArray = palloc0(Max(list_length(stripeMetadataList), 1) *
+								  sizeof(StripeMetadata *));
+
+	foreach(stripeMetadataCell, stripeMetadataList)
 	{
-		uint64 existsSize = stripeFooter->existsSizeArray[columnIndex];
-		uint64 valueSize = stripeFooter->valueSizeArray[columnIndex];
-		uint64 existsFileOffset = currentColumnFileOffset;
-		uint64 valueFileOffset = currentColumnFileOffset + existsSize;
+		stripeMetadataArray[stripeIndex] = (StripeMetadata *) lfirst(stripeMetadataCell);
+		stripeIndex++;
+	}
 
-		if (projectedColumnMask[columnIndex])
+	return stripeMetadataArray;
+}
+
+
+/*
+ * SelectReadStripes finds the stripes whose index column ranges the read's
+ * qualifiers don't refute, and keeps their sorted indexes in the read state.
+ * Stripes without a range for the column and the delta store stripe are always
+ * selected. We look the ranges up in the read's interval tree, so the cost of
+ * the selection grows with the number of selected stripes rather than with the
+ * table's stripe count. If the qualifiers don't bound the column, the read
+ * covers all stripes.
+ */
+static void
+SelectReadStripes(TableReadState *readState)
+{
+	StripeRangeQuery rangeQuery;
+	Form_pg_attribute attributeForm = NULL;
+	uint32 unrangedStripeIndex = 0;
+	MemoryContext oldContext = NULL;
+
+	readState->selectedStripeArray = NULL;
+	readState->selectedStripeCount = 0;
+
+	if (readState->whereClauseList == NIL)
+	{
+		return;
+	}
+
+	BuildStripeRangeTree(readState);
+	if (readState->rangeNodeCount == 0)
+	{
+		return;
+	}
+
+	attributeForm = TupleDescAttr(readState->tupleDescriptor,
+								  readState->rangeColumnIndex);
+
+	memset(&rangeQuery, 0, sizeof(StripeRangeQuery));
+	rangeQuery.comparisonFunction = readState->rangeComparisonFunction;
+	rangeQuery.collation = attributeForm->attcollation;
+
+	FindRangeBounds(readState->whereClauseList, attributeForm->attnum,
+					attributeForm->atttypid, &rangeQuery);
+	if (!rangeQuery.hasLowerBound && !rangeQuery.hasUpperBound)
+	{
+		return;
+	}
+
+	/* selected stripes live until the qualifiers change */
+	oldContext = MemoryContextSwitchTo(readState->whereClauseContext);
+
+	QueryStripeRangeTree(readState->rangeNodeArray, 0,
+						 (int32) readState->rangeNodeCount - 1, &rangeQuery);
+
+	for (unrangedStripeIndex = 0; unrangedStripeIndex < readState->unrangedStripeCount;
+		 unrangedStripeIndex++)
+	{
+		AppendSelectedStripe(&rangeQuery,
+							 readState->unrangedStripeArray[unrangedStripeIndex]);
+	}
+
+	if (readState->deltaRowCount > 0)
+	{
+		AppendSelectedStripe(&rangeQuery, readState->stripeCount);
+	}
+
+	/* with no selected stripes, the empty array still makes reads skip all */
+	if (rangeQuery.selectedStripeArray == NULL)
+	{
+		rangeQuery.selectedStripeArray = palloc0(sizeof(uint32));
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	qsort(rangeQuery.selectedStripeArray, rangeQuery.selectedStripeCount,
+		  sizeof(uint32), CompareStripeIndexes);
+
+	readState->selectedStripeArray = rangeQuery.selectedStripeArray;
+	readState->selectedStripeCount = rangeQuery.selectedStripeCount;
+}
+
+
+/* StripeSelected checks if the read's qualifiers select the given stripe. */
+static bool
+StripeSelected(TableReadState *readState, uint32 stripeIndex)
+{
+	if (readState->selectedStripeArray == NULL)
+	{
+		return true;
+	}
+
+	return bsearch(&stripeIndex, readState->selectedStripeArray,
+				   readState->selectedStripeCount, sizeof(uint32),
+				   CompareStripeIndexes) != NULL;
+}
+
+
+/*
+ * BuildStripeRangeTree builds the read's interval tree over the stripes' index
+ * column ranges, unless it was built before. Tables may have changed their index
+ * column, so the tree covers the column of the last stripe with a range, and the
+ * stripes that have no range for this column are kept aside. Range values point
+ * into the stripe metadata, which lives as long as the read.
+ */
+static void
+BuildStripeRangeTree(TableReadState *readState)
+{
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	uint32 stripeCount = readState->stripeCount;
+	uint32 stripeIndex = 0;
+	int32 rangeColumnIndex = -1;
+	Form_pg_attribute attributeForm = NULL;
+	FmgrInfo *comparisonFunction = NULL;
+	StripeRangeNode *rangeNodeArray = NULL;
+	uint32 rangeNodeCount = 0;
+	uint32 *unrangedStripeArray = NULL;
+	uint32 unrangedStripeCount = 0;
+	StripeRangeQuery rangeQuery;
+	MemoryContext oldContext = NULL;
+
+	if (readState->rangeTreeBuilt)
+	{
+		return;
+	}
+
+	readState->rangeTreeBuilt = true;
+
+	for (stripeIndex = stripeCount; stripeIndex > 0; stripeIndex--)
+	{
+		StripeMetadata *stripeMetadata = readState->stripeMetadataArray[stripeIndex - 1];
+
+		if (stripeMetadata->indexMinimumValueLength > 0)
 		{
-			ColumnBlockSkipNode *blockSkipNode =
-				selectedBlockSkipList->blockSkipNodeArray[columnIndex];
-			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
-			uint32 blockCount = selectedBlockSkipList->blockCount;
+			rangeColumnIndex = (int32) stripeMetadata->indexColumnIndex;
+			break;
+		}
+	}
 
-			ColumnBuffers *columnBuffers = LoadColumnBuffers(tableFile, blockSkipNode,
-															 blockCount,
-															 existsFileOffset,
-															 valueFileOffset,
-															 attributeForm);
+	if (rangeColumnIndex < 0 || rangeColumnIndex >= tupleDescriptor->natts)
+	{
+		return;
+	}
 
-			columnBuffersArray[columnIndex] = columnBuffers;
+	attributeForm = TupleDescAttr(tupleDescriptor, rangeColumnIndex);
+	if (attributeForm->attisdropped)
+	{
+		return;
+	}
+
+	oldContext = MemoryContextSwitchTo(readState->stripeMetadataContext);
+
+	comparisonFunction = GetFunctionInfoOrNull(attributeForm->atttypid, BTREE_AM_OID,
+											   BTORDER_PROC);
+	if (comparisonFunction == NULL)
+	{
+		MemoryContextSwitchTo(oldContext);
+		return;
+	}
+
+	rangeNodeArray = palloc0(stripeCount * sizeof(StripeRangeNode));
+	unrangedStripeArray = palloc0(stripeCount * sizeof(uint32));
+
+	for (stripeIndex = 0; stripeIndex < stripeCount; stripeIndex++)
+	{
+		StripeMetadata *stripeMetadata = readState->stripeMetadataArray[stripeIndex];
+		StripeRangeNode *rangeNode = NULL;
+
+		if (stripeMetadata->indexMinimumValueLength == 0 ||
+			stripeMetadata->indexColumnIndex != (uint32) rangeColumnIndex)
+		{
+			unrangedStripeArray[unrangedStripeCount] = stripeIndex;
+			unrangedStripeCount++;
+			continue;
 		}
 
-		currentColumnFileOffset += existsSize;
-		currentColumnFileOffset += valueSize;
+		rangeNode = &rangeNodeArray[rangeNodeCount];
+		rangeNode->stripeIndex = stripeIndex;
+		rangeNode->minimumValue = fetch_att(stripeMetadata->indexMinimumValue,
+											attributeForm->attbyval,
+											attributeForm->attlen);
+		rangeNode->maximumValue = fetch_att(stripeMetadata->indexMaximumValue,
+											attributeForm->attbyval,
+											attributeForm->attlen);
+		rangeNodeCount++;
 	}
 
-	stripeBuffers = palloc0(sizeof(StripeBuffers));
-	stripeBuffers->columnCount = columnCount;
-	stripeBuffers->rowCount = StripeSkipListRowCount(selectedBlockSkipList);
-	stripeBuffers->columnBuffersArray = columnBuffersArray;
+	MemoryContextSwitchTo(oldContext);
 
-	return stripeBuffers;
+	memset(&rangeQuery, 0, sizeof(StripeRangeQuery));
+	rangeQuery.comparisonFunction = comparisonFunction;
+	rangeQuery.collation = attributeForm->attcollation;
+
+	qsort_arg(rangeNodeArray, rangeNodeCount, sizeof(StripeRangeNode),
+			  CompareStripeRangeNodes, &rangeQuery);
+
+	if (rangeNodeCount > 0)
+	{
+		SetSubtreeMaximumValues(rangeNodeArray, 0, (int32) rangeNodeCount - 1,
+								&rangeQuery);
+	}
+
+	readState->rangeColumnIndex = rangeColumnIndex;
+	readState->rangeComparisonFunction = comparisonFunction;
+	readState->rangeNodeArray = rangeNodeArray;
+	readState->rangeNodeCount = rangeNodeCount;
+	readState->unrangedStripeArray = unrangedStripeArray;
+	readState->unrangedStripeCount = unrangedStripeCount;
 }
 
 
 /*
- * ReadStripeNextRow reads the next row from the given stripe, finds the projected
- * column values within this row, and accordingly sets the column values and nulls.
- * Note that this function sets the values for all non-projected columns to null.
+ * SetSubtreeMaximumValues sets the largest maximum value in the subtree of each
+ * node between the given first and last nodes, and returns the largest maximum
+ * value in the subtree over these nodes.
+ */
+static Datum
+SetSubtreeMaximumValues(StripeRangeNode *rangeNodeArray, int32 firstNodeIndex,
+						int32 lastNodeIndex, StripeRangeQuery *rangeQuery)
+{
+	int32 middleNodeIndex = firstNodeIndex + (lastNodeIndex - firstNodeIndex) / 2;
+	StripeRangeNode *rangeNode = &rangeNodeArray[middleNodeIndex];
+	Datum subtreeMaximumValue = rangeNode->maximumValue;
+
+	if (firstNodeIndex < middleNodeIndex)
+	{
+		Datum leftMaximumValue = SetSubtreeMaximumValues(rangeNodeArray, firstNodeIndex,
+														 middleNodeIndex - 1,
+														 rangeQuery);
+
+		if (CompareRangeValues(rangeQuery, leftMaximumValue, subtreeMaximumValue) > 0)
+		{
+			subtreeMaximumValue = leftMaximumValue;
+		}
+	}
+
+	if (middleNodeIndex < lastNodeIndex)
+	{
+		Datum rightMaximumValue = SetSubtreeMaximumValues(rangeNodeArray,
+														  middleNodeIndex + 1,
+														  lastNodeIndex, rangeQuery);
+
+		if (CompareRangeValues(rangeQuery, rightMaximumValue, subtreeMaximumValue) > 0)
+		{
+			subtreeMaximumValue = rightMaximumValue;
+		}
+	}
+
+	rangeNode->subtreeMaximumValue = subtreeMaximumValue;
+
+	return subtreeMaximumValue;
+}
+
+
+/*
+ * FindRangeBounds looks for qualifiers that compare the given column with a
+ * constant using an operator of the column type's default btree operator class,
+ * and sets the tightest lower and upper bounds that these qualifiers put on the
+ * column in the given range query. We treat all bounds as inclusive, which may
+ * select a few stripes too many but never misses one. As with sparse indexes,
+ * qualifiers must use the column's collation, which is the range query's
+ * collation, since writers compare values with it. Constants may also have the
+ * operator class's input type, which is text for varchar columns.
  */
 static void
-ReadStripeNextRow(StripeBuffers *stripeBuffers, List *projectedColumnList,
-				  uint64 blockIndex, uint64 blockRowIndex,
-				  ColumnBlockData **blockDataArray, Datum *columnValues,
-				  bool *columnNulls)
+FindRangeBounds(List *whereClauseList, AttrNumber attributeNumber, Oid columnTypeId,
+				StripeRangeQuery *rangeQuery)
 {
-	ListCell *projectedColumnCell = NULL;
+	Oid operatorClassId = GetDefaultOpClass(columnTypeId, BTREE_AM_OID);
+	Oid operatorFamilyId = InvalidOid;
+	Oid operatorClassTypeId = InvalidOid;
+	ListCell *clauseCell = NULL;
 
-	/* set all columns to null by default */
-	memset(columnNulls, 1, stripeBuffers->columnCount * sizeof(bool));
+	if (operatorClassId == InvalidOid)
+	{
+		return;
+	}
 
-	foreach(projectedColumnCell, projectedColumnList)
+	operatorFamilyId = get_opclass_family(operatorClassId);
+	operatorClassTypeId = get_opclass_input_type(operatorClassId);
+
+	foreach(clauseCell, whereClauseList)
 	{
-		Var *projectedColumn = lfirst(projectedColumnCell);
-		uint32 projectedColumnIndex = projectedColumn->varattno - 1;
-		ColumnBlockData *blockData = blockDataArray[projectedColumnIndex];
+		Node *clause = (Node *) lfirst(clauseCell);
+		OpExpr *operatorExpression = NULL;
+		Node *leftOperand = NULL;
+		Node *rightOperand = NULL;
+		Var *column = NULL;
+		Const *constant = NULL;
+		bool constantFirst = false;
+		int strategyNumber = 0;
+		Datum boundValue = 0;
+
+		if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2)
+		{
+			continue;
+		}
 
-		if (blockData->existsArray[blockRowIndex])
+		operatorExpression = (OpExpr *) clause;
+		leftOperand = get_leftop((Expr *) operatorExpression);
+		rightOperand = get_rightop((Expr *) operatorExpression);
+
+		/* varchar columns are compared as text, through a binary coercion */
+		if (IsA(leftOperand, RelabelType))
 		{
-			columnValues[projectedColumnIndex] = blockData->valueArray[blockRowIndex];
-			columnNulls[projectedColumnIndex] = false;
+			leftOperand = (Node *) ((RelabelType *) leftOperand)->arg;
+		}
+
+		if (IsA(rightOperand, RelabelType))
+		{
+			rightOperand = (Node *) ((RelabelType *) rightOperand)->arg;
+		}
+
+		if (IsA(leftOperand, Var) && IsA(rightOperand, Const))
+		{
+			column = (Var *) leftOperand;
+			constant = (Const *) rightOperand;
+		}
+		else if (IsA(leftOperand, Const) && IsA(rightOperand, Var))
+		{
+			column = (Var *) rightOperand;
+			constant = (Const *) leftOperand;
+			constantFirst = true;
+		}
+		else
+		{
+			continue;
+		}
+
+		if (column->varattno != attributeNumber || constant->constisnull ||
+			(constant->consttype != columnTypeId &&
+			 constant->consttype != operatorClassTypeId) ||
+			operatorExpression->inputcollid != rangeQuery->collation)
+		{
+			continue;
+		}
+
+		strategyNumber = get_op_opfamily_strategy(operatorExpression->opno,
+												  operatorFamilyId);
+		if (strategyNumber == 0)
+		{
+			continue;
+		}
+
+		/* for constant < column, the column is greater than the constant */
+		if (constantFirst)
+		{
+			strategyNumber = BTCommuteStrategyNumber(strategyNumber);
+		}
+
+		boundValue = constant->constvalue;
+
+		if (strategyNumber == BTLessStrategyNumber ||
+			strategyNumber == BTLessEqualStrategyNumber ||
+			strategyNumber == BTEqualStrategyNumber)
+		{
+			if (!rangeQuery->hasUpperBound ||
+				CompareRangeValues(rangeQuery, boundValue, rangeQuery->upperBound) < 0)
+			{
+				rangeQuery->hasUpperBound = true;
+				rangeQuery->upperBound = boundValue;
+			}
+		}
+
+		if (strategyNumber == BTGreaterStrategyNumber ||
+			strategyNumber == BTGreaterEqualStrategyNumber ||
+			strategyNumber == BTEqualStrategyNumber)
+		{
+			if (!rangeQuery->hasLowerBound ||
+				CompareRangeValues(rangeQuery, boundValue, rangeQuery->lowerBound) > 0)
+			{
+				rangeQuery->hasLowerBound = true;
+				rangeQuery->lowerBound = boundValue;
+			}
 		}
 	}
 }
 
 
 /*
- * LoadColumnBuffers reads serialized column data from the given file. These
- * column data are laid out as sequential blocks in the file; and block positions
- * and lengths are retrieved from the column block skip node array.
+ * QueryStripeRangeTree appends the stripes of the nodes between the given first
+ * and last nodes whose ranges overlap with the query's bounds to the query's
+ * selected stripes. We skip subtrees whose largest maximum is below the lower
+ * bound, and, as nodes are sorted by minimum, nodes after one whose minimum is
+ * above the upper bound.
  */
-static ColumnBuffers *
-LoadColumnBuffers(FILE *tableFile, ColumnBlockSkipNode *blockSkipNodeArray,
-				  uint32 blockCount, uint64 existsFileOffset, uint64 valueFileOffset,
-				  Form_pg_attribute attributeForm)
+static void
+QueryStripeRangeTree(StripeRangeNode *rangeNodeArray, int32 firstNodeIndex,
+					 int32 lastNodeIndex, StripeRangeQuery *rangeQuery)
 {
-	ColumnBuffers *columnBuffers = NULL;
-	uint32 blockIndex = 0;
-	ColumnBlockBuffers **blockBuffersArray =
-			palloc0(blockCount * sizeof(ColumnBlockBuffers *));
+	int32 middleNodeIndex = 0;
+	StripeRangeNode *rangeNode = NULL;
 
-	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	if (firstNodeIndex > lastNodeIndex)
 	{
-		blockBuffersArray[blockIndex] = palloc0(sizeof(ColumnBlockBuffers));
+		return;
 	}
 
-	/*
-	 * We first read the "exists" blocks. We don't read "values" array here,
-	 * because "exists" blocks are stored sequentially on disk, and we want to
-	 * minimize disk seeks.
-	 */
-	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
-	{
-		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
-		uint64 existsOffset = existsFileOffset + blockSkipNode->existsBlockOffset;
-		StringInfo rawExistsBuffer = ReadFromFile(tableFile, existsOffset,
-												  blockSkipNode->existsLength);
+	middleNodeIndex = firstNodeIndex + (lastNodeIndex - firstNodeIndex) / 2;
+	rangeNode = &rangeNodeArray[middleNodeIndex];
 
-		blockBuffersArray[blockIndex]->existsBuffer = rawExistsBuffer;
+	if (rangeQuery->hasLowerBound &&
+		CompareRangeValues(rangeQuery, rangeNode->subtreeMaximumValue,
+						   rangeQuery->lowerBound) < 0)
+	{
+		return;
 	}
 
-	/* then read "values" blocks, which are also stored sequentially on disk */
-	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
-	{
-		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
-		CompressionType compressionType = blockSkipNode->valueCompressionType;
-		uint64 valueOffset = valueFileOffset + blockSkipNode->valueBlockOffset;
-		StringInfo rawValueBuffer = ReadFromFile(tableFile, valueOffset,
-												 blockSkipNode->valueLength);
+	QueryStripeRangeTree(rangeNodeArray, firstNodeIndex, middleNodeIndex - 1,
+						 rangeQuery);
 
-		blockBuffersArray[blockIndex]->valueBuffer = rawValueBuffer;
-		blockBuffersArray[blockIndex]->valueCompressionType = compressionType;
+	if (rangeQuery->hasUpperBound &&
+		CompareRangeValues(rangeQuery, rangeNode->minimumValue,
+						   rangeQuery->upperBound) > 0)
+	{
+		return;
 	}
 
-	columnBuffers = palloc0(sizeof(ColumnBuffers));
-	columnBuffers->blockBuffersArray = blockBuffersArray;
+	if (!rangeQuery->hasLowerBound ||
+		CompareRangeValues(rangeQuery, rangeNode->maximumValue,
+						   rangeQuery->lowerBound) >= 0)
+	{
+		AppendSelectedStripe(rangeQuery, rangeNode->stripeIndex);
+	}
 
-	return columnBuffers;
+	QueryStripeRangeTree(rangeNodeArray, middleNodeIndex + 1, lastNodeIndex,
+						 rangeQuery);
 }
 
 
-/* Reads and returns the given stripe's footer. */
-static StripeFooter *
-LoadStripeFooter(FILE *tableFile, StripeMetadata *stripeMetadata,
-				 uint32 columnCount)
+/* AppendSelectedStripe appends the given stripe to the query's selected stripes. */
+static void
+AppendSelectedStripe(StripeRangeQuery *rangeQuery, uint32 stripeIndex)
 {
-	StripeFooter *stripeFooter = NULL;
-	StringInfo footerBuffer = NULL;
-	uint64 footerOffset = 0;
-
-	footerOffset += stripeMetadata->fileOffset;
-	footerOffset += stripeMetadata->skipListLength;
-	footerOffset += stripeMetadata->dataLength;
-
-	footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
-	stripeFooter = DeserializeStripeFooter(footerBuffer);
-	if (stripeFooter->columnCount > columnCount)
+	if (rangeQuery->selectedStripeArray == NULL)
 	{
-		ereport(ERROR, (errmsg("stripe footer column count and table column count "
-							   "don't match")));
+		rangeQuery->selectedStripeArraySize = 16;
+		rangeQuery->selectedStripeArray = palloc0(rangeQuery->selectedStripeArraySize *
+												  sizeof(uint32));
+	}
+	else if (rangeQuery->selectedStripeCount == rangeQuery->selectedStripeArraySize)
+	{
+		rangeQuery->selectedStripeArraySize *= 2;
+		rangeQuery->selectedStripeArray = repalloc(rangeQuery->selectedStripeArray,
+												   rangeQuery->selectedStripeArraySize *
+												   sizeof(uint32));
 	}
 
-	return stripeFooter;
+	rangeQuery->selectedStripeArray[rangeQuery->selectedStripeCount] = stripeIndex;
+	rangeQuery->selectedStripeCount++;
 }
 
 
-/* Reads the skip list for the given stripe. */
-static StripeSkipList *
-LoadStripeSkipList(FILE *tableFile, StripeMetadata *stripeMetadata,
-				   StripeFooter *stripeFooter, uint32 columnCount,
-				   bool *projectedColumnMask,
-				   TupleDesc tupleDescriptor)
+/* CompareRangeValues compares two values of the query's column. */
+static int
+CompareRangeValues(StripeRangeQuery *rangeQuery, Datum leftValue, Datum rightValue)
 {
-	StripeSkipList *stripeSkipList = NULL;
-	ColumnBlockSkipNode **blockSkipNodeArray = NULL;
-	StringInfo firstColumnSkipListBuffer = NULL;
-	uint64 currentColumnSkipListFileOffset = 0;
-	uint32 columnIndex = 0;
-	uint32 stripeBlockCount = 0;
-	uint32 stripeColumnCount = stripeFooter->columnCount;
+	Datum comparisonDatum = FunctionCall2Coll(rangeQuery->comparisonFunction,
+											  rangeQuery->collation,
+											  leftValue, rightValue);
 
-	/* deserialize block count */
-	firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
-											 stripeFooter->skipListSizeArray[0]);
-	stripeBlockCount = DeserializeBlockCount(firstColumnSkipListBuffer);
+	return DatumGetInt32(comparisonDatum);
+}
 
-	/* deserialize column skip lists */
-	blockSkipNodeArray = palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
-	currentColumnSkipListFileOffset = stripeMetadata->fileOffset;
 
-	for (columnIndex = 0; columnIndex < stripeColumnCount; columnIndex++)
-	{
-		uint64 columnSkipListSize = stripeFooter->skipListSizeArray[columnIndex];
-		bool firstColumn = columnIndex == 0;
+/* CompareStripeRangeNodes compares two interval tree nodes by their minimums. */
+static int
+CompareStripeRangeNodes(const void *leftElement, const void *rightElement,
+						void *context)
+{
+	const StripeRangeNode *leftNode = (const StripeRangeNode *) leftElement;
+	const StripeRangeNode *rightNode = (const StripeRangeNode *) rightElement;
+	StripeRangeQuery *rangeQuery = (StripeRangeQuery *) context;
 
-		/*
-		 * Only selected columns' column skip lists are read. However, the first
-		 * column's skip list is read regardless of being selected. It is used by
-		 * StripeSkipListRowCount later.
-		 */
-		if (projectedColumnMask[columnIndex] || firstColumn)
-		{
-			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+	return CompareRangeValues(rangeQuery, leftNode->minimumValue,
+							  rightNode->minimumValue);
+}
 
-			StringInfo columnSkipListBuffer =
-				ReadFromFile(tableFile, currentColumnSkipListFileOffset,
-							 columnSkipListSize);
-			ColumnBlockSkipNode *columnSkipList =
-				DeserializeColumnSkipList(columnSkipListBuffer, attributeForm->attbyval,
-										  attributeForm->attlen, stripeBlockCount);
-			blockSkipNodeArray[columnIndex] = columnSkipList;
-		}
 
-		currentColumnSkipListFileOffset += columnSkipListSize;
-	}
+/* CompareStripeIndexes compares two stripe indexes for sorting and searching. */
+static int
+CompareStripeIndexes(const void *leftElement, const void *rightElement)
+{
+	uint32 leftStripeIndex = *((const uint32 *) leftElement);
+	uint32 rightStripeIndex = *((const uint32 *) rightElement);
 
-	/* table contains additional columns added after this stripe is created */
-	for (columnIndex = stripeColumnCount; columnIndex < columnCount; columnIndex++)
+	if (leftStripeIndex != rightStripeIndex)
 	{
-		ColumnBlockSkipNode *columnSkipList = NULL;
-		uint32 blockIndex = 0;
-		bool firstColumn = columnIndex == 0;
-
-		/* no need to create ColumnBlockSkipList if the column is not selected */
-		if (!projectedColumnMask[columnIndex] && !firstColumn)
-		{
-			blockSkipNodeArray[columnIndex] = NULL;
-			continue;
-		}
-
-		/* create empty ColumnBlockSkipNode for missing columns*/
-		columnSkipList = palloc0(stripeBlockCount * sizeof(ColumnBlockSkipNode));
-
-		for (blockIndex = 0; blockIndex < stripeBlockCount; blockIndex++)
-		{
-			columnSkipList[blockIndex].rowCount = 0;
-			columnSkipList[blockIndex].hasMinMax = false;
-			columnSkipList[blockIndex].minimumValue = 0;
-			columnSkipList[blockIndex].maximumValue = 0;
-			columnSkipList[blockIndex].existsBlockOffset = 0;
-			columnSkipList[blockIndex].valueBlockOffset = 0;
-			columnSkipList[blockIndex].existsLength = 0;
-			columnSkipList[blockIndex].valueLength = 0;
-			columnSkipList[blockIndex].valueCompressionType = COMPRESSION_NONE;
-		}
-		blockSkipNodeArray[columnIndex] = columnSkipList;
+		return (leftStripeIndex < rightStripeIndex) ? -1 : 1;
 	}
 
-	stripeSkipList = palloc0(sizeof(StripeSkipList));
-	stripeSkipList->blockSkipNodeArray = blockSkipNodeArray;
-	stripeSkipList->columnCount = columnCount;
-	stripeSkipList->blockCount = stripeBlockCount;
-
-	return stripeSkipList;
+	return 0;
 }
 
 
 /*
- * SelectedBlockMask walks over each column's blocks and checks if a block can
- * be filtered without reading its data. The filtering happens when all rows in
- * the block can be refuted by the given qualifier conditions.
+ * SummaryBlockMask finds the selected blocks that can be summarized by their
+ * skip nodes, as described in CStoreBeginSummaryRead, and removes them from the
+ * given selected block mask. To check if the qualifiers hold for all rows of a
+ * block, we build min/max constraints for the block's columns that have no
+ * nulls, and check if these constraints imply the qualifiers. Blocks with
+ * deleted rows are never summarized.
  */
 static bool *
-SelectedBlockMask(StripeSkipList *stripeSkipList, List *projectedColumnList,
-				  List *whereClauseList)
+SummaryBlockMask(TableReadState *readState, StripeSkipList *stripeSkipList,
+				 bool *selectedBlockMask)
 {
-	bool *selectedBlockMask = NULL;
+	List *projectedColumnList = readState->projectedColumnList;
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	List *baseConstraintList = NIL;
 	ListCell *columnCell = NULL;
 	uint32 blockIndex = 0;
-	List *restrictInfoList = BuildRestrictInfoList(whereClauseList);
-
-	selectedBlockMask = palloc0(stripeSkipList->blockCount * sizeof(bool));
-	memset(selectedBlockMask, true, stripeSkipList->blockCount * sizeof(bool));
+	bool *summaryBlockMask = palloc0(stripeSkipList->blockCount * sizeof(bool));
 
 	foreach(columnCell, projectedColumnList)
 	{
 		Var *column = lfirst(columnCell);
-		uint32 columnIndex = column->varattno - 1;
-		FmgrInfo *comparisonFunction = NULL;
+		FmgrInfo *comparisonFunction = GetFunctionInfoOrNull(column->vartype,
+															 BTREE_AM_OID,
+															 BTORDER_PROC);
 		Node *baseConstraint = NULL;
 
-		/* if this column's data type doesn't have a comparator, skip it */
-		comparisonFunction = GetFunctionInfoOrNull(column->vartype, BTREE_AM_OID,
-												   BTORDER_PROC);
-		if (comparisonFunction == NULL)
+		if (comparisonFunction != NULL)
 		{
-			continue;
+			baseConstraint = BuildBaseConstraint(column);
 		}
 
-		baseConstraint = BuildBaseConstraint(column);
-		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		baseConstraintList = lappend(baseConstraintList, baseConstraint);
+	}
+
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	{
+		bool summaryBlock = selectedBlockMask[blockIndex];
+		List *constraintList = NIL;
+		ListCell *constraintCell = NULL;
+
+		/* skip nodes also summarize the block's deleted rows */
+		if (summaryBlock && BlockHasDeletedRows(readState, blockIndex))
 		{
-			bool predicateRefuted = false;
-			List *constraintList = NIL;
-			ColumnBlockSkipNode *blockSkipNodeArray =
-				stripeSkipList->blockSkipNodeArray[columnIndex];
-			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+			summaryBlock = false;
+		}
 
-			/*
-			 * A column block with comparable data type can miss min/max values
-			 * if all values in the block are NULL.
-			 */
-			if (!blockSkipNode->hasMinMax)
+		forboth(columnCell, projectedColumnList, constraintCell, baseConstraintList)
+		{
+			Var *column = lfirst(columnCell);
+			Node *baseConstraint = lfirst(constraintCell);
+			uint32 columnIndex = column->varattno - 1;
+			ColumnBlockSkipNode *blockSkipNode =
+				&stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+			bool blockHasNulls = (blockSkipNode->valueCount < blockSkipNode->rowCount);
+
+			if (!summaryBlock)
 			{
-				continue;
+				break;
 			}
 
-			UpdateConstraint(baseConstraint, blockSkipNode->minimumValue,
-							 blockSkipNode->maximumValue);
+			/* truncated minimum and maximum values aren't the block's values */
+			if (!blockSkipNode->hasValueCount ||
+				(blockSkipNode->valueCount > 0 && !blockSkipNode->hasMinMax) ||
+				blockSkipNode->minMaxTruncated)
+			{
+				summaryBlock = false;
+				break;
+			}
 
-			constraintList = list_make1(baseConstraint);
+			if ((int32) columnIndex == readState->summaryGroupColumnIndex &&
+				blockSkipNode->valueCount > 0)
+			{
+				Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+																columnIndex);
+
+				if (blockHasNulls ||
+					!datumIsEqual(blockSkipNode->minimumValue,
+								  blockSkipNode->maximumValue,
+								  attributeForm->attbyval, attributeForm->attlen))
+				{
+					summaryBlock = false;
+					break;
+				}
+			}
+
+			/* qualifiers on columns with nulls aren't implied by min/max values */
+			if (baseConstraint != NULL && blockSkipNode->valueCount > 0 && !blockHasNulls)
+			{
+				UpdateConstraint(baseConstraint, blockSkipNode->minimumValue,
+								 blockSkipNode->maximumValue);
+				constraintList = lappend(constraintList, copyObject(baseConstraint));
+			}
+		}
+
+		if (summaryBlock && readState->whereClauseList != NIL)
+		{
 #if (PG_VERSION_NUM >= 100000)
-			predicateRefuted = predicate_refuted_by(constraintList, restrictInfoList, false);
+			summaryBlock = predicate_implied_by(readState->whereClauseList,
+												constraintList, false);
 #else
-			predicateRefuted = predicate_refuted_by(constraintList, restrictInfoList);
+			summaryBlock = predicate_implied_by(readState->whereClauseList,
+												constraintList);
 #endif
-			if (predicateRefuted)
-			{
-				selectedBlockMask[blockIndex] = false;
-			}
+		}
+
+		if (summaryBlock)
+		{
+			summaryBlockMask[blockIndex] = true;
+			selectedBlockMask[blockIndex] = false;
 		}
 	}
 
-	return selectedBlockMask;
+	return summaryBlockMask;
 }
 
 
@@ -847,6 +4335,119 @@ GetFunctionInfoOrNull(Oid typeId, Oid accessMethodId, int16 procedureId)
 }
 
 
+/*
+ * SortKeyCollation returns true if skip lists keep binary sort keys for values of
+ * the given type and collation. We only use the sort keys of ICU collations, as
+ * PostgreSQL doesn't trust strxfrm() to order strings the same way as strcoll()
+ * on all platforms. The C collation compares bytes, and needs no sort keys.
+ */
+bool
+SortKeyCollation(Oid typeId, Oid collation)
+{
+	if (typeId != TEXTOID && typeId != VARCHAROID)
+	{
+		return false;
+	}
+
+#if PG_VERSION_NUM >= 100000 && defined(USE_ICU)
+	if (OidIsValid(collation) && collation != DEFAULT_COLLATION_OID &&
+		!lc_collate_is_c(collation))
+	{
+		pg_locale_t locale = pg_newlocale_from_collation(collation);
+
+		return (locale != 0 && locale->provider == COLLPROVIDER_ICU);
+	}
+#endif
+
+	return false;
+}
+
+
+/*
+ * TextSortKey returns the binary sort key of the given text value under the given
+ * collation, for which SortKeyCollation() must be true. Sort keys order the same
+ * way under memcmp() as their values do under the collation. ICU terminates
+ * sort keys with a zero byte, which we leave out.
+ */
+bytea *
+TextSortKey(Datum value, Oid collation)
+{
+	bytea *sortKey = NULL;
+
+#if PG_VERSION_NUM >= 100000 && defined(USE_ICU)
+	text *textValue = DatumGetTextPP(value);
+	pg_locale_t locale = pg_newlocale_from_collation(collation);
+	UChar *ucharValue = NULL;
+	int32_t ucharLength = 0;
+	int32_t sortKeyLength = 0;
+
+	ucharLength = icu_to_uchar(&ucharValue, VARDATA_ANY(textValue),
+							   VARSIZE_ANY_EXHDR(textValue));
+
+	sortKeyLength = ucol_getSortKey(locale->info.icu.ucol, ucharValue, ucharLength,
+									NULL, 0);
+
+	sortKey = palloc(VARHDRSZ + sortKeyLength);
+	ucol_getSortKey(locale->info.icu.ucol, ucharValue, ucharLength,
+					(uint8_t *) VARDATA(sortKey), sortKeyLength);
+	SET_VARSIZE(sortKey, VARHDRSZ + Max(sortKeyLength - 1, 0));
+
+	pfree(ucharValue);
+#else
+	elog(ERROR, "collation %u has no sort keys", collation);
+#endif
+
+	return sortKey;
+}
+
+
+/*
+ * SortKeyVersion returns the version of the sort keys of the given collation, for
+ * which SortKeyCollation() must be true. The upper half is a hash of the locale
+ * that the collation opens, and the lower half is the version of ICU's collator
+ * for that locale. Sort keys of different versions may order differently, so
+ * skip lists record the version of their sort keys, and readers ignore keys of
+ * other versions.
+ */
+uint64
+SortKeyVersion(Oid collation)
+{
+	uint64 sortKeyVersion = 0;
+
+#if PG_VERSION_NUM >= 100000 && defined(USE_ICU)
+	pg_locale_t locale = pg_newlocale_from_collation(collation);
+	HeapTuple collationTuple = NULL;
+	Form_pg_collation collationForm = NULL;
+	UVersionInfo collatorVersion;
+	uint32 localeHash = 0;
+
+	collationTuple = SearchSysCache1(COLLOID, ObjectIdGetDatum(collation));
+	if (!HeapTupleIsValid(collationTuple))
+	{
+		elog(ERROR, "cache lookup failed for collation %u", collation);
+	}
+
+	collationForm = (Form_pg_collation) GETSTRUCT(collationTuple);
+	localeHash = DatumGetUInt32(hash_any((unsigned char *)
+										 NameStr(collationForm->collcollate),
+										 strlen(NameStr(collationForm->collcollate))));
+	ReleaseSysCache(collationTuple);
+
+	ucol_getVersion(locale->info.icu.ucol, collatorVersion);
+
+	sortKeyVersion = ((uint64) localeHash << 32) |
+					 ((uint32) collatorVersion[0] << 24) |
+					 ((uint32) collatorVersion[1] << 16) |
+					 ((uint32) collatorVersion[2] << 8) |
+					 (uint32) collatorVersion[3];
+#else
+	elog(ERROR, "collation %u has no sort keys", collation);
+#endif
+
+	return sortKeyVersion;
+}
+
+
 /*
  * BuildRestrictInfoList builds restrict info list using the selection criteria,
  * and then return this list. The function is copied from CitusDB's shard pruning
@@ -1169,10 +4770,10 @@ DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray, uint32 datumCou
 /*
  * DeserializeBlockData deserializes requested data block for all columns and
  * stores in blockDataArray. It uncompresses serialized data if necessary. The
- * function also deallocates data buffers used for previous block, and compressed
- * data buffers for the current block which will not be needed again. If a column
- * data is not present serialized buffer, then default value (or null) is used
- * to fill value array.
+ * function also deallocates data buffers used for previous block. Compressed
+ * data buffers are kept, so that the stripe can be read again on rescans. If a
+ * column data is not present serialized buffer, then default value (or null) is
+ * used to fill value array.
  */
 static void
 DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
@@ -1197,21 +4798,18 @@ DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
 			ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
 			StringInfo valueBuffer = NULL;
 
-			/* free previous block's data buffers */
-			pfree(blockData->valueBuffer->data);
-			pfree(blockData->valueBuffer);
+			/* free previous block's decompressed data buffers */
+			if (blockData->valueBuffer != NULL)
+			{
+				pfree(blockData->valueBuffer->data);
+				pfree(blockData->valueBuffer);
+				blockData->valueBuffer = NULL;
+			}
 
 			/* decompress and deserialize current block's data */
 			valueBuffer = DecompressBuffer(blockBuffers->valueBuffer,
 										   blockBuffers->valueCompressionType);
 
-			if (blockBuffers->valueCompressionType != COMPRESSION_NONE)
-			{
-				/* compressed data is not needed anymore */
-				pfree(blockBuffers->valueBuffer->data);
-				pfree(blockBuffers->valueBuffer);
-			}
-
 			DeserializeBoolArray(blockBuffers->existsBuffer, blockData->existsArray,
 								 rowCount);
 			DeserializeDatumArray(valueBuffer, blockData->existsArray,
@@ -1219,8 +4817,14 @@ DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
 								  attributeForm->attlen, attributeForm->attalign,
 								  blockData->valueArray);
 
-			/* store current block's data buffer to be freed at next block read */
-			blockData->valueBuffer = valueBuffer;
+			/*
+			 * Store current block's decompressed data buffer to be freed at next
+			 * block read. Uncompressed data buffers belong to the stripe buffers.
+			 */
+			if (blockBuffers->valueCompressionType != COMPRESSION_NONE)
+			{
+				blockData->valueBuffer = valueBuffer;
+			}
 		}
 		else if (columnAdded)
 		{
@@ -1365,8 +4969,8 @@ ReadFromFile(FILE *file, uint64 offset, uint32 size)
 
 /*
  * ResetUncompressedBlockData iterates over deserialized column block data
- * and sets valueBuffer field to empty buffer. This field is allocated in stripe
- * memory context and becomes invalid once memory context is reset.
+ * and clears the valueBuffer field. This field is allocated in stripe memory
+ * context and becomes invalid once memory context is reset.
  */
 static void
 ResetUncompressedBlockData(ColumnBlockData **blockDataArray, uint32 columnCount)
@@ -1377,7 +4981,7 @@ ResetUncompressedBlockData(ColumnBlockData **blockDataArray, uint32 columnCount)
 		ColumnBlockData *blockData = blockDataArray[columnIndex];
 		if (blockData != NULL)
 		{
-			blockData->valueBuffer = makeStringInfo();
+			blockData->valueBuffer = NULL;
 		}
 	}
 }
@@ -0,0 +1,2461 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_tableam.c
+ *
+ * This file contains the cstore table access method, which stores regular
+ * tables in cstore files on PostgreSQL 12 and later. Unlike foreign tables,
+ * these tables work with parallel sequential scans, TID scans, indexes, block
+ * sampling in ANALYZE and TABLESAMPLE, and the executor's own INSERT and COPY
+ * code paths.
+ *
+ * A table's files are $PGDATA/cstore_fdw/{databaseOid}/{relfilenode}, and we
+ * create and remove them along with the relation's storage. Tables have a
+ * single segment, and writers of a table wait for each other until their
+ * transactions end. Each transaction buffers the rows it inserts, and writes
+ * them when it commits, or when it reads the table.
+ *
+ * The stripes that a transaction writes go into the table's pending footer,
+ * and readers of the table's footer don't see them. When the transaction
+ * commits, we rename the pending footer to the table's footer, so the rows of
+ * committed transactions appear at once, and those of aborted transactions
+ * never appear. Only the transaction itself, and the workers of its parallel
+ * scans, read the pending footer. Rows don't record the transactions that wrote
+ * them, but footers record their last writer. Reads of transactions whose
+ * snapshot lasts for the whole transaction error out if that writer committed
+ * after the snapshot, and serializable transactions lock the whole table.
+ *
+ * Rows are numbered in stripe order, and the number of each row gives its TID:
+ * the block number is the row number divided by MaxHeapTuplesPerPage, and the
+ * offset is the remainder plus one. Indexes store these TIDs, so we never give
+ * a row number to two rows. Writers reserve row numbers in the table's pending
+ * footer before they hand them out, and the next writer fills the numbers that
+ * an aborted or crashed writer reserved with deleted rows. Rows that rolled back
+ * subtransactions wrote also become deleted rows.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+
+#include "postgres.h"
+#include "cstore_fdw.h"
+#include "cstore_version_compat.h"
+
+#if PG_VERSION_NUM >= 120000
+
+#include <sys/stat.h>
+
+#include "access/heapam.h"
+#include "access/multixact.h"
+#include "access/tableam.h"
+#include "access/transam.h"
+#include "access/tsmapi.h"
+#include "access/xact.h"
+#include "catalog/index.h"
+#include "catalog/objectaccess.h"
+#include "catalog/pg_class.h"
+#include "catalog/storage.h"
+#include "commands/vacuum.h"
+#include "executor/executor.h"
+#include "executor/tuptable.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/tidbitmap.h"
+#include "storage/lmgr.h"
+#include "storage/predicate.h"
+#include "storage/smgr.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+
+
+/* number of rows in each block that TIDs of cstore tables address */
+#define CSTORE_TABLEAM_BLOCK_ROW_COUNT MaxHeapTuplesPerPage
+
+/* page of the table's page lock that writers take */
+#define CSTORE_TABLEAM_WRITE_LOCK_PAGE 0
+
+
+/*
+ * CStoreScanDescData represents a sequential, bitmap, sample or ANALYZE scan of
+ * a cstore table. Bitmap, sample and ANALYZE scans read rows by their TIDs, and
+ * keep the block and the offset that they read next.
+ */
+typedef struct CStoreScanDescData
+{
+	TableScanDescData baseScan;
+	TableReadState *readState;
+	MemoryContext scanContext;
+
+	BlockNumber currentBlock;
+	uint32 nextTupleIndex;
+	BlockNumber sampleBlockCount;
+
+} CStoreScanDescData;
+
+typedef struct CStoreScanDescData *CStoreScanDesc;
+
+
+/*
+ * CStoreParallelScanDescData is the shared state of a parallel scan. Processes
+ * of the scan claim stripes from the counter. If the transaction wrote into the
+ * table, the workers read the table's pending footer as the leader does.
+ */
+typedef struct CStoreParallelScanDescData
+{
+	ParallelTableScanDescData baseScan;
+	pg_atomic_uint32 nextStripeIndex;
+	bool pendingRead;
+
+} CStoreParallelScanDescData;
+
+typedef struct CStoreParallelScanDescData *CStoreParallelScanDesc;
+
+
+/*
+ * CStoreIndexFetchData represents fetching rows of a cstore table by TIDs that
+ * an index scan returns. We begin the read when we fetch the first row.
+ */
+typedef struct CStoreIndexFetchData
+{
+	IndexFetchTableData baseFetch;
+	TableReadState *readState;
+	MemoryContext fetchContext;
+
+} CStoreIndexFetchData;
+
+typedef struct CStoreIndexFetchData *CStoreIndexFetch;
+
+
+/*
+ * TableAMWriteState represents the writes of the current transaction to the
+ * files of a cstore table. Once the transaction first inserts into the table,
+ * it holds the table's write lock until it ends, so that row numbers don't
+ * change while it buffers rows. pendingFooter is the table's pending footer as
+ * of the last finished write, and stripeRowCount is the number of rows in its
+ * stripes. writeState is NULL when the buffered rows were written, and
+ * writeSubtransactionId is the subtransaction that began the write. abortFooter
+ * is the footer to restore if the transaction aborts after it published the
+ * pending footer. A write state whose write is interrupted by an error can't be
+ * used anymore. subtransactionStartList has the next row's number when each of
+ * the transaction's open subtransactions began, and deletedRowRangeList has the
+ * row numbers that rolled back subtransactions handed out, which we mark as
+ * deleted once their rows are in stripes.
+ */
+typedef struct TableAMWriteState
+{
+	RelFileNode relationFileNode;
+	char *filename;
+	TupleDesc tupleDescriptor;
+	TableWriteState *writeState;
+	SubTransactionId writeSubtransactionId;
+	MemoryContext rowContext;
+	TableFooter *pendingFooter;
+	uint64 stripeRowCount;
+	uint64 nextRowNumber;
+	TableFooter *abortFooter;
+	bool footerPublished;
+	bool writeInProgress;
+	List *subtransactionStartList;
+	List *deletedRowRangeList;
+
+} TableAMWriteState;
+
+
+/*
+ * SubtransactionStart records the number of the next row that a write state
+ * hands out when the given subtransaction began. For write states that the
+ * subtransaction created, it is the state's first row number.
+ */
+typedef struct SubtransactionStart
+{
+	SubTransactionId subtransactionId;
+	uint64 rowNumber;
+
+} SubtransactionStart;
+
+
+/*
+ * DeletedRowRange represents the row numbers from firstRowNumber up to, but not
+ * including, endRowNumber, which a rolled back subtransaction handed out.
+ */
+typedef struct DeletedRowRange
+{
+	uint64 firstRowNumber;
+	uint64 endRowNumber;
+
+} DeletedRowRange;
+
+
+/*
+ * PendingFileDelete represents the files of a cstore table, which we delete
+ * when the transaction commits or aborts. subtransactionId is the subtransaction
+ * that scheduled the delete, or its committed parent. For dropped tables,
+ * droppedRelationId is the table's id.
+ */
+typedef struct PendingFileDelete
+{
+	RelFileNode relationFileNode;
+	bool atCommit;
+	SubTransactionId subtransactionId;
+	Oid droppedRelationId;
+
+} PendingFileDelete;
+
+
+/* write states and pending file deletes of the current transaction */
+static List *TableAMWriteStateList = NIL;
+static List *PendingFileDeleteList = NIL;
+
+/* saved hook value in case of unload */
+static object_access_hook_type PreviousObjectAccessHook = NULL;
+
+
+/* local functions forward declarations */
+static const TupleTableSlotOps * CStoreSlotCallbacks(Relation relation);
+static TableScanDesc CStoreScanBegin(Relation relation, Snapshot snapshot, int keyCount,
+									 ScanKey key, ParallelTableScanDesc parallelScan,
+									 uint32 flags);
+static void CStoreScanEnd(TableScanDesc baseScan);
+static void CStoreScanRescan(TableScanDesc baseScan, ScanKey key, bool setParams,
+							 bool allowStrategy, bool allowSync, bool allowPageMode);
+static bool CStoreScanGetNextSlot(TableScanDesc baseScan, ScanDirection direction,
+								  TupleTableSlot *slot);
+static Size CStoreParallelScanEstimate(Relation relation);
+static Size CStoreParallelScanInitialize(Relation relation,
+										 ParallelTableScanDesc parallelScan);
+static void CStoreParallelScanReinitialize(Relation relation,
+										   ParallelTableScanDesc parallelScan);
+static IndexFetchTableData * CStoreIndexFetchBegin(Relation relation);
+static void CStoreIndexFetchReset(IndexFetchTableData *baseFetch);
+static void CStoreIndexFetchEnd(IndexFetchTableData *baseFetch);
+static bool CStoreIndexFetchTuple(IndexFetchTableData *baseFetch, ItemPointer tid,
+								  Snapshot snapshot, TupleTableSlot *slot,
+								  bool *callAgain, bool *allDead);
+static bool CStoreTupleFetchRowVersion(Relation relation, ItemPointer tid,
+									   Snapshot snapshot, TupleTableSlot *slot);
+static bool CStoreTupleTidValid(TableScanDesc baseScan, ItemPointer tid);
+static void CStoreTupleGetLatestTid(TableScanDesc baseScan, ItemPointer tid);
+static bool CStoreTupleSatisfiesSnapshot(Relation relation, TupleTableSlot *slot,
+										 Snapshot snapshot);
+static TransactionId CStoreComputeXidHorizonForTuples(Relation relation,
+													  ItemPointerData *tidArray,
+													  int tidCount);
+static void CStoreTupleInsert(Relation relation, TupleTableSlot *slot,
+							  CommandId commandId, int options,
+							  BulkInsertState bulkInsertState);
+static void CStoreTupleInsertSpeculative(Relation relation, TupleTableSlot *slot,
+										 CommandId commandId, int options,
+										 BulkInsertState bulkInsertState,
+										 uint32 specToken);
+static void CStoreTupleCompleteSpeculative(Relation relation, TupleTableSlot *slot,
+										   uint32 specToken, bool succeeded);
+static void CStoreMultiInsert(Relation relation, TupleTableSlot **slots, int slotCount,
+							  CommandId commandId, int options,
+							  BulkInsertState bulkInsertState);
+static TM_Result CStoreTupleDelete(Relation relation, ItemPointer tid,
+								   CommandId commandId, Snapshot snapshot,
+								   Snapshot crosscheck, bool wait,
+								   TM_FailureData *failureData, bool changingPart);
+static TM_Result CStoreTupleUpdate(Relation relation, ItemPointer oldTid,
+								   TupleTableSlot *slot, CommandId commandId,
+								   Snapshot snapshot, Snapshot crosscheck, bool wait,
+								   TM_FailureData *failureData,
+								   LockTupleMode *lockMode, bool *updateIndexes);
+static TM_Result CStoreTupleLock(Relation relation, ItemPointer tid, Snapshot snapshot,
+								 TupleTableSlot *slot, CommandId commandId,
+								 LockTupleMode mode, LockWaitPolicy waitPolicy,
+								 uint8 flags, TM_FailureData *failureData);
+static void CStoreFinishBulkInsert(Relation relation, int options);
+static void CStoreRelationSetNewFilenode(Relation relation,
+										 const RelFileNode *newFileNode,
+										 char persistence, TransactionId *freezeXid,
+										 MultiXactId *minMulti);
+static void CStoreRelationNontransactionalTruncate(Relation relation);
+static void CStoreRelationCopyData(Relation relation, const RelFileNode *newFileNode);
+static void CStoreRelationCopyForCluster(Relation newRelation, Relation oldRelation,
+										 Relation oldIndex, bool useSort,
+										 TransactionId oldestXmin,
+										 TransactionId *xidCutoff,
+										 MultiXactId *multiCutoff,
+										 double *tupleCount, double *vacuumedTupleCount,
+										 double *recentlyDeadTupleCount);
+static void CStoreRelationVacuum(Relation relation, VacuumParams *params,
+								 BufferAccessStrategy bufferStrategy);
+static bool CStoreScanAnalyzeNextBlock(TableScanDesc baseScan, BlockNumber blockNumber,
+									   BufferAccessStrategy bufferStrategy);
+static bool CStoreScanAnalyzeNextTuple(TableScanDesc baseScan, TransactionId oldestXmin,
+									   double *liveRowCount, double *deadRowCount,
+									   TupleTableSlot *slot);
+static double CStoreIndexBuildRangeScan(Relation tableRelation, Relation indexRelation,
+										IndexInfo *indexInfo, bool allowSync,
+										bool anyVisible, bool progress,
+										BlockNumber startBlock, BlockNumber blockCount,
+										IndexBuildCallback callback,
+										void *callbackState, TableScanDesc baseScan);
+static void CStoreIndexValidateScan(Relation tableRelation, Relation indexRelation,
+									IndexInfo *indexInfo, Snapshot snapshot,
+									ValidateIndexState *state);
+static uint64 CStoreRelationSize(Relation relation, ForkNumber forkNumber);
+static bool CStoreRelationNeedsToastTable(Relation relation);
+static void CStoreRelationEstimateSize(Relation relation, int32 *attributeWidths,
+									   BlockNumber *pageCount, double *tupleCount,
+									   double *allVisibleFraction);
+static bool CStoreScanBitmapNextBlock(TableScanDesc baseScan,
+									  TBMIterateResult *bitmapResult);
+static bool CStoreScanBitmapNextTuple(TableScanDesc baseScan,
+									  TBMIterateResult *bitmapResult,
+									  TupleTableSlot *slot);
+static bool CStoreScanSampleNextBlock(TableScanDesc baseScan,
+									  SampleScanState *sampleScanState);
+static bool CStoreScanSampleNextTuple(TableScanDesc baseScan,
+									  SampleScanState *sampleScanState,
+									  TupleTableSlot *slot);
+static char * TableAMFilename(RelFileNode relationFileNode);
+static TableFooter * ReadTableAMFooter(const char *filename, bool pending);
+static TableReadState * BeginTableAMRead(Relation relation, bool pendingRead);
+static void CheckReadSnapshot(Relation relation, TableReadState *readState,
+							  Snapshot snapshot);
+static bool FooterWrittenAfterSnapshot(TableFooter *tableFooter, Snapshot snapshot);
+static bool TableWrittenInTransaction(Relation relation);
+static uint64 TableRowNumberCount(Relation relation);
+static bool ReadRowByTid(TableReadState *readState, Relation relation, ItemPointer tid,
+						 TupleTableSlot *slot);
+static void RowNumberToTid(uint64 rowNumber, ItemPointer tid);
+static BlockNumber RowCountBlockCount(uint64 rowCount);
+static TableAMWriteState * GetTableAMWriteState(Relation relation);
+static TableAMWriteState * FindTableAMWriteState(RelFileNode relationFileNode);
+static void FillRowNumbers(TableAMWriteState *tableAMWriteState, uint64 rowCount);
+static void MarkRowsDeleted(StripeMetadata *stripeMetadata, uint64 firstRowIndex,
+							uint64 endRowIndex);
+static void DeleteRolledBackRows(TableAMWriteState *tableAMWriteState);
+static void RecordSubtransactionStart(TableAMWriteState *tableAMWriteState,
+									  SubTransactionId subtransactionId,
+									  uint64 rowNumber);
+static SubtransactionStart * FindSubtransactionStart(TableAMWriteState *tableAMWriteState,
+													 SubTransactionId subtransactionId);
+static void EndSubtransactionWrite(TableAMWriteState *tableAMWriteState,
+								   SubTransactionId subtransactionId,
+								   SubTransactionId parentSubtransactionId,
+								   bool isCommit);
+static void ReserveRowNumbers(TableAMWriteState *tableAMWriteState);
+static void WriteSlotRow(TableAMWriteState *tableAMWriteState, TupleTableSlot *slot);
+static void CheckWriteNotInterrupted(TableAMWriteState *tableAMWriteState);
+static bool FlushRelationWrites(Relation relation);
+static void FlushTableAMWrite(TableAMWriteState *tableAMWriteState);
+static void PublishTableAMWrite(TableAMWriteState *tableAMWriteState);
+static void DiscardTableAMWrite(RelFileNode relationFileNode);
+static void RestoreAbortedWrites(void);
+static void InitializeTableAMFiles(RelFileNode relationFileNode,
+								   TupleDesc tupleDescriptor);
+static void ScheduleFileDelete(RelFileNode relationFileNode, bool atCommit,
+							   Oid droppedRelationId);
+static bool FileDeletePending(RelFileNode relationFileNode, bool atCommit);
+static void DeletePendingFiles(bool isCommit);
+static void CStoreXactCallback(XactEvent event, void *argument);
+static void CStoreSubXactCallback(SubXactEvent event, SubTransactionId subtransactionId,
+								  SubTransactionId parentSubtransactionId,
+								  void *argument);
+static void CStoreObjectAccessHook(ObjectAccessType access, Oid classId, Oid objectId,
+								   int subId, void *argument);
+
+
+/* declarations for dynamic loading */
+PG_FUNCTION_INFO_V1(cstore_tableam_handler);
+
+
+/* callbacks of the cstore table access method */
+static const TableAmRoutine CStoreTableAmRoutine = {
+	.type = T_TableAmRoutine,
+
+	.slot_callbacks = CStoreSlotCallbacks,
+
+	.scan_begin = CStoreScanBegin,
+	.scan_end = CStoreScanEnd,
+	.scan_rescan = CStoreScanRescan,
+	.scan_getnextslot = CStoreScanGetNextSlot,
+
+	.parallelscan_estimate = CStoreParallelScanEstimate,
+	.parallelscan_initialize = CStoreParallelScanInitialize,
+	.parallelscan_reinitialize = CStoreParallelScanReinitialize,
+
+	.index_fetch_begin = CStoreIndexFetchBegin,
+	.index_fetch_reset = CStoreIndexFetchReset,
+	.index_fetch_end = CStoreIndexFetchEnd,
+	.index_fetch_tuple = CStoreIndexFetchTuple,
+
+	.tuple_fetch_row_version = CStoreTupleFetchRowVersion,
+	.tuple_tid_valid = CStoreTupleTidValid,
+	.tuple_get_latest_tid = CStoreTupleGetLatestTid,
+	.tuple_satisfies_snapshot = CStoreTupleSatisfiesSnapshot,
+	.compute_xid_horizon_for_tuples = CStoreComputeXidHorizonForTuples,
+
+	.tuple_insert = CStoreTupleInsert,
+	.tuple_insert_speculative = CStoreTupleInsertSpeculative,
+	.tuple_complete_speculative = CStoreTupleCompleteSpeculative,
+	.multi_insert = CStoreMultiInsert,
+	.tuple_delete = CStoreTupleDelete,
+	.tuple_update = CStoreTupleUpdate,
+	.tuple_lock = CStoreTupleLock,
+	.finish_bulk_insert = CStoreFinishBulkInsert,
+
+	.relation_set_new_filenode = CStoreRelationSetNewFilenode,
+	.relation_nontransactional_truncate = CStoreRelationNontransactionalTruncate,
+	.relation_copy_data = CStoreRelationCopyData,
+	.relation_copy_for_cluster = CStoreRelationCopyForCluster,
+	.relation_vacuum = CStoreRelationVacuum,
+	.scan_analyze_next_block = CStoreScanAnalyzeNextBlock,
+	.scan_analyze_next_tuple = CStoreScanAnalyzeNextTuple,
+	.index_build_range_scan = CStoreIndexBuildRangeScan,
+	.index_validate_scan = CStoreIndexValidateScan,
+
+	.relation_size = CStoreRelationSize,
+	.relation_needs_toast_table = CStoreRelationNeedsToastTable,
+
+	.relation_estimate_size = CStoreRelationEstimateSize,
+
+	.scan_bitmap_next_block = CStoreScanBitmapNextBlock,
+	.scan_bitmap_next_tuple = CStoreScanBitmapNextTuple,
+	.scan_sample_next_block = CStoreScanSampleNextBlock,
+	.scan_sample_next_tuple = CStoreScanSampleNextTuple
+};
+
+
+/*
+ * CStoreTableAMInit installs the callbacks that write, restore and delete files
+ * of cstore tables when transactions end, and the hook that finds dropped
+ * cstore tables. _PG_init calls this function.
+ */
+void
+CStoreTableAMInit(void)
+{
+	PreviousObjectAccessHook = object_access_hook;
+	object_access_hook = CStoreObjectAccessHook;
+
+	RegisterXactCallback(CStoreXactCallback, NULL);
+	RegisterSubXactCallback(CStoreSubXactCallback, NULL);
+}
+
+
+/* CStoreTableAMFini uninstalls the hook and callbacks of the access method. */
+void
+CStoreTableAMFini(void)
+{
+	object_access_hook = PreviousObjectAccessHook;
+
+	UnregisterXactCallback(CStoreXactCallback, NULL);
+	UnregisterSubXactCallback(CStoreSubXactCallback, NULL);
+}
+
+
+/*
+ * cstore_tableam_handler is the handler function of the cstore table access
+ * method, and returns the access method's callbacks.
+ */
+Datum
+cstore_tableam_handler(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(&CStoreTableAmRoutine);
+}
+
+
+/*
+ * CStoreSlotCallbacks returns the callbacks of virtual tuple slots, which is
+ * the slot type that our scans return rows in.
+ */
+static const TupleTableSlotOps *
+CStoreSlotCallbacks(Relation relation)
+{
+	return &TTSOpsVirtual;
+}
+
+
+/*
+ * CStoreScanBegin begins a scan of the given cstore table. We first write the
+ * rows that the transaction inserted into the table, so that the scan returns
+ * them. We read all columns, and don't filter rows with scan keys, which only
+ * catalog scans use. Scans that are part of a parallel scan claim stripes from
+ * the shared counter.
+ */
+static TableScanDesc
+CStoreScanBegin(Relation relation, Snapshot snapshot, int keyCount, ScanKey key,
+				ParallelTableScanDesc parallelScan, uint32 flags)
+{
+	CStoreScanDesc scan = NULL;
+	MemoryContext oldContext = NULL;
+	bool pendingRead = false;
+
+	FlushRelationWrites(relation);
+
+	scan = palloc0(sizeof(CStoreScanDescData));
+	scan->baseScan.rs_rd = relation;
+	scan->baseScan.rs_snapshot = snapshot;
+	scan->baseScan.rs_nkeys = keyCount;
+	scan->baseScan.rs_key = key;
+	scan->baseScan.rs_flags = flags;
+	scan->baseScan.rs_parallel = parallelScan;
+	scan->currentBlock = InvalidBlockNumber;
+	scan->sampleBlockCount = InvalidBlockNumber;
+
+	scan->scanContext = AllocSetContextCreate(CurrentMemoryContext,
+											  "CStore Table Scan Context",
+											  ALLOCSET_DEFAULT_SIZES);
+
+	pendingRead = TableWrittenInTransaction(relation) ||
+				  (parallelScan != NULL &&
+				   ((CStoreParallelScanDesc) parallelScan)->pendingRead);
+
+	oldContext = MemoryContextSwitchTo(scan->scanContext);
+	scan->readState = BeginTableAMRead(relation, pendingRead);
+	MemoryContextSwitchTo(oldContext);
+
+	CheckReadSnapshot(relation, scan->readState, snapshot);
+
+	if (parallelScan != NULL)
+	{
+		CStoreParallelScanDesc cstoreParallelScan = (CStoreParallelScanDesc) parallelScan;
+		CStoreBeginParallelRead(scan->readState, &cstoreParallelScan->nextStripeIndex);
+	}
+
+	return (TableScanDesc) scan;
+}
+
+
+/* CStoreScanEnd ends the given scan and frees its memory. */
+static void
+CStoreScanEnd(TableScanDesc baseScan)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+
+	CStoreEndRead(scan->readState);
+	MemoryContextDelete(scan->scanContext);
+
+	if (baseScan->rs_flags & SO_TEMP_SNAPSHOT)
+	{
+		UnregisterSnapshot(baseScan->rs_snapshot);
+	}
+
+	pfree(scan);
+}
+
+
+/* CStoreScanRescan restarts the given scan from the table's first row. */
+static void
+CStoreScanRescan(TableScanDesc baseScan, ScanKey key, bool setParams, bool allowStrategy,
+				 bool allowSync, bool allowPageMode)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+
+	CStoreRescanRead(scan->readState, NIL);
+	scan->currentBlock = InvalidBlockNumber;
+	scan->nextTupleIndex = 0;
+}
+
+
+/*
+ * CStoreScanGetNextSlot reads the next row of the scan in the given direction
+ * into the given slot, and sets the slot's TID from the row's number. The
+ * function returns false when there are no more rows.
+ */
+static bool
+CStoreScanGetNextSlot(TableScanDesc baseScan, ScanDirection direction,
+					  TupleTableSlot *slot)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+	bool rowFound = false;
+
+	ExecClearTuple(slot);
+
+	rowFound = CStoreReadRow(scan->readState, direction, slot->tts_values,
+							 slot->tts_isnull);
+	if (!rowFound)
+	{
+		return false;
+	}
+
+	ExecStoreVirtualTuple(slot);
+	RowNumberToTid(CStoreReadRowNumber(scan->readState), &slot->tts_tid);
+	slot->tts_tableOid = RelationGetRelid(baseScan->rs_rd);
+
+	return true;
+}
+
+
+/* CStoreParallelScanEstimate returns the size of the shared parallel scan state. */
+static Size
+CStoreParallelScanEstimate(Relation relation)
+{
+	return sizeof(CStoreParallelScanDescData);
+}
+
+
+/*
+ * CStoreParallelScanInitialize initializes the shared state of a parallel scan,
+ * and returns its size. We write the rows that the transaction inserted into
+ * the table before the workers start, so that they read these rows from the
+ * table's pending footer.
+ */
+static Size
+CStoreParallelScanInitialize(Relation relation, ParallelTableScanDesc parallelScan)
+{
+	CStoreParallelScanDesc cstoreParallelScan = (CStoreParallelScanDesc) parallelScan;
+
+	FlushRelationWrites(relation);
+
+	cstoreParallelScan->baseScan.phs_relid = RelationGetRelid(relation);
+	cstoreParallelScan->baseScan.phs_syncscan = false;
+	pg_atomic_init_u32(&cstoreParallelScan->nextStripeIndex, 0);
+	cstoreParallelScan->pendingRead = TableWrittenInTransaction(relation);
+
+	return sizeof(CStoreParallelScanDescData);
+}
+
+
+/* CStoreParallelScanReinitialize lets a parallel scan claim all stripes again. */
+static void
+CStoreParallelScanReinitialize(Relation relation, ParallelTableScanDesc parallelScan)
+{
+	CStoreParallelScanDesc cstoreParallelScan = (CStoreParallelScanDesc) parallelScan;
+
+	pg_atomic_write_u32(&cstoreParallelScan->nextStripeIndex, 0);
+}
+
+
+/* CStoreIndexFetchBegin begins fetching rows of the given table by their TIDs. */
+static IndexFetchTableData *
+CStoreIndexFetchBegin(Relation relation)
+{
+	CStoreIndexFetch fetch = palloc0(sizeof(CStoreIndexFetchData));
+	fetch->baseFetch.rel = relation;
+	fetch->fetchContext = AllocSetContextCreate(CurrentMemoryContext,
+												"CStore Index Fetch Context",
+												ALLOCSET_DEFAULT_SIZES);
+
+	return (IndexFetchTableData *) fetch;
+}
+
+
+/* CStoreIndexFetchReset does nothing, as fetches don't keep rows between calls. */
+static void
+CStoreIndexFetchReset(IndexFetchTableData *baseFetch)
+{
+}
+
+
+/* CStoreIndexFetchEnd ends fetching rows and frees the fetch's memory. */
+static void
+CStoreIndexFetchEnd(IndexFetchTableData *baseFetch)
+{
+	CStoreIndexFetch fetch = (CStoreIndexFetch) baseFetch;
+
+	if (fetch->readState != NULL)
+	{
+		CStoreEndRead(fetch->readState);
+	}
+
+	MemoryContextDelete(fetch->fetchContext);
+	pfree(fetch);
+}
+
+
+/*
+ * CStoreIndexFetchTuple reads the row with the given TID into the given slot.
+ * If the row isn't in the table's files, it may be one that the transaction
+ * inserted. We then write these rows, and try to read the row again. Rows that
+ * rolled back subtransactions wrote are deleted before the read begins. Rows
+ * have a single version, so we never ask the caller to call us again for the
+ * TID.
+ */
+static bool
+CStoreIndexFetchTuple(IndexFetchTableData *baseFetch, ItemPointer tid,
+					  Snapshot snapshot, TupleTableSlot *slot, bool *callAgain,
+					  bool *allDead)
+{
+	CStoreIndexFetch fetch = (CStoreIndexFetch) baseFetch;
+	Relation relation = baseFetch->rel;
+	MemoryContext oldContext = NULL;
+	bool rowFound = false;
+
+	*callAgain = false;
+	if (allDead != NULL)
+	{
+		*allDead = false;
+	}
+
+	/* unique checks wait for writers that a dirty snapshot names; rows have none */
+	if (snapshot->snapshot_type == SNAPSHOT_DIRTY)
+	{
+		snapshot->xmin = InvalidTransactionId;
+		snapshot->xmax = InvalidTransactionId;
+		snapshot->speculativeToken = 0;
+	}
+
+	if (fetch->readState == NULL)
+	{
+		TableAMWriteState *tableAMWriteState = FindTableAMWriteState(relation->rd_node);
+
+		/* rows of rolled back subtransactions may be in the files already */
+		if (tableAMWriteState != NULL && tableAMWriteState->deletedRowRangeList != NIL)
+		{
+			FlushRelationWrites(relation);
+		}
+
+		oldContext = MemoryContextSwitchTo(fetch->fetchContext);
+		fetch->readState = BeginTableAMRead(relation, tableAMWriteState != NULL);
+		MemoryContextSwitchTo(oldContext);
+
+		CheckReadSnapshot(relation, fetch->readState, snapshot);
+	}
+
+	rowFound = ReadRowByTid(fetch->readState, relation, tid, slot);
+	if (!rowFound && FlushRelationWrites(relation))
+	{
+		CStoreEndRead(fetch->readState);
+		MemoryContextReset(fetch->fetchContext);
+
+		oldContext = MemoryContextSwitchTo(fetch->fetchContext);
+		fetch->readState = BeginTableAMRead(relation, true);
+		MemoryContextSwitchTo(oldContext);
+
+		CheckReadSnapshot(relation, fetch->readState, snapshot);
+
+		rowFound = ReadRowByTid(fetch->readState, relation, tid, slot);
+	}
+
+	return rowFound;
+}
+
+
+/*
+ * CStoreTupleFetchRowVersion reads the row with the given TID into the given
+ * slot, and returns false if there is no such row. Since the read ends before
+ * we return, we copy the row's values into the slot.
+ */
+static bool
+CStoreTupleFetchRowVersion(Relation relation, ItemPointer tid, Snapshot snapshot,
+						   TupleTableSlot *slot)
+{
+	TableReadState *readState = NULL;
+	bool rowFound = false;
+
+	FlushRelationWrites(relation);
+
+	readState = BeginTableAMRead(relation, TableWrittenInTransaction(relation));
+	CheckReadSnapshot(relation, readState, snapshot);
+
+	rowFound = ReadRowByTid(readState, relation, tid, slot);
+	if (rowFound)
+	{
+		ExecMaterializeSlot(slot);
+	}
+
+	CStoreEndRead(readState);
+
+	return rowFound;
+}
+
+
+/*
+ * CStoreTupleTidValid checks if the given TID can address a row. Rows of blocks
+ * past the table's end don't exist, which fetches find out anyway.
+ */
+static bool
+CStoreTupleTidValid(TableScanDesc baseScan, ItemPointer tid)
+{
+	return ItemPointerIsValid(tid) &&
+		   ItemPointerGetOffsetNumber(tid) <= CSTORE_TABLEAM_BLOCK_ROW_COUNT;
+}
+
+
+/* CStoreTupleGetLatestTid keeps the given TID, since rows have a single version. */
+static void
+CStoreTupleGetLatestTid(TableScanDesc baseScan, ItemPointer tid)
+{
+}
+
+
+/*
+ * CStoreTupleSatisfiesSnapshot returns true, as rows don't record the
+ * transactions that wrote them. Reads return the rows of the table's footer
+ * when they begin, which only has the stripes of committed transactions, and
+ * the rows that the current transaction wrote. Other rows whose TIDs indexes
+ * return aren't found. Reads that began under a snapshot that doesn't see all
+ * of the footer's rows errored out in CheckReadSnapshot.
+ */
+static bool
+CStoreTupleSatisfiesSnapshot(Relation relation, TupleTableSlot *slot,
+							 Snapshot snapshot)
+{
+	return true;
+}
+
+
+/*
+ * CStoreComputeXidHorizonForTuples returns an invalid transaction id, as rows
+ * of cstore tables are never removed by vacuum.
+ */
+static TransactionId
+CStoreComputeXidHorizonForTuples(Relation relation, ItemPointerData *tidArray,
+								 int tidCount)
+{
+	return InvalidTransactionId;
+}
+
+
+/*
+ * CStoreTupleInsert adds the row in the given slot to the rows that the
+ * transaction writes into the table, and sets the slot's TID to the row's.
+ * Serializable transactions that read the table conflict with the insert.
+ */
+static void
+CStoreTupleInsert(Relation relation, TupleTableSlot *slot, CommandId commandId,
+				  int options, BulkInsertState bulkInsertState)
+{
+	TableAMWriteState *tableAMWriteState = GetTableAMWriteState(relation);
+
+	CheckForSerializableConflictIn(relation, NULL, InvalidBuffer);
+
+	WriteSlotRow(tableAMWriteState, slot);
+	slot->tts_tableOid = RelationGetRelid(relation);
+}
+
+
+/* CStoreTupleInsertSpeculative errors out, as cstore tables have no ON CONFLICT. */
+static void
+CStoreTupleInsertSpeculative(Relation relation, TupleTableSlot *slot,
+							 CommandId commandId, int options,
+							 BulkInsertState bulkInsertState, uint32 specToken)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("INSERT ... ON CONFLICT is not supported on cstore "
+						   "tables")));
+}
+
+
+/* CStoreTupleCompleteSpeculative errors out, as cstore tables have no ON CONFLICT. */
+static void
+CStoreTupleCompleteSpeculative(Relation relation, TupleTableSlot *slot,
+							   uint32 specToken, bool succeeded)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("INSERT ... ON CONFLICT is not supported on cstore "
+						   "tables")));
+}
+
+
+/*
+ * CStoreMultiInsert adds the rows in the given slots to the rows that the
+ * transaction writes into the table. COPY inserts rows this way.
+ */
+static void
+CStoreMultiInsert(Relation relation, TupleTableSlot **slots, int slotCount,
+				  CommandId commandId, int options, BulkInsertState bulkInsertState)
+{
+	TableAMWriteState *tableAMWriteState = GetTableAMWriteState(relation);
+	int slotIndex = 0;
+
+	CheckForSerializableConflictIn(relation, NULL, InvalidBuffer);
+
+	for (slotIndex = 0; slotIndex < slotCount; slotIndex++)
+	{
+		TupleTableSlot *slot = slots[slotIndex];
+
+		WriteSlotRow(tableAMWriteState, slot);
+		slot->tts_tableOid = RelationGetRelid(relation);
+	}
+}
+
+
+/* CStoreTupleDelete errors out, as cstore tables don't support DELETE. */
+static TM_Result
+CStoreTupleDelete(Relation relation, ItemPointer tid, CommandId commandId,
+				  Snapshot snapshot, Snapshot crosscheck, bool wait,
+				  TM_FailureData *failureData, bool changingPart)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("DELETE is not supported on cstore tables")));
+
+	return TM_Ok;
+}
+
+
+/* CStoreTupleUpdate errors out, as cstore tables don't support UPDATE. */
+static TM_Result
+CStoreTupleUpdate(Relation relation, ItemPointer oldTid, TupleTableSlot *slot,
+				  CommandId commandId, Snapshot snapshot, Snapshot crosscheck,
+				  bool wait, TM_FailureData *failureData, LockTupleMode *lockMode,
+				  bool *updateIndexes)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("UPDATE is not supported on cstore tables")));
+
+	return TM_Ok;
+}
+
+
+/* CStoreTupleLock errors out, as rows of cstore tables can't be locked. */
+static TM_Result
+CStoreTupleLock(Relation relation, ItemPointer tid, Snapshot snapshot,
+				TupleTableSlot *slot, CommandId commandId, LockTupleMode mode,
+				LockWaitPolicy waitPolicy, uint8 flags, TM_FailureData *failureData)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("row locks are not supported on cstore tables")));
+
+	return TM_Ok;
+}
+
+
+/*
+ * CStoreFinishBulkInsert does nothing. We keep the inserted rows buffered, so
+ * that later statements of the transaction can add rows to the same stripe.
+ */
+static void
+CStoreFinishBulkInsert(Relation relation, int options)
+{
+}
+
+
+/*
+ * CStoreRelationSetNewFilenode creates the files of a new cstore table, or the
+ * new files of a truncated or rewritten one. We delete the new files if the
+ * transaction aborts, and the old files if it commits. The relation also gets
+ * an empty main fork, as code that opens relations' storage expects it.
+ */
+static void
+CStoreRelationSetNewFilenode(Relation relation, const RelFileNode *newFileNode,
+							 char persistence, TransactionId *freezeXid,
+							 MultiXactId *minMulti)
+{
+	SMgrRelation storageRelation = NULL;
+
+	if (!RelFileNodeEquals(*newFileNode, relation->rd_node))
+	{
+		ScheduleFileDelete(relation->rd_node, true, InvalidOid);
+	}
+
+	*freezeXid = InvalidTransactionId;
+	*minMulti = InvalidMultiXactId;
+
+	storageRelation = RelationCreateStorage(*newFileNode, persistence);
+	smgrclose(storageRelation);
+
+	InitializeTableAMFiles(*newFileNode, RelationGetDescr(relation));
+	ScheduleFileDelete(*newFileNode, false, InvalidOid);
+}
+
+
+/*
+ * CStoreRelationNontransactionalTruncate truncates a table that the transaction
+ * created, or whose files it created, by replacing its files with empty ones.
+ * Buffered rows of the table are discarded.
+ */
+static void
+CStoreRelationNontransactionalTruncate(Relation relation)
+{
+	char *filename = TableAMFilename(relation->rd_node);
+
+	DiscardTableAMWrite(relation->rd_node);
+
+	DeleteCStoreTableFiles(filename);
+	InitializeTableAMFiles(relation->rd_node, RelationGetDescr(relation));
+}
+
+
+/* CStoreRelationCopyData errors out, as cstore tables can't move tablespaces. */
+static void
+CStoreRelationCopyData(Relation relation, const RelFileNode *newFileNode)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("changing the tablespace of cstore tables is not "
+						   "supported")));
+}
+
+
+/*
+ * CStoreRelationCopyForCluster errors out, as cstore tables don't support
+ * CLUSTER and VACUUM FULL. cstore tables only have the rows they return, so
+ * there is nothing for these commands to remove.
+ */
+static void
+CStoreRelationCopyForCluster(Relation newRelation, Relation oldRelation,
+							 Relation oldIndex, bool useSort, TransactionId oldestXmin,
+							 TransactionId *xidCutoff, MultiXactId *multiCutoff,
+							 double *tupleCount, double *vacuumedTupleCount,
+							 double *recentlyDeadTupleCount)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("CLUSTER and VACUUM FULL are not supported on cstore "
+						   "tables")));
+}
+
+
+/* CStoreRelationVacuum does nothing, as cstore tables have no dead rows. */
+static void
+CStoreRelationVacuum(Relation relation, VacuumParams *params,
+					 BufferAccessStrategy bufferStrategy)
+{
+}
+
+
+/*
+ * CStoreScanAnalyzeNextBlock starts reading the rows of the given block for
+ * ANALYZE. Blocks are the row number ranges that TIDs address.
+ */
+static bool
+CStoreScanAnalyzeNextBlock(TableScanDesc baseScan, BlockNumber blockNumber,
+						   BufferAccessStrategy bufferStrategy)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+
+	scan->currentBlock = blockNumber;
+	scan->nextTupleIndex = 0;
+
+	return true;
+}
+
+
+/*
+ * CStoreScanAnalyzeNextTuple reads the next row of the current ANALYZE block
+ * into the given slot, and counts it as a live row. The function returns false
+ * when the block has no more rows.
+ */
+static bool
+CStoreScanAnalyzeNextTuple(TableScanDesc baseScan, TransactionId oldestXmin,
+						   double *liveRowCount, double *deadRowCount,
+						   TupleTableSlot *slot)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+
+	while (scan->nextTupleIndex < CSTORE_TABLEAM_BLOCK_ROW_COUNT)
+	{
+		ItemPointerData tid;
+		bool rowFound = false;
+
+		ItemPointerSet(&tid, scan->currentBlock,
+					   scan->nextTupleIndex + FirstOffsetNumber);
+		scan->nextTupleIndex++;
+
+		rowFound = ReadRowByTid(scan->readState, baseScan->rs_rd, &tid, slot);
+		if (rowFound)
+		{
+			(*liveRowCount) += 1;
+			return true;
+		}
+	}
+
+	ExecClearTuple(slot);
+
+	return false;
+}
+
+
+/*
+ * CStoreIndexBuildRangeScan scans the rows of the given table for building the
+ * given index, and calls the callback with each row's index values and TID.
+ * We skip rows of partial indexes that don't satisfy the index predicate, and
+ * rows of blocks outside the given block range. Parallel index builds pass the
+ * scan of their process, which ends here as well.
+ */
+static double
+CStoreIndexBuildRangeScan(Relation tableRelation, Relation indexRelation,
+						  IndexInfo *indexInfo, bool allowSync, bool anyVisible,
+						  bool progress, BlockNumber startBlock, BlockNumber blockCount,
+						  IndexBuildCallback callback, void *callbackState,
+						  TableScanDesc baseScan)
+{
+	EState *estate = CreateExecutorState();
+	ExprContext *expressionContext = GetPerTupleExprContext(estate);
+	TupleTableSlot *slot = table_slot_create(tableRelation, NULL);
+	ExprState *predicate = NULL;
+	Datum indexValues[INDEX_MAX_KEYS];
+	bool indexNulls[INDEX_MAX_KEYS];
+	double rowCount = 0;
+
+	expressionContext->ecxt_scantuple = slot;
+	predicate = ExecPrepareQual(indexInfo->ii_Predicate, estate);
+
+	if (baseScan == NULL)
+	{
+		baseScan = table_beginscan_strat(tableRelation, SnapshotAny, 0, NULL, true,
+										 allowSync);
+	}
+
+	while (table_scan_getnextslot(baseScan, ForwardScanDirection, slot))
+	{
+		BlockNumber blockNumber = ItemPointerGetBlockNumber(&slot->tts_tid);
+		HeapTuple heapTuple = NULL;
+		MemoryContext oldContext = NULL;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (blockNumber < startBlock ||
+			(blockCount != InvalidBlockNumber && blockNumber - startBlock >= blockCount))
+		{
+			continue;
+		}
+
+		MemoryContextReset(expressionContext->ecxt_per_tuple_memory);
+
+		if (predicate != NULL && !ExecQual(predicate, expressionContext))
+		{
+			continue;
+		}
+
+		FormIndexDatum(indexInfo, slot, estate, indexValues, indexNulls);
+
+		/* index build callbacks take the row's TID from a heap tuple */
+		oldContext = MemoryContextSwitchTo(expressionContext->ecxt_per_tuple_memory);
+		heapTuple = ExecCopySlotHeapTuple(slot);
+		heapTuple->t_self = slot->tts_tid;
+		MemoryContextSwitchTo(oldContext);
+
+		callback(indexRelation, heapTuple, indexValues, indexNulls, true, callbackState);
+
+		rowCount += 1;
+	}
+
+	table_endscan(baseScan);
+
+	ExecDropSingleTupleTableSlot(slot);
+	FreeExecutorState(estate);
+
+	indexInfo->ii_ExpressionsState = NIL;
+	indexInfo->ii_PredicateState = NULL;
+
+	return rowCount;
+}
+
+
+/* CStoreIndexValidateScan errors out, as indexes can't be built concurrently. */
+static void
+CStoreIndexValidateScan(Relation tableRelation, Relation indexRelation,
+						IndexInfo *indexInfo, Snapshot snapshot,
+						ValidateIndexState *state)
+{
+	ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					errmsg("concurrent index builds are not supported on cstore "
+						   "tables")));
+}
+
+
+/*
+ * CStoreRelationSize returns the size of the given fork of the table. The main
+ * fork's size covers the blocks that TIDs of the table's rows address, so that
+ * ANALYZE and sample scans visit all rows. The other forks are empty.
+ */
+static uint64
+CStoreRelationSize(Relation relation, ForkNumber forkNumber)
+{
+	uint64 rowCount = 0;
+
+	if (forkNumber != MAIN_FORKNUM)
+	{
+		return 0;
+	}
+
+	FlushRelationWrites(relation);
+
+	rowCount = TableRowNumberCount(relation);
+
+	return (uint64) RowCountBlockCount(rowCount) * BLCKSZ;
+}
+
+
+/* CStoreRelationNeedsToastTable returns false, as cstore files hold large values. */
+static bool
+CStoreRelationNeedsToastTable(Relation relation)
+{
+	return false;
+}
+
+
+/*
+ * CStoreRelationEstimateSize sets the table's row count from its skip lists, and
+ * its page count to the blocks that its rows' TIDs address. Rows of cstore
+ * tables don't have visibility information, so no pages are all visible.
+ */
+static void
+CStoreRelationEstimateSize(Relation relation, int32 *attributeWidths,
+						   BlockNumber *pageCount, double *tupleCount,
+						   double *allVisibleFraction)
+{
+	char *filename = TableAMFilename(relation->rd_node);
+	uint64 rowCount = CStoreTableRowCount(filename);
+
+	*tupleCount = (double) rowCount;
+	*pageCount = RowCountBlockCount(rowCount);
+	*allVisibleFraction = 0;
+}
+
+
+/* CStoreScanBitmapNextBlock starts reading the rows of the given bitmap page. */
+static bool
+CStoreScanBitmapNextBlock(TableScanDesc baseScan, TBMIterateResult *bitmapResult)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+
+	scan->currentBlock = bitmapResult->blockno;
+	scan->nextTupleIndex = 0;
+
+	return true;
+}
+
+
+/*
+ * CStoreScanBitmapNextTuple reads the next row of the current bitmap page into
+ * the given slot. Lossy pages don't list their rows, so we then try all rows
+ * of the block.
+ */
+static bool
+CStoreScanBitmapNextTuple(TableScanDesc baseScan, TBMIterateResult *bitmapResult,
+						  TupleTableSlot *slot)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+	bool lossyPage = (bitmapResult->ntuples < 0);
+	uint32 tupleCount = lossyPage ? CSTORE_TABLEAM_BLOCK_ROW_COUNT :
+						bitmapResult->ntuples;
+
+	while (scan->nextTupleIndex < tupleCount)
+	{
+		ItemPointerData tid;
+		OffsetNumber offset = InvalidOffsetNumber;
+		bool rowFound = false;
+
+		if (lossyPage)
+		{
+			offset = scan->nextTupleIndex + FirstOffsetNumber;
+		}
+		else
+		{
+			offset = bitmapResult->offsets[scan->nextTupleIndex];
+		}
+
+		scan->nextTupleIndex++;
+
+		ItemPointerSet(&tid, bitmapResult->blockno, offset);
+		rowFound = ReadRowByTid(scan->readState, baseScan->rs_rd, &tid, slot);
+		if (rowFound)
+		{
+			return true;
+		}
+	}
+
+	ExecClearTuple(slot);
+
+	return false;
+}
+
+
+/*
+ * CStoreScanSampleNextBlock moves a sample scan to the next block that the
+ * sampling method selects, or to the next block in order if the method doesn't
+ * select blocks. The function returns false when no blocks are left.
+ */
+static bool
+CStoreScanSampleNextBlock(TableScanDesc baseScan, SampleScanState *sampleScanState)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+	TsmRoutine *sampleRoutine = sampleScanState->tsmroutine;
+	BlockNumber blockNumber = InvalidBlockNumber;
+
+	if (scan->sampleBlockCount == InvalidBlockNumber)
+	{
+		uint64 rowCount = TableRowNumberCount(baseScan->rs_rd);
+
+		scan->sampleBlockCount = RowCountBlockCount(rowCount);
+	}
+
+	if (sampleRoutine->NextSampleBlock != NULL)
+	{
+		blockNumber = sampleRoutine->NextSampleBlock(sampleScanState,
+													 scan->sampleBlockCount);
+	}
+	else if (scan->currentBlock == InvalidBlockNumber)
+	{
+		blockNumber = 0;
+	}
+	else
+	{
+		blockNumber = scan->currentBlock + 1;
+	}
+
+	if (blockNumber >= scan->sampleBlockCount)
+	{
+		blockNumber = InvalidBlockNumber;
+	}
+
+	scan->currentBlock = blockNumber;
+
+	return BlockNumberIsValid(blockNumber);
+}
+
+
+/*
+ * CStoreScanSampleNextTuple reads the next row of the current block that the
+ * sampling method selects into the given slot. The function returns false when
+ * the method selects no more rows of the block.
+ */
+static bool
+CStoreScanSampleNextTuple(TableScanDesc baseScan, SampleScanState *sampleScanState,
+						  TupleTableSlot *slot)
+{
+	CStoreScanDesc scan = (CStoreScanDesc) baseScan;
+	TsmRoutine *sampleRoutine = sampleScanState->tsmroutine;
+
+	for (;;)
+	{
+		ItemPointerData tid;
+		bool rowFound = false;
+		OffsetNumber offset = sampleRoutine->NextSampleTuple(sampleScanState,
+															 scan->currentBlock,
+															 CSTORE_TABLEAM_BLOCK_ROW_COUNT);
+		if (!OffsetNumberIsValid(offset))
+		{
+			break;
+		}
+
+		ItemPointerSet(&tid, scan->currentBlock, offset);
+		rowFound = ReadRowByTid(scan->readState, baseScan->rs_rd, &tid, slot);
+		if (rowFound)
+		{
+			return true;
+		}
+	}
+
+	ExecClearTuple(slot);
+
+	return false;
+}
+
+
+/*
+ * TableAMFilename returns the path of the data file of the cstore table with
+ * the given relfilenode. The path has the same form as the default path of
+ * cstore_fdw tables.
+ */
+static char *
+TableAMFilename(RelFileNode relationFileNode)
+{
+	StringInfo filename = makeStringInfo();
+	appendStringInfo(filename, "%s/%s/%u/%u", DataDir, CSTORE_FDW_NAME,
+					 relationFileNode.dbNode, relationFileNode.relNode);
+
+	return filename->data;
+}
+
+
+/*
+ * ReadTableAMFooter reads the footer of the given data file, or its pending
+ * footer if pending is true. The function returns NULL if there is no pending
+ * footer.
+ */
+static TableFooter *
+ReadTableAMFooter(const char *filename, bool pending)
+{
+	TableFooter *tableFooter = NULL;
+	StringInfo tableFooterFilename = makeStringInfo();
+	struct stat statBuffer;
+
+	appendStringInfo(tableFooterFilename, "%s%s", filename,
+					 pending ? CSTORE_PENDING_FOOTER_FILE_SUFFIX :
+					 CSTORE_FOOTER_FILE_SUFFIX);
+
+	if (!pending || stat(tableFooterFilename->data, &statBuffer) == 0)
+	{
+		tableFooter = CStoreReadFooter(tableFooterFilename);
+	}
+
+	pfree(tableFooterFilename->data);
+	pfree(tableFooterFilename);
+
+	return tableFooter;
+}
+
+
+/*
+ * BeginTableAMRead begins reading all columns of the given table's rows. Reads
+ * of tables that the transaction wrote into set pendingRead, and read the
+ * stripes of the table's pending footer.
+ */
+static TableReadState *
+BeginTableAMRead(Relation relation, bool pendingRead)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	char *filename = TableAMFilename(relation->rd_node);
+	List *columnList = NIL;
+	int columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		const Index tableId = 1;
+
+		if (!attributeForm->attisdropped)
+		{
+			Var *column = makeVar(tableId, columnIndex + 1, attributeForm->atttypid,
+								  attributeForm->atttypmod, attributeForm->attcollation, 0);
+			columnList = lappend(columnList, column);
+		}
+	}
+
+	if (pendingRead)
+	{
+		return CStoreBeginPendingRead(filename, tupleDescriptor, columnList);
+	}
+
+	return CStoreBeginRead(filename, tupleDescriptor, columnList, NIL);
+}
+
+
+/*
+ * CheckReadSnapshot checks that the given read of a table returns the rows that
+ * the given snapshot sees. Writers of a table publish their footers one after
+ * the other, so the read's footer has rows that the snapshot doesn't see only
+ * if the snapshot doesn't see the footer's last writer. Transactions whose
+ * snapshot lasts for the whole transaction then error out, as they do for heap
+ * rows that concurrent transactions updated. Serializable transactions also
+ * take a predicate lock on the whole table, which inserts conflict with.
+ */
+static void
+CheckReadSnapshot(Relation relation, TableReadState *readState, Snapshot snapshot)
+{
+	if (snapshot == NULL || !IsMVCCSnapshot(snapshot))
+	{
+		return;
+	}
+
+	PredicateLockRelation(relation, snapshot);
+
+	if (IsolationUsesXactSnapshot() &&
+		FooterWrittenAfterSnapshot(readState->tableFooter, snapshot))
+	{
+		ereport(ERROR, (errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
+						errmsg("could not serialize access due to concurrent insert")));
+	}
+}
+
+
+/*
+ * FooterWrittenAfterSnapshot checks if the given snapshot doesn't see the last
+ * writer of the given footer. Transactions that are more than half the
+ * transaction id space old precede all snapshots, and their ids may have
+ * wrapped around, so we compare full transaction ids first.
+ */
+static bool
+FooterWrittenAfterSnapshot(TableFooter *tableFooter, Snapshot snapshot)
+{
+	uint64 writerTransactionId = tableFooter->writerTransactionId;
+	uint64 nextTransactionId = U64FromFullTransactionId(ReadNextFullTransactionId());
+	TransactionId writerXid = InvalidTransactionId;
+
+	if (writerTransactionId == 0 ||
+		nextTransactionId - writerTransactionId > MaxTransactionId / 2)
+	{
+		return false;
+	}
+
+	writerXid = (TransactionId) writerTransactionId;
+	if (TransactionIdIsCurrentTransactionId(writerXid))
+	{
+		return false;
+	}
+
+	return XidInMVCCSnapshot(writerXid, snapshot);
+}
+
+
+/* TableWrittenInTransaction checks if the transaction wrote into the given table. */
+static bool
+TableWrittenInTransaction(Relation relation)
+{
+	return FindTableAMWriteState(relation->rd_node) != NULL;
+}
+
+
+/*
+ * TableRowNumberCount returns the number of rows in the stripes of the given
+ * table that the transaction reads, counting deleted rows.
+ */
+static uint64
+TableRowNumberCount(Relation relation)
+{
+	TableAMWriteState *tableAMWriteState = FindTableAMWriteState(relation->rd_node);
+
+	if (tableAMWriteState != NULL)
+	{
+		return tableAMWriteState->stripeRowCount;
+	}
+
+	return CStoreTableRowNumberCount(TableAMFilename(relation->rd_node));
+}
+
+
+/*
+ * ReadRowByTid reads the row with the given TID into the given slot, and returns
+ * false if there is no such row. The slot's values point into the read's memory.
+ */
+static bool
+ReadRowByTid(TableReadState *readState, Relation relation, ItemPointer tid,
+			 TupleTableSlot *slot)
+{
+	OffsetNumber offset = ItemPointerGetOffsetNumber(tid);
+	uint64 rowNumber = 0;
+	bool rowFound = false;
+
+	ExecClearTuple(slot);
+
+	if (offset < FirstOffsetNumber || offset > CSTORE_TABLEAM_BLOCK_ROW_COUNT)
+	{
+		return false;
+	}
+
+	rowNumber = (uint64) ItemPointerGetBlockNumber(tid) * CSTORE_TABLEAM_BLOCK_ROW_COUNT +
+				(offset - FirstOffsetNumber);
+
+	rowFound = CStoreReadRowByNumber(readState, rowNumber, slot->tts_values,
+									 slot->tts_isnull);
+	if (!rowFound)
+	{
+		return false;
+	}
+
+	ExecStoreVirtualTuple(slot);
+	slot->tts_tid = *tid;
+	slot->tts_tableOid = RelationGetRelid(relation);
+
+	return true;
+}
+
+
+/* RowNumberToTid sets the given TID to the TID of the row with the given number. */
+static void
+RowNumberToTid(uint64 rowNumber, ItemPointer tid)
+{
+	BlockNumber blockNumber = (BlockNumber) (rowNumber / CSTORE_TABLEAM_BLOCK_ROW_COUNT);
+	OffsetNumber offset = (OffsetNumber) (rowNumber % CSTORE_TABLEAM_BLOCK_ROW_COUNT) +
+						  FirstOffsetNumber;
+
+	ItemPointerSet(tid, blockNumber, offset);
+}
+
+
+/* RowCountBlockCount returns the number of blocks that TIDs of the rows cover. */
+static BlockNumber
+RowCountBlockCount(uint64 rowCount)
+{
+	return (BlockNumber) ((rowCount + CSTORE_TABLEAM_BLOCK_ROW_COUNT - 1) /
+						  CSTORE_TABLEAM_BLOCK_ROW_COUNT);
+}
+
+
+/*
+ * GetTableAMWriteState returns the state of the transaction's writes to the
+ * given table, ready to write rows. When the transaction first writes to the
+ * table, we wait for the table's write lock, and begin the table's pending
+ * footer from its footer. A pending footer that is already there belongs to a
+ * writer that aborted or crashed, and we only keep its reservation. We then
+ * fill row numbers that earlier writers reserved. When a write starts, we also
+ * fill the row numbers of rows that a write of a rolled back subtransaction
+ * handed out. The next row's number is then the number of rows in the stripes
+ * of the pending footer.
+ */
+static TableAMWriteState *
+GetTableAMWriteState(Relation relation)
+{
+	TupleDesc tupleDescriptor = RelationGetDescr(relation);
+	TableAMWriteState *tableAMWriteState = FindTableAMWriteState(relation->rd_node);
+	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	if (tableAMWriteState == NULL)
+	{
+		ResourceOwner savedResourceOwner = CurrentResourceOwner;
+		TableFooter *pendingFooter = NULL;
+		TableFooter *leftoverFooter = NULL;
+
+		tableAMWriteState = palloc0(sizeof(TableAMWriteState));
+		tableAMWriteState->relationFileNode = relation->rd_node;
+		tableAMWriteState->filename = TableAMFilename(relation->rd_node);
+		tableAMWriteState->tupleDescriptor = CreateTupleDescCopy(tupleDescriptor);
+		tableAMWriteState->rowContext = AllocSetContextCreate(TopTransactionContext,
+															  "CStore Table Write Row Context",
+															  ALLOCSET_DEFAULT_SIZES);
+
+		/* the lock outlives subtransactions, as the write state does */
+		CurrentResourceOwner = TopTransactionResourceOwner;
+		LockPage(relation, CSTORE_TABLEAM_WRITE_LOCK_PAGE, ExclusiveLock);
+		CurrentResourceOwner = savedResourceOwner;
+
+		pendingFooter = ReadTableAMFooter(tableAMWriteState->filename, false);
+		leftoverFooter = ReadTableAMFooter(tableAMWriteState->filename, true);
+		if (leftoverFooter != NULL)
+		{
+			pendingFooter->reservedRowCount = Max(pendingFooter->reservedRowCount,
+												  leftoverFooter->reservedRowCount);
+		}
+
+		CStoreReplacePendingFooter(tableAMWriteState->filename, pendingFooter);
+
+		tableAMWriteState->pendingFooter = pendingFooter;
+		tableAMWriteState->stripeRowCount =
+			CStoreTableRowNumberCount(tableAMWriteState->filename);
+		tableAMWriteState->abortFooter = ReadTableAMFooter(tableAMWriteState->filename,
+														   false);
+
+		FillRowNumbers(tableAMWriteState, pendingFooter->reservedRowCount);
+		RecordSubtransactionStart(tableAMWriteState, GetCurrentSubTransactionId(),
+								  tableAMWriteState->stripeRowCount);
+
+		TableAMWriteStateList = lappend(TableAMWriteStateList, tableAMWriteState);
+	}
+
+	CheckWriteNotInterrupted(tableAMWriteState);
+
+	/* columns added after the write started need a new write */
+	if (tableAMWriteState->writeState != NULL &&
+		tableAMWriteState->tupleDescriptor->natts != tupleDescriptor->natts)
+	{
+		FlushTableAMWrite(tableAMWriteState);
+	}
+
+	if (tableAMWriteState->writeState == NULL)
+	{
+		if (tableAMWriteState->tupleDescriptor->natts != tupleDescriptor->natts)
+		{
+			tableAMWriteState->tupleDescriptor = CreateTupleDescCopy(tupleDescriptor);
+		}
+
+		FillRowNumbers(tableAMWriteState, tableAMWriteState->nextRowNumber);
+
+		tableAMWriteState->nextRowNumber = tableAMWriteState->stripeRowCount;
+		tableAMWriteState->writeState =
+			CStoreBeginPendingWrite(tableAMWriteState->filename,
+									DEFAULT_STRIPE_ROW_COUNT,
+									tableAMWriteState->tupleDescriptor);
+		tableAMWriteState->writeSubtransactionId = GetCurrentSubTransactionId();
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	return tableAMWriteState;
+}
+
+
+/*
+ * FindTableAMWriteState returns the transaction's write state for the table
+ * files with the given relfilenode, or NULL if there is none.
+ */
+static TableAMWriteState *
+FindTableAMWriteState(RelFileNode relationFileNode)
+{
+	ListCell *writeStateCell = NULL;
+
+	foreach(writeStateCell, TableAMWriteStateList)
+	{
+		TableAMWriteState *tableAMWriteState = lfirst(writeStateCell);
+		if (RelFileNodeEquals(tableAMWriteState->relationFileNode, relationFileNode))
+		{
+			return tableAMWriteState;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * FillRowNumbers writes rows for the row numbers up to the given count that
+ * the stripes of the table's pending footer don't have yet. Writers that
+ * aborted, crashed, or rolled back a subtransaction handed out these numbers,
+ * and indexes may have entries for them. We write the rows as a single stripe,
+ * which we mark as deleted in the same footer update.
+ */
+static void
+FillRowNumbers(TableAMWriteState *tableAMWriteState, uint64 rowCount)
+{
+	char *filename = tableAMWriteState->filename;
+	TupleDesc tupleDescriptor = tableAMWriteState->tupleDescriptor;
+	uint32 columnCount = tupleDescriptor->natts;
+	uint64 stripeRowCount = tableAMWriteState->stripeRowCount;
+	uint64 fillRowCount = 0;
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
+	TableWriteState *writeState = NULL;
+	StripeMetadata *fillStripe = NULL;
+	uint64 rowIndex = 0;
+
+	if (rowCount <= stripeRowCount)
+	{
+		return;
+	}
+
+	fillRowCount = rowCount - stripeRowCount;
+	columnValues = palloc0(columnCount * sizeof(Datum));
+	columnNulls = palloc0(columnCount * sizeof(bool));
+	memset(columnNulls, true, columnCount * sizeof(bool));
+
+	/* the stripe row count makes the last row flush the stripe */
+	writeState = CStoreBeginPendingWrite(filename, fillRowCount, tupleDescriptor);
+	for (rowIndex = 0; rowIndex < fillRowCount; rowIndex++)
+	{
+		CStoreWriteRow(writeState, columnValues, columnNulls);
+	}
+
+	fillStripe = llast(writeState->tableFooter->stripeMetadataList);
+	MarkRowsDeleted(fillStripe, 0, fillRowCount);
+
+	CStoreEndWrite(writeState);
+
+	tableAMWriteState->pendingFooter = ReadTableAMFooter(filename, true);
+	tableAMWriteState->stripeRowCount = rowCount;
+}
+
+
+/*
+ * MarkRowsDeleted marks the rows of the given stripe from the first given row
+ * index up to, but not including, the end index as deleted. The stripe's
+ * deleted row bitmap grows to the last deleted row.
+ */
+static void
+MarkRowsDeleted(StripeMetadata *stripeMetadata, uint64 firstRowIndex, uint64 endRowIndex)
+{
+	uint32 bitmapLength = (uint32) ((endRowIndex + 7) / 8);
+	uint64 rowIndex = 0;
+
+	if (bitmapLength > stripeMetadata->deletedRowBitmapLength)
+	{
+		uint8 *deletedRowBitmap = palloc0(bitmapLength);
+		if (stripeMetadata->deletedRowBitmapLength > 0)
+		{
+			memcpy(deletedRowBitmap, stripeMetadata->deletedRowBitmap,
+				   stripeMetadata->deletedRowBitmapLength);
+		}
+
+		stripeMetadata->deletedRowBitmap = deletedRowBitmap;
+		stripeMetadata->deletedRowBitmapLength = bitmapLength;
+	}
+
+	for (rowIndex = firstRowIndex; rowIndex < endRowIndex; rowIndex++)
+	{
+		uint8 rowBit = (uint8) (1 << (rowIndex % 8));
+
+		if ((stripeMetadata->deletedRowBitmap[rowIndex / 8] & rowBit) == 0)
+		{
+			stripeMetadata->deletedRowBitmap[rowIndex / 8] |= rowBit;
+			stripeMetadata->deletedRowCount++;
+		}
+	}
+}
+
+
+/*
+ * DeleteRolledBackRows marks the rows whose numbers rolled back subtransactions
+ * handed out as deleted in the stripes of the table's pending footer, and writes
+ * the footer. The caller finished the transaction's write first, so these rows
+ * are in the footer's stripes, except for rows of discarded writes, which the
+ * next write fills with deleted rows anyway. Rolled back rows are at the end of
+ * the table, so we only read the row counts of the stripes that hold them.
+ */
+static void
+DeleteRolledBackRows(TableAMWriteState *tableAMWriteState)
+{
+	TableFooter *pendingFooter = tableAMWriteState->pendingFooter;
+	List *stripeMetadataList = pendingFooter->stripeMetadataList;
+	uint64 stripeEndRowNumber = tableAMWriteState->stripeRowCount;
+	uint64 firstDeletedRowNumber = PG_UINT64_MAX;
+	int stripeIndex = 0;
+	ListCell *rangeCell = NULL;
+
+	Assert(tableAMWriteState->writeState == NULL);
+
+	if (tableAMWriteState->deletedRowRangeList == NIL)
+	{
+		return;
+	}
+
+	foreach(rangeCell, tableAMWriteState->deletedRowRangeList)
+	{
+		DeletedRowRange *deletedRowRange = lfirst(rangeCell);
+		firstDeletedRowNumber = Min(firstDeletedRowNumber,
+									deletedRowRange->firstRowNumber);
+	}
+
+	for (stripeIndex = list_length(stripeMetadataList) - 1;
+		 stripeIndex >= 0 && stripeEndRowNumber > firstDeletedRowNumber;
+		 stripeIndex--)
+	{
+		StripeMetadata *stripeMetadata = list_nth(stripeMetadataList, stripeIndex);
+		uint64 stripeRowCount = CStoreStripeRowCount(tableAMWriteState->filename,
+													 stripeMetadata);
+		uint64 stripeFirstRowNumber = stripeEndRowNumber - stripeRowCount;
+
+		foreach(rangeCell, tableAMWriteState->deletedRowRangeList)
+		{
+			DeletedRowRange *deletedRowRange = lfirst(rangeCell);
+			uint64 firstRowNumber = Max(deletedRowRange->firstRowNumber,
+										stripeFirstRowNumber);
+			uint64 endRowNumber = Min(deletedRowRange->endRowNumber,
+									  stripeEndRowNumber);
+
+			if (firstRowNumber < endRowNumber)
+			{
+				MarkRowsDeleted(stripeMetadata, firstRowNumber - stripeFirstRowNumber,
+								endRowNumber - stripeFirstRowNumber);
+			}
+		}
+
+		stripeEndRowNumber = stripeFirstRowNumber;
+	}
+
+	CStoreReplacePendingFooter(tableAMWriteState->filename, pendingFooter);
+
+	list_free_deep(tableAMWriteState->deletedRowRangeList);
+	tableAMWriteState->deletedRowRangeList = NIL;
+}
+
+
+/*
+ * RecordSubtransactionStart records the given row number as the next row that
+ * the given write state handed out when the given subtransaction began. The
+ * top transaction rolls back all rows it wrote, so we don't record its start.
+ */
+static void
+RecordSubtransactionStart(TableAMWriteState *tableAMWriteState,
+						  SubTransactionId subtransactionId, uint64 rowNumber)
+{
+	SubtransactionStart *subtransactionStart = NULL;
+	MemoryContext oldContext = NULL;
+
+	if (subtransactionId == TopSubTransactionId)
+	{
+		return;
+	}
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	subtransactionStart = palloc0(sizeof(SubtransactionStart));
+	subtransactionStart->subtransactionId = subtransactionId;
+	subtransactionStart->rowNumber = rowNumber;
+
+	tableAMWriteState->subtransactionStartList =
+		lappend(tableAMWriteState->subtransactionStartList, subtransactionStart);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * FindSubtransactionStart returns the given write state's start record of the
+ * given subtransaction, or NULL if there is none.
+ */
+static SubtransactionStart *
+FindSubtransactionStart(TableAMWriteState *tableAMWriteState,
+						SubTransactionId subtransactionId)
+{
+	ListCell *subtransactionStartCell = NULL;
+
+	foreach(subtransactionStartCell, tableAMWriteState->subtransactionStartList)
+	{
+		SubtransactionStart *subtransactionStart = lfirst(subtransactionStartCell);
+		if (subtransactionStart->subtransactionId == subtransactionId)
+		{
+			return subtransactionStart;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * EndSubtransactionWrite updates the given write state when the given
+ * subtransaction commits or aborts. If it aborts, the row numbers that the
+ * write state handed out since the subtransaction began become deleted rows.
+ * If the write state has no start record for the parent, the write state is
+ * newer than the parent, and the parent takes the subtransaction's record,
+ * whose row number is then the write state's first.
+ */
+static void
+EndSubtransactionWrite(TableAMWriteState *tableAMWriteState,
+					   SubTransactionId subtransactionId,
+					   SubTransactionId parentSubtransactionId, bool isCommit)
+{
+	SubtransactionStart *subtransactionStart =
+		FindSubtransactionStart(tableAMWriteState, subtransactionId);
+
+	if (subtransactionStart == NULL)
+	{
+		return;
+	}
+
+	if (!isCommit && subtransactionStart->rowNumber < tableAMWriteState->nextRowNumber)
+	{
+		DeletedRowRange *deletedRowRange = palloc0(sizeof(DeletedRowRange));
+		deletedRowRange->firstRowNumber = subtransactionStart->rowNumber;
+		deletedRowRange->endRowNumber = tableAMWriteState->nextRowNumber;
+
+		tableAMWriteState->deletedRowRangeList =
+			lappend(tableAMWriteState->deletedRowRangeList, deletedRowRange);
+	}
+
+	if (parentSubtransactionId == TopSubTransactionId ||
+		FindSubtransactionStart(tableAMWriteState, parentSubtransactionId) != NULL)
+	{
+		tableAMWriteState->subtransactionStartList =
+			list_delete_ptr(tableAMWriteState->subtransactionStartList,
+							subtransactionStart);
+		pfree(subtransactionStart);
+	}
+	else
+	{
+		subtransactionStart->subtransactionId = parentSubtransactionId;
+	}
+}
+
+
+/*
+ * ReserveRowNumbers reserves the row numbers of the next stripe's worth of rows
+ * in the table's pending footer, so that no other writer uses them if the
+ * transaction aborts or crashes after handing them out. We write the pending
+ * footer of the last finished write with the new reservation, and keep the
+ * reservation in the footer that the current write writes later.
+ */
+static void
+ReserveRowNumbers(TableAMWriteState *tableAMWriteState)
+{
+	uint64 reservedRowCount = tableAMWriteState->nextRowNumber + DEFAULT_STRIPE_ROW_COUNT;
+	TableFooter *pendingFooter = tableAMWriteState->pendingFooter;
+
+	if (RowCountBlockCount(reservedRowCount) > MaxBlockNumber)
+	{
+		ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+						errmsg("cstore table has too many rows")));
+	}
+
+	pendingFooter->reservedRowCount = reservedRowCount;
+	CStoreReplacePendingFooter(tableAMWriteState->filename, pendingFooter);
+
+	tableAMWriteState->writeState->tableFooter->reservedRowCount = reservedRowCount;
+}
+
+
+/*
+ * WriteSlotRow adds the row in the given slot to the transaction's write to the
+ * table, and sets the slot's TID to the row's. The write keeps values that are
+ * stored in TOAST tables, so we fetch these values first.
+ */
+static void
+WriteSlotRow(TableAMWriteState *tableAMWriteState, TupleTableSlot *slot)
+{
+	TupleDesc tupleDescriptor = tableAMWriteState->tupleDescriptor;
+	uint32 columnCount = tupleDescriptor->natts;
+	Datum *columnValues = NULL;
+	bool *columnNulls = NULL;
+	uint32 columnIndex = 0;
+	MemoryContext oldContext = NULL;
+
+	if (tableAMWriteState->nextRowNumber >=
+		tableAMWriteState->pendingFooter->reservedRowCount)
+	{
+		ReserveRowNumbers(tableAMWriteState);
+	}
+
+	slot_getallattrs(slot);
+
+	oldContext = MemoryContextSwitchTo(tableAMWriteState->rowContext);
+
+	columnValues = palloc(columnCount * sizeof(Datum));
+	columnNulls = palloc(columnCount * sizeof(bool));
+	memcpy(columnValues, slot->tts_values, columnCount * sizeof(Datum));
+	memcpy(columnNulls, slot->tts_isnull, columnCount * sizeof(bool));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (!columnNulls[columnIndex] && attributeForm->attlen == -1 &&
+			VARATT_IS_EXTERNAL(DatumGetPointer(columnValues[columnIndex])))
+		{
+			columnValues[columnIndex] =
+				PointerGetDatum(PG_DETOAST_DATUM(columnValues[columnIndex]));
+		}
+	}
+
+	/* the write keeps the metadata of the stripes that it flushes in our context */
+	MemoryContextSwitchTo(TopTransactionContext);
+
+	tableAMWriteState->writeInProgress = true;
+	CStoreWriteRow(tableAMWriteState->writeState, columnValues, columnNulls);
+	tableAMWriteState->writeInProgress = false;
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextReset(tableAMWriteState->rowContext);
+
+	RowNumberToTid(tableAMWriteState->nextRowNumber, &slot->tts_tid);
+	tableAMWriteState->nextRowNumber++;
+}
+
+
+/*
+ * CheckWriteNotInterrupted errors out if an error interrupted the given write,
+ * for example in a subtransaction that rolled back. The transaction can't
+ * commit then, as we can't tell which rows the write kept.
+ */
+static void
+CheckWriteNotInterrupted(TableAMWriteState *tableAMWriteState)
+{
+	if (tableAMWriteState->writeInProgress)
+	{
+		ereport(ERROR, (errmsg("cannot write to cstore table after a failed write "
+							   "in the same transaction")));
+	}
+}
+
+
+/*
+ * FlushRelationWrites writes the rows that the transaction inserted into the
+ * given table and hasn't written yet, and deletes the rows of its rolled back
+ * subtransactions. The function returns true if there were such rows.
+ */
+static bool
+FlushRelationWrites(Relation relation)
+{
+	TableAMWriteState *tableAMWriteState = FindTableAMWriteState(relation->rd_node);
+
+	if (tableAMWriteState == NULL ||
+		(tableAMWriteState->writeState == NULL &&
+		 tableAMWriteState->deletedRowRangeList == NIL))
+	{
+		return false;
+	}
+
+	FlushTableAMWrite(tableAMWriteState);
+
+	return true;
+}
+
+
+/*
+ * FlushTableAMWrite finishes the given write, which writes its buffered rows and
+ * the table's new pending footer. We then delete the rows of rolled back
+ * subtransactions, which the write may have had. The transaction keeps the
+ * table's write lock, and later inserts start a new write.
+ */
+static void
+FlushTableAMWrite(TableAMWriteState *tableAMWriteState)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	if (tableAMWriteState->writeState != NULL)
+	{
+		CheckWriteNotInterrupted(tableAMWriteState);
+
+		tableAMWriteState->writeInProgress = true;
+		CStoreEndWrite(tableAMWriteState->writeState);
+		tableAMWriteState->writeInProgress = false;
+
+		tableAMWriteState->writeState = NULL;
+		tableAMWriteState->pendingFooter =
+			ReadTableAMFooter(tableAMWriteState->filename, true);
+		tableAMWriteState->stripeRowCount = tableAMWriteState->nextRowNumber;
+	}
+
+	DeleteRolledBackRows(tableAMWriteState);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * PublishTableAMWrite writes the rows that the transaction buffered for the
+ * table, and renames the table's pending footer to its footer, which makes the
+ * transaction's rows visible to other transactions. The footer keeps the row
+ * numbers that the transaction handed out reserved, which are in its stripes
+ * except for those of discarded writes, and releases the rest of its
+ * reservation. It also records the transaction as its writer, which readers
+ * compare with their snapshots.
+ */
+static void
+PublishTableAMWrite(TableAMWriteState *tableAMWriteState)
+{
+	TableFooter *pendingFooter = NULL;
+
+	FlushTableAMWrite(tableAMWriteState);
+	CheckWriteNotInterrupted(tableAMWriteState);
+
+	pendingFooter = tableAMWriteState->pendingFooter;
+	pendingFooter->reservedRowCount = tableAMWriteState->nextRowNumber;
+	pendingFooter->writerTransactionId =
+		U64FromFullTransactionId(GetTopFullTransactionId());
+	CStoreReplacePendingFooter(tableAMWriteState->filename, pendingFooter);
+
+	tableAMWriteState->abortFooter->reservedRowCount = tableAMWriteState->nextRowNumber;
+
+	CStorePublishPendingFooter(tableAMWriteState->filename);
+	tableAMWriteState->footerPublished = true;
+}
+
+
+/*
+ * DiscardTableAMWrite forgets the transaction's write to the files with the
+ * given relfilenode, whose rows were truncated.
+ */
+static void
+DiscardTableAMWrite(RelFileNode relationFileNode)
+{
+	TableAMWriteState *tableAMWriteState = FindTableAMWriteState(relationFileNode);
+
+	if (tableAMWriteState != NULL)
+	{
+		TableAMWriteStateList = list_delete_ptr(TableAMWriteStateList,
+												tableAMWriteState);
+	}
+}
+
+
+/*
+ * RestoreAbortedWrites restores the footers that tables had before the aborting
+ * transaction published its pending footers, which only happens if the commit
+ * fails after the transaction's pre-commit callbacks. We keep the row numbers
+ * that the transaction handed out reserved. The stripes that the transaction
+ * wrote are then past the footer's last stripe, and the next write overwrites
+ * them. Pending footers that the transaction didn't publish stay, and the next
+ * writer takes their reservations. We're in the middle of an abort, so failures
+ * only give a warning.
+ */
+static void
+RestoreAbortedWrites(void)
+{
+	ListCell *writeStateCell = NULL;
+
+	foreach(writeStateCell, TableAMWriteStateList)
+	{
+		TableAMWriteState *tableAMWriteState = lfirst(writeStateCell);
+		MemoryContext oldContext = CurrentMemoryContext;
+
+		if (!tableAMWriteState->footerPublished)
+		{
+			continue;
+		}
+
+		PG_TRY();
+		{
+			CStoreReplaceFooter(tableAMWriteState->filename,
+								tableAMWriteState->abortFooter);
+		}
+		PG_CATCH();
+		{
+			MemoryContextSwitchTo(oldContext);
+			FlushErrorState();
+
+			ereport(WARNING, (errmsg("could not remove the rows of the aborted "
+									 "transaction from \"%s\"",
+									 tableAMWriteState->filename)));
+		}
+		PG_END_TRY();
+	}
+}
+
+
+/*
+ * InitializeTableAMFiles creates an empty data file and footer for the table
+ * with the given relfilenode. We first remove files that a crashed transaction
+ * may have left behind for the relfilenode.
+ */
+static void
+InitializeTableAMFiles(RelFileNode relationFileNode, TupleDesc tupleDescriptor)
+{
+	char *filename = TableAMFilename(relationFileNode);
+	StringInfo tableFooterFilename = makeStringInfo();
+	TableWriteState *writeState = NULL;
+	struct stat statBuffer;
+
+	CreateCStoreDatabaseDirectory(relationFileNode.dbNode);
+
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+	if (stat(tableFooterFilename->data, &statBuffer) == 0)
+	{
+		DeleteCStoreTableFiles(filename);
+	}
+
+	writeState = CStoreBeginWrite(filename, DEFAULT_COMPRESSION_TYPE,
+								  DEFAULT_STRIPE_ROW_COUNT, DEFAULT_BLOCK_ROW_COUNT, -1,
+								  NULL, tupleDescriptor);
+	CStoreEndWrite(writeState);
+}
+
+
+/*
+ * ScheduleFileDelete schedules deleting the files of the table with the given
+ * relfilenode when the transaction commits or aborts. Deletes of dropped tables
+ * also have the table's id.
+ */
+static void
+ScheduleFileDelete(RelFileNode relationFileNode, bool atCommit, Oid droppedRelationId)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	PendingFileDelete *pendingDelete = palloc0(sizeof(PendingFileDelete));
+	pendingDelete->relationFileNode = relationFileNode;
+	pendingDelete->atCommit = atCommit;
+	pendingDelete->subtransactionId = GetCurrentSubTransactionId();
+	pendingDelete->droppedRelationId = droppedRelationId;
+
+	PendingFileDeleteList = lappend(PendingFileDeleteList, pendingDelete);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * FileDeletePending checks if the files with the given relfilenode are deleted
+ * when the transaction commits or aborts, as given.
+ */
+static bool
+FileDeletePending(RelFileNode relationFileNode, bool atCommit)
+{
+	ListCell *pendingDeleteCell = NULL;
+
+	foreach(pendingDeleteCell, PendingFileDeleteList)
+	{
+		PendingFileDelete *pendingDelete = lfirst(pendingDeleteCell);
+		if (pendingDelete->atCommit == atCommit &&
+			RelFileNodeEquals(pendingDelete->relationFileNode, relationFileNode))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * CStoreTableAMRelationDropped checks if the transaction dropped the cstore
+ * table with the given id. The drop event trigger uses this function to leave
+ * the files of these tables to the transaction's commit.
+ */
+bool
+CStoreTableAMRelationDropped(Oid relationId)
+{
+	ListCell *pendingDeleteCell = NULL;
+
+	foreach(pendingDeleteCell, PendingFileDeleteList)
+	{
+		PendingFileDelete *pendingDelete = lfirst(pendingDeleteCell);
+		if (pendingDelete->droppedRelationId == relationId)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/* DeletePendingFiles deletes the files scheduled for the transaction's outcome. */
+static void
+DeletePendingFiles(bool isCommit)
+{
+	ListCell *pendingDeleteCell = NULL;
+
+	foreach(pendingDeleteCell, PendingFileDeleteList)
+	{
+		PendingFileDelete *pendingDelete = lfirst(pendingDeleteCell);
+		if (pendingDelete->atCommit == isCommit)
+		{
+			DeleteCStoreTableFiles(TableAMFilename(pendingDelete->relationFileNode));
+		}
+	}
+}
+
+
+/*
+ * CStoreXactCallback writes the rows that the transaction buffered before it
+ * commits, and publishes the pending footers of the tables it wrote into,
+ * except for tables whose files the commit deletes. When the transaction ends,
+ * we restore the footers of tables whose pending footers an aborting
+ * transaction published, and delete the files scheduled for deletion. We can't
+ * keep these operations for a prepared transaction.
+ */
+static void
+CStoreXactCallback(XactEvent event, void *argument)
+{
+	switch (event)
+	{
+		case XACT_EVENT_PRE_COMMIT:
+		{
+			ListCell *writeStateCell = NULL;
+
+			foreach(writeStateCell, TableAMWriteStateList)
+			{
+				TableAMWriteState *tableAMWriteState = lfirst(writeStateCell);
+
+				if (!FileDeletePending(tableAMWriteState->relationFileNode, true))
+				{
+					PublishTableAMWrite(tableAMWriteState);
+				}
+			}
+
+			break;
+		}
+
+		case XACT_EVENT_PRE_PREPARE:
+		{
+			if (TableAMWriteStateList != NIL || PendingFileDeleteList != NIL)
+			{
+				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+								errmsg("cannot prepare a transaction that modified "
+									   "cstore tables")));
+			}
+
+			break;
+		}
+
+		case XACT_EVENT_COMMIT:
+		{
+			DeletePendingFiles(true);
+
+			TableAMWriteStateList = NIL;
+			PendingFileDeleteList = NIL;
+			break;
+		}
+
+		case XACT_EVENT_ABORT:
+		{
+			RestoreAbortedWrites();
+			DeletePendingFiles(false);
+
+			TableAMWriteStateList = NIL;
+			PendingFileDeleteList = NIL;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+}
+
+
+/*
+ * CStoreSubXactCallback records the next row number of each write when a
+ * subtransaction starts, and hands the writes and file deletes of a committing
+ * subtransaction to its parent. When a subtransaction aborts, we discard the
+ * writes that it began, whose files are closed, and delete the files that it
+ * created. We also forget the deletes that it scheduled for commit. Rows that
+ * the subtransaction added to writes of its parent become deleted rows.
+ */
+static void
+CStoreSubXactCallback(SubXactEvent event, SubTransactionId subtransactionId,
+					  SubTransactionId parentSubtransactionId, void *argument)
+{
+	ListCell *writeStateCell = NULL;
+	ListCell *pendingDeleteCell = NULL;
+	List *remainingDeleteList = NIL;
+	MemoryContext oldContext = NULL;
+
+	if (event == SUBXACT_EVENT_START_SUB)
+	{
+		foreach(writeStateCell, TableAMWriteStateList)
+		{
+			TableAMWriteState *tableAMWriteState = lfirst(writeStateCell);
+
+			RecordSubtransactionStart(tableAMWriteState, subtransactionId,
+									  tableAMWriteState->nextRowNumber);
+		}
+
+		return;
+	}
+
+	if (event != SUBXACT_EVENT_COMMIT_SUB && event != SUBXACT_EVENT_ABORT_SUB)
+	{
+		return;
+	}
+
+	oldContext = MemoryContextSwitchTo(TopTransactionContext);
+
+	foreach(writeStateCell, TableAMWriteStateList)
+	{
+		TableAMWriteState *tableAMWriteState = lfirst(writeStateCell);
+
+		EndSubtransactionWrite(tableAMWriteState, subtransactionId,
+							   parentSubtransactionId,
+							   event == SUBXACT_EVENT_COMMIT_SUB);
+
+		if (tableAMWriteState->writeState == NULL ||
+			tableAMWriteState->writeSubtransactionId != subtransactionId)
+		{
+			continue;
+		}
+
+		if (event == SUBXACT_EVENT_COMMIT_SUB)
+		{
+			tableAMWriteState->writeSubtransactionId = parentSubtransactionId;
+		}
+		else
+		{
+			tableAMWriteState->writeState = NULL;
+			tableAMWriteState->writeInProgress = false;
+		}
+	}
+
+	foreach(pendingDeleteCell, PendingFileDeleteList)
+	{
+		PendingFileDelete *pendingDelete = lfirst(pendingDeleteCell);
+
+		if (pendingDelete->subtransactionId != subtransactionId)
+		{
+			remainingDeleteList = lappend(remainingDeleteList, pendingDelete);
+		}
+		else if (event == SUBXACT_EVENT_COMMIT_SUB)
+		{
+			pendingDelete->subtransactionId = parentSubtransactionId;
+			remainingDeleteList = lappend(remainingDeleteList, pendingDelete);
+		}
+		else if (!pendingDelete->atCommit)
+		{
+			DiscardTableAMWrite(pendingDelete->relationFileNode);
+			DeleteCStoreTableFiles(TableAMFilename(pendingDelete->relationFileNode));
+		}
+	}
+
+	PendingFileDeleteList = remainingDeleteList;
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * CStoreObjectAccessHook schedules deleting the files of dropped cstore tables
+ * when the transaction commits.
+ */
+static void
+CStoreObjectAccessHook(ObjectAccessType access, Oid classId, Oid objectId, int subId,
+					   void *argument)
+{
+	if (PreviousObjectAccessHook != NULL)
+	{
+		PreviousObjectAccessHook(access, classId, objectId, subId, argument);
+	}
+
+	if (access == OAT_DROP && classId == RelationRelationId && subId == 0)
+	{
+		Relation relation = relation_open(objectId, NoLock);
+
+		if (relation->rd_tableam == &CStoreTableAmRoutine)
+		{
+			ScheduleFileDelete(relation->rd_node, true, RelationGetRelid(relation));
+		}
+
+		relation_close(relation, NoLock);
+	}
+}
+
+
+#endif
@@ -24,6 +24,7 @@
 #if PG_VERSION_NUM < 110000
 #define ALLOCSET_DEFAULT_SIZES ALLOCSET_DEFAULT_MINSIZE, ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE
 #define ACLCHECK_OBJECT_TABLE ACL_KIND_CLASS
+#define HASHSTANDARD_PROC HASHPROC
 #else
 #define ACLCHECK_OBJECT_TABLE OBJECT_TABLE
 
@@ -45,6 +46,14 @@
 					 completionTag)
 #endif
 
+#if PG_VERSION_NUM >= 110000 && PG_VERSION_NUM < 120000
+#define CreateParallelContextCompat(libraryName, functionName, workerCount) \
+	CreateParallelContext(libraryName, functionName, workerCount, true)
+#else
+#define CreateParallelContextCompat(libraryName, functionName, workerCount) \
+	CreateParallelContext(libraryName, functionName, workerCount)
+#endif
+
 #if PG_VERSION_NUM < 120000
 #define TTS_EMPTY(slot)	((slot)->tts_isempty)
 #define ExecForceStoreHeapTuple(tuple, slot, shouldFree) \
@@ -19,10 +19,15 @@
 #include "cstore_metadata_serialization.h"
 #include "cstore_version_compat.h"
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include "access/hash.h"
 #include "access/nbtree.h"
 #include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
+#include "mb/pg_wchar.h"
 #if PG_VERSION_NUM >= 120000
 #include "optimizer/optimizer.h"
 #else
@@ -32,10 +37,21 @@
 #include "storage/fd.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
 #include "utils/rel.h"
 
 
 static void CStoreWriteFooter(StringInfo footerFileName, TableFooter *tableFooter);
+static void ReplaceFooterFile(StringInfo tableFooterFilename, TableFooter *tableFooter);
+static TableWriteState * BeginWrite(const char *filename, StringInfo tableFooterFilename,
+									CompressionType compressionType,
+									uint64 stripeMaxRowCount, uint32 blockRowCount,
+									int32 indexColumnIndex,
+									uint32 *maxSkipValueLengthArray,
+									TupleDesc tupleDescriptor);
+static void ReleaseStripeSpace(const char *filename, List *remainingStripeList,
+							   List *droppedStripeList);
+static void PunchHole(FILE *file, const char *filename, uint64 offset, uint64 length);
 static StripeBuffers * CreateEmptyStripeBuffers(uint32 stripeMaxRowCount,
 												uint32 blockRowCount,
 												uint32 columnCount);
@@ -43,6 +59,13 @@ static StripeSkipList * CreateEmptyStripeSkipList(uint32 stripeMaxRowCount,
 												  uint32 blockRowCount,
 												  uint32 columnCount);
 static StripeMetadata FlushStripe(TableWriteState *writeState);
+static void AppendStripeIndexEntry(TableWriteState *writeState, Datum columnValue,
+								   uint32 blockIndex);
+static uint32 SortStripeIndexEntries(StripeIndexEntry *indexEntryArray,
+									 uint32 indexEntryCount);
+static int CompareStripeIndexEntries(const void *leftElement, const void *rightElement);
+static void SetStripeIndexRange(TableWriteState *writeState,
+								StripeMetadata *stripeMetadata);
 static StringInfo * CreateSkipListBufferArray(StripeSkipList *stripeSkipList,
 											  TupleDesc tupleDescriptor);
 static StripeFooter * CreateStripeFooter(StripeSkipList *stripeSkipList,
@@ -53,10 +76,22 @@ static void SerializeSingleDatum(StringInfo datumBuffer, Datum datum,
 								 char datumTypeAlign);
 static void SerializeBlockData(TableWriteState *writeState, uint32 blockIndex,
 							   uint32 rowCount);
-static void UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode,
-									  Datum columnValue, bool columnTypeByValue,
-									  int columnTypeLength, Oid columnCollation,
-									  FmgrInfo *comparisonFunction);
+static void UpdateBlockSkipNodeMinMax(TableWriteState *writeState, uint32 columnIndex,
+									  ColumnBlockSkipNode *blockSkipNode,
+									  Datum columnValue, uint32 valueOffset);
+static void SetBlockSkipNodeMinMax(TableWriteState *writeState, uint32 columnIndex,
+								   ColumnBlockSkipNode *blockSkipNode);
+static bool BoundSkipValue(Datum *skipValue, Form_pg_attribute attributeForm,
+						   uint32 maxSkipValueLength, bool upperBound,
+						   bool *truncated);
+static bool SkipValueTruncatable(Form_pg_attribute attributeForm);
+static struct varlena * PrefixBound(const char *data, uint32 prefixLength,
+									bool upperBound, unsigned char incrementLimit);
+static void SetBlockSkipNodeSortKeys(ColumnBlockSkipNode *blockSkipNode,
+									 Oid collation, uint32 maxSkipValueLength,
+									 Datum minimumValue, Datum maximumValue);
+static void UpdateBlockSkipNodeSum(ColumnBlockSkipNode *blockSkipNode,
+								   Datum columnValue, Oid columnTypeId);
 static Datum DatumCopy(Datum datum, bool datumTypeByValue, int datumTypeLength);
 static void AppendStripeMetadata(TableFooter *tableFooter,
 								 StripeMetadata stripeMetadata);
@@ -70,18 +105,63 @@ static StringInfo CopyStringInfo(StringInfo sourceString);
  * handle. This handle should be used for adding the row values and finishing the
  * data load operation. If the cstore footer file already exists, we read the
  * footer and then seek to right after the last stripe  where the new stripes
- * will be added.
+ * will be added. If indexColumnIndex isn't -1, each stripe we write gets a sparse
+ * index of that column. maxSkipValueLengthArray limits the length of each
+ * column's skip list minimum and maximum values; if it is NULL, all columns use
+ * the default limit.
  */
 TableWriteState *
 CStoreBeginWrite(const char *filename, CompressionType compressionType,
 				 uint64 stripeMaxRowCount, uint32 blockRowCount,
+				 int32 indexColumnIndex, uint32 *maxSkipValueLengthArray,
 				 TupleDesc tupleDescriptor)
+{
+	StringInfo tableFooterFilename = makeStringInfo();
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+
+	return BeginWrite(filename, tableFooterFilename, compressionType,
+					  stripeMaxRowCount, blockRowCount, indexColumnIndex,
+					  maxSkipValueLengthArray, tupleDescriptor);
+}
+
+
+/*
+ * CStoreBeginPendingWrite initializes a write operation like CStoreBeginWrite,
+ * but the write appends stripes after those of the table's pending footer, and
+ * CStoreEndWrite replaces the pending footer instead of the table's footer.
+ * Readers of the table's footer then don't see the new stripes until the writer
+ * publishes the pending footer. The pending footer file must exist.
+ */
+TableWriteState *
+CStoreBeginPendingWrite(const char *filename, uint64 stripeMaxRowCount,
+						TupleDesc tupleDescriptor)
+{
+	StringInfo pendingFooterFilename = makeStringInfo();
+	appendStringInfo(pendingFooterFilename, "%s%s", filename,
+					 CSTORE_PENDING_FOOTER_FILE_SUFFIX);
+
+	return BeginWrite(filename, pendingFooterFilename, DEFAULT_COMPRESSION_TYPE,
+					  stripeMaxRowCount, DEFAULT_BLOCK_ROW_COUNT, -1, NULL,
+					  tupleDescriptor);
+}
+
+
+/*
+ * BeginWrite initializes a write operation that reads and replaces the given
+ * footer file of the given data file.
+ */
+static TableWriteState *
+BeginWrite(const char *filename, StringInfo tableFooterFilename,
+		   CompressionType compressionType, uint64 stripeMaxRowCount,
+		   uint32 blockRowCount, int32 indexColumnIndex,
+		   uint32 *maxSkipValueLengthArray, TupleDesc tupleDescriptor)
 {
 	TableWriteState *writeState = NULL;
 	FILE *tableFile = NULL;
-	StringInfo tableFooterFilename = NULL;
 	TableFooter *tableFooter = NULL;
 	FmgrInfo **comparisonFunctionArray = NULL;
+	FmgrInfo *indexHashFunction = NULL;
+	uint32 *columnMaxSkipValueLengthArray = NULL;
 	MemoryContext stripeWriteContext = NULL;
 	uint64 currentFileOffset = 0;
 	uint32 columnCount = 0;
@@ -91,9 +171,6 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 	bool *columnMaskArray = NULL;
 	ColumnBlockData **blockData = NULL;
 
-	tableFooterFilename = makeStringInfo();
-	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
-
 	statResult = stat(tableFooterFilename->data, &statBuffer);
 	if (statResult < 0)
 	{
@@ -136,6 +213,7 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 		lastStripeSize += lastStripe->skipListLength;
 		lastStripeSize += lastStripe->dataLength;
 		lastStripeSize += lastStripe->footerLength;
+		lastStripeSize += lastStripe->indexLength;
 
 		currentFileOffset = lastStripe->fileOffset + lastStripeSize;
 
@@ -166,6 +244,50 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 		comparisonFunctionArray[columnIndex] = comparisonFunction;
 	}
 
+	/* record the column types, so that attaching the file can check them */
+	tableFooter->columnCount = columnCount;
+	tableFooter->columnTypeArray = palloc0(columnCount * sizeof(Oid));
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (!attributeForm->attisdropped)
+		{
+			tableFooter->columnTypeArray[columnIndex] = attributeForm->atttypid;
+		}
+	}
+
+	columnMaxSkipValueLengthArray = palloc(columnCount * sizeof(uint32));
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		uint32 maxSkipValueLength = DEFAULT_MAX_SKIP_VALUE_LENGTH;
+
+		if (maxSkipValueLengthArray != NULL)
+		{
+			maxSkipValueLength = maxSkipValueLengthArray[columnIndex];
+		}
+
+		columnMaxSkipValueLengthArray[columnIndex] = maxSkipValueLength;
+	}
+
+	/* the index column's values are indexed by the hashes of its hash opclass */
+	if (indexColumnIndex >= 0)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor,
+														indexColumnIndex);
+
+		if (!attributeForm->attisdropped)
+		{
+			indexHashFunction = GetFunctionInfoOrNull(attributeForm->atttypid,
+													  HASH_AM_OID, HASHSTANDARD_PROC);
+		}
+
+		if (indexHashFunction == NULL)
+		{
+			indexColumnIndex = -1;
+		}
+	}
+
 	/*
 	 * We allocate all stripe specific data in the stripeWriteContext, and
 	 * reset this memory context once we have flushed the stripe to the file.
@@ -194,6 +316,14 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 	writeState->stripeWriteContext = stripeWriteContext;
 	writeState->blockDataArray = blockData;
 	writeState->compressionBuffer = NULL;
+	writeState->indexColumnIndex = indexColumnIndex;
+	writeState->indexHashFunction = indexHashFunction;
+	writeState->indexEntryArray = NULL;
+	writeState->indexEntryCount = 0;
+	writeState->indexEntryArraySize = 0;
+	writeState->maxSkipValueLengthArray = columnMaxSkipValueLengthArray;
+	writeState->minimumValueOffsetArray = palloc0(columnCount * sizeof(uint32));
+	writeState->maximumValueOffsetArray = palloc0(columnCount * sizeof(uint32));
 
 	return writeState;
 }
@@ -240,6 +370,15 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
 			ColumnBlockData *blockData = blockDataArray[columnIndex];
 			blockData->valueBuffer = makeStringInfo();
 		}
+
+		/* the index entry array also lives in the stripe write memory context */
+		if (writeState->indexColumnIndex >= 0)
+		{
+			writeState->indexEntryArraySize = blockRowCount;
+			writeState->indexEntryArray = palloc(blockRowCount *
+												 sizeof(StripeIndexEntry));
+			writeState->indexEntryCount = 0;
+		}
 	}
 
 	blockIndex = stripeBuffers->rowCount / blockRowCount;
@@ -258,25 +397,33 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
 		}
 		else
 		{
-			FmgrInfo *comparisonFunction =
-				writeState->comparisonFunctionArray[columnIndex];
 			Form_pg_attribute attributeForm =
 				TupleDescAttr(writeState->tupleDescriptor, columnIndex);
 			bool columnTypeByValue = attributeForm->attbyval;
 			int columnTypeLength = attributeForm->attlen;
-			Oid columnCollation = attributeForm->attcollation;
 			char columnTypeAlign  = attributeForm->attalign;
+			uint32 valueOffset = blockData->valueBuffer->len;
 
 			blockData->existsArray[blockRowIndex] = true;
 
 			SerializeSingleDatum(blockData->valueBuffer, columnValues[columnIndex],
 								 columnTypeByValue, columnTypeLength, columnTypeAlign);
 
-			UpdateBlockSkipNodeMinMax(blockSkipNode, columnValues[columnIndex],
-									  columnTypeByValue, columnTypeLength,
-									  columnCollation, comparisonFunction);
+			UpdateBlockSkipNodeMinMax(writeState, columnIndex, blockSkipNode,
+									  columnValues[columnIndex], valueOffset);
+			UpdateBlockSkipNodeSum(blockSkipNode, columnValues[columnIndex],
+								   attributeForm->atttypid);
+
+			blockSkipNode->valueCount++;
+
+			if ((int32) columnIndex == writeState->indexColumnIndex)
+			{
+				AppendStripeIndexEntry(writeState, columnValues[columnIndex],
+									   blockIndex);
+			}
 		}
 
+		blockSkipNode->hasValueCount = true;
 		blockSkipNode->rowCount++;
 	}
 
@@ -292,18 +439,19 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
 	if (stripeBuffers->rowCount >= writeState->stripeMaxRowCount)
 	{
 		StripeMetadata stripeMetadata = FlushStripe(writeState);
-		MemoryContextReset(writeState->stripeWriteContext);
-
-		/* set stripe data and skip list to NULL so they are recreated next time */
-		writeState->stripeBuffers = NULL;
-		writeState->stripeSkipList = NULL;
 
 		/*
 		 * Append stripeMetadata in old context so next MemoryContextReset
-		 * doesn't free it.
+		 * doesn't free it. The stripe's index column range still lives in the
+		 * stripe write context, so we copy it before resetting the context.
 		 */
 		MemoryContextSwitchTo(oldContext);
 		AppendStripeMetadata(tableFooter, stripeMetadata);
+		MemoryContextReset(writeState->stripeWriteContext);
+
+		/* set stripe data and skip list to NULL so they are recreated next time */
+		writeState->stripeBuffers = NULL;
+		writeState->stripeSkipList = NULL;
 	}
 	else
 	{
@@ -321,9 +469,6 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
 void
 CStoreEndWrite(TableWriteState *writeState)
 {
-	StringInfo tableFooterFilename = NULL;
-	StringInfo tempTableFooterFileName = NULL;
-	int renameResult = 0;
 	int columnCount = writeState->tupleDescriptor->natts;
 	StripeBuffers *stripeBuffers = writeState->stripeBuffers;
 
@@ -332,32 +477,15 @@ CStoreEndWrite(TableWriteState *writeState)
 		MemoryContext oldContext = MemoryContextSwitchTo(writeState->stripeWriteContext);
 
 		StripeMetadata stripeMetadata = FlushStripe(writeState);
-		MemoryContextReset(writeState->stripeWriteContext);
 
 		MemoryContextSwitchTo(oldContext);
 		AppendStripeMetadata(writeState->tableFooter, stripeMetadata);
+		MemoryContextReset(writeState->stripeWriteContext);
 	}
 
 	SyncAndCloseFile(writeState->tableFile);
 
-	tableFooterFilename = writeState->tableFooterFilename;
-	tempTableFooterFileName = makeStringInfo();
-	appendStringInfo(tempTableFooterFileName, "%s%s", tableFooterFilename->data,
-					 CSTORE_TEMP_FILE_SUFFIX);
-
-	CStoreWriteFooter(tempTableFooterFileName, writeState->tableFooter);
-
-	renameResult = rename(tempTableFooterFileName->data, tableFooterFilename->data);
-	if (renameResult != 0)
-	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not rename file \"%s\" to \"%s\": %m",
-							   tempTableFooterFileName->data,
-							   tableFooterFilename->data)));
-	}
-
-	pfree(tempTableFooterFileName->data);
-	pfree(tempTableFooterFileName);
+	ReplaceFooterFile(writeState->tableFooterFilename, writeState->tableFooter);
 
 	MemoryContextDelete(writeState->stripeWriteContext);
 	list_free_deep(writeState->tableFooter->stripeMetadataList);
@@ -365,6 +493,9 @@ CStoreEndWrite(TableWriteState *writeState)
 	pfree(writeState->tableFooterFilename->data);
 	pfree(writeState->tableFooterFilename);
 	pfree(writeState->comparisonFunctionArray);
+	pfree(writeState->maxSkipValueLengthArray);
+	pfree(writeState->minimumValueOffsetArray);
+	pfree(writeState->maximumValueOffsetArray);
 	FreeColumnBlockDataArray(writeState->blockDataArray, columnCount);
 	pfree(writeState);
 }
@@ -414,6 +545,278 @@ CStoreWriteFooter(StringInfo tableFooterFilename, TableFooter *tableFooter)
 }
 
 
+/*
+ * ReplaceFooterFile writes the given footer to a temporary file, and atomically
+ * renames this temporary file to the given footer file.
+ */
+static void
+ReplaceFooterFile(StringInfo tableFooterFilename, TableFooter *tableFooter)
+{
+	StringInfo tempTableFooterFileName = makeStringInfo();
+	int renameResult = 0;
+
+	appendStringInfo(tempTableFooterFileName, "%s%s", tableFooterFilename->data,
+					 CSTORE_TEMP_FILE_SUFFIX);
+
+	CStoreWriteFooter(tempTableFooterFileName, tableFooter);
+
+	renameResult = rename(tempTableFooterFileName->data, tableFooterFilename->data);
+	if (renameResult != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   tempTableFooterFileName->data,
+							   tableFooterFilename->data)));
+	}
+
+	pfree(tempTableFooterFileName->data);
+	pfree(tempTableFooterFileName);
+}
+
+
+/*
+ * CStoreDropStripes removes the given stripes from the footer of the given data
+ * file, and then releases the file space that the stripes used. Since readers
+ * only find stripes through the footer, replacing the footer drops the stripes
+ * atomically.
+ */
+void
+CStoreDropStripes(const char *filename, TableFooter *tableFooter,
+				  List *droppedStripeList)
+{
+	List *remainingStripeList = list_difference_ptr(tableFooter->stripeMetadataList,
+													droppedStripeList);
+
+	tableFooter->stripeMetadataList = remainingStripeList;
+	CStoreReplaceFooter(filename, tableFooter);
+
+	ReleaseStripeSpace(filename, remainingStripeList, droppedStripeList);
+}
+
+
+/*
+ * CStoreReplaceFooter atomically replaces the footer of the given data file
+ * with the given footer.
+ */
+void
+CStoreReplaceFooter(const char *filename, TableFooter *tableFooter)
+{
+	StringInfo tableFooterFilename = makeStringInfo();
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+
+	ReplaceFooterFile(tableFooterFilename, tableFooter);
+
+	pfree(tableFooterFilename->data);
+	pfree(tableFooterFilename);
+}
+
+
+/*
+ * CStoreReplacePendingFooter atomically replaces the pending footer of the given
+ * data file with the given footer.
+ */
+void
+CStoreReplacePendingFooter(const char *filename, TableFooter *tableFooter)
+{
+	StringInfo pendingFooterFilename = makeStringInfo();
+	appendStringInfo(pendingFooterFilename, "%s%s", filename,
+					 CSTORE_PENDING_FOOTER_FILE_SUFFIX);
+
+	ReplaceFooterFile(pendingFooterFilename, tableFooter);
+
+	pfree(pendingFooterFilename->data);
+	pfree(pendingFooterFilename);
+}
+
+
+/*
+ * CStorePublishPendingFooter atomically renames the pending footer of the given
+ * data file to the file's footer, so that readers of the table see the stripes
+ * of the pending footer.
+ */
+void
+CStorePublishPendingFooter(const char *filename)
+{
+	StringInfo pendingFooterFilename = makeStringInfo();
+	StringInfo tableFooterFilename = makeStringInfo();
+	int renameResult = 0;
+
+	appendStringInfo(pendingFooterFilename, "%s%s", filename,
+					 CSTORE_PENDING_FOOTER_FILE_SUFFIX);
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+
+	renameResult = rename(pendingFooterFilename->data, tableFooterFilename->data);
+	if (renameResult != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   pendingFooterFilename->data,
+							   tableFooterFilename->data)));
+	}
+
+	pfree(pendingFooterFilename->data);
+	pfree(pendingFooterFilename);
+	pfree(tableFooterFilename->data);
+	pfree(tableFooterFilename);
+}
+
+
+/*
+ * CStoreEndRewrite finishes a write operation that rewrote the rows of the given
+ * stripes of the data file into new stripes at the file's end. The rewritten
+ * stripes must come from the write operation's footer. We remove them from the
+ * footer before the write operation replaces it, so that readers see either
+ * the old or the new stripes. Then, we release the rewritten stripes' space.
+ */
+void
+CStoreEndRewrite(TableWriteState *writeState, const char *filename,
+				 List *rewrittenStripeList)
+{
+	TableFooter *tableFooter = writeState->tableFooter;
+	StringInfo tableFooterFilename = makeStringInfo();
+
+	tableFooter->stripeMetadataList = list_difference_ptr(tableFooter->stripeMetadataList,
+														  rewrittenStripeList);
+	CStoreEndWrite(writeState);
+
+	/* the write operation freed its footer, so we read the new one */
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+	tableFooter = CStoreReadFooter(tableFooterFilename);
+
+	ReleaseStripeSpace(filename, tableFooter->stripeMetadataList, rewrittenStripeList);
+
+	pfree(tableFooterFilename->data);
+	pfree(tableFooterFilename);
+}
+
+
+/*
+ * ReleaseStripeSpace releases the space that the given dropped stripes used in
+ * the given data file, after they were removed from the file's footer. Space
+ * after the last remaining stripe is truncated, and loads reuse it. We free the
+ * space of stripes between remaining ones by punching holes in the file where
+ * the platform and file system support it; otherwise their space stays
+ * allocated.
+ */
+static void
+ReleaseStripeSpace(const char *filename, List *remainingStripeList,
+				   List *droppedStripeList)
+{
+	ListCell *stripeMetadataCell = NULL;
+	uint64 remainingFileSize = 0;
+	FILE *tableFile = NULL;
+
+	if (remainingStripeList != NIL)
+	{
+		StripeMetadata *lastStripe = llast(remainingStripeList);
+
+		remainingFileSize = lastStripe->fileOffset + lastStripe->skipListLength +
+							lastStripe->dataLength + lastStripe->footerLength +
+							lastStripe->indexLength;
+	}
+
+	tableFile = AllocateFile(filename, "r+");
+	if (tableFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for writing: %m",
+							   filename)));
+	}
+
+	foreach(stripeMetadataCell, droppedStripeList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		uint64 stripeLength = stripeMetadata->skipListLength +
+							  stripeMetadata->dataLength + stripeMetadata->footerLength +
+							  stripeMetadata->indexLength;
+
+		if (stripeMetadata->fileOffset < remainingFileSize)
+		{
+			PunchHole(tableFile, filename, stripeMetadata->fileOffset, stripeLength);
+		}
+	}
+
+	if (ftruncate(fileno(tableFile), remainingFileSize) != 0)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+						  errmsg("could not truncate file \"%s\": %m", filename)));
+	}
+
+	SyncAndCloseFile(tableFile);
+}
+
+
+/*
+ * PunchHole deallocates the given range of the given file without changing the
+ * file's size, so that reads of the range return zeros. The function does
+ * nothing on platforms and file systems that don't support this.
+ */
+static void
+PunchHole(FILE *file, const char *filename, uint64 offset, uint64 length)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	int fallocateResult = 0;
+
+	errno = 0;
+	fallocateResult = fallocate(fileno(file), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+								offset, length);
+	if (fallocateResult != 0 && errno != EOPNOTSUPP)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+						  errmsg("could not free space in file \"%s\": %m", filename)));
+	}
+#endif
+}
+
+
+/*
+ * CStoreWriteSegmentCount writes the table's segment manifest with the given
+ * segment count. Like the footer, we first write the manifest to a temporary
+ * file, and then rename it so readers never see a partially written manifest.
+ */
+void
+CStoreWriteSegmentCount(const char *filename, uint32 segmentCount)
+{
+	StringInfo manifestFilename = makeStringInfo();
+	StringInfo tempManifestFilename = makeStringInfo();
+	StringInfo manifestBuffer = NULL;
+	FILE *manifestFile = NULL;
+	int renameResult = 0;
+
+	appendStringInfo(manifestFilename, "%s%s", filename, CSTORE_MANIFEST_FILE_SUFFIX);
+	appendStringInfo(tempManifestFilename, "%s%s", manifestFilename->data,
+					 CSTORE_TEMP_FILE_SUFFIX);
+
+	manifestFile = AllocateFile(tempManifestFilename->data, PG_BINARY_W);
+	if (manifestFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for writing: %m",
+							   tempManifestFilename->data)));
+	}
+
+	manifestBuffer = SerializeSegmentManifest(segmentCount);
+	WriteToFile(manifestFile, manifestBuffer->data, manifestBuffer->len);
+	SyncAndCloseFile(manifestFile);
+
+	renameResult = rename(tempManifestFilename->data, manifestFilename->data);
+	if (renameResult != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   tempManifestFilename->data,
+							   manifestFilename->data)));
+	}
+
+	pfree(manifestBuffer->data);
+	pfree(manifestBuffer);
+	pfree(tempManifestFilename->data);
+	pfree(tempManifestFilename);
+	pfree(manifestFilename->data);
+	pfree(manifestFilename);
+}
+
+
 /*
  * CreateEmptyStripeBuffers allocates an empty StripeBuffers structure with the given
  * column count.
@@ -496,6 +899,7 @@ FlushStripe(TableWriteState *writeState)
 	StripeMetadata stripeMetadata = {0, 0, 0, 0};
 	uint64 skipListLength = 0;
 	uint64 dataLength = 0;
+	uint64 indexLength = 0;
 	StringInfo *skipListBufferArray = NULL;
 	StripeFooter *stripeFooter = NULL;
 	StringInfo stripeFooterBuffer = NULL;
@@ -567,6 +971,7 @@ FlushStripe(TableWriteState *writeState)
 	 * and then all "value" buffers.
 	 * (3) Stripe footer, which contains the skip list buffer size, exists buffer
 	 * size, and value buffer size for each of the columns.
+	 * (4) Sparse index of the index column, if the table has one.
 	 *
 	 * We start by flushing the skip list buffers.
 	 */
@@ -601,9 +1006,22 @@ FlushStripe(TableWriteState *writeState)
 		}
 	}
 
-	/* finally, we flush the footer buffer */
+	/* then, we flush the footer buffer */
 	WriteToFile(tableFile, stripeFooterBuffer->data, stripeFooterBuffer->len);
 
+	/* finally, we flush the sparse index */
+	if (writeState->indexEntryCount > 0)
+	{
+		uint32 indexEntryCount = SortStripeIndexEntries(writeState->indexEntryArray,
+														writeState->indexEntryCount);
+
+		indexLength = indexEntryCount * sizeof(StripeIndexEntry);
+		WriteToFile(tableFile, writeState->indexEntryArray, indexLength);
+
+		stripeMetadata.indexColumnIndex = writeState->indexColumnIndex;
+		SetStripeIndexRange(writeState, &stripeMetadata);
+	}
+
 	/* set stripe metadata */
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
@@ -616,16 +1034,192 @@ FlushStripe(TableWriteState *writeState)
 	stripeMetadata.skipListLength = skipListLength;
 	stripeMetadata.dataLength = dataLength;
 	stripeMetadata.footerLength = stripeFooterBuffer->len;
+	stripeMetadata.indexLength = indexLength;
 
 	/* advance current file offset */
 	writeState->currentFileOffset += skipListLength;
 	writeState->currentFileOffset += dataLength;
 	writeState->currentFileOffset += stripeFooterBuffer->len;
+	writeState->currentFileOffset += indexLength;
 
 	return stripeMetadata;
 }
 
 
+/*
+ * AppendStripeIndexEntry hashes the given index column value, and appends an
+ * entry for it in the given block to the stripe's sparse index entries.
+ */
+static void
+AppendStripeIndexEntry(TableWriteState *writeState, Datum columnValue,
+					   uint32 blockIndex)
+{
+	Form_pg_attribute attributeForm = TupleDescAttr(writeState->tupleDescriptor,
+													writeState->indexColumnIndex);
+	StripeIndexEntry *indexEntry = NULL;
+	Datum hashDatum = FunctionCall1Coll(writeState->indexHashFunction,
+										attributeForm->attcollation, columnValue);
+
+	if (writeState->indexEntryCount == writeState->indexEntryArraySize)
+	{
+		writeState->indexEntryArraySize *= 2;
+		writeState->indexEntryArray = repalloc(writeState->indexEntryArray,
+											   writeState->indexEntryArraySize *
+											   sizeof(StripeIndexEntry));
+	}
+
+	indexEntry = &writeState->indexEntryArray[writeState->indexEntryCount];
+	indexEntry->valueHash = DatumGetUInt32(hashDatum);
+	indexEntry->blockIndex = blockIndex;
+	writeState->indexEntryCount++;
+}
+
+
+/*
+ * SortStripeIndexEntries sorts the given sparse index entries by hash and block
+ * index, removes duplicate entries, and returns the remaining entry count.
+ */
+static uint32
+SortStripeIndexEntries(StripeIndexEntry *indexEntryArray, uint32 indexEntryCount)
+{
+	uint32 entryIndex = 0;
+	uint32 distinctEntryCount = 0;
+
+	qsort(indexEntryArray, indexEntryCount, sizeof(StripeIndexEntry),
+		  CompareStripeIndexEntries);
+
+	for (entryIndex = 0; entryIndex < indexEntryCount; entryIndex++)
+	{
+		if (distinctEntryCount > 0 &&
+			CompareStripeIndexEntries(&indexEntryArray[entryIndex],
+									  &indexEntryArray[distinctEntryCount - 1]) == 0)
+		{
+			continue;
+		}
+
+		indexEntryArray[distinctEntryCount] = indexEntryArray[entryIndex];
+		distinctEntryCount++;
+	}
+
+	return distinctEntryCount;
+}
+
+
+/* CompareStripeIndexEntries compares two sparse index entries for sorting. */
+static int
+CompareStripeIndexEntries(const void *leftElement, const void *rightElement)
+{
+	const StripeIndexEntry *leftEntry = (const StripeIndexEntry *) leftElement;
+	const StripeIndexEntry *rightEntry = (const StripeIndexEntry *) rightElement;
+
+	if (leftEntry->valueHash != rightEntry->valueHash)
+	{
+		return (leftEntry->valueHash < rightEntry->valueHash) ? -1 : 1;
+	}
+
+	if (leftEntry->blockIndex != rightEntry->blockIndex)
+	{
+		return (leftEntry->blockIndex < rightEntry->blockIndex) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * SetStripeIndexRange finds the minimum and maximum of the index column's values
+ * in the current stripe from the column's block skip nodes, and serializes them
+ * into the given stripe metadata. Reads prune stripes by these ranges without
+ * reading the stripes' skip lists.
+ */
+static void
+SetStripeIndexRange(TableWriteState *writeState, StripeMetadata *stripeMetadata)
+{
+	uint32 columnIndex = (uint32) writeState->indexColumnIndex;
+	Form_pg_attribute attributeForm = TupleDescAttr(writeState->tupleDescriptor,
+													columnIndex);
+	FmgrInfo *comparisonFunction = writeState->comparisonFunctionArray[columnIndex];
+	StripeSkipList *stripeSkipList = writeState->stripeSkipList;
+	ColumnBlockSkipNode *blockSkipNodeArray =
+		stripeSkipList->blockSkipNodeArray[columnIndex];
+	StringInfo minimumBuffer = NULL;
+	StringInfo maximumBuffer = NULL;
+	Datum minimumValue = 0;
+	Datum maximumValue = 0;
+	bool hasRange = false;
+	uint32 blockIndex = 0;
+
+	/* if type doesn't have a comparison function, the stripe has no range */
+	if (comparisonFunction == NULL)
+	{
+		return;
+	}
+
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		Datum minimumComparison = 0;
+		Datum maximumComparison = 0;
+
+		/* blocks whose values are too long to bound leave the stripe unbounded */
+		if (!blockSkipNode->hasMinMax)
+		{
+			if (blockSkipNode->valueCount > 0)
+			{
+				return;
+			}
+
+			continue;
+		}
+
+		if (!hasRange)
+		{
+			minimumValue = blockSkipNode->minimumValue;
+			maximumValue = blockSkipNode->maximumValue;
+			hasRange = true;
+			continue;
+		}
+
+		minimumComparison = FunctionCall2Coll(comparisonFunction,
+											  attributeForm->attcollation,
+											  blockSkipNode->minimumValue,
+											  minimumValue);
+		maximumComparison = FunctionCall2Coll(comparisonFunction,
+											  attributeForm->attcollation,
+											  blockSkipNode->maximumValue,
+											  maximumValue);
+
+		if (DatumGetInt32(minimumComparison) < 0)
+		{
+			minimumValue = blockSkipNode->minimumValue;
+		}
+
+		if (DatumGetInt32(maximumComparison) > 0)
+		{
+			maximumValue = blockSkipNode->maximumValue;
+		}
+	}
+
+	if (!hasRange)
+	{
+		return;
+	}
+
+	minimumBuffer = makeStringInfo();
+	SerializeSingleDatum(minimumBuffer, minimumValue, attributeForm->attbyval,
+						 attributeForm->attlen, attributeForm->attalign);
+
+	maximumBuffer = makeStringInfo();
+	SerializeSingleDatum(maximumBuffer, maximumValue, attributeForm->attbyval,
+						 attributeForm->attlen, attributeForm->attalign);
+
+	stripeMetadata->indexMinimumValue = (uint8 *) minimumBuffer->data;
+	stripeMetadata->indexMinimumValueLength = minimumBuffer->len;
+	stripeMetadata->indexMaximumValue = (uint8 *) maximumBuffer->data;
+	stripeMetadata->indexMaximumValueLength = maximumBuffer->len;
+}
+
+
 /*
  * CreateSkipListBufferArray serializes the skip list for each column of the
  * given stripe and returns the result as an array.
@@ -644,11 +1238,18 @@ CreateSkipListBufferArray(StripeSkipList *stripeSkipList, TupleDesc tupleDescrip
 		ColumnBlockSkipNode *blockSkipNodeArray =
 			stripeSkipList->blockSkipNodeArray[columnIndex];
 		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		uint64 sortKeyVersion = 0;
+
+		if (SortKeyCollation(attributeForm->atttypid, attributeForm->attcollation))
+		{
+			sortKeyVersion = SortKeyVersion(attributeForm->attcollation);
+		}
 
 		skipListBuffer = SerializeColumnSkipList(blockSkipNodeArray,
 												 stripeSkipList->blockCount,
 												 attributeForm->attbyval,
-												 attributeForm->attlen);
+												 attributeForm->attlen,
+												 sortKeyVersion);
 
 		skipListBufferArray[columnIndex] = skipListBuffer;
 	}
@@ -667,6 +1268,11 @@ CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArr
 	uint64 *skipListSizeArray = palloc0(columnCount * sizeof(uint64));
 	uint64 *existsSizeArray = palloc0(columnCount * sizeof(uint64));
 	uint64 *valueSizeArray = palloc0(columnCount * sizeof(uint64));
+	uint32 *skipListChecksumArray = NULL;
+
+#if PG_VERSION_NUM >= 90500
+	skipListChecksumArray = palloc0(columnCount * sizeof(uint32));
+#endif
 
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
@@ -680,6 +1286,11 @@ CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArr
 			valueSizeArray[columnIndex] += blockSkipNodeArray[blockIndex].valueLength;
 		}
 		skipListSizeArray[columnIndex] = skipListBufferArray[columnIndex]->len;
+
+#if PG_VERSION_NUM >= 90500
+		skipListChecksumArray[columnIndex] =
+			BufferChecksum(skipListBufferArray[columnIndex]);
+#endif
 	}
 
 	stripeFooter = palloc0(sizeof(StripeFooter));
@@ -687,6 +1298,7 @@ CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArr
 	stripeFooter->skipListSizeArray = skipListSizeArray;
 	stripeFooter->existsSizeArray = existsSizeArray;
 	stripeFooter->valueSizeArray = valueSizeArray;
+	stripeFooter->skipListChecksumArray = skipListChecksumArray;
 
 	return stripeFooter;
 }
@@ -762,7 +1374,8 @@ SerializeSingleDatum(StringInfo datumBuffer, Datum datum, bool datumTypeByValue,
 
 /*
  * SerializeBlockData serializes and compresses block data at given block index with given
- * compression type for every column.
+ * compression type for every column, and records the checksums of the serialized
+ * streams in the block's skip nodes.
  */
 static void
 SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCount)
@@ -774,6 +1387,15 @@ SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCou
 	const uint32 columnCount = stripeBuffers->columnCount;
 	StringInfo compressionBuffer = writeState->compressionBuffer;
 
+	/* copy minimum and maximum values out of value buffers before we reset them */
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode =
+			&writeState->stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+
+		SetBlockSkipNodeMinMax(writeState, columnIndex, blockSkipNode);
+	}
+
 	/* serialize exist values, data values are already serialized */
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
@@ -822,6 +1444,22 @@ SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCou
 		/* valueBuffer needs to be reset for next block's data */
 		resetStringInfo(blockData->valueBuffer);
 	}
+
+#if PG_VERSION_NUM >= 90500
+
+	/* checksum the streams as they will be stored on disk */
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
+		ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
+		ColumnBlockSkipNode *blockSkipNode =
+			&writeState->stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+
+		blockSkipNode->hasChecksum = true;
+		blockSkipNode->existsChecksum = BufferChecksum(blockBuffers->existsBuffer);
+		blockSkipNode->valueChecksum = BufferChecksum(blockBuffers->valueBuffer);
+	}
+#endif
 }
 
 
@@ -829,18 +1467,27 @@ SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCou
  * UpdateBlockSkipNodeMinMax takes the given column value, and checks if this
  * value falls outside the range of minimum/maximum values of the given column
  * block skip node. If it does, the function updates the column block skip node
- * accordingly.
+ * accordingly. The value has already been serialized at valueOffset of the
+ * block's value buffer; for pass-by-reference columns, we only remember this
+ * offset, and SetBlockSkipNodeMinMax() copies the final values when the block
+ * is serialized.
  */
 static void
-UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode, Datum columnValue,
-						  bool columnTypeByValue, int columnTypeLength,
-						  Oid columnCollation, FmgrInfo *comparisonFunction)
+UpdateBlockSkipNodeMinMax(TableWriteState *writeState, uint32 columnIndex,
+						  ColumnBlockSkipNode *blockSkipNode, Datum columnValue,
+						  uint32 valueOffset)
 {
-	bool hasMinMax = blockSkipNode->hasMinMax;
+	FmgrInfo *comparisonFunction = writeState->comparisonFunctionArray[columnIndex];
+	Form_pg_attribute attributeForm = TupleDescAttr(writeState->tupleDescriptor,
+													columnIndex);
+	StringInfo valueBuffer = writeState->blockDataArray[columnIndex]->valueBuffer;
+	uint32 *minimumOffset = &writeState->minimumValueOffsetArray[columnIndex];
+	uint32 *maximumOffset = &writeState->maximumValueOffsetArray[columnIndex];
+	bool columnTypeByValue = attributeForm->attbyval;
 	Datum previousMinimum = blockSkipNode->minimumValue;
 	Datum previousMaximum = blockSkipNode->maximumValue;
-	Datum currentMinimum = 0;
-	Datum currentMaximum = 0;
+	bool newMinimum = false;
+	bool newMaximum = false;
 
 	/* if type doesn't have a comparison function, skip min/max values */
 	if (comparisonFunction == NULL)
@@ -848,44 +1495,312 @@ UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode, Datum columnValue,
 		return;
 	}
 
-	if (!hasMinMax)
+	if (!blockSkipNode->hasMinMax)
 	{
-		currentMinimum = DatumCopy(columnValue, columnTypeByValue, columnTypeLength);
-		currentMaximum = DatumCopy(columnValue, columnTypeByValue, columnTypeLength);
+		newMinimum = true;
+		newMaximum = true;
 	}
 	else
 	{
-		Datum minimumComparisonDatum = FunctionCall2Coll(comparisonFunction,
-														 columnCollation, columnValue,
-														 previousMinimum);
-		Datum maximumComparisonDatum = FunctionCall2Coll(comparisonFunction,
-														 columnCollation, columnValue,
-														 previousMaximum);
-		int minimumComparison = DatumGetInt32(minimumComparisonDatum);
-		int maximumComparison = DatumGetInt32(maximumComparisonDatum);
+		Datum maximumComparisonDatum = 0;
 
-		if (minimumComparison < 0)
+		if (!columnTypeByValue)
 		{
-			currentMinimum = DatumCopy(columnValue, columnTypeByValue, columnTypeLength);
+			previousMinimum = PointerGetDatum(valueBuffer->data + *minimumOffset);
+			previousMaximum = PointerGetDatum(valueBuffer->data + *maximumOffset);
 		}
-		else
+
+		/*
+		 * A new maximum can't be a new minimum, so values of ascending loads
+		 * take a single comparison, which matters for collation-aware types.
+		 */
+		maximumComparisonDatum = FunctionCall2Coll(comparisonFunction,
+												   attributeForm->attcollation,
+												   columnValue, previousMaximum);
+		newMaximum = (DatumGetInt32(maximumComparisonDatum) > 0);
+
+		if (!newMaximum)
+		{
+			Datum minimumComparisonDatum =
+				FunctionCall2Coll(comparisonFunction, attributeForm->attcollation,
+								  columnValue, previousMinimum);
+
+			newMinimum = (DatumGetInt32(minimumComparisonDatum) < 0);
+		}
+	}
+
+	if (newMinimum)
+	{
+		blockSkipNode->minimumValue = columnTypeByValue ? columnValue : 0;
+		*minimumOffset = valueOffset;
+	}
+
+	if (newMaximum)
+	{
+		blockSkipNode->maximumValue = columnTypeByValue ? columnValue : 0;
+		*maximumOffset = valueOffset;
+	}
+
+	blockSkipNode->hasMinMax = true;
+}
+
+
+/*
+ * SetBlockSkipNodeMinMax copies the minimum and maximum values of a block of a
+ * pass-by-reference column from the block's value buffer into its skip node.
+ * Values longer than the column's maximum skip value length are cut to a prefix
+ * when the column's ordering allows it. Otherwise, the block has no minimum and
+ * maximum values, so that its skip node stays small. If the column's collation
+ * has sort keys, we also set the values' sort keys.
+ */
+static void
+SetBlockSkipNodeMinMax(TableWriteState *writeState, uint32 columnIndex,
+					   ColumnBlockSkipNode *blockSkipNode)
+{
+	Form_pg_attribute attributeForm = TupleDescAttr(writeState->tupleDescriptor,
+													columnIndex);
+	StringInfo valueBuffer = writeState->blockDataArray[columnIndex]->valueBuffer;
+	uint32 maxSkipValueLength = writeState->maxSkipValueLengthArray[columnIndex];
+	uint32 minimumOffset = writeState->minimumValueOffsetArray[columnIndex];
+	uint32 maximumOffset = writeState->maximumValueOffsetArray[columnIndex];
+	Datum minimumValue = PointerGetDatum(valueBuffer->data + minimumOffset);
+	Datum maximumValue = PointerGetDatum(valueBuffer->data + maximumOffset);
+	bool minimumTruncated = false;
+	bool maximumTruncated = false;
+	bool minimumBounded = false;
+	bool maximumBounded = false;
+
+	if (!blockSkipNode->hasMinMax || attributeForm->attbyval)
+	{
+		return;
+	}
+
+	/* sort keys come from the full values, and don't depend on their bounds */
+	if (SortKeyCollation(attributeForm->atttypid, attributeForm->attcollation))
+	{
+		SetBlockSkipNodeSortKeys(blockSkipNode, attributeForm->attcollation,
+								 maxSkipValueLength, minimumValue, maximumValue);
+	}
+
+	minimumBounded = BoundSkipValue(&minimumValue, attributeForm, maxSkipValueLength,
+									false, &minimumTruncated);
+	maximumBounded = BoundSkipValue(&maximumValue, attributeForm, maxSkipValueLength,
+									true, &maximumTruncated);
+
+	if (!minimumBounded || !maximumBounded)
+	{
+		blockSkipNode->hasMinMax = false;
+		blockSkipNode->minimumValue = 0;
+		blockSkipNode->maximumValue = 0;
+		return;
+	}
+
+	blockSkipNode->minimumValue = minimumValue;
+	blockSkipNode->maximumValue = maximumValue;
+	blockSkipNode->minMaxTruncated = (minimumTruncated || maximumTruncated);
+}
+
+
+/*
+ * BoundSkipValue copies the given skip value, and returns true if the copy is
+ * a valid minimum (or maximum, if upperBound is set) for skip lists. Variable
+ * length values longer than maxSkipValueLength bytes are cut to a prefix. A
+ * prefix is a lower bound of the value. For the upper bound, we increment the
+ * prefix's last byte after dropping trailing bytes that can't be incremented,
+ * so the result sorts after every value that starts with the prefix. If we
+ * can't bound the value, the function returns false. A maxSkipValueLength of
+ * 0 means the column's skip values aren't limited.
+ */
+static bool
+BoundSkipValue(Datum *skipValue, Form_pg_attribute attributeForm,
+			   uint32 maxSkipValueLength, bool upperBound, bool *truncated)
+{
+	struct varlena *valueVarlena = NULL;
+	struct varlena *prefixVarlena = NULL;
+	char *valueData = NULL;
+	uint32 valueLength = 0;
+	uint32 prefixLength = 0;
+	unsigned char incrementLimit = 0;
+
+	*truncated = false;
+
+	if (attributeForm->attlen != -1 || maxSkipValueLength == 0)
+	{
+		*skipValue = DatumCopy(*skipValue, attributeForm->attbyval,
+							   attributeForm->attlen);
+		return true;
+	}
+
+	/* values may be compressed inline, so we measure their decompressed data */
+	valueVarlena = pg_detoast_datum_packed((struct varlena *) DatumGetPointer(*skipValue));
+	valueData = VARDATA_ANY(valueVarlena);
+	valueLength = VARSIZE_ANY_EXHDR(valueVarlena);
+
+	if (valueLength <= maxSkipValueLength)
+	{
+		*skipValue = DatumCopy(*skipValue, attributeForm->attbyval,
+							   attributeForm->attlen);
+		return true;
+	}
+
+	if (!SkipValueTruncatable(attributeForm))
+	{
+		return false;
+	}
+
+	if (attributeForm->atttypid == BYTEAOID)
+	{
+		prefixLength = maxSkipValueLength;
+	}
+	else
+	{
+		prefixLength = pg_mbcliplen(valueData, valueLength, maxSkipValueLength);
+	}
+
+	/*
+	 * Bytes of multibyte characters are never ASCII in server encodings, so
+	 * incrementing an ASCII byte below 0x7F keeps the text valid.
+	 */
+	incrementLimit = (attributeForm->atttypid == BYTEAOID) ? 0xFF : 0x7F;
+
+	prefixVarlena = PrefixBound(valueData, prefixLength, upperBound, incrementLimit);
+	if (prefixVarlena == NULL)
+	{
+		return false;
+	}
+
+	*skipValue = PointerGetDatum(prefixVarlena);
+	*truncated = true;
+
+	return true;
+}
+
+
+/*
+ * PrefixBound returns a varlena with the first prefixLength bytes of the given
+ * data, which is a lower bound of the data under bytewise ordering. For the
+ * upper bound, we drop trailing bytes that aren't below incrementLimit, and
+ * increment the last byte. If no byte is left, the function returns NULL.
+ */
+static struct varlena *
+PrefixBound(const char *data, uint32 prefixLength, bool upperBound,
+			unsigned char incrementLimit)
+{
+	struct varlena *prefixVarlena = NULL;
+
+	if (upperBound)
+	{
+		while (prefixLength > 0 &&
+			   (unsigned char) data[prefixLength - 1] >= incrementLimit)
 		{
-			currentMinimum = previousMinimum;
+			prefixLength--;
 		}
 
-		if (maximumComparison > 0)
+		if (prefixLength == 0)
 		{
-			currentMaximum = DatumCopy(columnValue, columnTypeByValue, columnTypeLength);
+			return NULL;
 		}
-		else
+	}
+
+	prefixVarlena = palloc(VARHDRSZ + prefixLength);
+	SET_VARSIZE(prefixVarlena, VARHDRSZ + prefixLength);
+	memcpy(VARDATA(prefixVarlena), data, prefixLength);
+
+	if (upperBound)
+	{
+		((unsigned char *) VARDATA(prefixVarlena))[prefixLength - 1]++;
+	}
+
+	return prefixVarlena;
+}
+
+
+/*
+ * SetBlockSkipNodeSortKeys sets the sort keys of the given minimum and maximum
+ * values of a text column block in the block's skip node, cut to the column's
+ * maximum skip value length. Computing a sort key costs more than comparing two
+ * values, so we only compute keys for each block's final minimum and maximum.
+ */
+static void
+SetBlockSkipNodeSortKeys(ColumnBlockSkipNode *blockSkipNode, Oid collation,
+						 uint32 maxSkipValueLength, Datum minimumValue,
+						 Datum maximumValue)
+{
+	bytea *minimumSortKey = TextSortKey(minimumValue, collation);
+	bytea *maximumSortKey = TextSortKey(maximumValue, collation);
+
+	if (maxSkipValueLength > 0 &&
+		VARSIZE_ANY_EXHDR(minimumSortKey) > maxSkipValueLength)
+	{
+		minimumSortKey = PrefixBound(VARDATA_ANY(minimumSortKey), maxSkipValueLength,
+									 false, 0xFF);
+	}
+
+	if (maxSkipValueLength > 0 &&
+		VARSIZE_ANY_EXHDR(maximumSortKey) > maxSkipValueLength)
+	{
+		maximumSortKey = PrefixBound(VARDATA_ANY(maximumSortKey), maxSkipValueLength,
+									 true, 0xFF);
+		if (maximumSortKey == NULL)
 		{
-			currentMaximum = previousMaximum;
+			return;
 		}
 	}
 
-	blockSkipNode->hasMinMax = true;
-	blockSkipNode->minimumValue = currentMinimum;
-	blockSkipNode->maximumValue = currentMaximum;
+	blockSkipNode->hasSortKeys = true;
+	blockSkipNode->minimumSortKey = minimumSortKey;
+	blockSkipNode->maximumSortKey = maximumSortKey;
+}
+
+
+/*
+ * SkipValueTruncatable returns true if the given column's values are ordered
+ * by their bytes, so that prefixes of its values bound them. These are bytea
+ * columns, and text and varchar columns with the C collation.
+ */
+static bool
+SkipValueTruncatable(Form_pg_attribute attributeForm)
+{
+	Oid typeId = attributeForm->atttypid;
+
+	if (typeId == BYTEAOID)
+	{
+		return true;
+	}
+
+	if (typeId == TEXTOID || typeId == VARCHAROID)
+	{
+		return lc_collate_is_c(attributeForm->attcollation);
+	}
+
+	return false;
+}
+
+
+/*
+ * UpdateBlockSkipNodeSum adds the given column value to the sum of the given
+ * column block skip node. We only keep sums for smallint and integer columns,
+ * whose block sums always fit into 64 bits; aggregate scans can then compute
+ * sum() and avg() of fully selected blocks without reading their values.
+ */
+static void
+UpdateBlockSkipNodeSum(ColumnBlockSkipNode *blockSkipNode, Datum columnValue,
+					   Oid columnTypeId)
+{
+	if (columnTypeId == INT2OID)
+	{
+		blockSkipNode->valueSum += DatumGetInt16(columnValue);
+	}
+	else if (columnTypeId == INT4OID)
+	{
+		blockSkipNode->valueSum += DatumGetInt32(columnValue);
+	}
+	else
+	{
+		return;
+	}
+
+	blockSkipNode->hasValueSum = true;
 }
 
 
@@ -914,7 +1829,8 @@ DatumCopy(Datum datum, bool datumTypeByValue, int datumTypeLength)
 
 /*
  * AppendStripeMetadata adds a copy of given stripeMetadata to the given
- * table footer's stripeMetadataList.
+ * table footer's stripeMetadataList. The copy also has its own copy of the
+ * stripe's index column range.
  */
 static void
 AppendStripeMetadata(TableFooter *tableFooter, StripeMetadata stripeMetadata)
@@ -922,6 +1838,19 @@ AppendStripeMetadata(TableFooter *tableFooter, StripeMetadata stripeMetadata)
 	StripeMetadata *stripeMetadataCopy = palloc0(sizeof(StripeMetadata));
 	memcpy(stripeMetadataCopy, &stripeMetadata, sizeof(StripeMetadata));
 
+	if (stripeMetadata.indexMinimumValueLength > 0)
+	{
+		stripeMetadataCopy->indexMinimumValue =
+			palloc(stripeMetadata.indexMinimumValueLength);
+		memcpy(stripeMetadataCopy->indexMinimumValue, stripeMetadata.indexMinimumValue,
+			   stripeMetadata.indexMinimumValueLength);
+
+		stripeMetadataCopy->indexMaximumValue =
+			palloc(stripeMetadata.indexMaximumValueLength);
+		memcpy(stripeMetadataCopy->indexMaximumValue, stripeMetadata.indexMaximumValue,
+			   stripeMetadata.indexMaximumValueLength);
+	}
+
 	tableFooter->stripeMetadataList = lappend(tableFooter->stripeMetadataList,
 											  stripeMetadataCopy);
 }
@@ -0,0 +1,41 @@
+# Test which rows of a cstore_tableam table concurrent sessions see. Rows are
+# visible to other sessions once the transaction that inserted them commits.
+# Transactions whose snapshot lasts for the whole transaction can't read rows
+# committed after the snapshot, and get a serialization error instead.
+
+setup
+{
+	CREATE TABLE test_isolation (a int) USING cstore_tableam;
+}
+
+teardown
+{
+	DROP TABLE test_isolation;
+}
+
+session "s1"
+step "s1-begin" { BEGIN; }
+step "s1-insert" { INSERT INTO test_isolation SELECT i FROM generate_series(1, 10) i; }
+step "s1-count" { SELECT count(*), sum(a) FROM test_isolation; }
+step "s1-commit" { COMMIT; }
+step "s1-rollback" { ROLLBACK; }
+
+session "s2"
+step "s2-begin-repeatable-read" { BEGIN ISOLATION LEVEL REPEATABLE READ; }
+step "s2-insert" { INSERT INTO test_isolation SELECT i FROM generate_series(11, 20) i; }
+step "s2-count" { SELECT count(*), sum(a) FROM test_isolation; }
+step "s2-commit" { COMMIT; }
+
+# uncommitted rows are only visible to the transaction that inserted them
+permutation "s1-begin" "s1-insert" "s1-count" "s2-count" "s1-commit" "s2-count"
+
+# rows of an aborted transaction never become visible
+permutation "s1-begin" "s1-insert" "s2-count" "s1-rollback" "s2-count" "s2-insert" "s2-count"
+
+# writers wait for each other, and the rows of both are kept
+permutation "s1-begin" "s1-insert" "s2-insert" "s1-commit" "s2-count"
+
+# rows committed after the snapshot of a repeatable read transaction make its
+# reads fail, and rows committed before it are visible
+permutation "s2-begin-repeatable-read" "s2-count" "s1-insert" "s2-count" "s2-commit"
+permutation "s1-insert" "s2-begin-repeatable-read" "s2-count" "s2-commit"
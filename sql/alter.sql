@@ -83,3 +83,28 @@ ALTER FOREIGN TABLE test_alter_table ALTER COLUMN k TYPE varchar(20);
 ALTER FOREIGN TABLE test_alter_table ALTER COLUMN k TYPE text;
 
 DROP FOREIGN TABLE test_alter_table;
+
+-- the index column option follows renames of its column, and goes away with it
+CREATE FOREIGN TABLE test_index_column (a int, b int) SERVER cstore_server
+    OPTIONS(index_column 'a');
+INSERT INTO test_index_column SELECT i, i FROM generate_series(1, 10) i;
+
+ALTER FOREIGN TABLE test_index_column RENAME COLUMN a TO renamed_a;
+SELECT option_value FROM pg_options_to_table((SELECT ftoptions FROM pg_foreign_table
+    WHERE ftrelid = 'test_index_column'::regclass)) WHERE option_name = 'index_column';
+INSERT INTO test_index_column SELECT i, i FROM generate_series(11, 20) i;
+SELECT count(*), sum(b) FROM test_index_column WHERE renamed_a = 15;
+
+ALTER FOREIGN TABLE test_index_column DROP COLUMN renamed_a;
+SELECT option_value FROM pg_options_to_table((SELECT ftoptions FROM pg_foreign_table
+    WHERE ftrelid = 'test_index_column'::regclass)) WHERE option_name = 'index_column';
+INSERT INTO test_index_column SELECT 21;
+SELECT count(*), sum(b) FROM test_index_column;
+
+-- the option must name a column that can have a sparse index
+ALTER FOREIGN TABLE test_index_column OPTIONS (ADD index_column 'a'); -- ERROR
+ALTER FOREIGN TABLE test_index_column OPTIONS (ADD index_column 'b');
+SELECT option_value FROM pg_options_to_table((SELECT ftoptions FROM pg_foreign_table
+    WHERE ftrelid = 'test_index_column'::regclass)) WHERE option_name = 'index_column';
+
+DROP FOREIGN TABLE test_index_column;
@@ -15,6 +15,74 @@ COPY table_with_data FROM STDIN;
 SELECT cstore_table_size('empty_table') < cstore_table_size('table_with_data');
 SELECT cstore_table_size('non_cstore_table');
 
+SELECT segment, stripe, column_name, block, row_count, compression, min_value,
+	   max_value
+FROM cstore_block_info('table_with_data', true);
+SELECT * FROM cstore_block_info('non_cstore_table');
+
+-- drop whole stripes whose rows all satisfy a predicate
+CREATE FOREIGN TABLE stripes_table (a int) SERVER cstore_server
+	OPTIONS(stripe_row_count '1000', block_row_count '1000');
+INSERT INTO stripes_table SELECT generate_series(1, 3000);
+
+SELECT cstore_drop_stripes('stripes_table', 'a < 1500');
+SELECT count(*), min(a) FROM stripes_table;
+SELECT cstore_drop_stripes('stripes_table', 'a > 2000');
+SELECT count(*), min(a), max(a) FROM stripes_table;
+SELECT cstore_drop_stripes('stripes_table', 'a > 1500');
+
+SELECT cstore_drop_stripes('stripes_table', 'a > random()'); -- ERROR
+SELECT cstore_drop_stripes('stripes_table', 'a > 0 ORDER BY a'); -- ERROR
+SELECT cstore_drop_stripes('non_cstore_table', 'a > 0'); -- ERROR
+
+-- delete rows, and then remove them from the table's files
+CREATE FOREIGN TABLE delete_table (a int, b text) SERVER cstore_server
+	OPTIONS(stripe_row_count '1000', block_row_count '100');
+INSERT INTO delete_table SELECT i, 'row ' || i FROM generate_series(1, 3000) i;
+
+DELETE FROM delete_table WHERE a <= 50 OR a % 1000 = 0;
+SELECT count(*), min(a), max(a) FROM delete_table;
+DELETE FROM delete_table WHERE a BETWEEN 1001 AND 1100;
+SELECT count(*), min(a), max(a) FROM delete_table WHERE a > 1000;
+SELECT count(*) FROM delete_table WHERE a <= 100;
+DELETE FROM delete_table WHERE a <= 100;
+DELETE FROM delete_table WHERE a = 1 RETURNING *; -- ERROR
+
+SELECT cstore_compact('delete_table');
+SELECT count(*), min(a), max(a), min(b) FROM delete_table;
+SELECT cstore_compact('delete_table');
+SELECT cstore_compact('non_cstore_table'); -- ERROR
+
+-- update rows by deleting them and appending their new versions
+UPDATE delete_table SET b = 'updated' WHERE a % 500 = 0;
+UPDATE delete_table SET a = a + 10000 WHERE a > 2990;
+SELECT a, b FROM delete_table WHERE b = 'updated' ORDER BY a;
+SELECT count(*), min(a), max(a) FROM delete_table WHERE a > 2900;
+UPDATE delete_table SET b = 'x' WHERE a = 101 RETURNING *; -- ERROR
+SELECT cstore_compact('delete_table');
+SELECT count(*), min(a), max(a) FROM delete_table;
+
+-- long values get bounded min/max values in skip lists
+CREATE FOREIGN TABLE long_value_table (a text OPTIONS (max_skip_value_length '-1'))
+	SERVER cstore_server; -- ERROR
+CREATE FOREIGN TABLE long_value_table (
+	a text OPTIONS (max_skip_value_length '4') COLLATE "C",
+	b numeric OPTIONS (max_skip_value_length '4'))
+	SERVER cstore_server;
+COPY long_value_table FROM STDIN;
+abcdefgh	12345678901234567890
+abdzzzzz	98765432109876543210
+ab	11111111111111111111
+\.
+
+SELECT column_name, min_value, max_value FROM cstore_block_info('long_value_table');
+SELECT min(a), max(a) FROM long_value_table;
+SELECT a FROM long_value_table WHERE a > 'abd';
+SELECT count(*) FROM long_value_table WHERE a > 'abe';
+
 DROP FOREIGN TABLE empty_table;
 DROP FOREIGN TABLE table_with_data;
+DROP FOREIGN TABLE stripes_table;
+DROP FOREIGN TABLE delete_table;
+DROP FOREIGN TABLE long_value_table;
 DROP TABLE non_cstore_table;
@@ -0,0 +1,34 @@
+--
+-- Test block filtering through the sort keys of text columns with ICU collations.
+--
+
+-- skip the test unless the database is UTF8 and the server has ICU collations
+SELECT getdatabaseencoding() <> 'UTF8' OR
+       NOT EXISTS (SELECT 1 FROM pg_collation WHERE collname = 'und-x-icu')
+       AS skip_test \gset
+\if :skip_test
+\quit
+\endif
+
+-- values are longer than max_skip_value_length, so blocks have no min/max values
+CREATE FOREIGN TABLE test_sort_keys (
+	a int,
+	b text OPTIONS (max_skip_value_length '16') COLLATE "und-x-icu",
+	c varchar(64) OPTIONS (max_skip_value_length '16') COLLATE "und-x-icu")
+	SERVER cstore_server
+	OPTIONS(block_row_count '1000');
+INSERT INTO test_sort_keys
+	SELECT i, lpad(i::text, 5, '0') || repeat('-', 30), lpad(i::text, 5, '0') || repeat('-', 30)
+	FROM generate_series(1, 3000) i;
+
+SELECT count(*), min(a), max(a) FROM test_sort_keys WHERE b > '02500';
+SELECT a, b FROM test_sort_keys WHERE b >= '02998' AND b < '03000' ORDER BY a;
+SELECT count(*), min(a), max(a) FROM test_sort_keys WHERE c > '02500';
+SELECT a, c FROM test_sort_keys WHERE c = '01500' || repeat('-', 30);
+
+-- only the blocks that sort keys can't refute are read
+SELECT filtered_row_count('SELECT count(*) FROM test_sort_keys WHERE b > ''02500''');
+SELECT filtered_row_count('SELECT count(*) FROM test_sort_keys WHERE c > ''02500''');
+SELECT filtered_row_count('SELECT a FROM test_sort_keys WHERE c = ''01500'' || repeat(''-'', 30)');
+
+DROP FOREIGN TABLE test_sort_keys;
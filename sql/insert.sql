@@ -4,7 +4,7 @@
 
 CREATE FOREIGN TABLE test_insert_command (a int) SERVER cstore_server;
 
--- test single row inserts fail
+-- test single row inserts go to the delta store
 select count(*) from test_insert_command;
 insert into test_insert_command values(1);
 select count(*) from test_insert_command;
@@ -25,6 +25,39 @@ select count(*) from test_insert_command;
 drop table test_insert_command_data;
 drop foreign table test_insert_command;
 
+-- test delta store rows are merged into a stripe once there are enough of them
+CREATE FOREIGN TABLE test_delta_merge (a int, b text) SERVER cstore_server
+OPTIONS(stripe_row_count '1000', block_row_count '1000');
+
+DO $$
+BEGIN
+	EXECUTE 'insert into test_delta_merge values ' ||
+		(SELECT string_agg(format('(%s, %L)', i, 'row ' || i), ', ')
+		 FROM generate_series(1, 999) i);
+END $$;
+
+select count(*), sum(a), max(b) from test_delta_merge;
+select count(*) from cstore_block_info('test_delta_merge') where column_name = 'a';
+select * from test_delta_merge where a > 997 order by a;
+
+insert into test_delta_merge values (1000, 'row 1000'), (1001, 'row 1001');
+select count(*), sum(a), max(b) from test_delta_merge;
+select count(*) from cstore_block_info('test_delta_merge') where column_name = 'a';
+
+insert into test_delta_merge values (1002, 'row 1002');
+select * from test_delta_merge order by a desc limit 2;
+
+-- delete merges the delta store first, so the rows have positions in stripes
+delete from test_delta_merge where a % 2 = 0;
+select count(*), sum(a) from test_delta_merge;
+select count(*) from cstore_block_info('test_delta_merge') where column_name = 'a';
+
+truncate test_delta_merge;
+insert into test_delta_merge values (1, 'row 1');
+select * from test_delta_merge;
+
+drop foreign table test_delta_merge;
+
 -- test long attribute value insertion
 -- create sufficiently long text so that data is stored in toast
 CREATE TABLE test_long_text AS
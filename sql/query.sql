@@ -2,6 +2,23 @@
 -- Test querying cstore_fdw tables.
 --
 
+--
+-- plan_without_file returns the lines of the query's plan, without the cstore
+-- file paths that differ between test runs.
+--
+CREATE OR REPLACE FUNCTION plan_without_file (query text) RETURNS SETOF text AS
+$$
+    DECLARE
+        rec text;
+    BEGIN
+        FOR rec IN EXECUTE 'EXPLAIN (costs off) ' || query LOOP
+            IF rec !~ '^\s+CStore File' then
+                RETURN NEXT rec;
+            END IF;
+        END LOOP;
+    END;
+$$ LANGUAGE PLPGSQL;
+
 -- Settings to make the result deterministic
 SET datestyle = "ISO, YMD";
 
@@ -32,3 +49,23 @@ INSERT INTO union_second SELECT a, a FROM generate_series(11, 15) a;
 (SELECT a*1, b FROM union_first) union all (SELECT a*1, b FROM union_second);
 
 DROP FOREIGN TABLE union_first, union_second;
+
+-- Test aggregates computed over column blocks
+CREATE FOREIGN TABLE aggregate_test (a int, b int, c float8) SERVER cstore_server;
+INSERT INTO aggregate_test SELECT a, a % 3, a / 4.0 FROM generate_series(1, 10) a;
+INSERT INTO aggregate_test SELECT NULL, NULL, NULL;
+
+SELECT b, count(*), count(a), sum(a), avg(a), min(c), max(c), sum(c)
+	FROM aggregate_test GROUP BY b ORDER BY b;
+SELECT b, count(*), max(a) FROM aggregate_test WHERE a > 4 GROUP BY b ORDER BY b;
+SELECT count(*), sum(a), min(c) FROM aggregate_test WHERE a > 100;
+
+-- Verify that the scan computes the aggregates, on versions that support it
+SELECT plan_without_file('SELECT count(*), sum(a), min(c) FROM aggregate_test');
+
+-- Test aggregates over blocks summarized by their skip lists
+SELECT count(*), count(a), sum(a), avg(a), min(a), max(c) FROM aggregate_test WHERE a > 0;
+INSERT INTO aggregate_test SELECT a, 5, a FROM generate_series(1, 4) a;
+SELECT b, count(*), sum(a), min(a), max(c) FROM aggregate_test WHERE b >= 5 GROUP BY b;
+
+DROP FOREIGN TABLE aggregate_test;
@@ -0,0 +1,118 @@
+--
+-- Test the cstore_tableam table access method. Only run on PostgreSQL 12.
+--
+CREATE TABLE test_tableam (a int, b text) USING cstore_tableam;
+
+-- rows written in a transaction are visible to later statements
+INSERT INTO test_tableam SELECT i, 'row ' || i FROM generate_series(1, 1000) i;
+SELECT count(*), sum(a), max(b) FROM test_tableam;
+
+-- rows of an aborted transaction are discarded
+BEGIN;
+INSERT INTO test_tableam VALUES (1001, 'aborted');
+SELECT count(*) FROM test_tableam;
+ROLLBACK;
+SELECT count(*) FROM test_tableam;
+
+INSERT INTO test_tableam VALUES (1002, 'after abort');
+SELECT a, b FROM test_tableam WHERE a > 1000;
+
+-- index scans fetch rows by their row number
+CREATE INDEX test_tableam_a_idx ON test_tableam (a);
+SET enable_seqscan TO off;
+SET enable_bitmapscan TO off;
+SELECT a, b FROM test_tableam WHERE a = 500;
+SELECT a, b FROM test_tableam WHERE a = 1002;
+SET enable_indexscan TO off;
+SET enable_bitmapscan TO on;
+SELECT count(*) FROM test_tableam WHERE a BETWEEN 100 AND 199;
+RESET enable_seqscan;
+RESET enable_indexscan;
+RESET enable_bitmapscan;
+
+-- scroll cursors read rows backward, across stripe boundaries
+BEGIN;
+DECLARE test_tableam_cursor SCROLL CURSOR FOR SELECT a, b FROM test_tableam;
+FETCH LAST FROM test_tableam_cursor;
+FETCH BACKWARD 2 FROM test_tableam_cursor;
+FETCH ABSOLUTE 2 FROM test_tableam_cursor;
+FETCH BACKWARD 2 FROM test_tableam_cursor;
+FETCH FORWARD 1 FROM test_tableam_cursor;
+COMMIT;
+
+-- COPY inserts rows in batches, and indexes find the copied rows
+COPY test_tableam FROM STDIN;
+2001	copied 2001
+2002	copied 2002
+2003	\N
+\.
+SELECT a, b FROM test_tableam WHERE a > 2000 ORDER BY a;
+SET enable_seqscan TO off;
+SELECT a, b FROM test_tableam WHERE a = 2002;
+RESET enable_seqscan;
+
+BEGIN;
+COPY test_tableam FROM STDIN;
+3001	rolled back
+\.
+SELECT a, b FROM test_tableam WHERE a > 3000;
+ROLLBACK;
+SELECT a, b FROM test_tableam WHERE a > 3000;
+
+-- rolling back to a savepoint removes the rows inserted since the savepoint,
+-- including rows that failed their unique checks
+CREATE TABLE test_tableam_unique (a int PRIMARY KEY) USING cstore_tableam;
+BEGIN;
+INSERT INTO test_tableam_unique VALUES (1);
+SAVEPOINT s1;
+INSERT INTO test_tableam_unique VALUES (1);
+ROLLBACK TO SAVEPOINT s1;
+INSERT INTO test_tableam_unique VALUES (2);
+SAVEPOINT s2;
+INSERT INTO test_tableam_unique VALUES (3);
+SELECT a FROM test_tableam_unique ORDER BY a;
+ROLLBACK TO SAVEPOINT s2;
+SELECT a FROM test_tableam_unique ORDER BY a;
+SET enable_seqscan TO off;
+SELECT a FROM test_tableam_unique WHERE a = 3;
+RESET enable_seqscan;
+COMMIT;
+SELECT a FROM test_tableam_unique ORDER BY a;
+INSERT INTO test_tableam_unique VALUES (3);
+INSERT INTO test_tableam_unique VALUES (2);
+SELECT count(*) FROM test_tableam_unique;
+DROP TABLE test_tableam_unique;
+
+-- parallel scans split the stripes between processes, and the workers read
+-- the rows that the transaction inserted
+CREATE TABLE test_tableam_parallel (a int) USING cstore_tableam;
+INSERT INTO test_tableam_parallel SELECT generate_series(1, 1000);
+INSERT INTO test_tableam_parallel SELECT generate_series(1001, 2000);
+INSERT INTO test_tableam_parallel SELECT generate_series(2001, 3000);
+SET parallel_setup_cost TO 0;
+SET parallel_tuple_cost TO 0;
+SET min_parallel_table_scan_size TO 0;
+SET max_parallel_workers_per_gather TO 2;
+EXPLAIN (COSTS OFF) SELECT count(*), sum(a) FROM test_tableam_parallel;
+SELECT count(*), sum(a) FROM test_tableam_parallel;
+BEGIN;
+INSERT INTO test_tableam_parallel SELECT generate_series(3001, 4000);
+SELECT count(*), sum(a) FROM test_tableam_parallel;
+ROLLBACK;
+SELECT count(*), sum(a) FROM test_tableam_parallel;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+DROP TABLE test_tableam_parallel;
+
+-- row-level modifications are not supported
+DELETE FROM test_tableam WHERE a = 1;
+UPDATE test_tableam SET b = 'updated' WHERE a = 1;
+
+TRUNCATE test_tableam;
+SELECT count(*) FROM test_tableam;
+INSERT INTO test_tableam VALUES (1, 'after truncate');
+SELECT a, b FROM test_tableam;
+
+DROP TABLE test_tableam;